@@ -89,8 +89,14 @@ static jlong nativeCreate(JNIEnv* env, jclass clazz, jstring nameObj, jint curso
     name.setTo(nameStr);
     env->ReleaseStringUTFChars(nameObj, nameStr);
 
+    // Windows grow by segments of the requested size, up to as many as a
+    // window can have, before they are reported as full.
+    size_t size = cursorWindowSize;
+    size_t maxSize = size <= SIZE_MAX / CursorWindow::MAX_SEGMENTS
+            ? size * CursorWindow::MAX_SEGMENTS : size;
+
     CursorWindow* window;
-    status_t status = CursorWindow::create(name, cursorWindowSize, &window);
+    status_t status = CursorWindow::create(name, size, maxSize, &window);
     if (status || !window) {
         ALOGE("Could not allocate CursorWindow '%s' of size %d due to error %d.",
                 name.string(), cursorWindowSize, status);
@@ -571,8 +571,10 @@ enum CopyRowResult {
 
 static CopyRowResult copyRow(JNIEnv* env, CursorWindow* window,
         sqlite3_stmt* statement, int numColumns, int startPos, int addedRows) {
-    // Allocate a new field directory for the row.
-    status_t status = window->allocRow();
+    // Allocate a new field directory for the row. The fields are written
+    // straight into it rather than looked up by row and column one at a time.
+    CursorWindow::FieldSlot* fieldDir;
+    status_t status = window->allocRow(&fieldDir);
     if (status) {
         LOG_WINDOW("Failed allocating fieldDir at startPos %d row %d, error=%d",
                 startPos, addedRows, status);
@@ -591,7 +593,7 @@ static CopyRowResult copyRow(JNIEnv* env, CursorWindow* window,
             // ensure all strings are NULL terminated, so increase size by
             // one to make sure we store the terminator.
             size_t sizeIncludingNull = sqlite3_column_bytes(statement, i) + 1;
-            status = window->putString(addedRows, i, text, sizeIncludingNull);
+            status = window->putString(&fieldDir[i], text, sizeIncludingNull);
             if (status) {
                 LOG_WINDOW("Failed allocating %u bytes for text at %d,%d, error=%d",
                         sizeIncludingNull, startPos + addedRows, i, status);
@@ -603,30 +605,18 @@ static CopyRowResult copyRow(JNIEnv* env, CursorWindow* window,
         } else if (type == SQLITE_INTEGER) {
             // INTEGER data
             int64_t value = sqlite3_column_int64(statement, i);
-            status = window->putLong(addedRows, i, value);
-            if (status) {
-                LOG_WINDOW("Failed allocating space for a long in column %d, error=%d",
-                        i, status);
-                result = CPR_FULL;
-                break;
-            }
+            window->putLong(&fieldDir[i], value);
             LOG_WINDOW("%d,%d is INTEGER 0x%016llx", startPos + addedRows, i, value);
         } else if (type == SQLITE_FLOAT) {
             // FLOAT data
             double value = sqlite3_column_double(statement, i);
-            status = window->putDouble(addedRows, i, value);
-            if (status) {
-                LOG_WINDOW("Failed allocating space for a double in column %d, error=%d",
-                        i, status);
-                result = CPR_FULL;
-                break;
-            }
+            window->putDouble(&fieldDir[i], value);
             LOG_WINDOW("%d,%d is FLOAT %lf", startPos + addedRows, i, value);
         } else if (type == SQLITE_BLOB) {
             // BLOB data
             const void* blob = sqlite3_column_blob(statement, i);
             size_t size = sqlite3_column_bytes(statement, i);
-            status = window->putBlob(addedRows, i, blob, size);
+            status = window->putBlob(&fieldDir[i], blob, size);
             if (status) {
                 LOG_WINDOW("Failed allocating %u bytes for blob at %d,%d, error=%d",
                         size, startPos + addedRows, i, status);
@@ -636,15 +626,7 @@ static CopyRowResult copyRow(JNIEnv* env, CursorWindow* window,
             LOG_WINDOW("%d,%d is Blob with %u bytes",
                     startPos + addedRows, i, size);
         } else if (type == SQLITE_NULL) {
-            // NULL field
-            status = window->putNull(addedRows, i);
-            if (status) {
-                LOG_WINDOW("Failed allocating space for a null in column %d, error=%d",
-                        i, status);
-                result = CPR_FULL;
-                break;
-            }
-
+            // NULL field. allocRow() already cleared the field directory.
             LOG_WINDOW("%d,%d is NULL", startPos + addedRows, i);
         } else {
             // Unknown data
@@ -109,6 +109,14 @@ public:
      */
     virtual bool isAllocated(void) const { return false; }
 
+    /*
+     * Ask the kernel to start reading the asset's data into memory, so that
+     * later reads and getBuffer() don't stall on page faults.  This does not
+     * wait for the I/O.  Compressed assets read ahead their compressed data;
+     * they are still inflated on first access.
+     */
+    virtual status_t prefetch(void) { return NO_ERROR; }
+
     /*
      * Get a string identifying the asset's source.  This might be a full
      * path, it might be a colon-separated list of identifiers.
@@ -256,6 +264,7 @@ public:
     virtual off64_t getRemainingLength(void) const { return mLength-mOffset; }
     virtual int openFileDescriptor(off64_t* outStart, off64_t* outLength) const;
     virtual bool isAllocated(void) const { return mBuf != NULL; }
+    virtual status_t prefetch(void);
 
 private:
     off64_t     mStart;         // absolute file offset of start of chunk
@@ -312,6 +321,7 @@ public:
     virtual off64_t getRemainingLength(void) const { return mUncompressedLen-mOffset; }
     virtual int openFileDescriptor(off64_t* outStart, off64_t* outLength) const { return -1; }
     virtual bool isAllocated(void) const { return mBuf != NULL; }
+    virtual status_t prefetch(void);
 
 private:
     off64_t     mStart;         // offset to start of compressed data
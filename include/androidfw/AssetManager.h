@@ -30,6 +30,9 @@
 #include <utils/threads.h>
 #include <utils/Vector.h>
 
+#include <string>
+#include <vector>
+
 /*
  * Native-app access is via the opaque typedef struct AAssetManager in the C namespace.
  */
@@ -70,6 +73,7 @@ struct ResTable_config;
 class AssetManager : public AAssetManager {
 public:
     static const char* RESOURCES_FILENAME;
+    static const char* RESOURCES_INDEX_FILENAME;
     static const char* IDMAP_BIN;
     static const char* OVERLAY_DIR;
     /*
@@ -177,6 +181,14 @@ public:
      */
     Asset* openNonAsset(const int32_t cookie, const char* fileName, AccessMode mode);
 
+    /*
+     * Start reading the named assets into memory, as a hint that they will
+     * be opened soon.  This is meant to be called off the main thread, ahead
+     * of the assets being needed; see Asset::prefetch().  Returns how many
+     * of the assets were found and prefetched.
+     */
+    size_t prefetchAssets(const Vector<String8>& fileNames);
+
     /*
      * Open a directory within the asset hierarchy.
      *
@@ -293,6 +305,7 @@ private:
     bool appendPathToResTable(const asset_path& ap, bool appAsLib=false) const;
 
     Asset* openIdmapLocked(const struct asset_path& ap) const;
+    Asset* openResourceIndexLocked(const struct asset_path& ap, Asset* tableAsset) const;
 
     void addSystemOverlays(const char* pathOverlaysList, const String8& targetPackagePath,
             ResTable* sharedRes, size_t offset) const;
@@ -313,7 +326,23 @@ private:
 
         void addOverlay(const asset_path& ap);
         bool getOverlay(size_t idx, asset_path* out) const;
-        
+
+        /*
+         * Add the names of the files and subdirectories directly inside
+         * "dirName" ("" for the root) to outFiles and outDirs. Zips don't
+         * store directories, so they are inferred from the entries below
+         * them. Returns false if the zip could not be opened.
+         */
+        bool getDirContents(const String8& dirName, Vector<String8>* outFiles,
+                Vector<String8>* outDirs);
+
+        /*
+         * Returns kFileTypeRegular if "path" is an entry in the zip,
+         * kFileTypeDirectory if there are entries below it, and
+         * kFileTypeNonexistent otherwise.
+         */
+        FileType getEntryType(const String8& path);
+
     protected:
         ~SharedZip();
 
@@ -321,6 +350,14 @@ private:
         SharedZip(const String8& path, time_t modWhen);
         SharedZip(); // <-- not implemented
 
+        /*
+         * The names of all the entries, sorted, so that listings and
+         * lookups are binary searches instead of scans of the whole
+         * central directory. Built on first use and never changed after
+         * that, so the result can be read without holding mEntryNamesLock.
+         */
+        const std::vector<std::string>& getSortedEntryNames();
+
         String8 mPath;
         ZipFileRO* mZipFile;
         time_t mModWhen;
@@ -330,6 +367,10 @@ private:
 
         Vector<asset_path> mOverlays;
 
+        Mutex mEntryNamesLock;
+        bool mEntryNamesLoaded;
+        std::vector<std::string> mEntryNames;
+
         static Mutex gLock;
         static DefaultKeyedVector<String8, wp<SharedZip> > gOpen;
     };
@@ -365,8 +406,14 @@ private:
 
         void addOverlay(const String8& path, const asset_path& overlay);
         bool getOverlay(const String8& path, size_t idx, asset_path* out) const;
-        
+
+        bool getZipDirContents(const String8& path, const String8& dirName,
+                Vector<String8>* outFiles, Vector<String8>* outDirs);
+        FileType getZipEntryType(const String8& path, const String8& entryName);
+
     private:
+        sp<SharedZip> getSharedZip(const String8& path);
+
         void closeZip(int idx);
 
         int getIndex(const String8& zip) const;
@@ -82,6 +82,13 @@ public:
      */
     status_t WriteEntityData(const void* data, size_t size);
 
+    /* Like WriteEntityData, but copies up to 'size' bytes from the current
+     * position of 'fd' without passing them through a user space buffer when
+     * the kernel allows it.  The number of bytes copied is returned in
+     * 'outWritten'; it is less than 'size' only if 'fd' hit EOF.
+     */
+    status_t WriteEntityDataFromFd(int fd, size_t size, size_t* outWritten);
+
     void SetKeyPrefix(const String8& keyPrefix);
 
 private:
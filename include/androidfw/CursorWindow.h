@@ -18,12 +18,15 @@
 #define _ANDROID__DATABASE_WINDOW_H
 
 #include <cutils/log.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <binder/Parcel.h>
 #include <utils/String8.h>
 
+#include <vector>
+
 #if LOG_NDEBUG
 
 #define IF_LOG_WINDOW() if (false)
@@ -46,13 +49,26 @@ namespace android {
  * FieldSlot per column, which has the size, offset, and type of the data for that field.
  * Note that the data types come from sqlite3.h.
  *
+ * Between the header and the first chunk, windows also carry an IndexHeader and a
+ * table of the offsets of every chunk, so that the chunk holding a row can be found
+ * without walking the list. Readers that predate the table only follow the list, and
+ * windows without one are read the same way.
+ *
+ * A window may be made of several ashmem segments of the same size, which together
+ * form a single range of offsets. A growable window maps another segment whenever an
+ * allocation does not fit in the last one, up to its maximum size. Allocations never
+ * straddle two segments, so nothing larger than one segment can be stored.
+ *
  * Strings are stored in UTF-8.
  */
 class CursorWindow {
     CursorWindow(const String8& name, int ashmemFd,
-            void* data, size_t size, bool readOnly);
+            void* data, size_t size, size_t maxSize, bool readOnly);
 
 public:
+    /* Most segments a window can be made of, including one read from a parcel. */
+    static const size_t MAX_SEGMENTS = 4;
+
     /* Field types. */
     enum {
         FIELD_TYPE_NULL = 0,
@@ -81,6 +97,14 @@ public:
     ~CursorWindow();
 
     static status_t create(const String8& name, size_t size, CursorWindow** outCursorWindow);
+
+    /**
+     * Creates a window that starts with a single segment of 'size' bytes and
+     * grows by further segments of that size, up to 'maxSize' bytes in all
+     * and never past MAX_SEGMENTS segments.
+     */
+    static status_t create(const String8& name, size_t size, size_t maxSize,
+            CursorWindow** outCursorWindow);
     static status_t createFromParcel(Parcel* parcel, CursorWindow** outCursorWindow);
 
     status_t writeToParcel(Parcel* parcel);
@@ -99,6 +123,13 @@ public:
      * The row is initialized will null entries for each field.
      */
     status_t allocRow();
+
+    /**
+     * Same as allocRow(), but also returns the field directory of the new row,
+     * so that a whole row can be filled in through the put*() methods that take
+     * a FieldSlot without looking the row up again for each field.
+     */
+    status_t allocRow(FieldSlot** outFieldDir);
     status_t freeLastRow();
 
     status_t putBlob(uint32_t row, uint32_t column, const void* value, size_t size);
@@ -107,6 +138,16 @@ public:
     status_t putDouble(uint32_t row, uint32_t column, double value);
     status_t putNull(uint32_t row, uint32_t column);
 
+    /**
+     * Store a value in a field slot of a row returned by allocRow(FieldSlot**).
+     * The window must not be read-only.
+     */
+    status_t putBlob(FieldSlot* fieldSlot, const void* value, size_t size);
+    status_t putString(FieldSlot* fieldSlot, const char* value, size_t sizeIncludingNull);
+    void putLong(FieldSlot* fieldSlot, int64_t value);
+    void putDouble(FieldSlot* fieldSlot, double value);
+    void putNull(FieldSlot* fieldSlot);
+
     /**
      * Gets the field slot at the specified row and column.
      * Returns null if the requested row or column is not in the window.
@@ -125,15 +166,20 @@ public:
         return fieldSlot->data.d;
     }
 
+    /**
+     * Values that don't lie inside the window read as empty, and as NULL.
+     */
     inline const char* getFieldSlotValueString(FieldSlot* fieldSlot,
             size_t* outSizeIncludingNull) {
-        *outSizeIncludingNull = fieldSlot->data.buffer.size;
-        return static_cast<char*>(offsetToPtr(fieldSlot->data.buffer.offset));
+        void* value = offsetToPtr(fieldSlot->data.buffer.offset, fieldSlot->data.buffer.size);
+        *outSizeIncludingNull = value != NULL ? fieldSlot->data.buffer.size : 0;
+        return static_cast<char*>(value);
     }
 
     inline const void* getFieldSlotValueBlob(FieldSlot* fieldSlot, size_t* outSize) {
-        *outSize = fieldSlot->data.buffer.size;
-        return offsetToPtr(fieldSlot->data.buffer.offset);
+        void* value = offsetToPtr(fieldSlot->data.buffer.offset, fieldSlot->data.buffer.size);
+        *outSize = value != NULL ? fieldSlot->data.buffer.size : 0;
+        return value;
     }
 
 private:
@@ -159,20 +205,64 @@ private:
         uint32_t nextChunkOffset;
     };
 
+    static const uint32_t INDEX_MAGIC = 0x58495743; // 'CWIX'
+    static const uint32_t INDEX_VERSION = 1;
+
+    // Follows the Header in windows that index their row slot chunks.
+    struct IndexHeader {
+        uint32_t magic;
+        uint32_t version;
+
+        // Offset of the table holding the offset of each chunk, in order.
+        uint32_t chunkTableOffset;
+        uint32_t chunkTableCapacity;
+
+        // Number of chunks in the list. Chunks past the capacity of the
+        // table are only reachable through the list.
+        uint32_t numChunks;
+    };
+
+    struct Segment {
+        int ashmemFd;
+        void* data;
+    };
+
     String8 mName;
-    int mAshmemFd;
+    std::vector<Segment> mSegments;
+    // The first segment, which holds the header.
     void* mData;
+    size_t mSegmentSize;
+    // Total size of the mapped segments.
     size_t mSize;
+    size_t mMaxSize;
     bool mReadOnly;
+    // False for windows read from a parcel whose index doesn't fit in them,
+    // which are then read by walking the chunk list.
+    bool mIndexUsable;
     Header* mHeader;
 
-    inline void* offsetToPtr(uint32_t offset) {
-        return static_cast<uint8_t*>(mData) + offset;
+    /**
+     * Returns a pointer to the 'bufferSize' bytes at 'offset', or NULL if they
+     * don't all lie inside one segment of the window. Windows read from a
+     * parcel hold offsets written by another process, so they can't be trusted.
+     */
+    inline void* offsetToPtr(uint32_t offset, size_t bufferSize = 0) {
+        if (offset < mSegmentSize && bufferSize <= mSegmentSize - offset) {
+            return static_cast<uint8_t*>(mData) + offset;
+        }
+        if (offset >= mSize || bufferSize > mSegmentSize - offset % mSegmentSize) {
+            ALOGE("Offset %" PRIu32 " and size %zu out of bounds, window size %zu",
+                    offset, bufferSize, mSize);
+            return NULL;
+        }
+        return static_cast<uint8_t*>(mSegments[offset / mSegmentSize].data)
+                + offset % mSegmentSize;
     }
 
-    inline uint32_t offsetFromPtr(void* ptr) {
-        return static_cast<uint8_t*>(ptr) - static_cast<uint8_t*>(mData);
-    }
+    /**
+     * Maps another segment at the end of the window.
+     */
+    status_t addSegment();
 
     /**
      * Allocate a portion of the window. Returns the offset
@@ -181,11 +271,26 @@ private:
      */
     uint32_t alloc(size_t size, bool aligned = false);
 
+    /**
+     * Returns the chunk index of this window, or NULL if it was written
+     * without one or can't be used.
+     */
+    IndexHeader* getIndex();
+
+    /**
+     * Checks that the chunk index of a window read from a parcel, if it has
+     * one, lies inside the window.
+     */
+    bool isIndexUsable();
+
+    RowSlotChunk* getChunk(IndexHeader* index, uint32_t chunk);
     RowSlot* getRowSlot(uint32_t row);
     RowSlot* allocRowSlot();
 
     status_t putBlobOrString(uint32_t row, uint32_t column,
             const void* value, size_t size, int32_t type);
+    status_t putBlobOrString(FieldSlot* fieldSlot,
+            const void* value, size_t size, int32_t type);
 };
 
 }; // namespace android
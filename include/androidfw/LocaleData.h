@@ -19,6 +19,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
 
 namespace android {
 
@@ -31,6 +34,47 @@ void localeDataComputeScript(char out[4], const char* language, const char* regi
 
 bool localeDataIsCloseToUsEnglish(const char* region);
 
+/**
+ * The results of localeDataCompareRegions() between every pair of a fixed set
+ * of regions, for one requested locale. Built once for the regions a resource
+ * table has for the requested language, it turns comparing two of them into an
+ * array lookup.
+ */
+class LocaleRegionMatrix {
+public:
+    LocaleRegionMatrix();
+
+    // Compares every pair of 'regions', given as the two bytes of
+    // ResTable_config::country, for the requested locale. Duplicates are
+    // allowed.
+    void build(const char* requested_language, const char* requested_script,
+               const char* requested_region, const std::vector<uint16_t>& regions);
+
+    // Returns a value of the same sign as localeDataCompareRegions() for the
+    // requested locale. Regions the matrix was not built with are compared
+    // directly.
+    int compare(const char* left_region, const char* right_region) const;
+
+    inline size_t size() const {
+        return mRegions.size();
+    }
+
+private:
+    ssize_t indexOf(const char* region) const;
+
+    char mLanguage[2];
+    char mScript[4];
+    char mRegion[2];
+    // Sorted, without duplicates.
+    std::vector<uint16_t> mRegions;
+    // Open addressed hash of mRegions, holding index + 1 (0 for empty slots).
+    std::vector<uint16_t> mSlotRegions;
+    std::vector<uint16_t> mSlotIndices;
+    size_t mSlotMask;
+    // mResults[i * size() + j] is the comparison of mRegions[i] to mRegions[j].
+    std::vector<int8_t> mResults;
+};
+
 } // namespace android
 
 #endif // _LIBS_UTILS_LOCALE_DATA_H
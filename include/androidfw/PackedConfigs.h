@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PACKED_CONFIGS_H
+#define __PACKED_CONFIGS_H
+
+#include <androidfw/ResourceTypes.h>
+
+#include <vector>
+
+namespace android {
+
+/**
+ * A structure-of-arrays copy of the qualifiers that rule out most
+ * configurations of a type (mcc/mnc, locale, screen dp sizes and SDK
+ * version), so that a whole list of candidates can be checked against the
+ * requested configuration in one tight loop the compiler can vectorize.
+ *
+ * The script of each locale is computed once when the configuration is
+ * added, rather than by every call to ResTable_config::match().
+ */
+class PackedConfigs {
+public:
+    enum {
+        // The configuration does not match.
+        NO_MATCH = 0,
+        // The configuration matches.
+        MATCH = 1,
+        // The packed qualifiers match, but the configuration has others
+        // that must be checked with ResTable_config::match().
+        MAYBE_MATCH = 2,
+    };
+
+    void add(const ResTable_config& config);
+
+    inline size_t size() const {
+        return mLanguage.size();
+    }
+
+    /**
+     * Writes NO_MATCH, MATCH or MAYBE_MATCH to outResults[i] for each of the
+     * size() configurations, as compared to 'settings'.
+     */
+    void match(const ResTable_config& settings, uint8_t* outResults) const;
+
+private:
+    std::vector<uint16_t> mMcc;
+    std::vector<uint16_t> mMnc;
+    std::vector<uint16_t> mLanguage;
+    std::vector<uint16_t> mCountry;
+    std::vector<uint32_t> mScript;
+    std::vector<uint8_t> mCountryMustMatch;
+    std::vector<uint16_t> mSmallestScreenWidthDp;
+    std::vector<uint16_t> mScreenWidthDp;
+    std::vector<uint16_t> mScreenHeightDp;
+    std::vector<uint16_t> mSdkVersion;
+    // MATCH if the packed qualifiers are all the configuration has,
+    // otherwise MAYBE_MATCH.
+    std::vector<uint8_t> mMatchResult;
+};
+
+} // namespace android
+
+#endif // __PACKED_CONFIGS_H
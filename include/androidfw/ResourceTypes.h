@@ -35,7 +35,9 @@
 
 #include <android/configuration.h>
 
+#include <atomic>
 #include <memory>
+#include <vector>
 
 namespace android {
 
@@ -523,7 +525,40 @@ public:
     bool isSorted() const;
     bool isUTF8() const;
 
+    // Decodes strings [start, start+count) of a UTF-8 pool ahead of time,
+    // so that later calls to stringAt() for them only hit the cache.
+    void predecodeStrings(size_t start, size_t count) const;
+
+    // Bounds the memory held by the UTF-16 copies of a UTF-8 pool's strings
+    // to roughly 'bytes'; 0, the default, means no limit. Once the limit is
+    // reached the least recently used strings are dropped, so a string
+    // returned by stringAt() is then only valid until the next call to
+    // stringAt() on this pool. Only set a limit on pools whose callers copy
+    // strings out straight away.
+    void setDecodeCacheLimit(size_t bytes);
+
+    struct DecodeCacheStats {
+        // Memory held by decoded strings, in bytes.
+        size_t bytes;
+        // Number of strings currently decoded.
+        size_t strings;
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+    };
+
+    void getDecodeCacheStats(DecodeCacheStats* outStats) const;
+
+    // Totals over every ResStringPool in the process. 'bytes' and 'strings'
+    // cover live pools only.
+    static void getGlobalDecodeCacheStats(DecodeCacheStats* outStats);
+
 private:
+    struct DecodeCache;
+
+    const char16_t* decodeStringLocked(size_t idx, const uint8_t* u8str, size_t u8len,
+            size_t u16len) const;
+
     status_t                    mError;
     void*                       mOwnedData;
     const ResStringPool_header* mHeader;
@@ -532,7 +567,8 @@ private:
     const uint32_t*             mEntries;
     const uint32_t*             mEntryStyles;
     const void*                 mStrings;
-    char16_t mutable**          mCache;
+    mutable DecodeCache*        mDecodeCache;
+    size_t                      mDecodeCacheLimit;
     uint32_t                    mStringPoolSize;    // number of uint16_t
     const uint32_t*             mStyles;
     uint32_t                    mStylePoolSize;    // number of uint32_t
@@ -709,6 +745,13 @@ public:
         const void*                 curExt;
     };
 
+    // An attribute of a START_TAG that has a resource ID.
+    struct AttributeIndexEntry
+    {
+        uint32_t                    resId;
+        uint32_t                    index;
+    };
+
     void restart();
 
     const ResStringPool& getStrings() const;
@@ -768,6 +811,12 @@ public:
     ssize_t indexOfAttribute(const char16_t* ns, size_t nsLen,
                              const char16_t* attr, size_t attrLen) const;
 
+    // Returns the attributes of the current START_TAG that have a resource
+    // ID, sorted by that ID, and sets *outCount to how many there are. The
+    // entries belong to the tree, which builds them when it is loaded.
+    const AttributeIndexEntry* getSortedAttributes(size_t* outCount) const;
+    ssize_t indexOfAttribute(uint32_t resId) const;
+
     ssize_t indexOfID() const;
     ssize_t indexOfClass() const;
     ssize_t indexOfStyle() const;
@@ -808,6 +857,7 @@ private:
     friend class ResXMLParser;
 
     status_t validateNode(const ResXMLTree_node* node) const;
+    void buildAttributeIndex();
 
     const DynamicRefTable* const mDynamicRefTable;
 
@@ -822,6 +872,13 @@ private:
     const ResXMLTree_node*      mRootNode;
     const void*                 mRootExt;
     event_code_t                mRootCode;
+
+    // The offsets of the start tags that have attributes with resource IDs,
+    // in document order, and where their sorted entries begin. The last
+    // start is the end of mAttrIndexEntries.
+    std::vector<uint32_t>       mAttrIndexNodes;
+    std::vector<uint32_t>       mAttrIndexStarts;
+    std::vector<AttributeIndexEntry> mAttrIndexEntries;
 };
 
 /** ********************************************************************
@@ -1212,7 +1269,10 @@ struct ResTable_config
     // they are not equal then one must be generic because only generic and
     // '==requested' will pass the match() call.  So if this is not generic,
     // it wins.  If this IS generic, o wins (return false).
-    bool isBetterThan(const ResTable_config& o, const ResTable_config* requested) const;
+    // 'regions', if given, must have been built for the locale of 'requested';
+    // see isLocaleBetterThan().
+    bool isBetterThan(const ResTable_config& o, const ResTable_config* requested,
+            const LocaleRegionMatrix* regions = NULL) const;
 
     // Return true if 'this' can be considered a match for the parameters in 
     // 'settings'.
@@ -1278,7 +1338,10 @@ struct ResTable_config
     // 'requested' configuration. Similar to isBetterThan(), this assumes that
     // match() has already been used to remove any configurations that don't
     // match the requested configuration at all.
-    bool isLocaleBetterThan(const ResTable_config& o, const ResTable_config* requested) const;
+    // Regions are compared through 'regions' when it is given, which must have
+    // been built for the locale of 'requested'.
+    bool isLocaleBetterThan(const ResTable_config& o, const ResTable_config* requested,
+            const LocaleRegionMatrix* regions = NULL) const;
 
     String8 toString() const;
 };
@@ -1579,6 +1642,17 @@ public:
     status_t add(Asset* asset, Asset* idmapAsset, const int32_t cookie=-1, bool copyData=false,
             bool appAsLib=false, bool isSystemAsset=false);
 
+    // Like the above, but uses an index created by createIndex() for the
+    // same table to find the table's chunks without scanning it. If the
+    // index does not match the table's chunks, the table is scanned as
+    // usual and 'outIndexRejected', if given, is set to true.
+    status_t add(const void* data, size_t size, const void* idmapData, size_t idmapDataSize,
+            const void* indexData, size_t indexDataSize, const int32_t cookie,
+            bool copyData, bool appAsLib=false, bool* outIndexRejected=NULL);
+    status_t add(Asset* asset, Asset* idmapAsset, Asset* indexAsset, const int32_t cookie,
+            bool copyData, bool appAsLib=false, bool isSystemAsset=false,
+            bool* outIndexRejected=NULL);
+
     status_t add(ResTable* src, bool isSystemAsset=false);
     status_t addEmpty(const int32_t cookie);
 
@@ -1722,25 +1796,36 @@ public:
         Theme& operator=(const Theme&);
 
         struct theme_entry {
+            uint32_t attrRes;
             ssize_t stringBlock;
             uint32_t typeSpecFlags;
             Res_value value;
         };
 
-        struct type_info {
+        /**
+         * The attributes of a theme, sorted by resource ID. A list is shared
+         * between themes copied with setTo() and is never modified while it
+         * is shared; applyStyle() builds a new list instead.
+         */
+        struct entry_list {
+            volatile int32_t refCount;
             size_t numEntries;
-            theme_entry* entries;
+            // Followed by 'numEntries' theme_entry structures.
         };
 
-        struct package_info {
-            type_info types[Res_MAXTYPE + 1];
-        };
+        static entry_list* alloc_entries(size_t numEntries);
+        static void release_entries(entry_list* list);
+        static inline theme_entry* entries_of(entry_list* list) {
+            return reinterpret_cast<theme_entry*>(list + 1);
+        }
+        static inline const theme_entry* entries_of(const entry_list* list) {
+            return reinterpret_cast<const theme_entry*>(list + 1);
+        }
 
-        void free_package(package_info* pi);
-        package_info* copy_package(package_info* pi);
+        const theme_entry* find_entry(uint32_t attrRes) const;
 
         const ResTable& mTable;
-        package_info*   mPackages[Res_MAXPACKAGE];
+        entry_list*     mEntries;
         uint32_t        mTypeSpecFlags;
     };
 
@@ -1872,6 +1957,28 @@ public:
             uint32_t* pTargetCrc, uint32_t* pOverlayCrc,
             String8* pTargetPath, String8* pOverlayPath);
 
+    // Generate an index of the chunks in the resource table 'data', which
+    // add() can use to load the table without scanning and validating each
+    // chunk. 'tableCrc' identifies the table contents (typically the CRC-32
+    // of its zip entry) so that a stale index can be detected by the caller
+    // through getIndexInfo(). This is meant to run at build time: aapt2
+    // stores the index in the APK, next to the table, as resources.idx.
+    //
+    // Return value: on success: NO_ERROR; caller is responsible for free-ing
+    // outData (using free(3)). On failure, any status_t value other than
+    // NO_ERROR; the caller should not free outData.
+    static status_t createIndex(const void* data, size_t size, uint32_t tableCrc,
+            void** outData, size_t* outSize);
+
+    static const size_t INDEX_HEADER_SIZE_BYTES = 5 * sizeof(uint32_t);
+
+    // Retrieve index meta-data.
+    //
+    // This function only requires the index header (the first
+    // INDEX_HEADER_SIZE_BYTES) bytes of an index file.
+    static bool getIndexInfo(const void* index, size_t size,
+            uint32_t* pVersion, uint32_t* pTableSize, uint32_t* pTableCrc);
+
     void print(bool inclValues) const;
     static String8 normalizeForOutput(const char* input);
 
@@ -1887,6 +1994,9 @@ private:
         size_t numAttrs;    // number in array
         size_t availAttrs;  // total space in array
         uint32_t typeSpecFlags;
+        // Whether the bag and its parents resolve the same way in every
+        // ResTable sharing its package group, so it can be shared.
+        bool shareable;
         // Followed by 'numAttr' bag_entry structures.
     };
 
@@ -1897,16 +2007,26 @@ private:
     struct TypeCacheEntry {
         TypeCacheEntry() : cachedBags(NULL) {}
 
-        // Computed attribute bags for this type.
+        // Computed attribute bags for this type. Guarded by mLock.
         bag_set** cachedBags;
-
-        // Pre-filtered list of configurations (per asset path) that match the parameters set on this
-        // ResTable.
-        Vector<std::shared_ptr<Vector<const ResTable_type*>>> filteredConfigs;
     };
 
+    struct ResolvedEntry;
+    struct TypeSnapshot;
+    struct ConfigSnapshot;
+    class ScopedSnapshotReader;
+    struct SharedBagCache;
+
+    struct IndexEntry;
+
     status_t addInternal(const void* data, size_t size, const void* idmapData, size_t idmapDataSize,
-            bool appAsLib, const int32_t cookie, bool copyData, bool isSystemAsset=false);
+            bool appAsLib, const int32_t cookie, bool copyData, bool isSystemAsset=false,
+            const void* indexData=NULL, size_t indexDataSize=0, bool* outIndexRejected=NULL);
+
+    static const IndexEntry* validateIndex(const void* indexData, size_t indexDataSize,
+            const Header* header, size_t* outEntryCount);
+    status_t parseIndexedTable(Header* header, const IndexEntry* entries, size_t entryCount,
+            bool appAsLib, bool isSystemAsset);
 
     ssize_t getResourcePackageIndex(uint32_t resID) const;
 
@@ -1918,9 +2038,13 @@ private:
     uint32_t findEntry(const PackageGroup* group, ssize_t typeIndex, const char16_t* name,
             size_t nameLen, uint32_t* outTypeSpecFlags) const;
 
+    void publishSnapshot(ConfigSnapshot* snapshot);
+    void freeRetiredSnapshotsLocked() const;
+
     status_t parsePackage(
         const ResTable_package* const pkg, const Header* const header,
-        bool appAsLib, bool isSystemAsset);
+        bool appAsLib, bool isSystemAsset,
+        const IndexEntry* indexEntries=NULL, size_t indexEntryCount=0);
 
     void print_value(const Package* pkg, const Res_value& value) const;
 
@@ -1930,15 +2054,22 @@ private:
 
     mutable Mutex               mLock;
 
-    // Mutex that controls access to the list of pre-filtered configurations
-    // to check when looking up entries.
-    // When iterating over a bag, the mLock mutex is locked. While mLock is locked,
-    // we do resource lookups.
-    // Mutex is not reentrant, so we must use a different lock than mLock.
-    mutable Mutex               mFilteredConfigLock;
-
     status_t                    mError;
 
+    // Pre-filtered configurations and resolved entries for the current
+    // parameters. Lookups do not lock: they register in mSnapshotReaders and
+    // load the pointer, while setParameters() builds a new snapshot and
+    // publishes it with a single atomic exchange. Replaced snapshots are kept
+    // in mRetiredSnapshots until no reader is registered, and freed by either
+    // the publish or the last reader to leave, whichever sees that first.
+    std::atomic<ConfigSnapshot*> mSnapshot;
+    mutable std::atomic<int32_t> mSnapshotReaders;
+    // Guards replacing mSnapshot and mRetiredSnapshots. Readers only take it
+    // to free retired snapshots, so it is separate from mLock.
+    mutable Mutex               mSnapshotLock;
+    mutable Vector<ConfigSnapshot*> mRetiredSnapshots;
+    mutable std::atomic<bool>   mHasRetiredSnapshots;
+
     ResTable_config             mParams;
 
     // Array of all resource tables.
@@ -23,6 +23,8 @@
 
 #include <utils/Compat.h>
 
+#include <vector>
+
 namespace android {
 
 class StreamingZipInflater {
@@ -30,6 +32,11 @@ public:
     static const size_t INPUT_CHUNK_SIZE = 64 * 1024;
     static const size_t OUTPUT_CHUNK_SIZE = 64 * 1024;
 
+    // Memory spent by default on checkpoints for seeking backwards.
+    static const size_t DEFAULT_CHECKPOINT_BUDGET = 256 * 1024;
+    // Checkpoints are never closer together than this in the uncompressed data.
+    static const size_t MIN_CHECKPOINT_SPAN = 256 * 1024;
+
     // Flavor that pages in the compressed data from a fd
     StreamingZipInflater(int fd, off64_t compDataStart, size_t uncompSize, size_t compSize);
 
@@ -42,14 +49,34 @@ public:
     // be NULL, in which case the data is consumed and discarded.
     ssize_t read(void* outBuf, size_t count);
 
-    // seeking backwards requires uncompressing fom the beginning, so is very
-    // expensive.  seeking forwards only requires uncompressing from the current
-    // position to the destination.
+    // seeking backwards resumes uncompressing from the closest checkpoint before
+    // the destination, or from the beginning if there is none.  seeking forwards
+    // only requires uncompressing from the current position (or a checkpoint past
+    // it) to the destination.
     off64_t seekAbsolute(off64_t absoluteInputPosition);
 
+    // While streaming, the inflate state is saved at deflate block boundaries
+    // spread over the uncompressed data, each checkpoint holding a copy of the
+    // 32K inflate window.  This caps the memory all checkpoints may take; zero
+    // disables them.  Checkpoints that no longer fit are dropped.
+    void setCheckpointBudget(size_t bytes);
+
+    size_t getCheckpointCount() const { return mCheckpoints.size(); }
+
 private:
+    struct Checkpoint {
+        off64_t outOffset;          // uncompressed offset of the block boundary
+        size_t inOffset;            // compressed bytes consumed up to it
+        int bits;                   // bits of the last consumed byte not yet used
+        uint8_t lastByte;           // the last consumed byte, when bits != 0
+        std::vector<uint8_t> window; // the inflate dictionary at this point
+    };
+
     void initInflateState();
     int readNextChunk();
+    void updateCheckpointSpan();
+    void maybeAddCheckpoint();
+    bool resumeFromCheckpoint(const Checkpoint& checkpoint);
 
     // where to find the uncompressed data
     int mFd;
@@ -77,6 +104,11 @@ private:
     // input state bookkeeping
     size_t mInNextChunkOffset;  // offset from start of blob at which the next input chunk lies
     // the z_stream contains state about input block consumption
+
+    // checkpoints for seeking, in increasing offset order
+    std::vector<Checkpoint> mCheckpoints;
+    size_t mMaxCheckpoints;     // how many checkpoints fit the budget
+    size_t mCheckpointSpan;     // minimum uncompressed distance between checkpoints
 };
 
 }
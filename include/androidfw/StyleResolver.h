@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __STYLE_RESOLVER_H
+#define __STYLE_RESOLVER_H
+
+#include <androidfw/ResourceTypes.h>
+
+namespace android {
+
+/**
+ * Resolves a whole array of attributes against a theme in a single pass.
+ *
+ * Each requested attribute is looked up, in order of priority, in the
+ * explicit input values or XML attributes, the style named by the XML
+ * tag, the default style and finally the theme itself. The requested
+ * attributes are expected to be sorted (as generated by aapt), which lets
+ * every source be walked once in lock-step instead of searched from the
+ * start for each attribute.
+ *
+ * The results are written as STYLE_NUM_ENTRIES words per attribute, in
+ * the layout expected by android.content.res.TypedArray.
+ */
+class StyleResolver {
+public:
+    enum {
+        STYLE_TYPE = 0,
+        STYLE_DATA = 1,
+        STYLE_ASSET_COOKIE = 2,
+        STYLE_RESOURCE_ID = 3,
+        STYLE_CHANGING_CONFIGURATIONS = 4,
+        STYLE_DENSITY = 5,
+        STYLE_NUM_ENTRIES = 6
+    };
+
+    explicit StyleResolver(const ResTable::Theme& theme);
+
+    /**
+     * Resolves attrs using srcValues (which may be NULL) in place of XML
+     * attributes. A non-zero srcValues[i] is treated as a reference to
+     * the theme attribute with that identifier.
+     *
+     * outValues must hold attrsLength * STYLE_NUM_ENTRIES words. If
+     * outIndices is non-NULL it must hold attrsLength + 1 words; the first
+     * receives the number of attributes that resolved to a value and the
+     * rest receive their indices into attrs.
+     */
+    void resolveAttrs(uint32_t defStyleAttr, uint32_t defStyleRes,
+            const uint32_t* srcValues, size_t srcValuesLength,
+            const uint32_t* attrs, size_t attrsLength,
+            uint32_t* outValues, uint32_t* outIndices) const;
+
+    /**
+     * Resolves attrs for the current element of xmlParser (which may be
+     * NULL), including the style set on that element. The output layout
+     * is the same as for resolveAttrs().
+     */
+    void applyStyle(ResXMLParser* xmlParser, uint32_t defStyleAttr, uint32_t defStyleRes,
+            const uint32_t* attrs, size_t attrsLength,
+            uint32_t* outValues, uint32_t* outIndices) const;
+
+private:
+    struct Sources;
+
+    uint32_t findDefStyle(uint32_t defStyleAttr, uint32_t defStyleRes,
+            uint32_t* outTypeSetFlags) const;
+    void resolve(Sources& sources, const uint32_t* attrs, size_t attrsLength,
+            uint32_t* outValues, uint32_t* outIndices) const;
+
+    const ResTable::Theme& mTheme;
+};
+
+} // namespace android
+
+#endif // __STYLE_RESOLVER_H
@@ -24,8 +24,10 @@ commonSources := \
     LocaleData.cpp \
     misc.cpp \
     ObbFile.cpp \
+    PackedConfigs.cpp \
     ResourceTypes.cpp \
     StreamingZipInflater.cpp \
+    StyleResolver.cpp \
     TypeWrappers.cpp \
     ZipFileRO.cpp \
     ZipUtils.cpp
@@ -47,6 +47,37 @@ using namespace android;
 
 static const bool kIsDebug = false;
 
+/*
+ * Start reading a range of an open file into the page cache.
+ */
+static status_t readAheadFile(int fd, off64_t offset, off64_t length)
+{
+#if defined(__linux__)
+    int err = posix_fadvise64(fd, offset, length, POSIX_FADV_WILLNEED);
+    if (err != 0) {
+        ALOGW("readahead of %ld bytes failed: %s\n", (long) length, strerror(err));
+        return UNKNOWN_ERROR;
+    }
+#else
+    (void) fd;
+    (void) offset;
+    (void) length;
+#endif
+    return NO_ERROR;
+}
+
+/*
+ * Start faulting in the pages of a memory-mapped region.
+ */
+static status_t readAheadMap(FileMap* map)
+{
+    if (map->advise(FileMap::WILLNEED) != 0) {
+        ALOGW("readahead of %ld bytes of mapped data failed\n", (long) map->getDataLength());
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
 static Mutex gAssetLock;
 static int32_t gCount = 0;
 static Asset* gHead = NULL;
@@ -639,6 +670,20 @@ const void* _FileAsset::getBuffer(bool wordAligned)
     }
 }
 
+/*
+ * Start reading the chunk into memory.
+ */
+status_t _FileAsset::prefetch(void)
+{
+    if (mBuf != NULL)
+        return NO_ERROR;
+    if (mMap != NULL)
+        return readAheadMap(mMap);
+    if (mFp != NULL)
+        return readAheadFile(fileno(mFp), mStart, mLength);
+    return NO_ERROR;
+}
+
 int _FileAsset::openFileDescriptor(off64_t* outStart, off64_t* outLength) const
 {
     if (mMap != NULL) {
@@ -857,6 +902,21 @@ void _CompressedAsset::close(void)
     }
 }
 
+/*
+ * Start reading the compressed data into memory.  Once expanded, the data
+ * is in RAM already.
+ */
+status_t _CompressedAsset::prefetch(void)
+{
+    if (mBuf != NULL)
+        return NO_ERROR;
+    if (mMap != NULL)
+        return readAheadMap(mMap);
+    if (mFd >= 0)
+        return readAheadFile(mFd, mStart, mCompressedLen);
+    return NO_ERROR;
+}
+
 /*
  * Get a pointer to a read-only buffer of data.
  *
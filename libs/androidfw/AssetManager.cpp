@@ -45,6 +45,8 @@
 #include <string.h> // strerror
 #include <strings.h>
 
+#include <algorithm>
+
 #ifndef TEMP_FAILURE_RETRY
 /* Used to retry syscalls that can return EINTR. */
 #define TEMP_FAILURE_RETRY(exp) ({         \
@@ -77,6 +79,7 @@ static Asset* const kExcludedAsset = (Asset*) 0xd000000d;
 static volatile int32_t gCount = 0;
 
 const char* AssetManager::RESOURCES_FILENAME = "resources.arsc";
+const char* AssetManager::RESOURCES_INDEX_FILENAME = "resources.idx";
 const char* AssetManager::IDMAP_BIN = "/system/bin/idmap";
 const char* AssetManager::OVERLAY_DIR = "/vendor/overlay";
 const char* AssetManager::OVERLAY_THEME_DIR_PROPERTY = "ro.boot.vendor.overlay.theme";
@@ -513,6 +516,30 @@ Asset* AssetManager::open(const char* fileName, AccessMode mode)
     return NULL;
 }
 
+/*
+ * Prefetch a list of assets.
+ *
+ * Each asset is opened, asked to read its data ahead and closed again.
+ * What stays behind is the data in the page cache, which makes opening the
+ * asset for real cheap.
+ */
+size_t AssetManager::prefetchAssets(const Vector<String8>& fileNames)
+{
+    size_t prefetched = 0;
+    for (size_t i = 0; i < fileNames.size(); i++) {
+        Asset* pAsset = open(fileNames[i].string(), Asset::ACCESS_STREAMING);
+        if (pAsset == NULL) {
+            ALOGV("Not prefetching missing asset '%s'\n", fileNames[i].string());
+            continue;
+        }
+        if (pAsset->prefetch() == NO_ERROR) {
+            prefetched++;
+        }
+        delete pAsset;
+    }
+    return prefetched;
+}
+
 /*
  * Open a non-asset file as if it were an asset.
  *
@@ -580,6 +607,35 @@ Asset* AssetManager::openNonAsset(const int32_t cookie, const char* fileName, Ac
  */
 FileType AssetManager::getFileType(const char* fileName)
 {
+    {
+        AutoMutex _l(mLock);
+
+        LOG_FATAL_IF(mAssetPaths.size() == 0, "No assets added to AssetManager");
+
+        String8 assetName(kAssetsRoot);
+        assetName.appendPath(fileName);
+
+        /*
+         * Zips can be checked against their entry index without opening
+         * anything. Stop at the first loose directory, in priority order,
+         * and search the slow way from there.
+         */
+        size_t i = mAssetPaths.size();
+        while (i > 0) {
+            i--;
+            const asset_path& ap = mAssetPaths.itemAt(i);
+            if (ap.type != kFileTypeRegular) {
+                break;
+            }
+            if (mZipSet.getZipEntryType(ap.path, assetName) == kFileTypeRegular) {
+                return kFileTypeRegular;
+            }
+            if (i == 0) {
+                return kFileTypeNonexistent;
+            }
+        }
+    }
+
     Asset* pAsset = NULL;
 
     /*
@@ -642,7 +698,9 @@ bool AssetManager::appendPathToResTable(const asset_path& ap, bool appAsLib) con
                 // can quickly copy it out for others.
                 ALOGV("Creating shared resources for %s", ap.path.string());
                 sharedRes = new ResTable();
-                sharedRes->add(ass, idmap, nextEntryIdx + 1, false);
+                Asset* index = openResourceIndexLocked(ap, ass);
+                sharedRes->add(ass, idmap, index, nextEntryIdx + 1, false);
+                delete index;
 #ifdef __ANDROID__
                 const char* data = getenv("ANDROID_DATA");
                 LOG_ALWAYS_FATAL_IF(data == NULL, "ANDROID_DATA not set");
@@ -671,7 +729,10 @@ bool AssetManager::appendPathToResTable(const asset_path& ap, bool appAsLib) con
             mResources->add(sharedRes, ap.isSystemAsset);
         } else {
             ALOGV("Parsing resources for %s", ap.path.string());
-            mResources->add(ass, idmap, nextEntryIdx + 1, !shared, appAsLib, ap.isSystemAsset);
+            Asset* index = openResourceIndexLocked(ap, ass);
+            mResources->add(ass, idmap, index, nextEntryIdx + 1, !shared, appAsLib,
+                    ap.isSystemAsset);
+            delete index;
         }
         onlyEmptyResources = false;
 
@@ -763,6 +824,52 @@ Asset* AssetManager::openIdmapLocked(const struct asset_path& ap) const
     return ass;
 }
 
+/*
+ * Open the index that the build stored next to the resource table of a
+ * package, if there is one and it was made for the table in tableAsset.
+ * Indexes are only created ahead of time, so loading a table never pays
+ * for building one; a table without a usable index is scanned.
+ */
+Asset* AssetManager::openResourceIndexLocked(const struct asset_path& ap,
+        Asset* tableAsset) const
+{
+    if (ap.type == kFileTypeDirectory || tableAsset == NULL || tableAsset == kExcludedAsset) {
+        return NULL;
+    }
+
+    ZipFileRO* zip = const_cast<AssetManager*>(this)->getZipFileLocked(ap);
+    if (zip == NULL) {
+        return NULL;
+    }
+    ZipEntryRO entry = zip->findEntryByName(RESOURCES_FILENAME);
+    if (entry == NULL) {
+        return NULL;
+    }
+    uint32_t tableCrc = 0;
+    const bool haveCrc = zip->getEntryInfo(entry, NULL, NULL, NULL, NULL, NULL, &tableCrc);
+    zip->releaseEntry(entry);
+    if (!haveCrc) {
+        return NULL;
+    }
+
+    Asset* index = const_cast<AssetManager*>(this)->
+        openNonAssetInPathLocked(RESOURCES_INDEX_FILENAME, Asset::ACCESS_BUFFER, ap);
+    if (index == NULL || index == kExcludedAsset) {
+        return NULL;
+    }
+
+    const void* data = index->getBuffer(true);
+    uint32_t indexTableCrc = 0;
+    if (data == NULL || !ResTable::getIndexInfo(data, static_cast<size_t>(index->getLength()),
+            NULL, NULL, &indexTableCrc) || indexTableCrc != tableCrc) {
+        ALOGW("ignoring resource index of %s made for another table\n", ap.path.string());
+        delete index;
+        return NULL;
+    }
+    ALOGV("loading resource index of %s\n", ap.path.string());
+    return index;
+}
+
 void AssetManager::addSystemOverlays(const char* pathOverlaysList,
         const String8& targetPackagePath, ResTable* sharedRes, size_t offset) const
 {
@@ -1505,17 +1612,11 @@ SortedVector<AssetDir::FileInfo>* AssetManager::scanDirLocked(const String8& pat
 bool AssetManager::scanAndMergeZipLocked(SortedVector<AssetDir::FileInfo>* pMergedInfo,
     const asset_path& ap, const char* rootDir, const char* baseDirName)
 {
-    ZipFileRO* pZip;
+    Vector<String8> files;
     Vector<String8> dirs;
     AssetDir::FileInfo info;
     SortedVector<AssetDir::FileInfo> contents;
-    String8 sourceName, zipName, dirName;
-
-    pZip = mZipSet.getZip(ap.path);
-    if (pZip == NULL) {
-        ALOGW("Failure opening zip %s\n", ap.path.string());
-        return false;
-    }
+    String8 zipName, dirName;
 
     zipName = ZipSet::getPathName(ap.path.string());
 
@@ -1524,85 +1625,31 @@ bool AssetManager::scanAndMergeZipLocked(SortedVector<AssetDir::FileInfo>* pMerg
     dirName.appendPath(baseDirName);
 
     /*
-     * Scan through the list of files, looking for a match.  The files in
-     * the Zip table of contents are not in sorted order, so we have to
-     * process the entire list.  We're looking for a string that begins
-     * with the characters in "dirName", is followed by a '/', and has no
-     * subsequent '/' in the stuff that follows.
-     *
-     * What makes this especially fun is that directories are not stored
-     * explicitly in Zip archives, so we have to infer them from context.
-     * When we see "sounds/foo.wav" we have to leave a note to ourselves
-     * to insert a directory called "sounds" into the list.  We store
-     * these in temporary vector so that we only return each one once.
+     * The shared zip keeps a sorted index of its entry names, so this
+     * only looks at the entries below dirName rather than the whole table
+     * of contents. Directories are not stored explicitly in Zip archives,
+     * so they are inferred from the entries below them, and each is only
+     * returned once.
      *
      * Name comparisons are case-sensitive to match UNIX filesystem
      * semantics.
      */
-    int dirNameLen = dirName.length();
-    void *iterationCookie;
-    if (!pZip->startIteration(&iterationCookie, dirName.string(), NULL)) {
-        ALOGW("ZipFileRO::startIteration returned false");
+    if (!mZipSet.getZipDirContents(ap.path, dirName, &files, &dirs)) {
+        ALOGW("Failure opening zip %s\n", ap.path.string());
         return false;
     }
 
-    ZipEntryRO entry;
-    while ((entry = pZip->nextEntry(iterationCookie)) != NULL) {
-        char nameBuf[256];
-
-        if (pZip->getEntryFileName(entry, nameBuf, sizeof(nameBuf)) != 0) {
-            // TODO: fix this if we expect to have long names
-            ALOGE("ARGH: name too long?\n");
-            continue;
-        }
-        //printf("Comparing %s in %s?\n", nameBuf, dirName.string());
-        if (dirNameLen == 0 || nameBuf[dirNameLen] == '/')
-        {
-            const char* cp;
-            const char* nextSlash;
-
-            cp = nameBuf + dirNameLen;
-            if (dirNameLen != 0)
-                cp++;       // advance past the '/'
-
-            nextSlash = strchr(cp, '/');
-//xxx this may break if there are bare directory entries
-            if (nextSlash == NULL) {
-                /* this is a file in the requested directory */
-
-                info.set(String8(nameBuf).getPathLeaf(), kFileTypeRegular);
-
-                info.setSourceName(
-                    createZipSourceNameLocked(zipName, dirName, info.getFileName()));
-
-                contents.add(info);
-                //printf("FOUND: file '%s'\n", info.getFileName().string());
-            } else {
-                /* this is a subdir; add it if we don't already have it*/
-                String8 subdirName(cp, nextSlash - cp);
-                size_t j;
-                size_t N = dirs.size();
-
-                for (j = 0; j < N; j++) {
-                    if (subdirName == dirs[j]) {
-                        break;
-                    }
-                }
-                if (j == N) {
-                    dirs.add(subdirName);
-                }
-
-                //printf("FOUND: dir '%s'\n", subdirName.string());
-            }
-        }
+    for (size_t i = 0; i < files.size(); i++) {
+        info.set(files[i], kFileTypeRegular);
+        info.setSourceName(
+            createZipSourceNameLocked(zipName, dirName, info.getFileName()));
+        contents.add(info);
     }
 
-    pZip->endIteration(iterationCookie);
-
     /*
      * Add the set of unique directories.
      */
-    for (int i = 0; i < (int) dirs.size(); i++) {
+    for (size_t i = 0; i < dirs.size(); i++) {
         info.set(dirs[i], kFileTypeDirectory);
         info.setSourceName(
             createZipSourceNameLocked(zipName, dirName, info.getFileName()));
@@ -1870,7 +1917,7 @@ DefaultKeyedVector<String8, wp<AssetManager::SharedZip> > AssetManager::SharedZi
 
 AssetManager::SharedZip::SharedZip(const String8& path, time_t modWhen)
     : mPath(path), mZipFile(NULL), mModWhen(modWhen),
-      mResourceTableAsset(NULL), mResourceTable(NULL)
+      mResourceTableAsset(NULL), mResourceTable(NULL), mEntryNamesLoaded(false)
 {
     if (kIsDebug) {
         ALOGI("Creating SharedZip %p %s\n", this, (const char*)mPath);
@@ -1967,6 +2014,96 @@ bool AssetManager::SharedZip::getOverlay(size_t idx, asset_path* out) const
     return true;
 }
 
+const std::vector<std::string>& AssetManager::SharedZip::getSortedEntryNames()
+{
+    AutoMutex _l(mEntryNamesLock);
+    if (mEntryNamesLoaded || mZipFile == NULL) {
+        return mEntryNames;
+    }
+
+    // Callers read the names after the lock is dropped, so they must never
+    // change once returned: a zip that can't be iterated stays empty rather
+    // than being retried.
+    mEntryNamesLoaded = true;
+
+    void* iterationCookie;
+    if (!mZipFile->startIteration(&iterationCookie)) {
+        ALOGW("ZipFileRO::startIteration returned false");
+        return mEntryNames;
+    }
+
+    std::vector<char> nameBuf(256);
+    ZipEntryRO entry;
+    while ((entry = mZipFile->nextEntry(iterationCookie)) != NULL) {
+        int requiredSize = mZipFile->getEntryFileName(entry, nameBuf.data(), nameBuf.size());
+        if (requiredSize != 0) {
+            nameBuf.resize(requiredSize);
+            mZipFile->getEntryFileName(entry, nameBuf.data(), nameBuf.size());
+        }
+        mEntryNames.push_back(nameBuf.data());
+    }
+    mZipFile->endIteration(iterationCookie);
+
+    std::sort(mEntryNames.begin(), mEntryNames.end());
+    return mEntryNames;
+}
+
+bool AssetManager::SharedZip::getDirContents(const String8& dirName,
+        Vector<String8>* outFiles, Vector<String8>* outDirs)
+{
+    if (mZipFile == NULL) {
+        return false;
+    }
+
+    const std::vector<std::string>& names = getSortedEntryNames();
+    std::string prefix(dirName.string(), dirName.length());
+    if (!prefix.empty()) {
+        prefix += '/';
+    }
+
+    // Everything below dirName sorts together, starting at the prefix.
+    auto iter = std::lower_bound(names.begin(), names.end(), prefix);
+    while (iter != names.end() && iter->compare(0, prefix.size(), prefix) == 0) {
+        const char* name = iter->c_str() + prefix.size();
+        const char* nextSlash = strchr(name, '/');
+        if (nextSlash == NULL) {
+            if (*name != '\0') {
+                outFiles->add(String8(name));
+            }
+            ++iter;
+            continue;
+        }
+
+        if (nextSlash != name) {
+            outDirs->add(String8(name, nextSlash - name));
+        }
+
+        // Skip the rest of this subdirectory: '0' is the character after
+        // '/', so this is the first name that is not below it.
+        std::string subdirEnd(iter->c_str(), nextSlash - iter->c_str());
+        subdirEnd += '0';
+        iter = std::lower_bound(iter, names.end(), subdirEnd);
+    }
+    return true;
+}
+
+FileType AssetManager::SharedZip::getEntryType(const String8& path)
+{
+    const std::vector<std::string>& names = getSortedEntryNames();
+    std::string name(path.string(), path.length());
+    auto iter = std::lower_bound(names.begin(), names.end(), name);
+    if (iter != names.end() && *iter == name) {
+        return kFileTypeRegular;
+    }
+
+    name += '/';
+    iter = std::lower_bound(iter, names.end(), name);
+    if (iter != names.end() && iter->compare(0, name.size(), name) == 0) {
+        return kFileTypeDirectory;
+    }
+    return kFileTypeNonexistent;
+}
+
 AssetManager::SharedZip::~SharedZip()
 {
     if (kIsDebug) {
@@ -2061,6 +2198,28 @@ ResTable* AssetManager::ZipSet::getZipResourceTable(const String8& path)
     return zip->getResourceTable();
 }
 
+bool AssetManager::ZipSet::getZipDirContents(const String8& path, const String8& dirName,
+        Vector<String8>* outFiles, Vector<String8>* outDirs)
+{
+    return getSharedZip(path)->getDirContents(dirName, outFiles, outDirs);
+}
+
+FileType AssetManager::ZipSet::getZipEntryType(const String8& path, const String8& entryName)
+{
+    return getSharedZip(path)->getEntryType(entryName);
+}
+
+sp<AssetManager::SharedZip> AssetManager::ZipSet::getSharedZip(const String8& path)
+{
+    int idx = getIndex(path);
+    sp<SharedZip> zip = mZipFile[idx];
+    if (zip == NULL) {
+        zip = SharedZip::get(path);
+        mZipFile.editItemAt(idx) = zip;
+    }
+    return zip;
+}
+
 ResTable* AssetManager::ZipSet::setZipResourceTable(const String8& path,
                                                     ResTable* res)
 {
@@ -19,8 +19,11 @@
 #include <androidfw/BackupHelpers.h>
 #include <utils/ByteOrder.h>
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
 
 #include <cutils/log.h>
@@ -168,6 +171,70 @@ BackupDataWriter::WriteEntityData(const void* data, size_t size)
     return NO_ERROR;
 }
 
+status_t
+BackupDataWriter::WriteEntityDataFromFd(int fd, size_t size, size_t* outWritten)
+{
+    if (kIsDebug) ALOGD("Writing data from fd %d: size=%lu", fd, (unsigned long) size);
+
+    *outWritten = 0;
+    if (m_status != NO_ERROR) {
+        if (kIsDebug) {
+            ALOGD("Not writing data - stream in error state %d (%s)", m_status, strerror(m_status));
+        }
+        return m_status;
+    }
+
+    // sendfile() copies from the page cache straight into our fd, whether that
+    // is a file, a pipe or a socket.  Fall back to read()/write() for inputs
+    // it does not support.
+    const size_t bufsize = 64*1024;
+    char* buf = NULL;
+    size_t written = 0;
+    while (written < size) {
+        size_t toWrite = size - written;
+        ssize_t amt;
+        if (buf == NULL) {
+            amt = sendfile(m_fd, fd, NULL, toWrite);
+            if (amt < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                buf = (char*)malloc(bufsize);
+                if (buf == NULL) {
+                    m_status = ENOMEM;
+                    break;
+                }
+                continue;
+            }
+        } else {
+            amt = read(fd, buf, toWrite < bufsize ? toWrite : bufsize);
+            for (ssize_t done = 0; amt > 0 && done < amt; ) {
+                ssize_t w = write(m_fd, buf + done, amt - done);
+                if (w < 0 && errno != EINTR) {
+                    amt = -1;
+                } else if (w > 0) {
+                    done += w;
+                }
+            }
+        }
+        if (amt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            m_status = errno;
+            if (kIsDebug) ALOGD("copy returned error %d (%s)", m_status, strerror(m_status));
+            break;
+        }
+        if (amt == 0) {
+            // EOF on the input
+            break;
+        }
+        written += amt;
+    }
+    free(buf);
+
+    m_pos += written;
+    *outWritten = written;
+    return m_status;
+}
+
 void
 BackupDataWriter::SetKeyPrefix(const String8& keyPrefix)
 {
@@ -34,12 +34,29 @@
 #include <fcntl.h>
 #include <zlib.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include <cutils/log.h>
 
 namespace android {
 
 #define MAGIC0 0x70616e53 // Snap
 #define MAGIC1 0x656c6946 // File
+#define MAGIC2 0x6e616353 // Scan
+
+/*
+ * Snapshots written by back_up_files() end with this record, which is
+ * counted in SnapshotHeader.totalSize.  It holds the time at which the scan
+ * that wrote the snapshot started, which can't be kept in the file's mtime:
+ * BackupHelperDispatcher writes the chunk header, and the next helper its
+ * own snapshot, to the same file afterwards.
+ */
+struct SnapshotScanTime {
+    int magic;
+    int scanStart;
+};
 
 /*
  * File entity data format (v1):
@@ -84,7 +101,7 @@ round_up(int n)
 }
 
 static int
-read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
+read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot, time_t* outScanStart = NULL)
 {
     int bytesRead = 0;
     int amt;
@@ -131,6 +148,19 @@ read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
         }
     }
 
+    if (header.totalSize - bytesRead == (int)sizeof(SnapshotScanTime)) {
+        SnapshotScanTime scanTime;
+        amt = read(fd, &scanTime, sizeof(scanTime));
+        if (amt != sizeof(scanTime) || scanTime.magic != MAGIC2) {
+            ALOGW("read_snapshot_file bad scan time record with read at %d bytes\n", bytesRead);
+            return 1;
+        }
+        bytesRead += amt;
+        if (outScanStart != NULL) {
+            *outScanStart = scanTime.scanStart;
+        }
+    }
+
     if (header.totalSize != bytesRead) {
         ALOGW("read_snapshot_file length mismatch: header.totalSize=%d bytesRead=%d\n",
                 header.totalSize, bytesRead);
@@ -141,10 +171,13 @@ read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
 }
 
 static int
-write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
+write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot, time_t scanStart = 0)
 {
     int fileCount = 0;
     int bytesWritten = sizeof(SnapshotHeader);
+    if (scanStart != 0) {
+        bytesWritten += sizeof(SnapshotScanTime);
+    }
     // preflight size
     const int N = snapshot.size();
     for (int i=0; i<N; i++) {
@@ -198,6 +231,15 @@ write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
         }
     }
 
+    if (scanStart != 0) {
+        SnapshotScanTime scanTime = { MAGIC2, (int)scanStart };
+        amt = write(fd, &scanTime, sizeof(scanTime));
+        if (amt != sizeof(scanTime)) {
+            ALOGW("write_snapshot_file error writing scan time %s", strerror(errno));
+            return 1;
+        }
+    }
+
     return 0;
 }
 
@@ -305,31 +347,106 @@ write_update_file(BackupDataWriter* dataStream, const String8& key, char const*
 }
 
 static int
-compute_crc32(const char* file, FileRec* out) {
+compute_crc32(const char* file, FileRec* out, char* buf, int bufsize) {
     int fd = open(file, O_RDONLY);
     if (fd < 0) {
         return -1;
     }
 
-    const int bufsize = 4*1024;
     int amt;
-
-    char* buf = (char*)malloc(bufsize);
     int crc = crc32(0L, Z_NULL, 0);
 
-    lseek(fd, 0, SEEK_SET);
-
-    while ((amt = read(fd, buf, bufsize)) != 0) {
+    while ((amt = read(fd, buf, bufsize)) > 0) {
         crc = crc32(crc, (Bytef*)buf, amt);
     }
 
     close(fd);
-    free(buf);
+    if (amt < 0) {
+        return -1;
+    }
 
     out->s.crc32 = crc;
     return NO_ERROR;
 }
 
+// Files are scanned by up to this many threads, each taking at least
+// SCAN_FILES_PER_THREAD files.
+const static int MAX_SCAN_THREADS = 4;
+const static int SCAN_FILES_PER_THREAD = 32;
+const static int SCAN_BUFFER_SIZE = 64*1024;
+
+enum {
+    SCAN_OK,
+    SCAN_MISSING,
+    SCAN_UNREADABLE
+};
+
+struct ScanResult {
+    FileRec r;
+    int status;
+};
+
+struct BackupScan {
+    char const* const* files;
+    char const* const* keys;
+    int fileCount;
+    const KeyedVector<String8,FileState>* oldSnapshot;
+    // When the scan that wrote the old snapshot started; see back_up_files().
+    time_t snapshotTime;
+    std::atomic<int> next;
+    ScanResult* results;
+};
+
+static void
+scan_file(const BackupScan* scan, char const* key, char const* file, ScanResult* out, char* buf)
+{
+    FileRec& r = out->r;
+    r.file = file;
+    struct stat st;
+
+    if (stat(file, &st) != 0) {
+        // not found => treat as deleted
+        out->status = SCAN_MISSING;
+        return;
+    }
+    r.deleted = false;
+    r.s.modTime_sec = st.st_mtime;
+    r.s.modTime_nsec = 0; // workaround sim breakage
+    //r.s.modTime_nsec = st.st_mtime_nsec;
+    r.s.mode = st.st_mode;
+    r.s.size = st.st_size;
+
+    // Reuse the old CRC if the file looks untouched since the old snapshot.
+    // That is only safe for a file last modified before the previous scan
+    // started: a write after that would have moved its mtime past the one
+    // recorded.  The extra second allows for filesystems that keep mtimes
+    // in two-second units.
+    ssize_t old = scan->oldSnapshot->indexOfKey(String8(key));
+    if (old >= 0 && st.st_mtime < scan->snapshotTime - 1) {
+        const FileState& f = scan->oldSnapshot->valueAt(old);
+        if (f.modTime_sec == r.s.modTime_sec && f.mode == r.s.mode && f.size == r.s.size) {
+            r.s.crc32 = f.crc32;
+            out->status = SCAN_OK;
+            return;
+        }
+    }
+
+    // compute the CRC
+    out->status = compute_crc32(file, &r, buf, SCAN_BUFFER_SIZE) == NO_ERROR
+            ? SCAN_OK : SCAN_UNREADABLE;
+}
+
+static void
+scan_files(BackupScan* scan)
+{
+    char* buf = (char*)malloc(SCAN_BUFFER_SIZE);
+    int i;
+    while ((i = scan->next++) < scan->fileCount) {
+        scan_file(scan, scan->keys[i], scan->files[i], &scan->results[i], buf);
+    }
+    free(buf);
+}
+
 int
 back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD,
         char const* const* files, char const* const* keys, int fileCount)
@@ -337,47 +454,64 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
     int err;
     KeyedVector<String8,FileState> oldSnapshot;
     KeyedVector<String8,FileRec> newSnapshot;
+    time_t snapshotTime = 0;
+    const time_t scanStart = time(NULL);
 
     if (oldSnapshotFD != -1) {
-        err = read_snapshot_file(oldSnapshotFD, &oldSnapshot);
+        // Snapshots without a scan time never have their CRCs reused.
+        err = read_snapshot_file(oldSnapshotFD, &oldSnapshot, &snapshotTime);
         if (err != 0) {
             // On an error, treat this as a full backup.
             oldSnapshot.clear();
+            snapshotTime = 0;
         }
     }
 
+    // Stat and checksum the files on a few threads.  Each result has its own
+    // slot, so the new snapshot is built in the same order as before.
+    ScanResult* results = new ScanResult[fileCount > 0 ? fileCount : 1];
+    BackupScan scan;
+    scan.files = files;
+    scan.keys = keys;
+    scan.fileCount = fileCount;
+    scan.oldSnapshot = &oldSnapshot;
+    scan.snapshotTime = snapshotTime;
+    scan.next = 0;
+    scan.results = results;
+
+    int threadCount = fileCount / SCAN_FILES_PER_THREAD;
+    if (threadCount > MAX_SCAN_THREADS) {
+        threadCount = MAX_SCAN_THREADS;
+    }
+    std::vector<std::thread> threads;
+    for (int t=1; t<threadCount; t++) {
+        threads.push_back(std::thread(scan_files, &scan));
+    }
+    scan_files(&scan);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
     for (int i=0; i<fileCount; i++) {
+        ScanResult& result = results[i];
+        if (result.status == SCAN_MISSING) {
+            continue;
+        }
+
         String8 key(keys[i]);
-        FileRec r;
-        char const* file = files[i];
-        r.file = file;
-        struct stat st;
+        if (newSnapshot.indexOfKey(key) >= 0) {
+            LOGP("back_up_files key already in use '%s'", key.string());
+            delete[] results;
+            return -1;
+        }
 
-        err = stat(file, &st);
-        if (err != 0) {
-            // not found => treat as deleted
+        if (result.status == SCAN_UNREADABLE) {
+            ALOGW("Unable to open file %s", files[i]);
             continue;
-        } else {
-            r.deleted = false;
-            r.s.modTime_sec = st.st_mtime;
-            r.s.modTime_nsec = 0; // workaround sim breakage
-            //r.s.modTime_nsec = st.st_mtime_nsec;
-            r.s.mode = st.st_mode;
-            r.s.size = st.st_size;
-
-            if (newSnapshot.indexOfKey(key) >= 0) {
-                LOGP("back_up_files key already in use '%s'", key.string());
-                return -1;
-            }
-
-            // compute the CRC
-            if (compute_crc32(file, &r) != NO_ERROR) {
-                ALOGW("Unable to open file %s", file);
-                continue;
-            }
         }
-        newSnapshot.add(key, r);
+        newSnapshot.add(key, result.r);
     }
+    delete[] results;
 
     int n = 0;
     int N = oldSnapshot.size();
@@ -437,7 +571,7 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
         m++;
     }
 
-    err = write_snapshot_file(newSnapshotFD, newSnapshot);
+    err = write_snapshot_file(newSnapshotFD, newSnapshot, scanStart);
 
     return 0;
 }
@@ -538,7 +672,6 @@ int write_tarfile(const String8& packageName, const String8& domain,
     // Measure case: we've returned the size; now return without moving data
     if (!writer) return 0;
 
-    // !!! TODO: use mmap when possible to avoid churning the buffer cache
     // !!! TODO: this will break with symlinks; need to use readlink(2)
     int fd = open(filepath.string(), O_RDONLY);
     if (fd < 0) {
@@ -547,11 +680,14 @@ int write_tarfile(const String8& packageName, const String8& domain,
         return err;
     }
 
-    // read/write up to this much at a time.
+    // scratch space for the headers, and for padding.
     const size_t BUFSIZE = 32 * 1024;
+    // file data is sent in chunks of up to this size; a multiple of 512 bytes.
+    const size_t DATA_CHUNK_SIZE = 1024 * 1024;
     char* buf = (char *)calloc(1,BUFSIZE);
     char* paxHeader = buf + 512;    // use a different chunk of it as separate scratch
     char* paxData = buf + 1024;
+    size_t headerLen = 0;           // bytes of pax header and data before the ustar block
 
     if (buf == NULL) {
         ALOGE("Out of mem allocating transfer buffer");
@@ -661,52 +797,58 @@ int write_tarfile(const String8& packageName, const String8& domain,
         memset(paxHeader + 124, 0, 12);
         snprintf(paxHeader + 124, 12, "%011o", (unsigned int)(p - paxData));
 
-        // Checksum and write the pax block header
+        // Checksum the pax block header; the pax data already follows it
         calc_tar_checksum(paxHeader);
-        send_tarfile_chunk(writer, paxHeader, 512);
-
-        // Now write the pax data itself
         int paxblocks = (paxLen + 511) / 512;
-        send_tarfile_chunk(writer, paxData, 512 * paxblocks);
+        headerLen = 512 + 512 * paxblocks;
     }
 
-    // Checksum and write the 512-byte ustar file header block to the output
+    // Checksum the 512-byte ustar file header block and write all headers to the
+    // output as a single chunk: with a pax header, the ustar block follows the
+    // pax data in the scratch area.
     calc_tar_checksum(buf);
-    send_tarfile_chunk(writer, buf, 512);
+    memcpy(paxHeader + headerLen, buf, 512);
+    send_tarfile_chunk(writer, paxHeader, headerLen + 512);
 
-    // Now write the file data itself, for real files.  We honor tar's convention that
-    // only full 512-byte blocks are sent to write().
+    // Now write the file data itself, for real files, in large chunks that the writer
+    // copies straight from the file.  We honor tar's convention that only full 512-byte
+    // blocks are sent to write(), so the end of the data is NUL-padded.
     if (!isdir) {
+        memset(buf, 0, BUFSIZE);
         off64_t toWrite = s.st_size;
+        bool shortRead = false;
         while (toWrite > 0) {
-            size_t toRead = toWrite;
-            if (toRead > BUFSIZE) {
-                toRead = BUFSIZE;
-            }
-            ssize_t nRead = read(fd, buf, toRead);
-            if (nRead < 0) {
-                err = errno;
-                ALOGE("Unable to read file [%s], err=%d (%s)", filepath.string(),
-                        err, strerror(err));
-                break;
-            } else if (nRead == 0) {
-                ALOGE("EOF but expect %lld more bytes in [%s]", (long long) toWrite,
-                        filepath.string());
-                err = EIO;
-                break;
+            size_t toSend = toWrite > (off64_t) DATA_CHUNK_SIZE ? DATA_CHUNK_SIZE : toWrite;
+            size_t chunkSize = 512 * ((toSend + 511) / 512);
+            uint32_t chunk_size_no = htonl(chunkSize);
+            writer->WriteEntityData(&chunk_size_no, 4);
+
+            size_t sent = 0;
+            if (!shortRead) {
+                status_t werr = writer->WriteEntityDataFromFd(fd, toSend, &sent);
+                if (werr != NO_ERROR) {
+                    err = werr;
+                    ALOGE("Unable to send file [%s], err=%d (%s)", filepath.string(),
+                            err, strerror(err));
+                    break;
+                }
+                if (sent < toSend) {
+                    ALOGE("EOF but expect %lld more bytes in [%s]",
+                            (long long) (toWrite - sent), filepath.string());
+                    err = EIO;
+                    shortRead = true;
+                }
             }
 
-            // At EOF we might have a short block; NUL-pad that to a 512-byte multiple.  This
-            // depends on the OS guarantee that for ordinary files, read() will never return
-            // less than the number of bytes requested.
-            ssize_t partial = (nRead+512) % 512;
-            if (partial > 0) {
-                ssize_t remainder = 512 - partial;
-                memset(buf + nRead, 0, remainder);
-                nRead += remainder;
+            // Fill the rest of the chunk.  Once the file has come up short every
+            // later chunk is all padding, so that the stream still carries as much
+            // data as the header promised and stays well formed.
+            for (size_t pad = chunkSize - sent; pad > 0; ) {
+                size_t n = pad < BUFSIZE ? pad : BUFSIZE;
+                writer->WriteEntityData(buf, n);
+                pad -= n;
             }
-            send_tarfile_chunk(writer, buf, nRead);
-            toWrite -= nRead;
+            toWrite -= toSend;
         }
     }
 
@@ -28,20 +28,31 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
 namespace android {
 
 CursorWindow::CursorWindow(const String8& name, int ashmemFd,
-        void* data, size_t size, bool readOnly) :
-        mName(name), mAshmemFd(ashmemFd), mData(data), mSize(size), mReadOnly(readOnly) {
+        void* data, size_t size, size_t maxSize, bool readOnly) :
+        mName(name), mData(data), mSegmentSize(size), mSize(size), mMaxSize(maxSize),
+        mReadOnly(readOnly), mIndexUsable(true) {
+    Segment segment = { ashmemFd, data };
+    mSegments.push_back(segment);
     mHeader = static_cast<Header*>(mData);
 }
 
 CursorWindow::~CursorWindow() {
-    ::munmap(mData, mSize);
-    ::close(mAshmemFd);
+    for (const Segment& segment : mSegments) {
+        ::munmap(segment.data, mSegmentSize);
+        ::close(segment.ashmemFd);
+    }
 }
 
-status_t CursorWindow::create(const String8& name, size_t size, CursorWindow** outCursorWindow) {
+/*
+ * Creates and maps a writable ashmem region, which other processes can
+ * only map read-only.
+ */
+static status_t createSegment(const String8& name, size_t size, int* outFd, void** outData) {
     String8 ashmemName("CursorWindow: ");
     ashmemName.append(name);
 
@@ -58,64 +69,147 @@ status_t CursorWindow::create(const String8& name, size_t size, CursorWindow** o
             } else {
                 result = ashmem_set_prot_region(ashmemFd, PROT_READ);
                 if (result >= 0) {
-                    CursorWindow* window = new CursorWindow(name, ashmemFd,
-                            data, size, false /*readOnly*/);
-                    result = window->clear();
-                    if (!result) {
-                        LOG_WINDOW("Created new CursorWindow: freeOffset=%d, "
-                                "numRows=%d, numColumns=%d, mSize=%d, mData=%p",
-                                window->mHeader->freeOffset,
-                                window->mHeader->numRows,
-                                window->mHeader->numColumns,
-                                window->mSize, window->mData);
-                        *outCursorWindow = window;
-                        return OK;
-                    }
-                    delete window;
+                    *outFd = ashmemFd;
+                    *outData = data;
+                    return OK;
                 }
+                ::munmap(data, size);
             }
-            ::munmap(data, size);
         }
         ::close(ashmemFd);
     }
+    return result;
+}
+
+status_t CursorWindow::create(const String8& name, size_t size, CursorWindow** outCursorWindow) {
+    return create(name, size, size, outCursorWindow);
+}
+
+status_t CursorWindow::create(const String8& name, size_t size, size_t maxSize,
+        CursorWindow** outCursorWindow) {
+    int ashmemFd;
+    void* data;
+    status_t result = createSegment(name, size, &ashmemFd, &data);
+    if (result == OK) {
+        CursorWindow* window = new CursorWindow(name, ashmemFd,
+                data, size, std::max(size, maxSize), false /*readOnly*/);
+        result = window->clear();
+        if (!result) {
+            LOG_WINDOW("Created new CursorWindow: freeOffset=%d, "
+                    "numRows=%d, numColumns=%d, mSize=%d, mMaxSize=%d, mData=%p",
+                    window->mHeader->freeOffset,
+                    window->mHeader->numRows,
+                    window->mHeader->numColumns,
+                    window->mSize, window->mMaxSize, window->mData);
+            *outCursorWindow = window;
+            return OK;
+        }
+        delete window;
+    }
     *outCursorWindow = NULL;
     return result;
 }
 
-status_t CursorWindow::createFromParcel(Parcel* parcel, CursorWindow** outCursorWindow) {
-    String8 name = parcel->readString8();
+status_t CursorWindow::addSegment() {
+    int ashmemFd;
+    void* data;
+    status_t result = createSegment(mName, mSegmentSize, &ashmemFd, &data);
+    if (result == OK) {
+        Segment segment = { ashmemFd, data };
+        mSegments.push_back(segment);
+        mSize += mSegmentSize;
+        LOG_WINDOW("Added segment %zu to CursorWindow: mSize=%zu",
+                mSegments.size() - 1, mSize);
+    }
+    return result;
+}
 
-    status_t result;
+/*
+ * Duplicates and maps read-only the next ashmem region in a parcel.
+ */
+static status_t readSegment(Parcel* parcel, int* outFd, void** outData, size_t* outSize) {
     int ashmemFd = parcel->readFileDescriptor();
     if (ashmemFd == int(BAD_TYPE)) {
-        result = BAD_TYPE;
-    } else {
-        ssize_t size = ashmem_get_size_region(ashmemFd);
-        if (size < 0) {
-            result = UNKNOWN_ERROR;
-        } else {
-            int dupAshmemFd = ::dup(ashmemFd);
-            if (dupAshmemFd < 0) {
-                result = -errno;
-            } else {
-                void* data = ::mmap(NULL, size, PROT_READ, MAP_SHARED, dupAshmemFd, 0);
-                if (data == MAP_FAILED) {
-                    result = -errno;
-                } else {
-                    CursorWindow* window = new CursorWindow(name, dupAshmemFd,
-                            data, size, true /*readOnly*/);
-                    LOG_WINDOW("Created CursorWindow from parcel: freeOffset=%d, "
-                            "numRows=%d, numColumns=%d, mSize=%d, mData=%p",
-                            window->mHeader->freeOffset,
-                            window->mHeader->numRows,
-                            window->mHeader->numColumns,
-                            window->mSize, window->mData);
-                    *outCursorWindow = window;
-                    return OK;
-                }
-                ::close(dupAshmemFd);
+        return BAD_TYPE;
+    }
+
+    ssize_t size = ashmem_get_size_region(ashmemFd);
+    if (size < 0) {
+        return UNKNOWN_ERROR;
+    }
+
+    int dupAshmemFd = ::dup(ashmemFd);
+    if (dupAshmemFd < 0) {
+        return -errno;
+    }
+
+    void* data = ::mmap(NULL, size, PROT_READ, MAP_SHARED, dupAshmemFd, 0);
+    if (data == MAP_FAILED) {
+        status_t result = -errno;
+        ::close(dupAshmemFd);
+        return result;
+    }
+
+    *outFd = dupAshmemFd;
+    *outData = data;
+    *outSize = size;
+    return OK;
+}
+
+status_t CursorWindow::createFromParcel(Parcel* parcel, CursorWindow** outCursorWindow) {
+    String8 name = parcel->readString8();
+    int32_t numSegments = parcel->readInt32();
+    if (numSegments <= 0 || size_t(numSegments) > MAX_SEGMENTS) {
+        ALOGE("CursorWindow in parcel has %d segments", numSegments);
+        *outCursorWindow = NULL;
+        return BAD_VALUE;
+    }
+
+    int ashmemFd;
+    void* data;
+    size_t size;
+    status_t result = readSegment(parcel, &ashmemFd, &data, &size);
+    if (result == OK && (size < sizeof(Header) || size > SIZE_MAX / numSegments)) {
+        ALOGE("CursorWindow in parcel has %d segments of %zu bytes", numSegments, size);
+        ::munmap(data, size);
+        ::close(ashmemFd);
+        result = BAD_VALUE;
+    }
+    if (result == OK) {
+        CursorWindow* window = new CursorWindow(name, ashmemFd,
+                data, size, size * numSegments, true /*readOnly*/);
+        for (int32_t i = 1; result == OK && i < numSegments; i++) {
+            size_t segmentSize;
+            result = readSegment(parcel, &ashmemFd, &data, &segmentSize);
+            if (result == OK && segmentSize != size) {
+                // Offsets into the window would not line up with the segments.
+                ::munmap(data, segmentSize);
+                ::close(ashmemFd);
+                result = BAD_VALUE;
+            }
+            if (result == OK) {
+                Segment segment = { ashmemFd, data };
+                window->mSegments.push_back(segment);
+                window->mSize += size;
             }
         }
+
+        if (result == OK) {
+            window->mIndexUsable = window->isIndexUsable();
+            if (!window->mIndexUsable) {
+                ALOGW("Ignoring the chunk index of CursorWindow '%s', which doesn't "
+                        "fit in the window", name.string());
+            }
+            LOG_WINDOW("Created CursorWindow from parcel: freeOffset=%d, "
+                    "numRows=%d, numColumns=%d, mSize=%d, mData=%p",
+                    window->mHeader->freeOffset,
+                    window->mHeader->numRows,
+                    window->mHeader->numColumns,
+                    window->mSize, window->mData);
+            *outCursorWindow = window;
+            return OK;
+        }
+        delete window;
     }
     *outCursorWindow = NULL;
     return result;
@@ -124,7 +218,10 @@ status_t CursorWindow::createFromParcel(Parcel* parcel, CursorWindow** outCursor
 status_t CursorWindow::writeToParcel(Parcel* parcel) {
     status_t status = parcel->writeString8(mName);
     if (!status) {
-        status = parcel->writeDupFileDescriptor(mAshmemFd);
+        status = parcel->writeInt32(mSegments.size());
+    }
+    for (size_t i = 0; !status && i < mSegments.size(); i++) {
+        status = parcel->writeDupFileDescriptor(mSegments[i].ashmemFd);
     }
     return status;
 }
@@ -134,11 +231,38 @@ status_t CursorWindow::clear() {
         return INVALID_OPERATION;
     }
 
-    mHeader->freeOffset = sizeof(Header) + sizeof(RowSlotChunk);
-    mHeader->firstChunkOffset = sizeof(Header);
+    // Every row has at least one field, so this is enough to index all the
+    // chunks that can fit in the window once it has grown to its maximum size.
+    // The table has to fit in the first segment along with the first chunk.
+    const size_t minChunkSpace = sizeof(RowSlotChunk)
+            + ROW_SLOT_CHUNK_NUM_ROWS * sizeof(FieldSlot);
+    uint32_t chunkTableCapacity = mMaxSize / minChunkSpace + 1;
+    uint32_t chunkTableOffset = sizeof(Header) + sizeof(IndexHeader);
+    uint32_t firstChunkOffset = chunkTableOffset + chunkTableCapacity * sizeof(uint32_t);
+    if (firstChunkOffset + sizeof(RowSlotChunk) > mSegmentSize) {
+        chunkTableCapacity = mSegmentSize / minChunkSpace + 1;
+        firstChunkOffset = chunkTableOffset + chunkTableCapacity * sizeof(uint32_t);
+    }
+    if (firstChunkOffset + sizeof(RowSlotChunk) > mSegmentSize) {
+        // Too small to be worth indexing.
+        firstChunkOffset = sizeof(Header);
+    }
+
+    mHeader->freeOffset = firstChunkOffset + sizeof(RowSlotChunk);
+    mHeader->firstChunkOffset = firstChunkOffset;
     mHeader->numRows = 0;
     mHeader->numColumns = 0;
 
+    if (firstChunkOffset != sizeof(Header)) {
+        IndexHeader* index = static_cast<IndexHeader*>(offsetToPtr(sizeof(Header)));
+        index->magic = INDEX_MAGIC;
+        index->version = INDEX_VERSION;
+        index->chunkTableOffset = chunkTableOffset;
+        index->chunkTableCapacity = chunkTableCapacity;
+        index->numChunks = 1;
+        static_cast<uint32_t*>(offsetToPtr(chunkTableOffset))[0] = firstChunkOffset;
+    }
+
     RowSlotChunk* firstChunk = static_cast<RowSlotChunk*>(offsetToPtr(mHeader->firstChunkOffset));
     firstChunk->nextChunkOffset = 0;
     return OK;
@@ -159,6 +283,11 @@ status_t CursorWindow::setNumColumns(uint32_t numColumns) {
 }
 
 status_t CursorWindow::allocRow() {
+    FieldSlot* fieldDir;
+    return allocRow(&fieldDir);
+}
+
+status_t CursorWindow::allocRow(FieldSlot** outFieldDir) {
     if (mReadOnly) {
         return INVALID_OPERATION;
     }
@@ -181,9 +310,10 @@ status_t CursorWindow::allocRow() {
     FieldSlot* fieldDir = static_cast<FieldSlot*>(offsetToPtr(fieldDirOffset));
     memset(fieldDir, 0, fieldDirSize);
 
-    LOG_WINDOW("Allocated row %u, rowSlot is at offset %u, fieldDir is %d bytes at offset %u\n",
-            mHeader->numRows - 1, offsetFromPtr(rowSlot), fieldDirSize, fieldDirOffset);
+    LOG_WINDOW("Allocated row %u, fieldDir is %d bytes at offset %u\n",
+            mHeader->numRows - 1, fieldDirSize, fieldDirOffset);
     rowSlot->offset = fieldDirOffset;
+    *outFieldDir = fieldDir;
     return OK;
 }
 
@@ -199,6 +329,12 @@ status_t CursorWindow::freeLastRow() {
 }
 
 uint32_t CursorWindow::alloc(size_t size, bool aligned) {
+    if (size == 0) {
+        // Nothing will be stored, so any offset inside the first segment will
+        // do, and there's no need to map a new segment for it.
+        return sizeof(Header);
+    }
+
     uint32_t padding;
     if (aligned) {
         // 4 byte alignment
@@ -208,50 +344,137 @@ uint32_t CursorWindow::alloc(size_t size, bool aligned) {
     }
 
     uint32_t offset = mHeader->freeOffset + padding;
-    uint32_t nextFreeOffset = offset + size;
-    if (nextFreeOffset > mSize) {
+    size_t segment = offset / mSegmentSize;
+    if (size > mSegmentSize - offset % mSegmentSize) {
+        // Allocations never straddle two segments, so start the next one.
+        segment += 1;
+        offset = segment * mSegmentSize;
+        if (aligned) {
+            offset += (~offset + 1) & 3;
+        }
+    }
+
+    if (size > mSegmentSize - offset % mSegmentSize
+            || (segment >= mSegments.size()
+                    && (segment >= MAX_SEGMENTS || (segment + 1) * mSegmentSize > mMaxSize
+                            || addSegment() != OK))) {
         ALOGW("Window is full: requested allocation %zu bytes, "
                 "free space %zu bytes, window size %zu bytes",
                 size, freeSpace(), mSize);
         return 0;
     }
 
+    uint32_t nextFreeOffset = offset + size;
+
     mHeader->freeOffset = nextFreeOffset;
     return offset;
 }
 
+CursorWindow::IndexHeader* CursorWindow::getIndex() {
+    if (!mIndexUsable || mHeader->firstChunkOffset < sizeof(Header) + sizeof(IndexHeader)) {
+        return NULL;
+    }
+    IndexHeader* index = static_cast<IndexHeader*>(
+            offsetToPtr(sizeof(Header), sizeof(IndexHeader)));
+    if (index == NULL || index->magic != INDEX_MAGIC || index->version != INDEX_VERSION) {
+        return NULL;
+    }
+    return index;
+}
+
+bool CursorWindow::isIndexUsable() {
+    const IndexHeader* index = getIndex();
+    if (index == NULL) {
+        return true;
+    }
+    return index->numChunks > 0 && index->chunkTableCapacity > 0
+            && index->chunkTableCapacity <= mSize / sizeof(uint32_t)
+            && offsetToPtr(index->chunkTableOffset,
+                    index->chunkTableCapacity * sizeof(uint32_t)) != NULL;
+}
+
+CursorWindow::RowSlotChunk* CursorWindow::getChunk(IndexHeader* index, uint32_t chunk) {
+    uint32_t chunkIndex = 0;
+    uint32_t chunkOffset = mHeader->firstChunkOffset;
+    uint32_t numIndexed = index != NULL
+            ? std::min(index->numChunks, index->chunkTableCapacity) : 0;
+    if (numIndexed > 0) {
+        // Start from the closest chunk in the table. Each entry is looked up
+        // on its own, since the table may have changed since it was checked.
+        chunkIndex = std::min(chunk, numIndexed - 1);
+        const uint32_t* entry = static_cast<uint32_t*>(offsetToPtr(
+                index->chunkTableOffset + chunkIndex * sizeof(uint32_t), sizeof(uint32_t)));
+        if (entry != NULL) {
+            chunkOffset = *entry;
+        } else {
+            chunkIndex = 0;
+        }
+    }
+
+    RowSlotChunk* rowSlotChunk = static_cast<RowSlotChunk*>(
+            offsetToPtr(chunkOffset, sizeof(RowSlotChunk)));
+    while (rowSlotChunk != NULL && chunkIndex < chunk) {
+        rowSlotChunk = static_cast<RowSlotChunk*>(
+                offsetToPtr(rowSlotChunk->nextChunkOffset, sizeof(RowSlotChunk)));
+        chunkIndex++;
+    }
+    return rowSlotChunk;
+}
+
 CursorWindow::RowSlot* CursorWindow::getRowSlot(uint32_t row) {
-    uint32_t chunkPos = row;
-    RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
-            offsetToPtr(mHeader->firstChunkOffset));
-    while (chunkPos >= ROW_SLOT_CHUNK_NUM_ROWS) {
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
-        chunkPos -= ROW_SLOT_CHUNK_NUM_ROWS;
+    RowSlotChunk* chunk = getChunk(getIndex(), row / ROW_SLOT_CHUNK_NUM_ROWS);
+    if (chunk == NULL) {
+        return NULL;
     }
-    return &chunk->slots[chunkPos];
+    return &chunk->slots[row % ROW_SLOT_CHUNK_NUM_ROWS];
 }
 
 CursorWindow::RowSlot* CursorWindow::allocRowSlot() {
-    uint32_t chunkPos = mHeader->numRows;
-    RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
-            offsetToPtr(mHeader->firstChunkOffset));
-    while (chunkPos > ROW_SLOT_CHUNK_NUM_ROWS) {
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
-        chunkPos -= ROW_SLOT_CHUNK_NUM_ROWS;
-    }
-    if (chunkPos == ROW_SLOT_CHUNK_NUM_ROWS) {
-        if (!chunk->nextChunkOffset) {
-            chunk->nextChunkOffset = alloc(sizeof(RowSlotChunk), true /*aligned*/);
+    IndexHeader* index = getIndex();
+    if (index == NULL) {
+        uint32_t chunkPos = mHeader->numRows;
+        RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
+                offsetToPtr(mHeader->firstChunkOffset));
+        while (chunkPos > ROW_SLOT_CHUNK_NUM_ROWS) {
+            chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
+            chunkPos -= ROW_SLOT_CHUNK_NUM_ROWS;
+        }
+        if (chunkPos == ROW_SLOT_CHUNK_NUM_ROWS) {
             if (!chunk->nextChunkOffset) {
-                return NULL;
+                chunk->nextChunkOffset = alloc(sizeof(RowSlotChunk), true /*aligned*/);
+                if (!chunk->nextChunkOffset) {
+                    return NULL;
+                }
             }
+            chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
+            chunk->nextChunkOffset = 0;
+            chunkPos = 0;
+        }
+        mHeader->numRows += 1;
+        return &chunk->slots[chunkPos];
+    }
+
+    uint32_t chunkIndex = mHeader->numRows / ROW_SLOT_CHUNK_NUM_ROWS;
+    if (chunkIndex >= index->numChunks) {
+        // Chunks left behind by freeLastRow() are reused, so this is
+        // always the chunk right after the last one.
+        uint32_t chunkOffset = alloc(sizeof(RowSlotChunk), true /*aligned*/);
+        if (!chunkOffset) {
+            return NULL;
         }
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
+        RowSlotChunk* chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunkOffset));
         chunk->nextChunkOffset = 0;
-        chunkPos = 0;
+        getChunk(index, chunkIndex - 1)->nextChunkOffset = chunkOffset;
+        if (chunkIndex < index->chunkTableCapacity) {
+            static_cast<uint32_t*>(offsetToPtr(index->chunkTableOffset))[chunkIndex] =
+                    chunkOffset;
+        }
+        index->numChunks += 1;
     }
+
+    RowSlotChunk* chunk = getChunk(index, chunkIndex);
     mHeader->numRows += 1;
-    return &chunk->slots[chunkPos];
+    return &chunk->slots[(mHeader->numRows - 1) % ROW_SLOT_CHUNK_NUM_ROWS];
 }
 
 CursorWindow::FieldSlot* CursorWindow::getFieldSlot(uint32_t row, uint32_t column) {
@@ -266,7 +489,17 @@ CursorWindow::FieldSlot* CursorWindow::getFieldSlot(uint32_t row, uint32_t colum
         ALOGE("Failed to find rowSlot for row %d.", row);
         return NULL;
     }
-    FieldSlot* fieldDir = static_cast<FieldSlot*>(offsetToPtr(rowSlot->offset));
+    // Checking the size of the directory up to this column is enough, and
+    // can't overflow once the column is known to be within the window.
+    FieldSlot* fieldDir = NULL;
+    if (column < mSize / sizeof(FieldSlot)) {
+        fieldDir = static_cast<FieldSlot*>(
+                offsetToPtr(rowSlot->offset, (column + 1) * sizeof(FieldSlot)));
+    }
+    if (!fieldDir) {
+        ALOGE("Failed to find field directory for row %d.", row);
+        return NULL;
+    }
     return &fieldDir[column];
 }
 
@@ -289,7 +522,11 @@ status_t CursorWindow::putBlobOrString(uint32_t row, uint32_t column,
     if (!fieldSlot) {
         return BAD_VALUE;
     }
+    return putBlobOrString(fieldSlot, value, size, type);
+}
 
+status_t CursorWindow::putBlobOrString(FieldSlot* fieldSlot,
+        const void* value, size_t size, int32_t type) {
     uint32_t offset = alloc(size);
     if (!offset) {
         return NO_MEMORY;
@@ -313,8 +550,7 @@ status_t CursorWindow::putLong(uint32_t row, uint32_t column, int64_t value) {
         return BAD_VALUE;
     }
 
-    fieldSlot->type = FIELD_TYPE_INTEGER;
-    fieldSlot->data.l = value;
+    putLong(fieldSlot, value);
     return OK;
 }
 
@@ -328,8 +564,7 @@ status_t CursorWindow::putDouble(uint32_t row, uint32_t column, double value) {
         return BAD_VALUE;
     }
 
-    fieldSlot->type = FIELD_TYPE_FLOAT;
-    fieldSlot->data.d = value;
+    putDouble(fieldSlot, value);
     return OK;
 }
 
@@ -343,10 +578,33 @@ status_t CursorWindow::putNull(uint32_t row, uint32_t column) {
         return BAD_VALUE;
     }
 
+    putNull(fieldSlot);
+    return OK;
+}
+
+status_t CursorWindow::putBlob(FieldSlot* fieldSlot, const void* value, size_t size) {
+    return putBlobOrString(fieldSlot, value, size, FIELD_TYPE_BLOB);
+}
+
+status_t CursorWindow::putString(FieldSlot* fieldSlot, const char* value,
+        size_t sizeIncludingNull) {
+    return putBlobOrString(fieldSlot, value, sizeIncludingNull, FIELD_TYPE_STRING);
+}
+
+void CursorWindow::putLong(FieldSlot* fieldSlot, int64_t value) {
+    fieldSlot->type = FIELD_TYPE_INTEGER;
+    fieldSlot->data.l = value;
+}
+
+void CursorWindow::putDouble(FieldSlot* fieldSlot, double value) {
+    fieldSlot->type = FIELD_TYPE_FLOAT;
+    fieldSlot->data.d = value;
+}
+
+void CursorWindow::putNull(FieldSlot* fieldSlot) {
     fieldSlot->type = FIELD_TYPE_NULL;
     fieldSlot->data.buffer.offset = 0;
     fieldSlot->data.buffer.size = 0;
-    return OK;
 }
 
 }; // namespace android
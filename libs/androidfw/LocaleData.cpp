@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cstdlib>
@@ -239,4 +240,85 @@ bool localeDataIsCloseToUsEnglish(const char* region) {
     return stop_list_index == 0; // 'en' is first in ENGLISH_STOP_LIST
 }
 
+static inline uint16_t packRegion(const char* region) {
+    return ((uint8_t) region[0]) | (((uint8_t) region[1]) << 8u);
+}
+
+static inline size_t hashRegion(uint16_t region) {
+    return (region * 0x9E37u) >> 5u;
+}
+
+LocaleRegionMatrix::LocaleRegionMatrix() : mSlotMask(0) {
+    memset(mLanguage, 0, sizeof(mLanguage));
+    memset(mScript, 0, sizeof(mScript));
+    memset(mRegion, 0, sizeof(mRegion));
+}
+
+void LocaleRegionMatrix::build(const char* requested_language, const char* requested_script,
+                               const char* requested_region,
+                               const std::vector<uint16_t>& regions) {
+    memcpy(mLanguage, requested_language, sizeof(mLanguage));
+    memcpy(mScript, requested_script, sizeof(mScript));
+    memcpy(mRegion, requested_region, sizeof(mRegion));
+
+    mRegions = regions;
+    std::sort(mRegions.begin(), mRegions.end());
+    mRegions.erase(std::unique(mRegions.begin(), mRegions.end()), mRegions.end());
+
+    // At most half full, so probe sequences stay short.
+    const size_t count = mRegions.size();
+    size_t slotCount = 1;
+    while (slotCount < count * 2) {
+        slotCount <<= 1;
+    }
+    mSlotMask = slotCount - 1;
+    mSlotRegions.assign(slotCount, 0);
+    mSlotIndices.assign(slotCount, 0);
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = hashRegion(mRegions[i]) & mSlotMask;
+        while (mSlotIndices[slot] != 0) {
+            slot = (slot + 1) & mSlotMask;
+        }
+        mSlotRegions[slot] = mRegions[i];
+        mSlotIndices[slot] = i + 1;
+    }
+
+    // The comparison is antisymmetric, so only half of it is computed.
+    mResults.assign(count * count, 0);
+    for (size_t i = 0; i < count; i++) {
+        const char left[2] = { (char) (mRegions[i] & 0xff), (char) (mRegions[i] >> 8) };
+        for (size_t j = i + 1; j < count; j++) {
+            const char right[2] = { (char) (mRegions[j] & 0xff), (char) (mRegions[j] >> 8) };
+            const int result = localeDataCompareRegions(
+                    left, right, mLanguage, mScript, mRegion);
+            const int8_t sign = (result > 0) - (result < 0);
+            mResults[i * count + j] = sign;
+            mResults[j * count + i] = -sign;
+        }
+    }
+}
+
+ssize_t LocaleRegionMatrix::indexOf(const char* region) const {
+    if (mSlotIndices.empty()) {
+        return -1;
+    }
+    const uint16_t packed = packRegion(region);
+    for (size_t slot = hashRegion(packed) & mSlotMask; mSlotIndices[slot] != 0;
+            slot = (slot + 1) & mSlotMask) {
+        if (mSlotRegions[slot] == packed) {
+            return mSlotIndices[slot] - 1;
+        }
+    }
+    return -1;
+}
+
+int LocaleRegionMatrix::compare(const char* left_region, const char* right_region) const {
+    const ssize_t left = indexOf(left_region);
+    const ssize_t right = left >= 0 ? indexOf(right_region) : -1;
+    if (right < 0) {
+        return localeDataCompareRegions(left_region, right_region, mLanguage, mScript, mRegion);
+    }
+    return mResults[left * mRegions.size() + right];
+}
+
 } // namespace android
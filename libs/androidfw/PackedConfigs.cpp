@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/LocaleData.h>
+#include <androidfw/PackedConfigs.h>
+
+#include <string.h>
+
+namespace android {
+
+static inline uint16_t packChars(const char chars[2]) {
+    return static_cast<uint8_t>(chars[0]) | (static_cast<uint8_t>(chars[1]) << 8);
+}
+
+void PackedConfigs::add(const ResTable_config& config) {
+    mMcc.push_back(config.mcc);
+    mMnc.push_back(config.mnc);
+    mLanguage.push_back(packChars(config.language));
+    mCountry.push_back(packChars(config.country));
+
+    // Resolve the script the same way ResTable_config::match() does.
+    char script[4] = { 0, 0, 0, 0 };
+    bool countryMustMatch = false;
+    if (config.localeScript[0] == '\0' && !config.localeScriptWasComputed) {
+        localeDataComputeScript(script, config.language, config.country);
+        countryMustMatch = script[0] == '\0';
+    } else {
+        memcpy(script, config.localeScript, sizeof(script));
+    }
+    uint32_t packedScript;
+    memcpy(&packedScript, script, sizeof(packedScript));
+    mScript.push_back(packedScript);
+    mCountryMustMatch.push_back(countryMustMatch ? 1 : 0);
+
+    mSmallestScreenWidthDp.push_back(config.smallestScreenWidthDp);
+    mScreenWidthDp.push_back(config.screenWidthDp);
+    mScreenHeightDp.push_back(config.screenHeightDp);
+    mSdkVersion.push_back(config.sdkVersion);
+
+    // Density never prevents a match, so only these qualifiers are left
+    // for ResTable_config::match() to check.
+    const bool hasOtherQualifiers = config.screenLayout != 0
+            || config.uiMode != 0
+            || config.screenLayout2 != 0
+            || config.orientation != 0
+            || config.touchscreen != 0
+            || config.inputFlags != 0
+            || config.keyboard != 0
+            || config.navigation != 0
+            || config.screenWidth != 0
+            || config.screenHeight != 0
+            || config.minorVersion != 0;
+    mMatchResult.push_back(hasOtherQualifiers ? MAYBE_MATCH : MATCH);
+}
+
+void PackedConfigs::match(const ResTable_config& settings, uint8_t* outResults) const {
+    const uint16_t mcc = settings.mcc;
+    const uint16_t mnc = settings.mnc;
+    const uint16_t language = packChars(settings.language);
+    const uint16_t country = packChars(settings.country);
+    uint32_t script;
+    memcpy(&script, settings.localeScript, sizeof(script));
+    const uint8_t settingsHaveScript = settings.localeScript[0] != '\0' ? 1 : 0;
+    const uint16_t smallestScreenWidthDp = settings.smallestScreenWidthDp;
+    const uint16_t screenWidthDp = settings.screenWidthDp;
+    const uint16_t screenHeightDp = settings.screenHeightDp;
+    const uint16_t sdkVersion = settings.sdkVersion;
+
+    const uint16_t* const configMcc = mMcc.data();
+    const uint16_t* const configMnc = mMnc.data();
+    const uint16_t* const configLanguage = mLanguage.data();
+    const uint16_t* const configCountry = mCountry.data();
+    const uint32_t* const configScript = mScript.data();
+    const uint8_t* const configCountryMustMatch = mCountryMustMatch.data();
+    const uint16_t* const configSmallestScreenWidthDp = mSmallestScreenWidthDp.data();
+    const uint16_t* const configScreenWidthDp = mScreenWidthDp.data();
+    const uint16_t* const configScreenHeightDp = mScreenHeightDp.data();
+    const uint16_t* const configSdkVersion = mSdkVersion.data();
+    const uint8_t* const configMatchResult = mMatchResult.data();
+
+    // Every condition is evaluated for every candidate without branching,
+    // which keeps this loop vectorizable.
+    const size_t N = size();
+    for (size_t i = 0; i < N; i++) {
+        uint8_t ok = (configMcc[i] == 0) | (configMcc[i] == mcc);
+        ok &= (configMnc[i] == 0) | (configMnc[i] == mnc);
+
+        const uint8_t hasLocale = (configLanguage[i] | configCountry[i]) != 0;
+        const uint8_t countryMustMatch = (settingsHaveScript ^ 1) | configCountryMustMatch[i];
+        const uint8_t countryOk = ((configCountry[i] & 0xff) == 0) | (configCountry[i] == country);
+        const uint8_t scriptOk = configScript[i] == script;
+        const uint8_t localeOk = (configLanguage[i] == language)
+                & ((countryMustMatch & countryOk) | ((countryMustMatch ^ 1) & scriptOk));
+        ok &= (hasLocale ^ 1) | localeOk;
+
+        ok &= (configSmallestScreenWidthDp[i] == 0)
+                | (configSmallestScreenWidthDp[i] <= smallestScreenWidthDp);
+        ok &= (configScreenWidthDp[i] == 0) | (configScreenWidthDp[i] <= screenWidthDp);
+        ok &= (configScreenHeightDp[i] == 0) | (configScreenHeightDp[i] <= screenHeightDp);
+        ok &= (configSdkVersion[i] == 0) | (configSdkVersion[i] <= sdkVersion);
+
+        outResults[i] = ok * configMatchResult[i];
+    }
+}
+
+} // namespace android
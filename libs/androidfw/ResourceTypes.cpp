@@ -27,9 +27,13 @@
 #include <algorithm>
 #include <limits>
 #include <memory>
+#include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include <androidfw/ByteBucketArray.h>
+#include <androidfw/PackedConfigs.h>
 #include <androidfw/ResourceTypes.h>
 #include <androidfw/TypeWrappers.h>
 #include <utils/Atomic.h>
@@ -61,6 +65,9 @@ namespace android {
 #define IDMAP_MAGIC             0x504D4449
 #define IDMAP_CURRENT_VERSION   0x00000001
 
+#define INDEX_MAGIC             0x58444952
+#define INDEX_CURRENT_VERSION   0x00000001
+
 #define APP_PACKAGE_ID      0x7f
 #define SYS_PACKAGE_ID      0x01
 
@@ -256,6 +263,46 @@ static bool assertIdmapHeader(const void* idmap, size_t size) {
     return true;
 }
 
+// Checks that a chunk named by an index entry has a header of at least
+// 'minHeaderSize' bytes and lies before 'end'. That is all loading through
+// the index reads of the chunk; the rest is validated when it is used.
+static bool indexedChunkFits(const ResChunk_header* chunk, size_t minHeaderSize,
+        const uint8_t* end)
+{
+    const size_t headerSize = dtohs(chunk->headerSize);
+    const size_t size = dtohl(chunk->size);
+    return headerSize >= minHeaderSize && size >= headerSize
+            && size <= (size_t)(end - (const uint8_t*)chunk);
+}
+
+static bool assertIndexHeader(const void* index, size_t size) {
+    if (reinterpret_cast<uintptr_t>(index) & 0x03) {
+        ALOGE("index: header is not word aligned");
+        return false;
+    }
+
+    if (size < ResTable::INDEX_HEADER_SIZE_BYTES) {
+        ALOGW("index: header too small (%d bytes)", (uint32_t) size);
+        return false;
+    }
+
+    const uint32_t magic = dtohl(*reinterpret_cast<const uint32_t*>(index));
+    if (magic != INDEX_MAGIC) {
+        ALOGW("index: no magic found in header (is 0x%08x, expected 0x%08x)",
+             magic, INDEX_MAGIC);
+        return false;
+    }
+
+    const uint32_t version = dtohl(*(reinterpret_cast<const uint32_t*>(index) + 1));
+    if (version != INDEX_CURRENT_VERSION) {
+        // Like idmaps, indices are generated and simply get rebuilt.
+        ALOGW("index: version mismatch in header (is 0x%08x, expected 0x%08x)",
+                version, INDEX_CURRENT_VERSION);
+        return false;
+    }
+    return true;
+}
+
 class IdmapEntries {
 public:
     IdmapEntries() : mData(NULL) {}
@@ -417,13 +464,227 @@ Res_png_9patch* Res_png_9patch::deserialize(void* inData)
 // --------------------------------------------------------------------
 // --------------------------------------------------------------------
 
+// Strings decoded from UTF-8 are allocated from blocks of this many
+// char16_t. Blocks are also the unit of eviction when a pool is bounded.
+static const size_t kDecodeBlockChars = 2048;
+
+/**
+ * The UTF-16 copies of the strings of a UTF-8 pool that have been asked
+ * for. Guarded by the pool's mDecodeLock.
+ */
+struct ResStringPool::DecodeCache
+{
+    struct Block {
+        char16_t* data;
+        size_t capacity;
+        size_t used;
+        uint64_t lastUse;
+        // The strings that were allocated from this block, while tracking.
+        std::vector<uint32_t> indices;
+    };
+
+    // Only changed under the pool's mDecodeLock, so an update is a plain
+    // load and store rather than a locked read-modify-write; it is atomic
+    // only so that getGlobalDecodeCacheStats() can read it without taking
+    // the lock of every pool.
+    class Counter {
+    public:
+        Counter() : mValue(0) {}
+        void add(size_t n) {
+            mValue.store(mValue.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+        }
+        void sub(size_t n) {
+            mValue.store(mValue.load(std::memory_order_relaxed) - n,
+                    std::memory_order_relaxed);
+        }
+        size_t get() const { return mValue.load(std::memory_order_relaxed); }
+    private:
+        std::atomic<size_t> mValue;
+    };
+
+    explicit DecodeCache(size_t stringCount);
+    ~DecodeCache();
+
+    // Starts or stops keeping track of which block each string lives in,
+    // which is only needed to evict strings once the pool has a limit.
+    void setTracking(bool track) {
+        if (track == tracking) {
+            return;
+        }
+        tracking = track;
+        if (!track) {
+            std::vector<Block*>().swap(stringBlocks);
+            for (Block* block : blocks) {
+                std::vector<uint32_t>().swap(block->indices);
+            }
+            return;
+        }
+
+        // Find the block of each string decoded so far.
+        std::vector<Block*> sorted(blocks);
+        std::sort(sorted.begin(), sorted.end(), [](const Block* a, const Block* b) {
+            return a->data < b->data;
+        });
+        stringBlocks.assign(strings.size(), NULL);
+        for (size_t idx = 0; idx < strings.size(); idx++) {
+            if (strings[idx] == NULL) {
+                continue;
+            }
+            auto iter = std::upper_bound(sorted.begin(), sorted.end(), strings[idx],
+                    [](const char16_t* str, const Block* block) {
+                        return str < block->data;
+                    });
+            Block* block = *(iter - 1);
+            block->indices.push_back(idx);
+            stringBlocks[idx] = block;
+        }
+    }
+
+    void touch(uint32_t idx) {
+        if (tracking) {
+            stringBlocks[idx]->lastUse = ++clock;
+        }
+    }
+
+    char16_t* allocate(uint32_t idx, size_t chars, size_t limit) {
+        Block* block = blocks.empty() ? NULL : blocks.back();
+        if (block == NULL || block->capacity - block->used < chars) {
+            const size_t capacity = std::max(chars, kDecodeBlockChars);
+            if (limit != 0) {
+                trim(limit > capacity * sizeof(char16_t)
+                        ? limit - capacity * sizeof(char16_t) : 0);
+            }
+
+            block = new Block();
+            block->data = (char16_t*)malloc(capacity * sizeof(char16_t));
+            if (block->data == NULL) {
+                delete block;
+                return NULL;
+            }
+            block->capacity = capacity;
+            block->used = 0;
+            blocks.push_back(block);
+            bytes.add(capacity * sizeof(char16_t));
+        }
+
+        char16_t* str = block->data + block->used;
+        block->used += chars;
+        block->lastUse = ++clock;
+        strings[idx] = str;
+        if (tracking) {
+            block->indices.push_back(idx);
+            stringBlocks[idx] = block;
+        }
+        stringCount.add(1);
+        return str;
+    }
+
+    // Drops the least recently used blocks until at most 'maxBytes' are
+    // held. Only called while tracking.
+    void trim(size_t maxBytes) {
+        while (bytes.get() > maxBytes && !blocks.empty()) {
+            size_t lru = 0;
+            for (size_t i = 1; i < blocks.size(); i++) {
+                if (blocks[i]->lastUse < blocks[lru]->lastUse) {
+                    lru = i;
+                }
+            }
+
+            Block* block = blocks[lru];
+            for (uint32_t idx : block->indices) {
+                strings[idx] = NULL;
+                stringBlocks[idx] = NULL;
+            }
+            bytes.sub(block->capacity * sizeof(char16_t));
+            stringCount.sub(block->indices.size());
+            evictions.add(block->indices.size());
+
+            free(block->data);
+            delete block;
+            blocks.erase(blocks.begin() + lru);
+        }
+    }
+
+    void getStats(DecodeCacheStats* outStats) const {
+        outStats->bytes = bytes.get();
+        outStats->strings = stringCount.get();
+        outStats->hits = hits.get();
+        outStats->misses = misses.get();
+        outStats->evictions = evictions.get();
+    }
+
+    std::vector<char16_t*> strings;
+    // The block of each string; only kept while tracking.
+    std::vector<Block*> stringBlocks;
+    std::vector<Block*> blocks;
+    uint64_t clock;
+    bool tracking;
+
+    Counter bytes;
+    Counter stringCount;
+    Counter hits;
+    Counter misses;
+    Counter evictions;
+
+    // Links in the list of live caches, guarded by sLock.
+    DecodeCache* prev;
+    DecodeCache* next;
+
+    // Every live cache, for getGlobalDecodeCacheStats(), along with the
+    // hits, misses and evictions of the ones that are gone.
+    static Mutex sLock;
+    static DecodeCache* sCaches;
+    static DecodeCacheStats sRetired;
+};
+
+Mutex ResStringPool::DecodeCache::sLock;
+ResStringPool::DecodeCache* ResStringPool::DecodeCache::sCaches = NULL;
+ResStringPool::DecodeCacheStats ResStringPool::DecodeCache::sRetired;
+
+ResStringPool::DecodeCache::DecodeCache(size_t stringCount)
+    : strings(stringCount, NULL), clock(0), tracking(false), prev(NULL)
+{
+    AutoMutex lock(sLock);
+    next = sCaches;
+    if (next != NULL) {
+        next->prev = this;
+    }
+    sCaches = this;
+}
+
+ResStringPool::DecodeCache::~DecodeCache()
+{
+    {
+        AutoMutex lock(sLock);
+        if (prev != NULL) {
+            prev->next = next;
+        } else {
+            sCaches = next;
+        }
+        if (next != NULL) {
+            next->prev = prev;
+        }
+        sRetired.hits += hits.get();
+        sRetired.misses += misses.get();
+        sRetired.evictions += evictions.get();
+    }
+
+    for (Block* block : blocks) {
+        free(block->data);
+        delete block;
+    }
+}
+
 ResStringPool::ResStringPool()
-    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mCache(NULL)
+    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mDecodeCache(NULL),
+      mDecodeCacheLimit(0)
 {
 }
 
 ResStringPool::ResStringPool(const void* data, size_t size, bool copyData)
-    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mCache(NULL)
+    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mDecodeCache(NULL),
+      mDecodeCacheLimit(0)
 {
     setTo(data, size, copyData);
 }
@@ -634,15 +895,9 @@ status_t ResStringPool::getError() const
 void ResStringPool::uninit()
 {
     mError = NO_INIT;
-    if (mHeader != NULL && mCache != NULL) {
-        for (size_t x = 0; x < mHeader->stringCount; x++) {
-            if (mCache[x] != NULL) {
-                free(mCache[x]);
-                mCache[x] = NULL;
-            }
-        }
-        free(mCache);
-        mCache = NULL;
+    if (mDecodeCache != NULL) {
+        delete mDecodeCache;
+        mDecodeCache = NULL;
     }
     if (mOwnedData) {
         free(mOwnedData);
@@ -727,58 +982,7 @@ const char16_t* ResStringPool::stringAt(size_t idx, size_t* u16len) const
                 // encLen must be less than 0x7FFF due to encoding.
                 if ((uint32_t)(u8str+u8len-strings) < mStringPoolSize) {
                     AutoMutex lock(mDecodeLock);
-
-                    if (mCache == NULL) {
-#ifndef __ANDROID__
-                        if (kDebugStringPoolNoisy) {
-                            ALOGI("CREATING STRING CACHE OF %zu bytes",
-                                    mHeader->stringCount*sizeof(char16_t**));
-                        }
-#else
-                        // We do not want to be in this case when actually running Android.
-                        ALOGW("CREATING STRING CACHE OF %zu bytes",
-                                static_cast<size_t>(mHeader->stringCount*sizeof(char16_t**)));
-#endif
-                        mCache = (char16_t**)calloc(mHeader->stringCount, sizeof(char16_t**));
-                        if (mCache == NULL) {
-                            ALOGW("No memory trying to allocate decode cache table of %d bytes\n",
-                                    (int)(mHeader->stringCount*sizeof(char16_t**)));
-                            return NULL;
-                        }
-                    }
-
-                    if (mCache[idx] != NULL) {
-                        return mCache[idx];
-                    }
-
-                    ssize_t actualLen = utf8_to_utf16_length(u8str, u8len);
-                    if (actualLen < 0 || (size_t)actualLen != *u16len) {
-                        ALOGW("Bad string block: string #%lld decoded length is not correct "
-                                "%lld vs %llu\n",
-                                (long long)idx, (long long)actualLen, (long long)*u16len);
-                        return NULL;
-                    }
-
-                    // Reject malformed (non null-terminated) strings
-                    if (u8str[u8len] != 0x00) {
-                        ALOGW("Bad string block: string #%d is not null-terminated",
-                              (int)idx);
-                        return NULL;
-                    }
-
-                    char16_t *u16str = (char16_t *)calloc(*u16len+1, sizeof(char16_t));
-                    if (!u16str) {
-                        ALOGW("No memory when trying to allocate decode cache for string #%d\n",
-                                (int)idx);
-                        return NULL;
-                    }
-
-                    if (kDebugStringPoolNoisy) {
-                        ALOGI("Caching UTF8 string: %s", u8str);
-                    }
-                    utf8_to_utf16(u8str, u8len, u16str);
-                    mCache[idx] = u16str;
-                    return u16str;
+                    return decodeStringLocked(idx, u8str, u8len, *u16len);
                 } else {
                     ALOGW("Bad string block: string #%lld extends to %lld, past end at %lld\n",
                             (long long)idx, (long long)(u8str+u8len-strings),
@@ -794,6 +998,122 @@ const char16_t* ResStringPool::stringAt(size_t idx, size_t* u16len) const
     return NULL;
 }
 
+const char16_t* ResStringPool::decodeStringLocked(size_t idx, const uint8_t* u8str,
+        size_t u8len, size_t u16len) const
+{
+    if (mDecodeCache == NULL) {
+#ifndef __ANDROID__
+        if (kDebugStringPoolNoisy) {
+            ALOGI("CREATING STRING CACHE OF %zu bytes",
+                    mHeader->stringCount*sizeof(char16_t**));
+        }
+#else
+        // We do not want to be in this case when actually running Android.
+        ALOGW("CREATING STRING CACHE OF %zu bytes",
+                static_cast<size_t>(mHeader->stringCount*sizeof(char16_t**)));
+#endif
+        mDecodeCache = new DecodeCache(mHeader->stringCount);
+        mDecodeCache->setTracking(mDecodeCacheLimit != 0);
+    }
+
+    if (mDecodeCache->strings[idx] != NULL) {
+        mDecodeCache->touch(idx);
+        mDecodeCache->hits.add(1);
+        return mDecodeCache->strings[idx];
+    }
+    mDecodeCache->misses.add(1);
+
+    ssize_t actualLen = utf8_to_utf16_length(u8str, u8len);
+    if (actualLen < 0 || (size_t)actualLen != u16len) {
+        ALOGW("Bad string block: string #%lld decoded length is not correct "
+                "%lld vs %llu\n",
+                (long long)idx, (long long)actualLen, (long long)u16len);
+        return NULL;
+    }
+
+    // Reject malformed (non null-terminated) strings
+    if (u8str[u8len] != 0x00) {
+        ALOGW("Bad string block: string #%d is not null-terminated",
+              (int)idx);
+        return NULL;
+    }
+
+    char16_t* u16str = mDecodeCache->allocate(idx, u16len+1, mDecodeCacheLimit);
+    if (!u16str) {
+        ALOGW("No memory when trying to allocate decode cache for string #%d\n",
+                (int)idx);
+        return NULL;
+    }
+
+    if (kDebugStringPoolNoisy) {
+        ALOGI("Caching UTF8 string: %s", u8str);
+    }
+    utf8_to_utf16(u8str, u8len, u16str);
+    return u16str;
+}
+
+void ResStringPool::predecodeStrings(size_t start, size_t count) const
+{
+    if (mError != NO_ERROR || !isUTF8()) {
+        return;
+    }
+
+    const size_t end = std::min(start + count, (size_t)mHeader->stringCount);
+    const uint8_t* strings = (uint8_t*)mStrings;
+
+    AutoMutex lock(mDecodeLock);
+    for (size_t idx = start; idx < end; idx++) {
+        const uint32_t off = mEntries[idx];
+        if (off >= (mStringPoolSize-1)) {
+            continue;
+        }
+
+        const uint8_t* u8str = strings+off;
+        const size_t u16len = decodeLength(&u8str);
+        const size_t u8len = decodeLength(&u8str);
+        if ((uint32_t)(u8str+u8len-strings) < mStringPoolSize) {
+            decodeStringLocked(idx, u8str, u8len, u16len);
+        }
+    }
+}
+
+void ResStringPool::setDecodeCacheLimit(size_t bytes)
+{
+    AutoMutex lock(mDecodeLock);
+    mDecodeCacheLimit = bytes;
+    if (mDecodeCache != NULL) {
+        mDecodeCache->setTracking(bytes != 0);
+        if (bytes != 0) {
+            mDecodeCache->trim(bytes);
+        }
+    }
+}
+
+void ResStringPool::getDecodeCacheStats(DecodeCacheStats* outStats) const
+{
+    AutoMutex lock(mDecodeLock);
+    if (mDecodeCache != NULL) {
+        mDecodeCache->getStats(outStats);
+    } else {
+        memset(outStats, 0, sizeof(*outStats));
+    }
+}
+
+void ResStringPool::getGlobalDecodeCacheStats(DecodeCacheStats* outStats)
+{
+    AutoMutex lock(DecodeCache::sLock);
+    *outStats = DecodeCache::sRetired;
+    for (const DecodeCache* cache = DecodeCache::sCaches; cache != NULL; cache = cache->next) {
+        DecodeCacheStats stats;
+        cache->getStats(&stats);
+        outStats->bytes += stats.bytes;
+        outStats->strings += stats.strings;
+        outStats->hits += stats.hits;
+        outStats->misses += stats.misses;
+        outStats->evictions += stats.evictions;
+    }
+}
+
 const char* ResStringPool::string8At(size_t idx, size_t* outLen) const
 {
     if (mError == NO_ERROR && idx < mHeader->stringCount) {
@@ -1424,6 +1744,47 @@ ssize_t ResXMLParser::indexOfAttribute(const char16_t* ns, size_t nsLen,
     return NAME_NOT_FOUND;
 }
 
+const ResXMLParser::AttributeIndexEntry* ResXMLParser::getSortedAttributes(
+        size_t* outCount) const
+{
+    *outCount = 0;
+    if (mEventCode != START_TAG) {
+        return NULL;
+    }
+
+    const std::vector<uint32_t>& nodes = mTree.mAttrIndexNodes;
+    const uint32_t offset = ((const uint8_t*)mCurNode) - ((const uint8_t*)mTree.mHeader);
+    std::vector<uint32_t>::const_iterator iter =
+            std::lower_bound(nodes.begin(), nodes.end(), offset);
+    if (iter == nodes.end() || *iter != offset) {
+        return NULL;
+    }
+
+    const size_t i = iter - nodes.begin();
+    *outCount = mTree.mAttrIndexStarts[i + 1] - mTree.mAttrIndexStarts[i];
+    return mTree.mAttrIndexEntries.data() + mTree.mAttrIndexStarts[i];
+}
+
+static bool compareAttributeIndexEntries(const ResXMLParser::AttributeIndexEntry& a,
+        const ResXMLParser::AttributeIndexEntry& b)
+{
+    return a.resId < b.resId;
+}
+
+ssize_t ResXMLParser::indexOfAttribute(uint32_t resId) const
+{
+    size_t count;
+    const AttributeIndexEntry* const begin = getSortedAttributes(&count);
+    const AttributeIndexEntry* const end = begin + count;
+    const AttributeIndexEntry key = { resId, 0 };
+    const AttributeIndexEntry* entry =
+            std::lower_bound(begin, end, key, compareAttributeIndexEntries);
+    if (entry != end && entry->resId == resId) {
+        return entry->index;
+    }
+    return NAME_NOT_FOUND;
+}
+
 ssize_t ResXMLParser::indexOfID() const
 {
     if (mEventCode == START_TAG) {
@@ -1655,6 +2016,9 @@ status_t ResXMLTree::setTo(const void* data, size_t size, bool copyData)
     }
 
     mError = mStrings.getError();
+    if (mError == NO_ERROR) {
+        buildAttributeIndex();
+    }
 
 done:
     restart();
@@ -1670,6 +2034,9 @@ void ResXMLTree::uninit()
 {
     mError = NO_INIT;
     mStrings.uninit();
+    mAttrIndexNodes.clear();
+    mAttrIndexStarts.clear();
+    mAttrIndexEntries.clear();
     if (mOwnedData) {
         free(mOwnedData);
         mOwnedData = NULL;
@@ -1677,6 +2044,44 @@ void ResXMLTree::uninit()
     restart();
 }
 
+void ResXMLTree::buildAttributeIndex()
+{
+    // Layout inflation looks up the attributes of every element by resource
+    // ID, walking them alongside the (sorted) attributes it asks for. Sort
+    // each element's attributes once here instead of relying on the
+    // compiler having written them in order.
+    ResXMLParser parser(*this);
+    parser.restart();
+    event_code_t code;
+    while ((code = parser.next()) != END_DOCUMENT && code != BAD_DOCUMENT) {
+        if (code != START_TAG) {
+            continue;
+        }
+
+        const size_t start = mAttrIndexEntries.size();
+        const size_t N = parser.getAttributeCount();
+        for (size_t i = 0; i < N; i++) {
+            const uint32_t resId = parser.getAttributeNameResID(i);
+            if (resId != 0) {
+                const AttributeIndexEntry entry = { resId, (uint32_t)i };
+                mAttrIndexEntries.push_back(entry);
+            }
+        }
+        if (mAttrIndexEntries.size() == start) {
+            continue;
+        }
+
+        // Stable, so a duplicated attribute resolves to the first one as it
+        // would with a linear search.
+        std::stable_sort(mAttrIndexEntries.begin() + start, mAttrIndexEntries.end(),
+                compareAttributeIndexEntries);
+        mAttrIndexNodes.push_back(
+                ((const uint8_t*)parser.mCurNode) - ((const uint8_t*)mHeader));
+        mAttrIndexStarts.push_back(start);
+    }
+    mAttrIndexStarts.push_back(mAttrIndexEntries.size());
+}
+
 status_t ResXMLTree::validateNode(const ResXMLTree_node* node) const
 {
     const uint16_t eventCode = dtohs(node->header.type);
@@ -2171,7 +2576,7 @@ bool ResTable_config::isMoreSpecificThan(const ResTable_config& o) const {
 }
 
 bool ResTable_config::isLocaleBetterThan(const ResTable_config& o,
-        const ResTable_config* requested) const {
+        const ResTable_config* requested, const LocaleRegionMatrix* regions) const {
     if (requested->locale == 0) {
         // The request doesn't have a locale, so no resource is better
         // than the other.
@@ -2236,9 +2641,11 @@ bool ResTable_config::isLocaleBetterThan(const ResTable_config& o,
     // to check the region and variant.
 
     // See if any of the regions is better than the other
-    const int region_comparison = localeDataCompareRegions(
-            country, o.country,
-            language, requested->localeScript, requested->country);
+    const int region_comparison = regions != NULL
+            ? regions->compare(country, o.country)
+            : localeDataCompareRegions(
+                    country, o.country,
+                    language, requested->localeScript, requested->country);
     if (region_comparison != 0) {
         return (region_comparison > 0);
     }
@@ -2253,7 +2660,7 @@ bool ResTable_config::isLocaleBetterThan(const ResTable_config& o,
 }
 
 bool ResTable_config::isBetterThan(const ResTable_config& o,
-        const ResTable_config* requested) const {
+        const ResTable_config* requested, const LocaleRegionMatrix* regions) const {
     if (requested) {
         if (imsi || o.imsi) {
             if ((mcc != o.mcc) && requested->mcc) {
@@ -2265,7 +2672,7 @@ bool ResTable_config::isBetterThan(const ResTable_config& o,
             }
         }
 
-        if (isLocaleBetterThan(o, requested)) {
+        if (isLocaleBetterThan(o, requested, regions)) {
             return true;
         }
 
@@ -3137,6 +3544,21 @@ struct ResTable::Header
     size_t                          resourceIDMapSize;
 };
 
+// One chunk recorded in a resource table index, following the
+// INDEX_HEADER_SIZE_BYTES header (magic, version, table size, table CRC,
+// entry count). Entries are listed in table order: the value string pool,
+// then each package followed by its type specs, types and library chunks.
+struct ResTable::IndexEntry {
+    uint16_t chunkType;
+    // Type ID for RES_TABLE_TYPE_SPEC_TYPE and RES_TABLE_TYPE_TYPE chunks.
+    uint8_t typeId;
+    uint8_t res0;
+    // Offset of the chunk from the start of the table.
+    uint32_t offset;
+    // Entry count for type specs and types, otherwise the chunk size.
+    uint32_t count;
+};
+
 struct ResTable::Entry {
     ResTable_config config;
     const ResTable_entry* entry;
@@ -3152,14 +3574,67 @@ struct ResTable::Type
 {
     Type(const Header* _header, const Package* _package, size_t count)
         : header(_header), package(_package), entryCount(count),
-          typeSpec(NULL), typeSpecFlags(NULL) { }
+          typeSpec(NULL), typeSpecFlags(NULL), pendingConfigsEnd(NULL),
+          configsLoaded(true), entryNameIndexBuilt(false) { }
+
+    ssize_t indexOfEntryName(const std::string& key) const;
+
+    // Returns the configurations of this type, validating any that were
+    // deferred by addPendingConfig() first.
+    inline const Vector<const ResTable_type*>& getConfigs() const {
+        if (!configsLoaded.load(std::memory_order_acquire)) {
+            loadPendingConfigs();
+        }
+        return configs;
+    }
+
+    // The qualifiers of getConfigs(), in the same order, for matching them
+    // all at once.
+    inline const PackedConfigs& getPackedConfigs() const {
+        getConfigs();
+        return packedConfigs;
+    }
+
+    // Returns true if getConfigs() would not have to load anything.
+    inline bool hasLoadedConfigs() const {
+        return configsLoaded.load(std::memory_order_acquire);
+    }
+
+    // Adds a type chunk that has not been validated yet. 'end' is the end of
+    // the package chunk containing it.
+    void addPendingConfig(const ResTable_type* type, const uint8_t* end) {
+        pendingConfigs.add(type);
+        pendingConfigsEnd = end;
+        configsLoaded.store(false, std::memory_order_relaxed);
+    }
+
     const Header* const             header;
     const Package* const            package;
     const size_t                    entryCount;
     const ResTable_typeSpec*        typeSpec;
     const uint32_t*                 typeSpecFlags;
     IdmapEntries                    idmapEntries;
-    Vector<const ResTable_type*>    configs;
+
+private:
+    void loadPendingConfigs() const;
+    void buildEntryNameIndexLocked() const;
+
+    // Type chunks are only validated and added to 'configs' on the first
+    // lookup into the type. Types may be shared between ResTables, so this
+    // is done under configsLock.
+    mutable Vector<const ResTable_type*> configs;
+    mutable PackedConfigs           packedConfigs;
+    mutable Vector<const ResTable_type*> pendingConfigs;
+    const uint8_t*                  pendingConfigsEnd;
+    mutable Mutex                   configsLock;
+    mutable std::atomic<bool>       configsLoaded;
+
+    // Map from the key string of each entry (in the encoding of the package's
+    // key string pool) to its entry index. Built on the first name lookup.
+    // Types may be shared between ResTables, so this has its own lock.
+    mutable Mutex                   entryNameIndexLock;
+    mutable bool                    entryNameIndexBuilt;
+    mutable std::unordered_map<std::string, uint32_t> entryNameIndex;
 };
 
 struct ResTable::Package
@@ -3183,63 +3658,273 @@ struct ResTable::Package
     size_t                          typeIdOffset;
 };
 
-// A group of objects describing a particular resource package.
-// The first in 'package' is always the root object (from the resource
-// table that defined the package); the ones after are skins on top of it.
-struct ResTable::PackageGroup
+// Returns the bytes of a string as they are stored in 'pool', so that it can
+// be compared against the pool's strings without decoding them.
+static std::string encodeForPool(const ResStringPool& pool, const char16_t* str, size_t len)
 {
-    PackageGroup(
-            ResTable* _owner, const String16& _name, uint32_t _id,
-            bool appAsLib, bool _isSystemAsset)
-        : owner(_owner)
-        , name(_name)
-        , id(_id)
-        , largestTypeId(0)
-        , dynamicRefTable(static_cast<uint8_t>(_id), appAsLib)
-        , isSystemAsset(_isSystemAsset)
-    { }
+    if (pool.isUTF8()) {
+        String8 str8(str, len);
+        return std::string(str8.string(), str8.size());
+    }
+    return std::string(reinterpret_cast<const char*>(str), len * sizeof(char16_t));
+}
 
-    ~PackageGroup() {
-        clearBagCache();
-        const size_t numTypes = types.size();
-        for (size_t i = 0; i < numTypes; i++) {
-            const TypeList& typeList = types[i];
-            const size_t numInnerTypes = typeList.size();
-            for (size_t j = 0; j < numInnerTypes; j++) {
-                if (typeList[j]->package->owner == owner) {
-                    delete typeList[j];
-                }
-            }
+// Returns the bytes of string 'idx' as stored in 'pool'.
+static bool poolStringBytes(const ResStringPool& pool, size_t idx, std::string* outBytes)
+{
+    size_t len;
+    if (pool.isUTF8()) {
+        const char* str8 = pool.string8At(idx, &len);
+        if (str8 == NULL) {
+            return false;
         }
+        outBytes->assign(str8, len);
+        return true;
+    }
 
-        const size_t N = packages.size();
-        for (size_t i=0; i<N; i++) {
-            Package* pkg = packages[i];
-            if (pkg->owner == owner) {
-                delete pkg;
-            }
-        }
+    const char16_t* str16 = pool.stringAt(idx, &len);
+    if (str16 == NULL) {
+        return false;
     }
+    outBytes->assign(reinterpret_cast<const char*>(str16), len * sizeof(char16_t));
+    return true;
+}
 
-    /**
-     * Clear all cache related data that depends on parameters/configuration.
-     * This includes the bag caches and filtered types.
-     */
-    void clearBagCache() {
-        for (size_t i = 0; i < typeCacheEntries.size(); i++) {
-            if (kDebugTableNoisy) {
-                printf("type=%zu\n", i);
-            }
-            const TypeList& typeList = types[i];
-            if (!typeList.isEmpty()) {
-                TypeCacheEntry& cacheEntry = typeCacheEntries.editItemAt(i);
+// Checks a ResTable_type chunk before any of its entries are read.
+static status_t validate_type(const ResTable_type* type, const uint8_t* endPos)
+{
+    status_t err = validate_chunk(&type->header, sizeof(*type)-sizeof(ResTable_config)+4,
+                                  endPos, "ResTable_type");
+    if (err != NO_ERROR) {
+        return err;
+    }
 
-                // Reset the filtered configurations.
-                cacheEntry.filteredConfigs.clear();
+    const uint32_t typeSize = dtohl(type->header.size);
+    const size_t entryCount = dtohl(type->entryCount);
+    if (dtohs(type->header.headerSize)+(sizeof(uint32_t)*entryCount) > typeSize) {
+        ALOGW("ResTable_type entry index to %p extends beyond chunk end 0x%x.",
+                (void*)(dtohs(type->header.headerSize) + (sizeof(uint32_t)*entryCount)),
+                typeSize);
+        return BAD_TYPE;
+    }
 
-                bag_set** typeBags = cacheEntry.cachedBags;
-                if (kDebugTableNoisy) {
-                    printf("typeBags=%p\n", typeBags);
+    if (entryCount != 0
+        && dtohl(type->entriesStart) > (typeSize-sizeof(ResTable_entry))) {
+        ALOGW("ResTable_type entriesStart at 0x%x extends beyond chunk end 0x%x.",
+             dtohl(type->entriesStart), typeSize);
+        return BAD_TYPE;
+    }
+    return NO_ERROR;
+}
+
+void ResTable::Type::loadPendingConfigs() const
+{
+    AutoMutex _l(configsLock);
+    if (configsLoaded.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    const size_t N = pendingConfigs.size();
+    for (size_t i = 0; i < N; i++) {
+        const ResTable_type* type = pendingConfigs[i];
+        if (validate_type(type, pendingConfigsEnd) != NO_ERROR) {
+            // The rest of the table has been in use already, so drop just
+            // this configuration rather than failing the whole table.
+            ALOGW("Ignoring invalid ResTable_type for type %d", type->id);
+            continue;
+        }
+
+        ResTable_config thisConfig;
+        thisConfig.copyFromDtoH(type->config);
+        if (kDebugTableGetEntry) {
+            ALOGI("Adding config to type %d: %s\n", type->id,
+                    thisConfig.toString().string());
+        }
+        configs.add(type);
+        packedConfigs.add(thisConfig);
+    }
+    pendingConfigs.clear();
+    configsLoaded.store(true, std::memory_order_release);
+}
+
+void ResTable::Type::buildEntryNameIndexLocked() const
+{
+    const ResStringPool& keyStrings = package->keyStrings;
+    std::vector<bool> seen(entryCount, false);
+    std::string key;
+
+    const Vector<const ResTable_type*>& typeConfigs = getConfigs();
+    const size_t configCount = typeConfigs.size();
+    for (size_t i = 0; i < configCount; i++) {
+        const TypeVariant tv(typeConfigs[i]);
+        for (TypeVariant::iterator iter = tv.beginEntries();
+             iter != tv.endEntries();
+             iter++) {
+            const ResTable_entry* entry = *iter;
+            const size_t entryIndex = iter.index();
+            if (entry == NULL || entryIndex >= entryCount || seen[entryIndex]) {
+                continue;
+            }
+            seen[entryIndex] = true;
+
+            if (poolStringBytes(keyStrings, dtohl(entry->key.index), &key)) {
+                // The first entry seen for a name wins, as with a linear scan.
+                entryNameIndex.insert(std::make_pair(key, static_cast<uint32_t>(entryIndex)));
+            }
+        }
+    }
+    entryNameIndexBuilt = true;
+}
+
+ssize_t ResTable::Type::indexOfEntryName(const std::string& key) const
+{
+    AutoMutex _lock(entryNameIndexLock);
+    if (!entryNameIndexBuilt) {
+        buildEntryNameIndexLocked();
+    }
+
+    std::unordered_map<std::string, uint32_t>::const_iterator iter = entryNameIndex.find(key);
+    if (iter == entryNameIndex.end()) {
+        return NAME_NOT_FOUND;
+    }
+    return iter->second;
+}
+
+// Bags computed for a package group on behalf of every ResTable that shares
+// it through add(ResTable*), keyed by configuration. The framework resources
+// are shared this way, so their style bags only need to be resolved once per
+// process and configuration. Bags are never freed before the cache itself,
+// so pointers handed out stay valid for as long as the source group lives.
+struct ResTable::SharedBagCache
+{
+    // Configurations beyond this many are not shared, which bounds the memory
+    // held on behalf of short-lived configurations.
+    enum { MAX_CONFIGS = 4 };
+
+    ~SharedBagCache() {
+        const size_t N = configs.size();
+        for (size_t i = 0; i < N; i++) {
+            ConfigBags* configBags = configs[i];
+            for (auto& bag : configBags->bags) {
+                free(bag.second);
+            }
+            delete configBags;
+        }
+    }
+
+    const bag_set* find(const ResTable_config& config, uint32_t resID) {
+        AutoMutex _lock(lock);
+        ConfigBags* configBags = findConfigLocked(config);
+        if (configBags == NULL) {
+            return NULL;
+        }
+        std::unordered_map<uint32_t, bag_set*>::const_iterator iter =
+                configBags->bags.find(resID);
+        return iter != configBags->bags.end() ? iter->second : NULL;
+    }
+
+    void add(const ResTable_config& config, uint32_t resID, const bag_set* set) {
+        AutoMutex _lock(lock);
+        ConfigBags* configBags = findConfigLocked(config);
+        if (configBags == NULL) {
+            if (configs.size() >= MAX_CONFIGS) {
+                return;
+            }
+            configBags = new ConfigBags();
+            configBags->config = config;
+            configs.add(configBags);
+        }
+
+        if (configBags->bags.find(resID) != configBags->bags.end()) {
+            // Another ResTable got here first.
+            return;
+        }
+
+        const size_t size = sizeof(bag_set) + sizeof(bag_entry) * set->numAttrs;
+        bag_set* copy = (bag_set*)malloc(size);
+        if (copy == NULL) {
+            return;
+        }
+        memcpy(copy, set, size);
+        copy->availAttrs = copy->numAttrs;
+        configBags->bags[resID] = copy;
+    }
+
+private:
+    struct ConfigBags {
+        ResTable_config config;
+        std::unordered_map<uint32_t, bag_set*> bags;
+    };
+
+    ConfigBags* findConfigLocked(const ResTable_config& config) const {
+        const size_t N = configs.size();
+        for (size_t i = 0; i < N; i++) {
+            if (memcmp(&configs[i]->config, &config, sizeof(config)) == 0) {
+                return configs[i];
+            }
+        }
+        return NULL;
+    }
+
+    Mutex lock;
+    Vector<ConfigBags*> configs;
+};
+
+// A group of objects describing a particular resource package.
+// The first in 'package' is always the root object (from the resource
+// table that defined the package); the ones after are skins on top of it.
+struct ResTable::PackageGroup
+{
+    PackageGroup(
+            ResTable* _owner, const String16& _name, uint32_t _id,
+            bool appAsLib, bool _isSystemAsset)
+        : owner(_owner)
+        , name(_name)
+        , id(_id)
+        , largestTypeId(0)
+        , dynamicRefTable(static_cast<uint8_t>(_id), appAsLib)
+        , isSystemAsset(_isSystemAsset)
+        , sourceGroup(NULL)
+    { }
+
+    ~PackageGroup() {
+        clearBagCache();
+        const size_t numTypes = types.size();
+        for (size_t i = 0; i < numTypes; i++) {
+            const TypeList& typeList = types[i];
+            const size_t numInnerTypes = typeList.size();
+            for (size_t j = 0; j < numInnerTypes; j++) {
+                if (typeList[j]->package->owner == owner) {
+                    delete typeList[j];
+                }
+            }
+        }
+
+        const size_t N = packages.size();
+        for (size_t i=0; i<N; i++) {
+            Package* pkg = packages[i];
+            if (pkg->owner == owner) {
+                delete pkg;
+            }
+        }
+    }
+
+    /**
+     * Clear the bag caches, which depend on the parameters/configuration.
+     * Filtered types and resolved entries live in the ResTable's ConfigSnapshot.
+     */
+    void clearBagCache() {
+        for (size_t i = 0; i < typeCacheEntries.size(); i++) {
+            if (kDebugTableNoisy) {
+                printf("type=%zu\n", i);
+            }
+            const TypeList& typeList = types[i];
+            if (!typeList.isEmpty()) {
+                TypeCacheEntry& cacheEntry = typeCacheEntries.editItemAt(i);
+
+                bag_set** typeBags = cacheEntry.cachedBags;
+                if (kDebugTableNoisy) {
+                    printf("typeBags=%p\n", typeBags);
                 }
 
                 if (typeBags) {
@@ -3259,6 +3944,29 @@ struct ResTable::PackageGroup
         }
     }
 
+    /**
+     * Returns the bag cache shared with other ResTables if bags of type
+     * 'typeIndex' are computed from exactly the same data as in the group this
+     * one was copied from, or NULL otherwise.
+     */
+    SharedBagCache* getSharedBagCache(size_t typeIndex) const {
+        if (sourceGroup == NULL) {
+            return NULL;
+        }
+
+        // Dynamic references may be mapped differently in each ResTable.
+        if (dynamicRefTable.entries().size() != 0
+                || sourceGroup->dynamicRefTable.entries().size() != 0) {
+            return NULL;
+        }
+
+        // Packages (e.g. overlays) added on top of the shared ones change the bags.
+        if (types[typeIndex].size() != sourceGroup->types[typeIndex].size()) {
+            return NULL;
+        }
+        return &sourceGroup->sharedBags;
+    }
+
     ssize_t findType16(const char16_t* type, size_t len) const {
         const size_t N = packages.size();
         for (size_t i = 0; i < N; i++) {
@@ -3299,53 +4007,149 @@ struct ResTable::PackageGroup
     // If the package group comes from a system asset. Used in
     // determining non-system locales.
     const bool                      isSystemAsset;
+
+    // The group this one was copied from by ResTable::add(ResTable*), if any.
+    PackageGroup*                   sourceGroup;
+
+    // Bags computed by ResTables whose groups were copied from this one.
+    SharedBagCache                  sharedBags;
+};
+
+// The best match for an entry under the parameters of a ConfigSnapshot.
+// Lookups fill these in lazily from any thread; 'state' is published last
+// so a reader never observes a partially written entry.
+struct ResTable::ResolvedEntry
+{
+    enum {
+        EMPTY = 0,
+        WRITING,
+        READY
+    };
+
+    ResolvedEntry()
+        : state(EMPTY), type(NULL), offset(0), specFlags(0), package(NULL),
+          actualTypeIndex(0) { }
+
+    std::atomic<uint32_t>           state;
+    const ResTable_type*            type;
+    uint32_t                        offset;
+    uint32_t                        specFlags;
+    const Package*                  package;
+    uint8_t                         actualTypeIndex;
+};
+
+// Lookup data for one type of a package group, derived from the parameters
+// of a ConfigSnapshot. Apart from the resolved entries, it is never modified
+// once the snapshot is published.
+struct ResTable::TypeSnapshot
+{
+    TypeSnapshot() : resolvedEntryCount(0), typeCount(0) { }
+
+    // Pre-filtered list of configurations (per asset path) that match the
+    // parameters. Only valid where 'filtered' is set; types that had not been
+    // loaded when the snapshot was created are left unfiltered.
+    Vector<Vector<const ResTable_type*> > filteredConfigs;
+    Vector<bool>                    filtered;
+
+    std::unique_ptr<ResolvedEntry[]> resolvedEntries;
+    size_t                          resolvedEntryCount;
+
+    // Number of Types in the TypeList when the snapshot was created. If
+    // packages are added to the type afterwards, the resolved entries are
+    // stale and must not be used.
+    size_t                          typeCount;
+};
+
+// Everything a ResTable derives from its parameters, published as a whole
+// by setParameters().
+struct ResTable::ConfigSnapshot
+{
+    ConfigSnapshot(const ResTable_config& _params) : params(_params) { }
+
+    ~ConfigSnapshot() {
+        const size_t N = groups.size();
+        for (size_t i = 0; i < N; i++) {
+            delete groups.valueAt(i);
+        }
+    }
+
+    ResTable_config                 params;
+    KeyedVector<const PackageGroup*, ByteBucketArray<TypeSnapshot>*> groups;
+    // Region comparisons for the requested locale, between the regions of the
+    // matching configurations in the loaded types.
+    LocaleRegionMatrix              regions;
+};
+
+// Registers the calling thread as a reader of ResTable::mSnapshot for the
+// lifetime of this object, so that a snapshot it loaded is not freed by a
+// concurrent setParameters().
+class ResTable::ScopedSnapshotReader {
+public:
+    explicit ScopedSnapshotReader(const ResTable& table) : mTable(table) {
+        mTable.mSnapshotReaders.fetch_add(1);
+    }
+
+    ~ScopedSnapshotReader() {
+        // The last reader out frees the snapshots replaced while it was reading.
+        if (mTable.mSnapshotReaders.fetch_sub(1) == 1 && mTable.mHasRetiredSnapshots.load()) {
+            AutoMutex _l(mTable.mSnapshotLock);
+            mTable.freeRetiredSnapshotsLocked();
+        }
+    }
+
+private:
+    const ResTable& mTable;
 };
 
 ResTable::Theme::Theme(const ResTable& table)
     : mTable(table)
+    , mEntries(NULL)
     , mTypeSpecFlags(0)
 {
-    memset(mPackages, 0, sizeof(mPackages));
 }
 
 ResTable::Theme::~Theme()
 {
-    for (size_t i=0; i<Res_MAXPACKAGE; i++) {
-        package_info* pi = mPackages[i];
-        if (pi != NULL) {
-            free_package(pi);
-        }
+    release_entries(mEntries);
+}
+
+ResTable::Theme::entry_list* ResTable::Theme::alloc_entries(size_t numEntries)
+{
+    if (numEntries > (SIZE_MAX - sizeof(entry_list)) / sizeof(theme_entry)) {
+        return NULL;
+    }
+    entry_list* list = (entry_list*)malloc(sizeof(entry_list) + numEntries*sizeof(theme_entry));
+    if (list == NULL) {
+        return NULL;
     }
+    list->refCount = 1;
+    list->numEntries = numEntries;
+    return list;
 }
 
-void ResTable::Theme::free_package(package_info* pi)
+void ResTable::Theme::release_entries(entry_list* list)
 {
-    for (size_t j = 0; j <= Res_MAXTYPE; j++) {
-        theme_entry* te = pi->types[j].entries;
-        if (te != NULL) {
-            free(te);
-        }
+    if (list != NULL && android_atomic_dec(&list->refCount) == 1) {
+        free(list);
     }
-    free(pi);
 }
 
-ResTable::Theme::package_info* ResTable::Theme::copy_package(package_info* pi)
+const ResTable::Theme::theme_entry* ResTable::Theme::find_entry(uint32_t attrRes) const
 {
-    package_info* newpi = (package_info*)malloc(sizeof(package_info));
-    for (size_t j = 0; j <= Res_MAXTYPE; j++) {
-        size_t cnt = pi->types[j].numEntries;
-        newpi->types[j].numEntries = cnt;
-        theme_entry* te = pi->types[j].entries;
-        size_t cnt_max = SIZE_MAX / sizeof(theme_entry);
-        if (te != NULL && (cnt < 0xFFFFFFFF-1) && (cnt < cnt_max)) {
-            theme_entry* newte = (theme_entry*)malloc(cnt*sizeof(theme_entry));
-            newpi->types[j].entries = newte;
-            memcpy(newte, te, cnt*sizeof(theme_entry));
-        } else {
-            newpi->types[j].entries = NULL;
-        }
+    if (mEntries == NULL) {
+        return NULL;
+    }
+
+    const theme_entry* const begin = entries_of(mEntries);
+    const theme_entry* const end = begin + mEntries->numEntries;
+    const theme_entry* iter = std::lower_bound(begin, end, attrRes,
+            [](const theme_entry& entry, uint32_t attr) -> bool {
+                return entry.attrRes < attr;
+            });
+    if (iter != end && iter->attrRes == attrRes) {
+        return iter;
     }
-    return newpi;
+    return NULL;
 }
 
 status_t ResTable::Theme::applyStyle(uint32_t resID, bool force)
@@ -3364,12 +4168,23 @@ status_t ResTable::Theme::applyStyle(uint32_t resID, bool force)
 
     mTypeSpecFlags |= bagTypeSpecFlags;
 
+    // Both the bag and the current entries are sorted by attribute, so the
+    // new list is the result of a single merge of the two.
+    const size_t numOldEntries = mEntries != NULL ? mEntries->numEntries : 0;
+    entry_list* newEntries = alloc_entries(numOldEntries + N);
+    if (newEntries == NULL) {
+        mTable.unlock();
+        return NO_MEMORY;
+    }
+
+    const theme_entry* oldEntry = mEntries != NULL ? entries_of(mEntries) : NULL;
+    const theme_entry* const oldEnd = oldEntry + numOldEntries;
+    theme_entry* curEntry = entries_of(newEntries);
+
     uint32_t curPackage = 0xffffffff;
     ssize_t curPackageIndex = 0;
-    package_info* curPI = NULL;
     uint32_t curType = 0xffffffff;
     size_t numEntries = 0;
-    theme_entry* curEntries = NULL;
 
     const bag_entry* end = bag + N;
     while (bag < end) {
@@ -3387,12 +4202,6 @@ status_t ResTable::Theme::applyStyle(uint32_t resID, bool force)
             }
             curPackage = p;
             curPackageIndex = pidx;
-            curPI = mPackages[pidx];
-            if (curPI == NULL) {
-                curPI = (package_info*)malloc(sizeof(package_info));
-                memset(curPI, 0, sizeof(*curPI));
-                mPackages[pidx] = curPI;
-            }
             curType = 0xffffffff;
         }
         if (curType != t) {
@@ -3402,27 +4211,33 @@ status_t ResTable::Theme::applyStyle(uint32_t resID, bool force)
                 continue;
             }
             curType = t;
-            curEntries = curPI->types[t].entries;
-            if (curEntries == NULL) {
-                PackageGroup* const grp = mTable.mPackageGroups[curPackageIndex];
-                const TypeList& typeList = grp->types[t];
-                size_t cnt = typeList.isEmpty() ? 0 : typeList[0]->entryCount;
-                size_t cnt_max = SIZE_MAX / sizeof(theme_entry);
-                size_t buff_size = (cnt < cnt_max && cnt < 0xFFFFFFFF-1) ?
-                                          cnt*sizeof(theme_entry) : 0;
-                curEntries = (theme_entry*)malloc(buff_size);
-                memset(curEntries, Res_value::TYPE_NULL, buff_size);
-                curPI->types[t].numEntries = cnt;
-                curPI->types[t].entries = curEntries;
-            }
-            numEntries = curPI->types[t].numEntries;
+            const PackageGroup* const grp = mTable.mPackageGroups[curPackageIndex];
+            const TypeList& typeList = grp->types[t];
+            numEntries = typeList.isEmpty() ? 0 : typeList[0]->entryCount;
         }
         if (e >= numEntries) {
             ALOGE("Style contains key with bad entry: 0x%08x\n", attrRes);
             bag++;
             continue;
         }
-        theme_entry* curEntry = curEntries + e;
+
+        // Keep the existing attributes that come before this one.
+        while (oldEntry != oldEnd && oldEntry->attrRes < attrRes) {
+            *curEntry++ = *oldEntry++;
+        }
+
+        if (oldEntry != oldEnd && oldEntry->attrRes == attrRes) {
+            *curEntry = *oldEntry++;
+        } else {
+            curEntry->attrRes = attrRes;
+            curEntry->stringBlock = 0;
+            curEntry->typeSpecFlags = 0;
+            curEntry->value.size = 0;
+            curEntry->value.res0 = 0;
+            curEntry->value.dataType = Res_value::TYPE_NULL;
+            curEntry->value.data = 0;
+        }
+
         if (kDebugTableNoisy) {
             ALOGV("Attr 0x%08x: type=0x%x, data=0x%08x; curType=0x%x",
                     attrRes, bag->map.value.dataType, bag->map.value.data,
@@ -3434,11 +4249,21 @@ status_t ResTable::Theme::applyStyle(uint32_t resID, bool force)
             curEntry->value = bag->map.value;
         }
 
+        curEntry++;
         bag++;
     }
 
+    // Keep the remaining existing attributes.
+    while (oldEntry != oldEnd) {
+        *curEntry++ = *oldEntry++;
+    }
+
     mTable.unlock();
 
+    newEntries->numEntries = curEntry - entries_of(newEntries);
+    release_entries(mEntries);
+    mEntries = newEntries;
+
     if (kDebugTableTheme) {
         ALOGI("Applying style 0x%08x (force=%d)  theme %p...\n", resID, force, this);
         dumpToLog();
@@ -3456,30 +4281,36 @@ status_t ResTable::Theme::setTo(const Theme& other)
     }
 
     if (&mTable == &other.mTable) {
-        for (size_t i=0; i<Res_MAXPACKAGE; i++) {
-            if (mPackages[i] != NULL) {
-                free_package(mPackages[i]);
-            }
-            if (other.mPackages[i] != NULL) {
-                mPackages[i] = copy_package(other.mPackages[i]);
-            } else {
-                mPackages[i] = NULL;
-            }
+        // Share the other theme's entries; whichever theme is modified
+        // first builds a new list.
+        if (other.mEntries != NULL) {
+            android_atomic_inc(&other.mEntries->refCount);
         }
+        release_entries(mEntries);
+        mEntries = other.mEntries;
     } else {
         // @todo: need to really implement this, not just copy
         // the system package (which is still wrong because it isn't
         // fixing up resource references).
-        for (size_t i=0; i<Res_MAXPACKAGE; i++) {
-            if (mPackages[i] != NULL) {
-                free_package(mPackages[i]);
+        entry_list* newEntries = NULL;
+        if (other.mEntries != NULL) {
+            newEntries = alloc_entries(other.mEntries->numEntries);
+            if (newEntries == NULL) {
+                return NO_MEMORY;
             }
-            if (i == 0 && other.mPackages[i] != NULL) {
-                mPackages[i] = copy_package(other.mPackages[i]);
-            } else {
-                mPackages[i] = NULL;
+
+            const theme_entry* otherEntry = entries_of(other.mEntries);
+            const theme_entry* const otherEnd = otherEntry + other.mEntries->numEntries;
+            theme_entry* curEntry = entries_of(newEntries);
+            for (; otherEntry != otherEnd; otherEntry++) {
+                if (other.mTable.getResourcePackageIndex(otherEntry->attrRes) == 0) {
+                    *curEntry++ = *otherEntry;
+                }
             }
+            newEntries->numEntries = curEntry - entries_of(newEntries);
         }
+        release_entries(mEntries);
+        mEntries = newEntries;
     }
 
     mTypeSpecFlags = other.mTypeSpecFlags;
@@ -3499,12 +4330,8 @@ status_t ResTable::Theme::clear()
         dumpToLog();
     }
 
-    for (size_t i = 0; i < Res_MAXPACKAGE; i++) {
-        if (mPackages[i] != NULL) {
-            free_package(mPackages[i]);
-            mPackages[i] = NULL;
-        }
-    }
+    release_entries(mEntries);
+    mEntries = NULL;
 
     mTypeSpecFlags = 0;
 
@@ -3524,54 +4351,33 @@ ssize_t ResTable::Theme::getAttribute(uint32_t resID, Res_value* outValue,
     if (outTypeSpecFlags != NULL) *outTypeSpecFlags = 0;
 
     do {
-        const ssize_t p = mTable.getResourcePackageIndex(resID);
-        const uint32_t t = Res_GETTYPE(resID);
-        const uint32_t e = Res_GETENTRY(resID);
-
         if (kDebugTableTheme) {
             ALOGI("Looking up attr 0x%08x in theme %p", resID, this);
         }
 
-        if (p >= 0) {
-            const package_info* const pi = mPackages[p];
-            if (kDebugTableTheme) {
-                ALOGI("Found package: %p", pi);
+        const theme_entry* const te = find_entry(resID);
+        if (te != NULL) {
+            if (outTypeSpecFlags != NULL) {
+                *outTypeSpecFlags |= te->typeSpecFlags;
             }
-            if (pi != NULL) {
-                if (kDebugTableTheme) {
-                    ALOGI("Desired type index is %zd in avail %zu", t, Res_MAXTYPE + 1);
-                }
-                if (t <= Res_MAXTYPE) {
-                    const type_info& ti = pi->types[t];
-                    if (kDebugTableTheme) {
-                        ALOGI("Desired entry index is %u in avail %zu", e, ti.numEntries);
-                    }
-                    if (e < ti.numEntries) {
-                        const theme_entry& te = ti.entries[e];
-                        if (outTypeSpecFlags != NULL) {
-                            *outTypeSpecFlags |= te.typeSpecFlags;
-                        }
-                        if (kDebugTableTheme) {
-                            ALOGI("Theme value: type=0x%x, data=0x%08x",
-                                    te.value.dataType, te.value.data);
-                        }
-                        const uint8_t type = te.value.dataType;
-                        if (type == Res_value::TYPE_ATTRIBUTE) {
-                            if (cnt > 0) {
-                                cnt--;
-                                resID = te.value.data;
-                                continue;
-                            }
-                            ALOGW("Too many attribute references, stopped at: 0x%08x\n", resID);
-                            return BAD_INDEX;
-                        } else if (type != Res_value::TYPE_NULL) {
-                            *outValue = te.value;
-                            return te.stringBlock;
-                        }
-                        return BAD_INDEX;
-                    }
+            if (kDebugTableTheme) {
+                ALOGI("Theme value: type=0x%x, data=0x%08x",
+                        te->value.dataType, te->value.data);
+            }
+            const uint8_t type = te->value.dataType;
+            if (type == Res_value::TYPE_ATTRIBUTE) {
+                if (cnt > 0) {
+                    cnt--;
+                    resID = te->value.data;
+                    continue;
                 }
+                ALOGW("Too many attribute references, stopped at: 0x%08x\n", resID);
+                return BAD_INDEX;
+            } else if (type != Res_value::TYPE_NULL) {
+                *outValue = te->value;
+                return te->stringBlock;
             }
+            return BAD_INDEX;
         }
         break;
 
@@ -3610,41 +4416,38 @@ uint32_t ResTable::Theme::getChangingConfigurations() const
 void ResTable::Theme::dumpToLog() const
 {
     ALOGI("Theme %p:\n", this);
-    for (size_t i=0; i<Res_MAXPACKAGE; i++) {
-        package_info* pi = mPackages[i];
-        if (pi == NULL) continue;
+    if (mEntries == NULL) {
+        return;
+    }
 
-        ALOGI("  Package #0x%02x:\n", (int)(i + 1));
-        for (size_t j = 0; j <= Res_MAXTYPE; j++) {
-            type_info& ti = pi->types[j];
-            if (ti.numEntries == 0) continue;
-            ALOGI("    Type #0x%02x:\n", (int)(j + 1));
-            for (size_t k = 0; k < ti.numEntries; k++) {
-                const theme_entry& te = ti.entries[k];
-                if (te.value.dataType == Res_value::TYPE_NULL) continue;
-                ALOGI("      0x%08x: t=0x%x, d=0x%08x (block=%d)\n",
-                     (int)Res_MAKEID(i, j, k),
-                     te.value.dataType, (int)te.value.data, (int)te.stringBlock);
-            }
-        }
+    const theme_entry* const entries = entries_of(mEntries);
+    for (size_t i = 0; i < mEntries->numEntries; i++) {
+        const theme_entry& te = entries[i];
+        if (te.value.dataType == Res_value::TYPE_NULL) continue;
+        ALOGI("  0x%08x: t=0x%x, d=0x%08x (block=%d)\n",
+             (int)te.attrRes, te.value.dataType, (int)te.value.data, (int)te.stringBlock);
     }
 }
 
 ResTable::ResTable()
-    : mError(NO_INIT), mNextPackageId(2)
+    : mError(NO_INIT), mSnapshot(NULL), mSnapshotReaders(0), mHasRetiredSnapshots(false)
+    , mNextPackageId(2)
 {
     memset(&mParams, 0, sizeof(mParams));
     memset(mPackageMap, 0, sizeof(mPackageMap));
+    mSnapshot.store(new ConfigSnapshot(mParams));
     if (kDebugTableSuperNoisy) {
         ALOGI("Creating ResTable %p\n", this);
     }
 }
 
 ResTable::ResTable(const void* data, size_t size, const int32_t cookie, bool copyData)
-    : mError(NO_INIT), mNextPackageId(2)
+    : mError(NO_INIT), mSnapshot(NULL), mSnapshotReaders(0), mHasRetiredSnapshots(false)
+    , mNextPackageId(2)
 {
     memset(&mParams, 0, sizeof(mParams));
     memset(mPackageMap, 0, sizeof(mPackageMap));
+    mSnapshot.store(new ConfigSnapshot(mParams));
     addInternal(data, size, NULL, 0, false, cookie, copyData);
     LOG_FATAL_IF(mError != NO_ERROR, "Error parsing resource table");
     if (kDebugTableSuperNoisy) {
@@ -3658,6 +4461,12 @@ ResTable::~ResTable()
         ALOGI("Destroying ResTable in %p\n", this);
     }
     uninit();
+
+    delete mSnapshot.load();
+    const size_t N = mRetiredSnapshots.size();
+    for (size_t i = 0; i < N; i++) {
+        delete mRetiredSnapshots[i];
+    }
 }
 
 inline ssize_t ResTable::getResourcePackageIndex(uint32_t resID) const
@@ -3674,6 +4483,13 @@ status_t ResTable::add(const void* data, size_t size, const void* idmapData, siz
     return addInternal(data, size, idmapData, idmapDataSize, appAsLib, cookie, copyData);
 }
 
+status_t ResTable::add(const void* data, size_t size, const void* idmapData, size_t idmapDataSize,
+        const void* indexData, size_t indexDataSize, const int32_t cookie, bool copyData,
+        bool appAsLib, bool* outIndexRejected) {
+    return addInternal(data, size, idmapData, idmapDataSize, appAsLib, cookie, copyData,
+            false, indexData, indexDataSize, outIndexRejected);
+}
+
 status_t ResTable::add(Asset* asset, const int32_t cookie, bool copyData) {
     const void* data = asset->getBuffer(true);
     if (data == NULL) {
@@ -3709,6 +4525,40 @@ status_t ResTable::add(
             idmapData, idmapSize, appAsLib, cookie, copyData, isSystemAsset);
 }
 
+status_t ResTable::add(
+        Asset* asset, Asset* idmapAsset, Asset* indexAsset, const int32_t cookie,
+        bool copyData, bool appAsLib, bool isSystemAsset, bool* outIndexRejected) {
+    if (indexAsset == NULL) {
+        return add(asset, idmapAsset, cookie, copyData, appAsLib, isSystemAsset);
+    }
+
+    const void* data = asset->getBuffer(true);
+    if (data == NULL) {
+        ALOGW("Unable to get buffer of resource asset file");
+        return UNKNOWN_ERROR;
+    }
+
+    size_t idmapSize = 0;
+    const void* idmapData = NULL;
+    if (idmapAsset != NULL) {
+        idmapData = idmapAsset->getBuffer(true);
+        if (idmapData == NULL) {
+            ALOGW("Unable to get buffer of idmap asset file");
+            return UNKNOWN_ERROR;
+        }
+        idmapSize = static_cast<size_t>(idmapAsset->getLength());
+    }
+
+    // A missing index only costs us the scan, so don't fail the load over it.
+    const void* indexData = indexAsset->getBuffer(true);
+    const size_t indexSize = indexData != NULL
+            ? static_cast<size_t>(indexAsset->getLength()) : 0;
+
+    return addInternal(data, static_cast<size_t>(asset->getLength()),
+            idmapData, idmapSize, appAsLib, cookie, copyData, isSystemAsset,
+            indexData, indexSize, outIndexRejected);
+}
+
 status_t ResTable::add(ResTable* src, bool isSystemAsset)
 {
     mError = src->mError;
@@ -3721,6 +4571,7 @@ status_t ResTable::add(ResTable* src, bool isSystemAsset)
         PackageGroup* srcPg = src->mPackageGroups[i];
         PackageGroup* pg = new PackageGroup(this, srcPg->name, srcPg->id,
                 false /* appAsLib */, isSystemAsset || srcPg->isSystemAsset);
+        pg->sourceGroup = srcPg->sourceGroup != NULL ? srcPg->sourceGroup : srcPg;
         for (size_t j=0; j<srcPg->packages.size(); j++) {
             pg->packages.add(srcPg->packages[j]);
         }
@@ -3761,8 +4612,13 @@ status_t ResTable::addEmpty(const int32_t cookie) {
 }
 
 status_t ResTable::addInternal(const void* data, size_t dataSize, const void* idmapData, size_t idmapDataSize,
-        bool appAsLib, const int32_t cookie, bool copyData, bool isSystemAsset)
+        bool appAsLib, const int32_t cookie, bool copyData, bool isSystemAsset,
+        const void* indexData, size_t indexDataSize, bool* outIndexRejected)
 {
+    if (outIndexRejected != NULL) {
+        *outIndexRejected = false;
+    }
+
     if (!data) {
         return NO_ERROR;
     }
@@ -3827,6 +4683,24 @@ status_t ResTable::addInternal(const void* data, size_t dataSize, const void* id
     }
     header->dataEnd = ((const uint8_t*)header->header) + header->size;
 
+    if (indexData != NULL) {
+        size_t indexEntryCount = 0;
+        const IndexEntry* indexEntries = validateIndex(indexData, indexDataSize, header,
+                &indexEntryCount);
+        if (indexEntries != NULL) {
+            return parseIndexedTable(header, indexEntries, indexEntryCount, appAsLib,
+                    isSystemAsset);
+        }
+
+        // Nothing has been parsed yet, so the table can still be loaded the
+        // slow way. The caller decides what to do with the bad index.
+        ALOGW("Resource index does not match table @%p; scanning the table instead",
+                header->header);
+        if (outIndexRejected != NULL) {
+            *outIndexRejected = true;
+        }
+    }
+
     // Iterate through all chunks.
     size_t curPackage = 0;
 
@@ -3894,6 +4768,156 @@ status_t ResTable::addInternal(const void* data, size_t dataSize, const void* id
     return mError;
 }
 
+const ResTable::IndexEntry* ResTable::validateIndex(const void* indexData, size_t indexDataSize,
+        const Header* header, size_t* outEntryCount)
+{
+    if (!assertIndexHeader(indexData, indexDataSize)) {
+        return NULL;
+    }
+
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(indexData);
+    if (dtohl(words[2]) != header->size) {
+        ALOGW("index: table size 0x%x does not match actual size 0x%x",
+                dtohl(words[2]), (int)header->size);
+        return NULL;
+    }
+
+    const size_t entryCount = dtohl(words[4]);
+    if ((indexDataSize - INDEX_HEADER_SIZE_BYTES) / sizeof(IndexEntry) < entryCount) {
+        ALOGW("index: %d entries do not fit in %d bytes", (int)entryCount, (int)indexDataSize);
+        return NULL;
+    }
+
+    const IndexEntry* entries = reinterpret_cast<const IndexEntry*>(
+            reinterpret_cast<const uint8_t*>(indexData) + INDEX_HEADER_SIZE_BYTES);
+
+    // Check that every entry points at a chunk of its type, within the table
+    // and its package, whose header agrees with the entry, and that the chunks
+    // are in the order the scan would have found them. Anything else means the
+    // index can't be trusted. Like the scan, this leaves type chunks to be
+    // validated on the first lookup into their type.
+    const uint8_t* base = (const uint8_t*)header->header;
+    const size_t tableSize = header->size;
+    size_t minOffset = dtohs(header->header->header.headerSize);
+    size_t packageEnd = 0;
+    size_t packageCount = 0;
+    uint8_t specTypeId = 0;
+    size_t specEntryCount = 0;
+    for (size_t i = 0; i < entryCount; i++) {
+        const IndexEntry& entry = entries[i];
+        const uint16_t ctype = dtohs(entry.chunkType);
+        const size_t offset = dtohl(entry.offset);
+        const size_t count = dtohl(entry.count);
+        if (offset < minOffset || (offset & 0x3) != 0
+                || offset > tableSize - sizeof(ResChunk_header)) {
+            ALOGW("index: entry %d has bad offset 0x%x", (int)i, (int)offset);
+            return NULL;
+        }
+        minOffset = offset + sizeof(ResChunk_header);
+
+        const ResChunk_header* chunk = (const ResChunk_header*)(base + offset);
+        if (dtohs(chunk->type) != ctype) {
+            ALOGW("index: entry %d has type 0x%x, chunk at 0x%x has type 0x%x",
+                    (int)i, ctype, (int)offset, dtohs(chunk->type));
+            return NULL;
+        }
+
+        const bool inPackage = offset < packageEnd;
+        bool valid = false;
+        if (ctype == RES_STRING_POOL_TYPE) {
+            valid = !inPackage
+                    && indexedChunkFits(chunk, sizeof(ResChunk_header), header->dataEnd)
+                    && count == dtohl(chunk->size);
+        } else if (ctype == RES_TABLE_PACKAGE_TYPE) {
+            valid = !inPackage
+                    && indexedChunkFits(chunk, sizeof(ResTable_package) - sizeof(uint32_t),
+                            header->dataEnd)
+                    && count == dtohl(chunk->size);
+            packageEnd = offset + dtohl(chunk->size);
+            packageCount++;
+            specTypeId = 0;
+        } else if (ctype == RES_TABLE_TYPE_SPEC_TYPE) {
+            const ResTable_typeSpec* typeSpec = (const ResTable_typeSpec*)chunk;
+            valid = inPackage
+                    && indexedChunkFits(chunk, sizeof(*typeSpec), base + packageEnd)
+                    && entry.typeId != 0 && entry.typeId == typeSpec->id
+                    && count == dtohl(typeSpec->entryCount)
+                    && count <= INT32_MAX / sizeof(uint32_t)
+                    && dtohs(chunk->headerSize) + sizeof(uint32_t) * count
+                            <= dtohl(chunk->size);
+            specTypeId = entry.typeId;
+            specEntryCount = count;
+        } else if (ctype == RES_TABLE_TYPE_TYPE) {
+            const ResTable_type* type = (const ResTable_type*)chunk;
+            valid = inPackage
+                    && indexedChunkFits(chunk, sizeof(ResChunk_header), base + packageEnd)
+                    && dtohl(chunk->size) >= sizeof(*type) - sizeof(ResTable_config) + 4
+                    && entry.typeId == specTypeId && entry.typeId == type->id
+                    && count == specEntryCount && count == dtohl(type->entryCount);
+        } else if (ctype == RES_TABLE_LIBRARY_TYPE) {
+            valid = inPackage
+                    && indexedChunkFits(chunk, sizeof(ResTable_lib_header), base + packageEnd)
+                    && count == dtohl(chunk->size);
+        }
+
+        if (!valid) {
+            ALOGW("index: entry %d (type 0x%x at 0x%x) does not match the table",
+                    (int)i, ctype, (int)offset);
+            return NULL;
+        }
+    }
+
+    if (packageCount != dtohl(header->header->packageCount)) {
+        ALOGW("index: found %d packages, table declares %d",
+                (int)packageCount, dtohl(header->header->packageCount));
+        return NULL;
+    }
+
+    *outEntryCount = entryCount;
+    return entries;
+}
+
+status_t ResTable::parseIndexedTable(Header* header, const IndexEntry* entries,
+        size_t entryCount, bool appAsLib, bool isSystemAsset)
+{
+    const uint8_t* base = (const uint8_t*)header->header;
+    size_t i = 0;
+    while (i < entryCount) {
+        const IndexEntry& entry = entries[i++];
+        const ResChunk_header* chunk = (const ResChunk_header*)(base + dtohl(entry.offset));
+        if (dtohs(entry.chunkType) == RES_STRING_POOL_TYPE) {
+            if (header->values.getError() != NO_ERROR) {
+                status_t err = header->values.setTo(chunk, dtohl(entry.count));
+                if (err != NO_ERROR) {
+                    return (mError=err);
+                }
+            } else {
+                ALOGW("Multiple string chunks found in resource table.");
+            }
+            continue;
+        }
+
+        // validateIndex() only allows packages and string pools at the top
+        // level; everything up to the next package belongs to this one.
+        size_t end = i;
+        while (end < entryCount && dtohs(entries[end].chunkType) != RES_TABLE_PACKAGE_TYPE
+                && dtohs(entries[end].chunkType) != RES_STRING_POOL_TYPE) {
+            end++;
+        }
+        if (parsePackage((const ResTable_package*)chunk, header, appAsLib, isSystemAsset,
+                entries + i, end - i) != NO_ERROR) {
+            return mError;
+        }
+        i = end;
+    }
+
+    mError = header->values.getError();
+    if (mError != NO_ERROR) {
+        ALOGW("No string values found in resource table!");
+    }
+    return mError;
+}
+
 status_t ResTable::getError() const
 {
     return mError;
@@ -3920,6 +4944,39 @@ void ResTable::uninit()
 
     mPackageGroups.clear();
     mHeaders.clear();
+
+    // The snapshot refers to the package groups we just deleted.
+    publishSnapshot(new ConfigSnapshot(mParams));
+}
+
+void ResTable::publishSnapshot(ConfigSnapshot* snapshot)
+{
+    AutoMutex _l(mSnapshotLock);
+    ConfigSnapshot* oldSnapshot = mSnapshot.exchange(snapshot);
+    if (oldSnapshot != NULL) {
+        mRetiredSnapshots.add(oldSnapshot);
+        mHasRetiredSnapshots.store(true);
+    }
+
+    // Readers still registered free the retired snapshots once the last of
+    // them leaves.
+    freeRetiredSnapshotsLocked();
+}
+
+void ResTable::freeRetiredSnapshotsLocked() const
+{
+    // Readers register themselves before loading mSnapshot, and snapshots
+    // are only replaced under mSnapshotLock, so if there are none right now,
+    // nobody can be using a snapshot that was replaced.
+    if (mSnapshotReaders.load() != 0) {
+        return;
+    }
+    const size_t N = mRetiredSnapshots.size();
+    for (size_t i = 0; i < N; i++) {
+        delete mRetiredSnapshots[i];
+    }
+    mRetiredSnapshots.clear();
+    mHasRetiredSnapshots.store(false);
 }
 
 bool ResTable::getResourceName(uint32_t resID, bool allowUtf8, resource_name* outName) const
@@ -4017,7 +5074,11 @@ ssize_t ResTable::getResource(uint32_t resID, Res_value* outValue, bool mayBeBag
     }
 
     // Allow overriding density
-    ResTable_config desiredConfig = mParams;
+    ResTable_config desiredConfig;
+    {
+        ScopedSnapshotReader reader(*this);
+        desiredConfig = mSnapshot.load()->params;
+    }
     if (density > 0) {
         desiredConfig.density = density;
     }
@@ -4215,6 +5276,22 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
         }
     }
 
+    // Another ResTable sharing this package group may have computed it already.
+    SharedBagCache* sharedBags = grp->getSharedBagCache(t);
+    if (sharedBags != NULL) {
+        const bag_set* set = sharedBags->find(mParams, resID);
+        if (set != NULL) {
+            if (outTypeSpecFlags != NULL) {
+                *outTypeSpecFlags = set->typeSpecFlags;
+            }
+            *outBag = (const bag_entry*)(set+1);
+            if (kDebugTableSuperNoisy) {
+                ALOGI("Found shared bag for: 0x%x\n", resID);
+            }
+            return set->numAttrs;
+        }
+    }
+
     // Bag not found, we need to compute it!
     if (!typeSet) {
         typeSet = (bag_set**)calloc(NENTRY, sizeof(bag_set*));
@@ -4276,6 +5353,14 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
         if (set == NULL) {
             return NO_MEMORY;
         }
+
+        // The bag can only be shared if its parent could be. That rules out
+        // parents from another package, which may resolve differently in
+        // other ResTables, anywhere up the chain.
+        set->shareable = sharedBags != NULL && NP >= 0
+                && Res_GETPACKAGE(resolvedParent) + 1 == grp->id
+                && (((const bag_set*)parentBag) - 1)->shareable;
+
         if (NP > 0) {
             memcpy(set+1, parentBag, NP*sizeof(bag_entry));
             set->numAttrs = NP;
@@ -4298,6 +5383,7 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
         set->numAttrs = 0;
         set->availAttrs = N;
         set->typeSpecFlags = 0;
+        set->shareable = sharedBags != NULL;
     }
 
     set->typeSpecFlags |= entry.specFlags;
@@ -4410,6 +5496,9 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
 
     // And this is it...
     typeSet[e] = set;
+    if (set && set->shareable) {
+        sharedBags->add(mParams, resID, set);
+    }
     if (set) {
         if (outTypeSpecFlags != NULL) {
             *outTypeSpecFlags = set->typeSpecFlags;
@@ -4426,12 +5515,16 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
 void ResTable::setParameters(const ResTable_config* params)
 {
     AutoMutex _lock(mLock);
-    AutoMutex _lock2(mFilteredConfigLock);
 
     if (kDebugTableGetEntry) {
         ALOGI("Setting parameters: %s\n", params->toString().string());
     }
     mParams = *params;
+
+    // Lookups keep using the current snapshot until the new one is published.
+    ConfigSnapshot* snapshot = new ConfigSnapshot(mParams);
+    std::vector<uint8_t> matchResults;
+    std::vector<uint16_t> localeRegions;
     for (size_t p = 0; p < mPackageGroups.size(); p++) {
         PackageGroup* packageGroup = mPackageGroups.editItemAt(p);
         if (kDebugTableNoisy) {
@@ -4439,6 +5532,9 @@ void ResTable::setParameters(const ResTable_config* params)
         }
         packageGroup->clearBagCache();
 
+        ByteBucketArray<TypeSnapshot>* typeSnapshots = new ByteBucketArray<TypeSnapshot>();
+        snapshot->groups.add(packageGroup, typeSnapshots);
+
         // Find which configurations match the set of parameters. This allows for a much
         // faster lookup in getEntry() if the set of values is narrowed down.
         for (size_t t = 0; t < packageGroup->types.size(); t++) {
@@ -4446,35 +5542,69 @@ void ResTable::setParameters(const ResTable_config* params)
                 continue;
             }
 
-            TypeList& typeList = packageGroup->types.editItemAt(t);
-
-            // Retrieve the cache entry for this type.
-            TypeCacheEntry& cacheEntry = packageGroup->typeCacheEntries.editItemAt(t);
+            const TypeList& typeList = packageGroup->types[t];
+            TypeSnapshot& typeSnapshot = typeSnapshots->editItemAt(t);
 
             for (size_t ts = 0; ts < typeList.size(); ts++) {
-                Type* type = typeList.editItemAt(ts);
+                const Type* type = typeList[ts];
 
-                std::shared_ptr<Vector<const ResTable_type*>> newFilteredConfigs =
-                        std::make_shared<Vector<const ResTable_type*>>();
+                // Don't load a type just to filter it; getEntry() matches
+                // the configurations of types that were not loaded yet.
+                if (!type->hasLoadedConfigs()) {
+                    typeSnapshot.filteredConfigs.add();
+                    typeSnapshot.filtered.add(false);
+                    continue;
+                }
 
-                for (size_t ti = 0; ti < type->configs.size(); ti++) {
-                    ResTable_config config;
-                    config.copyFromDtoH(type->configs[ti]->config);
+                const Vector<const ResTable_type*>& typeConfigs = type->getConfigs();
+                matchResults.resize(typeConfigs.size());
+                type->getPackedConfigs().match(mParams, matchResults.data());
 
-                    if (config.match(mParams)) {
-                        newFilteredConfigs->add(type->configs[ti]);
+                Vector<const ResTable_type*> newFilteredConfigs;
+                for (size_t ti = 0; ti < typeConfigs.size(); ti++) {
+                    if (matchResults[ti] == PackedConfigs::NO_MATCH) {
+                        continue;
+                    }
+                    if (matchResults[ti] == PackedConfigs::MAYBE_MATCH) {
+                        ResTable_config config;
+                        config.copyFromDtoH(typeConfigs[ti]->config);
+                        if (!config.match(mParams)) {
+                            continue;
+                        }
+                    }
+                    newFilteredConfigs.add(typeConfigs[ti]);
+
+                    // Only configurations in the requested language have their
+                    // regions compared by getEntry().
+                    const ResTable_config& config = typeConfigs[ti]->config;
+                    if (mParams.locale != 0 && config.language[0] == mParams.language[0]
+                            && config.language[1] == mParams.language[1]) {
+                        localeRegions.push_back(static_cast<uint8_t>(config.country[0])
+                                | (static_cast<uint8_t>(config.country[1]) << 8));
                     }
                 }
 
                 if (kDebugTableNoisy) {
                     ALOGD("Updating pkg=%zu type=%zu with %zu filtered configs",
-                          p, t, newFilteredConfigs->size());
+                          p, t, newFilteredConfigs.size());
                 }
 
-                cacheEntry.filteredConfigs.add(newFilteredConfigs);
+                typeSnapshot.filteredConfigs.add(newFilteredConfigs);
+                typeSnapshot.filtered.add(true);
             }
+
+            // Entries are resolved against the new parameters on first lookup.
+            const size_t entryCount = typeList[0]->entryCount;
+            typeSnapshot.resolvedEntries.reset(new ResolvedEntry[entryCount]);
+            typeSnapshot.resolvedEntryCount = entryCount;
+            typeSnapshot.typeCount = typeList.size();
         }
     }
+
+    snapshot->regions.build(mParams.language, mParams.localeScript, mParams.country,
+            localeRegions);
+
+    publishSnapshot(snapshot);
 }
 
 void ResTable::getParameters(ResTable_config* params) const
@@ -4662,38 +5792,33 @@ uint32_t ResTable::findEntry(const PackageGroup* group, ssize_t typeIndex, const
         size_t nameLen, uint32_t* outTypeSpecFlags) const {
     const TypeList& typeList = group->types[typeIndex];
     const size_t typeCount = typeList.size();
+    std::string key;
+    const ResStringPool* keyPool = NULL;
     for (size_t i = 0; i < typeCount; i++) {
         const Type* t = typeList[i];
-        const ssize_t ei = t->package->keyStrings.indexOfString(name, nameLen);
+
+        // Packages in a group usually share the key pool encoding, so only
+        // re-encode the name when it changes.
+        if (keyPool == NULL || keyPool->isUTF8() != t->package->keyStrings.isUTF8()) {
+            keyPool = &t->package->keyStrings;
+            key = encodeForPool(*keyPool, name, nameLen);
+        }
+
+        const ssize_t ei = t->indexOfEntryName(key);
         if (ei < 0) {
             continue;
         }
 
-        const size_t configCount = t->configs.size();
-        for (size_t j = 0; j < configCount; j++) {
-            const TypeVariant tv(t->configs[j]);
-            for (TypeVariant::iterator iter = tv.beginEntries();
-                 iter != tv.endEntries();
-                 iter++) {
-                const ResTable_entry* entry = *iter;
-                if (entry == NULL) {
-                    continue;
-                }
-
-                if (dtohl(entry->key.index) == (size_t) ei) {
-                    uint32_t resId = Res_MAKEID(group->id - 1, typeIndex, iter.index());
-                    if (outTypeSpecFlags) {
-                        Entry result;
-                        if (getEntry(group, typeIndex, iter.index(), NULL, &result) != NO_ERROR) {
-                            ALOGW("Failed to find spec flags for 0x%08x", resId);
-                            return 0;
-                        }
-                        *outTypeSpecFlags = result.specFlags;
-                    }
-                    return resId;
-                }
+        uint32_t resId = Res_MAKEID(group->id - 1, typeIndex, ei);
+        if (outTypeSpecFlags) {
+            Entry result;
+            if (getEntry(group, typeIndex, ei, NULL, &result) != NO_ERROR) {
+                ALOGW("Failed to find spec flags for 0x%08x", resId);
+                return 0;
             }
+            *outTypeSpecFlags = result.specFlags;
         }
+        return resId;
     }
     return 0;
 }
@@ -5847,9 +6972,10 @@ void ResTable::forEachConfiguration(bool ignoreMipmap, bool ignoreAndroidPackage
                     continue;
                 }
 
-                const size_t numConfigs = type->configs.size();
+                const Vector<const ResTable_type*>& typeConfigs = type->getConfigs();
+                const size_t numConfigs = typeConfigs.size();
                 for (size_t m = 0; m < numConfigs; m++) {
-                    const ResTable_type* config = type->configs[m];
+                    const ResTable_type* config = typeConfigs[m];
                     ResTable_config cfg;
                     memset(&cfg, 0, sizeof(ResTable_config));
                     cfg.copyFromDtoH(config->config);
@@ -5980,9 +7106,49 @@ status_t ResTable::getEntry(
     ResTable_config bestConfig;
     memset(&bestConfig, 0, sizeof(bestConfig));
 
-    // Iterate over the Types of each package.
     const size_t typeCount = typeList.size();
-    for (size_t i = 0; i < typeCount; i++) {
+
+    // The snapshot stays alive for as long as we are registered as a reader.
+    ScopedSnapshotReader reader(*this);
+    const ConfigSnapshot* snapshot = mSnapshot.load();
+
+    // Filtered configurations and resolved entries are only available for lookups
+    // against the parameters of this ResTable.
+    const TypeSnapshot* typeSnapshot = NULL;
+    const LocaleRegionMatrix* regions = NULL;
+    if (config != NULL && snapshot != NULL
+            && memcmp(&snapshot->params, config, sizeof(*config)) == 0) {
+        regions = &snapshot->regions;
+        const ssize_t groupIndex = snapshot->groups.indexOfKey(packageGroup);
+        if (groupIndex >= 0) {
+            typeSnapshot = &(*snapshot->groups.valueAt(groupIndex))[typeIndex];
+        }
+    }
+
+    ResolvedEntry* resolved = NULL;
+    bool foundResolved = false;
+    if (typeSnapshot != NULL
+            && typeSnapshot->typeCount == typeCount
+            && entryIndex >= 0
+            && static_cast<size_t>(entryIndex) < typeSnapshot->resolvedEntryCount) {
+        resolved = &typeSnapshot->resolvedEntries[entryIndex];
+        if (resolved->state.load(std::memory_order_acquire) == ResolvedEntry::READY) {
+            bestType = resolved->type;
+            bestOffset = resolved->offset;
+            bestPackage = resolved->package;
+            specFlags = resolved->specFlags;
+            actualTypeIndex = resolved->actualTypeIndex;
+            bestConfig.copyFromDtoH(bestType->config);
+            foundResolved = true;
+        }
+    }
+
+    static const size_t kMaxStackMatchResults = 64;
+    uint8_t stackMatchResults[kMaxStackMatchResults];
+    std::vector<uint8_t> heapMatchResults;
+
+    // Iterate over the Types of each package.
+    for (size_t i = 0; !foundResolved && i < typeCount; i++) {
         const Type* const typeSpec = typeList[i];
 
         int realEntryIndex = entryIndex;
@@ -6018,26 +7184,27 @@ status_t ResTable::getEntry(
             specFlags = -1;
         }
 
-        const Vector<const ResTable_type*>* candidateConfigs = &typeSpec->configs;
-
-        std::shared_ptr<Vector<const ResTable_type*>> filteredConfigs;
-        if (config && memcmp(&mParams, config, sizeof(mParams)) == 0) {
-            // Grab the lock first so we can safely get the current filtered list.
-            AutoMutex _lock(mFilteredConfigLock);
+        const Vector<const ResTable_type*>* candidateConfigs = NULL;
+        uint8_t* matchResults = NULL;
 
-            // This configuration is equal to the one we have previously cached for,
-            // so use the filtered configs.
-
-            const TypeCacheEntry& cacheEntry = packageGroup->typeCacheEntries[typeIndex];
-            if (i < cacheEntry.filteredConfigs.size()) {
-                if (cacheEntry.filteredConfigs[i]) {
-                    // Grab a reference to the shared_ptr so it doesn't get destroyed while
-                    // going through this list.
-                    filteredConfigs = cacheEntry.filteredConfigs[i];
-
-                    // Use this filtered list.
-                    candidateConfigs = filteredConfigs.get();
+        // This configuration is equal to the one the snapshot was built for,
+        // so use the filtered configs.
+        if (typeSnapshot != NULL && i < typeSnapshot->filtered.size()
+                && typeSnapshot->filtered[i]) {
+            candidateConfigs = &typeSnapshot->filteredConfigs[i];
+        } else {
+            candidateConfigs = &typeSpec->getConfigs();
+            if (config != NULL) {
+                // Rule out most candidates in one pass before looking at
+                // any of them.
+                const PackedConfigs& packedConfigs = typeSpec->getPackedConfigs();
+                if (packedConfigs.size() > kMaxStackMatchResults) {
+                    heapMatchResults.resize(packedConfigs.size());
+                    matchResults = heapMatchResults.data();
+                } else {
+                    matchResults = stackMatchResults;
                 }
+                packedConfigs.match(*config, matchResults);
             }
         }
 
@@ -6048,11 +7215,17 @@ status_t ResTable::getEntry(
                 continue;
             }
 
+            if (matchResults != NULL && matchResults[c] == PackedConfigs::NO_MATCH) {
+                continue;
+            }
+
             ResTable_config thisConfig;
             thisConfig.copyFromDtoH(thisType->config);
 
             // Check to make sure this one is valid for the current parameters.
-            if (config != NULL && !thisConfig.match(*config)) {
+            if (config != NULL
+                    && (matchResults == NULL || matchResults[c] != PackedConfigs::MATCH)
+                    && !thisConfig.match(*config)) {
                 continue;
             }
 
@@ -6070,7 +7243,7 @@ status_t ResTable::getEntry(
                 // Check if this one is less specific than the last found.  If so,
                 // we will skip it.  We check starting with things we most care
                 // about to those we least care about.
-                if (!thisConfig.isBetterThan(bestConfig, config)) {
+                if (!thisConfig.isBetterThan(bestConfig, config, regions)) {
                     if (!currentTypeIsOverlay || thisConfig.compare(bestConfig) != 0) {
                         continue;
                     }
@@ -6094,6 +7267,21 @@ status_t ResTable::getEntry(
         return BAD_INDEX;
     }
 
+    if (resolved != NULL && !foundResolved) {
+        // Only the first thread to get here publishes the result; any other thread
+        // resolving the same entry concurrently computed the same answer.
+        uint32_t expected = ResolvedEntry::EMPTY;
+        if (resolved->state.compare_exchange_strong(expected, ResolvedEntry::WRITING,
+                std::memory_order_acquire)) {
+            resolved->type = bestType;
+            resolved->offset = bestOffset;
+            resolved->package = bestPackage;
+            resolved->specFlags = specFlags;
+            resolved->actualTypeIndex = actualTypeIndex;
+            resolved->state.store(ResolvedEntry::READY, std::memory_order_release);
+        }
+    }
+
     bestOffset += dtohl(bestType->entriesStart);
 
     if (bestOffset > (dtohl(bestType->header.size)-sizeof(ResTable_entry))) {
@@ -6126,7 +7314,8 @@ status_t ResTable::getEntry(
 }
 
 status_t ResTable::parsePackage(const ResTable_package* const pkg,
-                                const Header* const header, bool appAsLib, bool isSystemAsset)
+                                const Header* const header, bool appAsLib, bool isSystemAsset,
+                                const IndexEntry* indexEntries, size_t indexEntryCount)
 {
     const uint8_t* base = (const uint8_t*)pkg;
     status_t err = validate_chunk(&pkg->header, sizeof(*pkg) - sizeof(pkg->typeIdOffset),
@@ -6238,6 +7427,124 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
         return (mError=err);
     }
 
+    // Creates the Type for a (validated) type spec chunk.
+    auto addTypeSpec = [&](const ResTable_typeSpec* typeSpec, uint8_t typeId,
+            size_t newEntryCount) {
+        uint8_t typeIndex = typeId - 1;
+        ssize_t idmapIndex = idmapEntries.indexOfKey(typeId);
+        if (idmapIndex >= 0) {
+            typeIndex = idmapEntries[idmapIndex].targetTypeId() - 1;
+        }
+
+        TypeList& typeList = group->types.editItemAt(typeIndex);
+        if (!typeList.isEmpty()) {
+            const Type* existingType = typeList[0];
+            if (existingType->entryCount != newEntryCount && idmapIndex < 0) {
+                ALOGW("ResTable_typeSpec entry count inconsistent: given %d, previously %d",
+                        (int) newEntryCount, (int) existingType->entryCount);
+                // We should normally abort here, but some legacy apps declare
+                // resources in the 'android' package (old bug in AAPT).
+            }
+        }
+
+        Type* t = new Type(header, package, newEntryCount);
+        t->typeSpec = typeSpec;
+        t->typeSpecFlags = (const uint32_t*)(
+                ((const uint8_t*)typeSpec) + dtohs(typeSpec->header.headerSize));
+        if (idmapIndex >= 0) {
+            t->idmapEntries = idmapEntries[idmapIndex];
+        }
+        typeList.add(t);
+        group->largestTypeId = max(group->largestTypeId, typeId);
+    };
+
+    // Adds a type chunk, which must lie before 'end', to the Type of its spec.
+    // The chunk is only validated on the first lookup into the type.
+    auto addType = [&](const ResTable_type* type, uint8_t typeId,
+            size_t newEntryCount, const uint8_t* end) -> status_t {
+        uint8_t typeIndex = typeId - 1;
+        ssize_t idmapIndex = idmapEntries.indexOfKey(typeId);
+        if (idmapIndex >= 0) {
+            typeIndex = idmapEntries[idmapIndex].targetTypeId() - 1;
+        }
+
+        TypeList& typeList = group->types.editItemAt(typeIndex);
+        if (typeList.isEmpty()) {
+            ALOGE("No TypeSpec for type %d", typeId);
+            return (mError=BAD_TYPE);
+        }
+
+        Type* t = typeList.editItemAt(typeList.size() - 1);
+        if (newEntryCount != t->entryCount) {
+            ALOGE("ResTable_type entry count inconsistent: given %d, previously %d",
+                (int)newEntryCount, (int)t->entryCount);
+            return (mError=BAD_TYPE);
+        }
+
+        if (t->package != package) {
+            ALOGE("No TypeSpec for type %d", typeId);
+            return (mError=BAD_TYPE);
+        }
+
+        t->addPendingConfig(type, end);
+        return NO_ERROR;
+    };
+
+    auto addLibrary = [&](const ResTable_lib_header* lib) -> status_t {
+        if (group->dynamicRefTable.entries().size() == 0) {
+            status_t err = group->dynamicRefTable.load(lib);
+            if (err != NO_ERROR) {
+                return (mError=err);
+            }
+
+            // Fill in the reference table with the entries we already know about.
+            size_t N = mPackageGroups.size();
+            for (size_t i = 0; i < N; i++) {
+                group->dynamicRefTable.addMapping(mPackageGroups[i]->name, mPackageGroups[i]->id);
+            }
+        } else {
+            ALOGW("Found multiple library tables, ignoring...");
+        }
+        return NO_ERROR;
+    };
+
+    if (indexEntries != NULL) {
+        // The index lists the chunks the scan below would visit, and
+        // validateIndex() has checked each of them against its entry. As in
+        // the scan, type chunks are validated on the first lookup.
+        const uint8_t* tableBase = (const uint8_t*)header->header;
+        const uint8_t* pkgEnd = base + dtohl(pkg->header.size);
+        for (size_t i = 0; i < indexEntryCount; i++) {
+            const IndexEntry& entry = indexEntries[i];
+            const uint8_t* chunk = tableBase + dtohl(entry.offset);
+            const size_t newEntryCount = dtohl(entry.count);
+            switch (dtohs(entry.chunkType)) {
+                case RES_TABLE_TYPE_SPEC_TYPE:
+                    if (newEntryCount > 0) {
+                        addTypeSpec((const ResTable_typeSpec*)chunk, entry.typeId,
+                                newEntryCount);
+                    }
+                    break;
+                case RES_TABLE_TYPE_TYPE:
+                    if (newEntryCount > 0) {
+                        err = addType((const ResTable_type*)chunk, entry.typeId,
+                                newEntryCount, pkgEnd);
+                        if (err != NO_ERROR) {
+                            return err;
+                        }
+                    }
+                    break;
+                case RES_TABLE_LIBRARY_TYPE:
+                    err = addLibrary((const ResTable_lib_header*)chunk);
+                    if (err != NO_ERROR) {
+                        return err;
+                    }
+                    break;
+            }
+        }
+        return NO_ERROR;
+    }
+
     // Iterate through all chunks.
     const ResChunk_header* chunk =
         (const ResChunk_header*)(((const uint8_t*)pkg)
@@ -6286,45 +7593,21 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
             }
 
             if (newEntryCount > 0) {
-                uint8_t typeIndex = typeSpec->id - 1;
-                ssize_t idmapIndex = idmapEntries.indexOfKey(typeSpec->id);
-                if (idmapIndex >= 0) {
-                    typeIndex = idmapEntries[idmapIndex].targetTypeId() - 1;
-                }
-
-                TypeList& typeList = group->types.editItemAt(typeIndex);
-                if (!typeList.isEmpty()) {
-                    const Type* existingType = typeList[0];
-                    if (existingType->entryCount != newEntryCount && idmapIndex < 0) {
-                        ALOGW("ResTable_typeSpec entry count inconsistent: given %d, previously %d",
-                                (int) newEntryCount, (int) existingType->entryCount);
-                        // We should normally abort here, but some legacy apps declare
-                        // resources in the 'android' package (old bug in AAPT).
-                    }
-                }
-
-                Type* t = new Type(header, package, newEntryCount);
-                t->typeSpec = typeSpec;
-                t->typeSpecFlags = (const uint32_t*)(
-                        ((const uint8_t*)typeSpec) + dtohs(typeSpec->header.headerSize));
-                if (idmapIndex >= 0) {
-                    t->idmapEntries = idmapEntries[idmapIndex];
-                }
-                typeList.add(t);
-                group->largestTypeId = max(group->largestTypeId, typeSpec->id);
+                addTypeSpec(typeSpec, typeSpec->id, newEntryCount);
             } else {
                 ALOGV("Skipping empty ResTable_typeSpec for type %d", typeSpec->id);
             }
 
         } else if (ctype == RES_TABLE_TYPE_TYPE) {
+            // Only the fields needed to file the chunk under its type are
+            // read here; the rest of it is validated by validate_type() on
+            // the first lookup into the type.
             const ResTable_type* type = (const ResTable_type*)(chunk);
-            err = validate_chunk(&type->header, sizeof(*type)-sizeof(ResTable_config)+4,
-                                 endPos, "ResTable_type");
-            if (err != NO_ERROR) {
-                return (mError=err);
+            if (csize < sizeof(*type)-sizeof(ResTable_config)+4) {
+                ALOGW("ResTable_type size 0x%x is too small.", (int)csize);
+                return (mError=BAD_TYPE);
             }
 
-            const uint32_t typeSize = dtohl(type->header.size);
             const size_t newEntryCount = dtohl(type->entryCount);
 
             if (kDebugLoadTableNoisy) {
@@ -6332,20 +7615,7 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
                         (void*)(base-(const uint8_t*)chunk),
                         dtohs(type->header.type),
                         dtohs(type->header.headerSize),
-                        typeSize);
-            }
-            if (dtohs(type->header.headerSize)+(sizeof(uint32_t)*newEntryCount) > typeSize) {
-                ALOGW("ResTable_type entry index to %p extends beyond chunk end 0x%x.",
-                        (void*)(dtohs(type->header.headerSize) + (sizeof(uint32_t)*newEntryCount)),
-                        typeSize);
-                return (mError=BAD_TYPE);
-            }
-
-            if (newEntryCount != 0
-                && dtohl(type->entriesStart) > (typeSize-sizeof(ResTable_entry))) {
-                ALOGW("ResTable_type entriesStart at 0x%x extends beyond chunk end 0x%x.",
-                     dtohl(type->entriesStart), typeSize);
-                return (mError=BAD_TYPE);
+                        dtohl(type->header.size));
             }
 
             if (type->id == 0) {
@@ -6354,56 +7624,18 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
             }
 
             if (newEntryCount > 0) {
-                uint8_t typeIndex = type->id - 1;
-                ssize_t idmapIndex = idmapEntries.indexOfKey(type->id);
-                if (idmapIndex >= 0) {
-                    typeIndex = idmapEntries[idmapIndex].targetTypeId() - 1;
-                }
-
-                TypeList& typeList = group->types.editItemAt(typeIndex);
-                if (typeList.isEmpty()) {
-                    ALOGE("No TypeSpec for type %d", type->id);
-                    return (mError=BAD_TYPE);
-                }
-
-                Type* t = typeList.editItemAt(typeList.size() - 1);
-                if (newEntryCount != t->entryCount) {
-                    ALOGE("ResTable_type entry count inconsistent: given %d, previously %d",
-                        (int)newEntryCount, (int)t->entryCount);
-                    return (mError=BAD_TYPE);
-                }
-
-                if (t->package != package) {
-                    ALOGE("No TypeSpec for type %d", type->id);
-                    return (mError=BAD_TYPE);
-                }
-
-                t->configs.add(type);
-
-                if (kDebugTableGetEntry) {
-                    ResTable_config thisConfig;
-                    thisConfig.copyFromDtoH(type->config);
-                    ALOGI("Adding config to type %d: %s\n", type->id,
-                            thisConfig.toString().string());
+                err = addType(type, type->id, newEntryCount, endPos);
+                if (err != NO_ERROR) {
+                    return err;
                 }
             } else {
                 ALOGV("Skipping empty ResTable_type for type %d", type->id);
             }
 
         } else if (ctype == RES_TABLE_LIBRARY_TYPE) {
-            if (group->dynamicRefTable.entries().size() == 0) {
-                status_t err = group->dynamicRefTable.load((const ResTable_lib_header*) chunk);
-                if (err != NO_ERROR) {
-                    return (mError=err);
-                }
-
-                // Fill in the reference table with the entries we already know about.
-                size_t N = mPackageGroups.size();
-                for (size_t i = 0; i < N; i++) {
-                    group->dynamicRefTable.addMapping(mPackageGroups[i]->name, mPackageGroups[i]->id);
-                }
-            } else {
-                ALOGW("Found multiple library tables, ignoring...");
+            err = addLibrary((const ResTable_lib_header*) chunk);
+            if (err != NO_ERROR) {
+                return err;
             }
         } else {
             status_t err = validate_chunk(chunk, sizeof(ResChunk_header),
@@ -6755,6 +7987,104 @@ bool ResTable::getIdmapInfo(const void* idmap, size_t sizeBytes,
     return true;
 }
 
+status_t ResTable::createIndex(const void* data, size_t size, uint32_t tableCrc,
+        void** outData, size_t* outSize)
+{
+    // Only index tables that load cleanly. Loading defers the checks on
+    // type chunks, so those are validated as they are recorded below.
+    ResTable table;
+    status_t err = table.add(data, size);
+    if (err != NO_ERROR) {
+        ALOGW("index: cannot index a table that fails to load (%d)", err);
+        return err;
+    }
+
+    const Header* header = table.mHeaders[0];
+    const uint8_t* base = (const uint8_t*)header->header;
+    Vector<IndexEntry> entries;
+    auto addEntry = [&](const ResChunk_header* chunk, uint8_t typeId, size_t count) {
+        IndexEntry entry;
+        entry.chunkType = htods(dtohs(chunk->type));
+        entry.typeId = typeId;
+        entry.res0 = 0;
+        entry.offset = htodl(static_cast<uint32_t>((const uint8_t*)chunk - base));
+        entry.count = htodl(static_cast<uint32_t>(count));
+        entries.add(entry);
+    };
+
+    const ResChunk_header* chunk = (const ResChunk_header*)(
+            base + dtohs(header->header->header.headerSize));
+    while ((const uint8_t*)chunk <= header->dataEnd - sizeof(ResChunk_header)
+            && (const uint8_t*)chunk <= header->dataEnd - dtohl(chunk->size)) {
+        const uint16_t ctype = dtohs(chunk->type);
+        if (ctype == RES_STRING_POOL_TYPE) {
+            addEntry(chunk, 0, dtohl(chunk->size));
+        } else if (ctype == RES_TABLE_PACKAGE_TYPE) {
+            const ResTable_package* pkg = (const ResTable_package*)chunk;
+            addEntry(chunk, 0, dtohl(chunk->size));
+
+            const uint8_t* endPos = (const uint8_t*)pkg + dtohl(pkg->header.size);
+            const ResChunk_header* child = (const ResChunk_header*)(
+                    (const uint8_t*)pkg + dtohs(pkg->header.headerSize));
+            while ((const uint8_t*)child <= endPos - sizeof(ResChunk_header)
+                    && (const uint8_t*)child <= endPos - dtohl(child->size)) {
+                const uint16_t childType = dtohs(child->type);
+                if (childType == RES_TABLE_TYPE_SPEC_TYPE) {
+                    const ResTable_typeSpec* typeSpec = (const ResTable_typeSpec*)child;
+                    addEntry(child, typeSpec->id, dtohl(typeSpec->entryCount));
+                } else if (childType == RES_TABLE_TYPE_TYPE) {
+                    // Loading the table only validated the type specs.
+                    const ResTable_type* type = (const ResTable_type*)child;
+                    err = validate_type(type, endPos);
+                    if (err != NO_ERROR) {
+                        return err;
+                    }
+                    addEntry(child, type->id, dtohl(type->entryCount));
+                } else if (childType == RES_TABLE_LIBRARY_TYPE) {
+                    addEntry(child, 0, dtohl(child->size));
+                }
+                child = (const ResChunk_header*)((const uint8_t*)child + dtohl(child->size));
+            }
+        }
+        chunk = (const ResChunk_header*)((const uint8_t*)chunk + dtohl(chunk->size));
+    }
+
+    *outSize = INDEX_HEADER_SIZE_BYTES + entries.size() * sizeof(IndexEntry);
+    if ((*outData = malloc(*outSize)) == NULL) {
+        return NO_MEMORY;
+    }
+
+    uint32_t* words = (uint32_t*)*outData;
+    *words++ = htodl(INDEX_MAGIC);
+    *words++ = htodl(INDEX_CURRENT_VERSION);
+    *words++ = htodl(static_cast<uint32_t>(header->size));
+    *words++ = htodl(tableCrc);
+    *words++ = htodl(static_cast<uint32_t>(entries.size()));
+    if (!entries.isEmpty()) {
+        memcpy(words, entries.array(), entries.size() * sizeof(IndexEntry));
+    }
+    return NO_ERROR;
+}
+
+bool ResTable::getIndexInfo(const void* index, size_t size,
+        uint32_t* pVersion, uint32_t* pTableSize, uint32_t* pTableCrc)
+{
+    const uint32_t* words = (const uint32_t*)index;
+    if (!assertIndexHeader(words, size)) {
+        return false;
+    }
+    if (pVersion) {
+        *pVersion = dtohl(words[1]);
+    }
+    if (pTableSize) {
+        *pTableSize = dtohl(words[2]);
+    }
+    if (pTableCrc) {
+        *pTableCrc = dtohl(words[3]);
+    }
+    return true;
+}
+
 
 #define CHAR16_TO_CSTR(c16, len) (String8(String16(c16,len)).string())
 
@@ -6931,7 +8261,7 @@ void ResTable::print(bool inclValues) const
                 continue;
             }
             const Type* typeConfigs = typeList[0];
-            const size_t NTC = typeConfigs->configs.size();
+            const size_t NTC = typeConfigs->getConfigs().size();
             printf("    type %d configCount=%d entryCount=%d\n",
                    (int)typeIndex, (int)NTC, (int)typeConfigs->entryCount);
             if (typeConfigs->typeSpecFlags != NULL) {
@@ -6971,7 +8301,7 @@ void ResTable::print(bool inclValues) const
                 }
             }
             for (size_t configIndex=0; configIndex<NTC; configIndex++) {
-                const ResTable_type* type = typeConfigs->configs[configIndex];
+                const ResTable_type* type = typeConfigs->getConfigs()[configIndex];
                 if ((((uint64_t)type)&0x3) != 0) {
                     printf("      NON-INTEGER ResTable_type ADDRESS: %p\n", type);
                     continue;
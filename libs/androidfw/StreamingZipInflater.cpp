@@ -44,6 +44,10 @@
 static const bool kIsDebug = false;
 
 static inline size_t min_of(size_t a, size_t b) { return (a < b) ? a : b; }
+static inline size_t max_of(size_t a, size_t b) { return (a > b) ? a : b; }
+
+// size of the inflate window a checkpoint has to keep
+static const size_t kWindowSize = 1 << MAX_WBITS;
 
 using namespace android;
 
@@ -64,6 +68,7 @@ StreamingZipInflater::StreamingZipInflater(int fd, off64_t compDataStart,
     mOutBufSize = StreamingZipInflater::OUTPUT_CHUNK_SIZE;
     mOutBuf = new uint8_t[mOutBufSize];
 
+    setCheckpointBudget(DEFAULT_CHECKPOINT_BUDGET);
     initInflateState();
 }
 
@@ -82,6 +87,7 @@ StreamingZipInflater::StreamingZipInflater(FileMap* dataMap, size_t uncompSize)
     mOutBufSize = StreamingZipInflater::OUTPUT_CHUNK_SIZE;
     mOutBuf = new uint8_t[mOutBufSize];
 
+    setCheckpointBudget(DEFAULT_CHECKPOINT_BUDGET);
     initInflateState();
 }
 
@@ -181,7 +187,10 @@ ssize_t StreamingZipInflater::read(void* outBuf, size_t count) {
                 result = inflateInit2(&mInflateState, -MAX_WBITS);
                 mStreamNeedsInit = false;
             }
-            if (result == Z_OK) result = ::inflate(&mInflateState, Z_SYNC_FLUSH);
+            if (result == Z_OK) {
+                // Z_BLOCK stops at deflate block boundaries, where checkpoints can be taken
+                result = ::inflate(&mInflateState, mMaxCheckpoints > 0 ? Z_BLOCK : Z_SYNC_FLUSH);
+            }
             if (result < 0) {
                 // Whoops, inflation failed
                 ALOGE("Error inflating asset: %d", result);
@@ -198,6 +207,10 @@ ssize_t StreamingZipInflater::read(void* outBuf, size_t count) {
                 // Note how much data we got, and off we go
                 mOutDeliverable = 0;
                 mOutLastDecoded = mOutBufSize - mInflateState.avail_out;
+
+                if (result == Z_OK) {
+                    maybeAddCheckpoint();
+                }
             }
         }
     }
@@ -227,18 +240,139 @@ int StreamingZipInflater::readNextChunk() {
     return 0;
 }
 
-// seeking backwards requires uncompressing fom the beginning, so is very
-// expensive.  seeking forwards only requires uncompressing from the current
-// position to the destination.
+void StreamingZipInflater::setCheckpointBudget(size_t bytes) {
+    mMaxCheckpoints = bytes / (kWindowSize + sizeof(Checkpoint));
+    if (mCheckpoints.size() > mMaxCheckpoints) {
+        mCheckpoints.resize(mMaxCheckpoints);
+    }
+    updateCheckpointSpan();
+}
+
+void StreamingZipInflater::updateCheckpointSpan() {
+    // spread the checkpoints we can afford evenly over the whole blob
+    mCheckpointSpan = max_of(MIN_CHECKPOINT_SPAN, mOutTotalSize / (mMaxCheckpoints + 1));
+}
+
+/*
+ * Called after each successful inflate() call.  If inflate stopped right after
+ * the end of a block that isn't the last one, far enough past the previous
+ * checkpoint, remember everything needed to restart inflating from here: the
+ * input and output offsets, the bits of the last input byte that belong to the
+ * next block, and the window of recent output the next blocks may refer to.
+ */
+void StreamingZipInflater::maybeAddCheckpoint() {
+    if (mCheckpoints.size() >= mMaxCheckpoints) {
+        return;
+    }
+    const int dataType = mInflateState.data_type;
+    if ((dataType & 128) == 0 || (dataType & 64) != 0) {
+        return;
+    }
+
+    // everything decoded before this call has been delivered already
+    const off64_t outOffset = mOutCurPosition + mOutLastDecoded;
+    const off64_t lastOffset = mCheckpoints.empty() ? 0 : mCheckpoints.back().outOffset;
+    if (outOffset >= (off64_t) mOutTotalSize
+            || outOffset < lastOffset + (off64_t) mCheckpointSpan) {
+        return;
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.outOffset = outOffset;
+    checkpoint.inOffset = (mDataMap == NULL ? mInNextChunkOffset : mInTotalSize)
+            - mInflateState.avail_in;
+    checkpoint.bits = dataType & 7;
+    checkpoint.lastByte = 0;
+    if (checkpoint.bits != 0) {
+        if (mInflateState.next_in == (Bytef*) mInBuf) {
+            // the partial byte was in the previous input chunk; try the next boundary
+            return;
+        }
+        checkpoint.lastByte = mInflateState.next_in[-1];
+    }
+    checkpoint.window.resize(kWindowSize);
+    uInt windowSize = kWindowSize;
+    if (inflateGetDictionary(&mInflateState, checkpoint.window.data(), &windowSize) != Z_OK) {
+        return;
+    }
+    checkpoint.window.resize(windowSize);
+
+    ALOGV("Checkpoint at %" PRId64 " (compressed %zu)", (int64_t) outOffset, checkpoint.inOffset);
+    mCheckpoints.push_back(checkpoint);
+}
+
+/*
+ * Point the inflate state at a checkpoint, so that the next read() continues
+ * from its output offset.  On failure the state is rewound to the beginning.
+ */
+bool StreamingZipInflater::resumeFromCheckpoint(const Checkpoint& checkpoint) {
+    if (!mStreamNeedsInit) {
+        ::inflateEnd(&mInflateState);
+    }
+    initInflateState();
+
+    if (mDataMap == NULL) {
+        if (::lseek(mFd, mInFileStart + checkpoint.inOffset, SEEK_SET) < 0) {
+            ALOGE("Unable to seek in asset data: %s", strerror(errno));
+            initInflateState();
+            return false;
+        }
+        mInNextChunkOffset = checkpoint.inOffset;
+    } else {
+        mInflateState.next_in = (Bytef*) mInBuf + checkpoint.inOffset;
+        mInflateState.avail_in = mInBufSize - checkpoint.inOffset;
+    }
+
+    int result = inflateInit2(&mInflateState, -MAX_WBITS);
+    if (result == Z_OK) {
+        mStreamNeedsInit = false;
+        if (checkpoint.bits != 0) {
+            result = inflatePrime(&mInflateState, checkpoint.bits,
+                    checkpoint.lastByte >> (8 - checkpoint.bits));
+        }
+        if (result == Z_OK) {
+            result = inflateSetDictionary(&mInflateState, checkpoint.window.data(),
+                    checkpoint.window.size());
+        }
+    }
+    if (result != Z_OK) {
+        ALOGE("Unable to resume inflating asset: %d", result);
+        if (!mStreamNeedsInit) {
+            ::inflateEnd(&mInflateState);
+        }
+        initInflateState();
+        return false;
+    }
+
+    mOutCurPosition = checkpoint.outOffset;
+    return true;
+}
+
+// seeking backwards resumes from the closest checkpoint before the destination,
+// or uncompresses from the beginning when there is none.  seeking forwards only
+// requires uncompressing from the current position to the destination, unless a
+// checkpoint lies in between.
 off64_t StreamingZipInflater::seekAbsolute(off64_t absoluteInputPosition) {
-    if (absoluteInputPosition < mOutCurPosition) {
+    const Checkpoint* checkpoint = NULL;
+    for (size_t i = mCheckpoints.size(); i > 0; i--) {
+        if (mCheckpoints[i - 1].outOffset <= absoluteInputPosition) {
+            checkpoint = &mCheckpoints[i - 1];
+            break;
+        }
+    }
+
+    if (checkpoint != NULL && (absoluteInputPosition < mOutCurPosition
+            || checkpoint->outOffset > mOutCurPosition)) {
+        // on failure this rewinds to the beginning, which the read below copes with
+        resumeFromCheckpoint(*checkpoint);
+    } else if (absoluteInputPosition < mOutCurPosition) {
         // rewind and reprocess the data from the beginning
         if (!mStreamNeedsInit) {
             ::inflateEnd(&mInflateState);
         }
         initInflateState();
-        read(NULL, absoluteInputPosition);
-    } else if (absoluteInputPosition > mOutCurPosition) {
+    }
+    if (absoluteInputPosition > mOutCurPosition) {
         read(NULL, absoluteInputPosition - mOutCurPosition);
     }
     // else if the target position *is* our current position, do nothing
@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "StyleResolver"
+
+#include <androidfw/AttributeFinder.h>
+#include <androidfw/StyleResolver.h>
+#include <utils/Log.h>
+
+namespace android {
+
+static const bool kDebugStyles = false;
+
+// Marks values that did not come from a string block (XML attributes and
+// explicit input values); these are reported to Java with a cookie of -1.
+static const ssize_t kXmlBlock = 0x10000000;
+
+namespace {
+
+class XmlAttributeFinder : public BackTrackingAttributeFinder<XmlAttributeFinder,
+        const ResXMLParser::AttributeIndexEntry*> {
+public:
+    XmlAttributeFinder(const ResXMLParser::AttributeIndexEntry* start,
+            const ResXMLParser::AttributeIndexEntry* end)
+        : BackTrackingAttributeFinder(start, end) {}
+
+    inline uint32_t getAttribute(const ResXMLParser::AttributeIndexEntry* entry) const {
+        return entry->resId;
+    }
+};
+
+class BagAttributeFinder : public BackTrackingAttributeFinder<BagAttributeFinder, const ResTable::bag_entry*> {
+public:
+    BagAttributeFinder(const ResTable::bag_entry* start, const ResTable::bag_entry* end)
+        : BackTrackingAttributeFinder(start, end) {}
+
+    inline uint32_t getAttribute(const ResTable::bag_entry* entry) const {
+        return entry->map.name.ident;
+    }
+};
+
+} // namespace
+
+struct StyleResolver::Sources {
+    Sources()
+        : srcValues(NULL), srcValuesLength(0), xmlParser(NULL),
+          styleStart(NULL), styleEnd(NULL), styleTypeSetFlags(0),
+          defStyleStart(NULL), defStyleEnd(NULL), defStyleTypeSetFlags(0) {}
+
+    const uint32_t* srcValues;
+    size_t srcValuesLength;
+
+    const ResXMLParser* xmlParser;
+
+    const ResTable::bag_entry* styleStart;
+    const ResTable::bag_entry* styleEnd;
+    uint32_t styleTypeSetFlags;
+
+    const ResTable::bag_entry* defStyleStart;
+    const ResTable::bag_entry* defStyleEnd;
+    uint32_t defStyleTypeSetFlags;
+};
+
+StyleResolver::StyleResolver(const ResTable::Theme& theme)
+    : mTheme(theme) {
+}
+
+uint32_t StyleResolver::findDefStyle(uint32_t defStyleAttr, uint32_t defStyleRes,
+        uint32_t* outTypeSetFlags) const {
+    *outTypeSetFlags = 0;
+    if (defStyleAttr != 0) {
+        Res_value value;
+        if (mTheme.getAttribute(defStyleAttr, &value, outTypeSetFlags) >= 0) {
+            if (value.dataType == Res_value::TYPE_REFERENCE) {
+                return value.data;
+            }
+        }
+    }
+    return defStyleRes;
+}
+
+void StyleResolver::resolveAttrs(uint32_t defStyleAttr, uint32_t defStyleRes,
+        const uint32_t* srcValues, size_t srcValuesLength,
+        const uint32_t* attrs, size_t attrsLength,
+        uint32_t* outValues, uint32_t* outIndices) const {
+    if (kDebugStyles) {
+        ALOGI("RESOLVE ATTRS: theme=%p defStyleAttr=0x%x defStyleRes=0x%x",
+                &mTheme, defStyleAttr, defStyleRes);
+    }
+
+    Sources sources;
+    sources.srcValues = srcValues;
+    sources.srcValuesLength = srcValues != NULL ? srcValuesLength : 0;
+
+    uint32_t defStyleBagTypeSetFlags = 0;
+    defStyleRes = findDefStyle(defStyleAttr, defStyleRes, &defStyleBagTypeSetFlags);
+
+    const ResTable& res = mTheme.getResTable();
+    res.lock();
+
+    ssize_t bagOff = defStyleRes != 0
+            ? res.getBagLocked(defStyleRes, &sources.defStyleStart,
+                    &sources.defStyleTypeSetFlags)
+            : -1;
+    sources.defStyleTypeSetFlags |= defStyleBagTypeSetFlags;
+    sources.defStyleEnd = sources.defStyleStart + (bagOff >= 0 ? bagOff : 0);
+
+    resolve(sources, attrs, attrsLength, outValues, outIndices);
+
+    res.unlock();
+}
+
+void StyleResolver::applyStyle(ResXMLParser* xmlParser, uint32_t defStyleAttr,
+        uint32_t defStyleRes, const uint32_t* attrs, size_t attrsLength,
+        uint32_t* outValues, uint32_t* outIndices) const {
+    if (kDebugStyles) {
+        ALOGI("APPLY STYLE: theme=%p defStyleAttr=0x%x defStyleRes=0x%x xml=%p",
+                &mTheme, defStyleAttr, defStyleRes, xmlParser);
+    }
+
+    Sources sources;
+    sources.xmlParser = xmlParser;
+
+    uint32_t defStyleBagTypeSetFlags = 0;
+    defStyleRes = findDefStyle(defStyleAttr, defStyleRes, &defStyleBagTypeSetFlags);
+
+    // Retrieve the style class associated with the current XML tag.
+    uint32_t style = 0;
+    uint32_t styleBagTypeSetFlags = 0;
+    if (xmlParser != NULL) {
+        Res_value value;
+        ssize_t idx = xmlParser->indexOfStyle();
+        if (idx >= 0 && xmlParser->getAttributeValue(idx, &value) >= 0) {
+            if (value.dataType == Res_value::TYPE_ATTRIBUTE) {
+                if (mTheme.getAttribute(value.data, &value, &styleBagTypeSetFlags) < 0) {
+                    value.dataType = Res_value::TYPE_NULL;
+                }
+            }
+            if (value.dataType == Res_value::TYPE_REFERENCE) {
+                style = value.data;
+            }
+        }
+    }
+
+    const ResTable& res = mTheme.getResTable();
+    res.lock();
+
+    ssize_t bagOff = defStyleRes != 0
+            ? res.getBagLocked(defStyleRes, &sources.defStyleStart,
+                    &sources.defStyleTypeSetFlags)
+            : -1;
+    sources.defStyleTypeSetFlags |= defStyleBagTypeSetFlags;
+    sources.defStyleEnd = sources.defStyleStart + (bagOff >= 0 ? bagOff : 0);
+
+    bagOff = style != 0
+            ? res.getBagLocked(style, &sources.styleStart, &sources.styleTypeSetFlags)
+            : -1;
+    sources.styleTypeSetFlags |= styleBagTypeSetFlags;
+    sources.styleEnd = sources.styleStart + (bagOff >= 0 ? bagOff : 0);
+
+    resolve(sources, attrs, attrsLength, outValues, outIndices);
+
+    res.unlock();
+}
+
+void StyleResolver::resolve(Sources& sources, const uint32_t* attrs, size_t attrsLength,
+        uint32_t* outValues, uint32_t* outIndices) const {
+    const ResTable& res = mTheme.getResTable();
+
+    // Every source is sorted the same way as attrs, so each finder only ever
+    // moves forward (modulo package boundaries) as we walk the attributes.
+    size_t xmlAttrCount = 0;
+    const ResXMLParser::AttributeIndexEntry* const xmlAttrStart = sources.xmlParser != NULL
+            ? sources.xmlParser->getSortedAttributes(&xmlAttrCount) : NULL;
+    const ResXMLParser::AttributeIndexEntry* const xmlAttrEnd = xmlAttrStart + xmlAttrCount;
+    XmlAttributeFinder xmlAttrFinder(xmlAttrStart, xmlAttrEnd);
+    BagAttributeFinder styleAttrFinder(sources.styleStart, sources.styleEnd);
+    BagAttributeFinder defStyleAttrFinder(sources.defStyleStart, sources.defStyleEnd);
+
+    ResTable_config config;
+    Res_value value;
+    uint32_t indicesIdx = 0;
+    uint32_t* dest = outValues;
+    for (size_t ii = 0; ii < attrsLength; ii++) {
+        const uint32_t curIdent = attrs[ii];
+
+        if (kDebugStyles) {
+            ALOGI("RETRIEVING ATTR 0x%08x...", curIdent);
+        }
+
+        // Try to find a value for this attribute...  we prioritize values
+        // coming from, first input values or XML attributes, then XML style,
+        // then default style, and finally the theme.
+        value.dataType = Res_value::TYPE_NULL;
+        value.data = Res_value::DATA_NULL_UNDEFINED;
+        ssize_t block = -1;
+        uint32_t typeSetFlags = 0;
+        config.density = 0;
+
+        if (ii < sources.srcValuesLength && sources.srcValues[ii] != 0) {
+            block = kXmlBlock;
+            value.dataType = Res_value::TYPE_ATTRIBUTE;
+            value.data = sources.srcValues[ii];
+            if (kDebugStyles) {
+                ALOGI("-> From values: type=0x%x, data=0x%08x", value.dataType, value.data);
+            }
+        } else if (sources.xmlParser != NULL) {
+            const ResXMLParser::AttributeIndexEntry* const xmlAttrEntry =
+                    xmlAttrFinder.find(curIdent);
+            if (xmlAttrEntry != xmlAttrEnd) {
+                block = kXmlBlock;
+                sources.xmlParser->getAttributeValue(xmlAttrEntry->index, &value);
+                if (kDebugStyles) {
+                    ALOGI("-> From XML: type=0x%x, data=0x%08x", value.dataType, value.data);
+                }
+            }
+        }
+
+        if (value.dataType == Res_value::TYPE_NULL) {
+            const ResTable::bag_entry* const styleAttrEntry = styleAttrFinder.find(curIdent);
+            if (styleAttrEntry != sources.styleEnd) {
+                block = styleAttrEntry->stringBlock;
+                typeSetFlags = sources.styleTypeSetFlags;
+                value = styleAttrEntry->map.value;
+                if (kDebugStyles) {
+                    ALOGI("-> From style: type=0x%x, data=0x%08x", value.dataType, value.data);
+                }
+            }
+        }
+
+        if (value.dataType == Res_value::TYPE_NULL) {
+            const ResTable::bag_entry* const defStyleAttrEntry =
+                    defStyleAttrFinder.find(curIdent);
+            if (defStyleAttrEntry != sources.defStyleEnd) {
+                block = defStyleAttrEntry->stringBlock;
+                typeSetFlags = sources.defStyleTypeSetFlags;
+                value = defStyleAttrEntry->map.value;
+                if (kDebugStyles) {
+                    ALOGI("-> From def style: type=0x%x, data=0x%08x", value.dataType,
+                            value.data);
+                }
+            }
+        }
+
+        uint32_t resid = 0;
+        if (value.dataType != Res_value::TYPE_NULL) {
+            // Take care of resolving the found resource to its final value.
+            ssize_t newBlock = mTheme.resolveAttributeReference(&value, block,
+                    &resid, &typeSetFlags, &config);
+            if (newBlock >= 0) {
+                block = newBlock;
+            }
+            if (kDebugStyles) {
+                ALOGI("-> Resolved attr: type=0x%x, data=0x%08x", value.dataType, value.data);
+            }
+        } else {
+            // If we still don't have a value for this attribute, try to find
+            // it in the theme!
+            ssize_t newBlock = mTheme.getAttribute(curIdent, &value, &typeSetFlags);
+            if (newBlock >= 0) {
+                if (kDebugStyles) {
+                    ALOGI("-> From theme: type=0x%x, data=0x%08x", value.dataType, value.data);
+                }
+                block = newBlock;
+                newBlock = res.resolveReference(&value, block, &resid,
+                        &typeSetFlags, &config);
+                if (newBlock >= 0) {
+                    block = newBlock;
+                }
+                if (kDebugStyles) {
+                    ALOGI("-> Resolved theme: type=0x%x, data=0x%08x", value.dataType,
+                            value.data);
+                }
+            }
+        }
+
+        // Deal with the special @null value -- it turns back to TYPE_NULL.
+        if (value.dataType == Res_value::TYPE_REFERENCE && value.data == 0) {
+            if (kDebugStyles) {
+                ALOGI("-> Setting to @null!");
+            }
+            value.dataType = Res_value::TYPE_NULL;
+            value.data = Res_value::DATA_NULL_UNDEFINED;
+            block = kXmlBlock;
+        }
+
+        if (kDebugStyles) {
+            ALOGI("Attribute 0x%08x: type=0x%x, data=0x%08x", curIdent, value.dataType,
+                    value.data);
+        }
+
+        dest[STYLE_TYPE] = value.dataType;
+        dest[STYLE_DATA] = value.data;
+        dest[STYLE_ASSET_COOKIE] = block >= 0 && block != kXmlBlock
+                ? static_cast<uint32_t>(res.getTableCookie(block))
+                : static_cast<uint32_t>(-1);
+        dest[STYLE_RESOURCE_ID] = resid;
+        dest[STYLE_CHANGING_CONFIGURATIONS] = typeSetFlags;
+        dest[STYLE_DENSITY] = config.density;
+
+        if (outIndices != NULL && value.dataType != Res_value::TYPE_NULL) {
+            indicesIdx++;
+            outIndices[indicesIdx] = ii;
+        }
+
+        dest += STYLE_NUM_ENTRIES;
+    }
+
+    if (outIndices != NULL) {
+        outIndices[0] = indicesIdx;
+    }
+}
+
+} // namespace android
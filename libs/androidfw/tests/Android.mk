@@ -28,13 +28,24 @@ testFiles := \
     Config_test.cpp \
     ConfigLocale_test.cpp \
     Idmap_test.cpp \
+    PackedConfigs_test.cpp \
+    ResStringPool_test.cpp \
     ResTable_test.cpp \
+    ResXMLParser_test.cpp \
     Split_test.cpp \
+    StyleResolver_test.cpp \
     TestHelpers.cpp \
     Theme_test.cpp \
     TypeWrappers_test.cpp \
     ZipUtils_test.cpp
 
+benchmarkFiles := \
+    BenchMain.cpp \
+    CursorWindow_bench.cpp \
+    LocaleData_bench.cpp \
+    PackedConfigs_bench.cpp \
+    Theme_bench.cpp
+
 androidfw_test_cflags := \
     -Wall \
     -Werror \
@@ -72,14 +83,37 @@ LOCAL_MODULE := libandroidfw_tests
 LOCAL_CFLAGS := $(androidfw_test_cflags)
 LOCAL_SRC_FILES := $(testFiles) \
     BackupData_test.cpp \
+    BackupHelpers_test.cpp \
+    CursorWindow_test.cpp \
     ObbFile_test.cpp \
 
 LOCAL_SHARED_LIBRARIES := \
     libandroidfw \
+    libbinder \
     libcutils \
     libutils \
     libui \
+    libz \
 
 include $(BUILD_NATIVE_TEST)
 endif # Not SDK_ONLY
 
+# ==========================================================
+# Build the device benchmarks: libandroidfw_benchmarks
+# ==========================================================
+ifneq ($(SDK_ONLY),true)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libandroidfw_benchmarks
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA)/local/tmp
+LOCAL_MODULE_TAGS := tests
+LOCAL_CFLAGS := $(androidfw_test_cflags)
+LOCAL_SRC_FILES := $(benchmarkFiles)
+LOCAL_STATIC_LIBRARIES := libgoogle-benchmark
+LOCAL_SHARED_LIBRARIES := \
+    libandroidfw \
+    libcutils \
+    libutils \
+
+include $(BUILD_EXECUTABLE)
+endif # Not SDK_ONLY
@@ -15,11 +15,85 @@
  */
 
 #include <androidfw/Asset.h>
+#include <androidfw/StreamingZipInflater.h>
+#include <androidfw/ZipFileRO.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
 
 #include <gtest/gtest.h>
 
 using namespace android;
 
+namespace {
+
+// A few megabytes of text that compresses into many deflate blocks.
+std::vector<uint8_t> makeText(size_t size) {
+    std::vector<uint8_t> text(size);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        text[i] = 'a' + (seed >> 16) % 12;
+    }
+    return text;
+}
+
+// Raw deflate, as stored in zip entries.
+std::vector<uint8_t> rawDeflate(const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> out(compressBound(data.size()));
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    EXPECT_EQ(Z_OK, deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+            Z_DEFAULT_STRATEGY));
+    stream.next_in = const_cast<uint8_t*>(data.data());
+    stream.avail_in = data.size();
+    stream.next_out = out.data();
+    stream.avail_out = out.size();
+    EXPECT_EQ(Z_STREAM_END, ::deflate(&stream, Z_FINISH));
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+class CompressedDataTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mData = makeText(4 * 1024 * 1024);
+        mCompressed = rawDeflate(mData);
+        mFile = tmpfile();
+        ASSERT_TRUE(mFile != NULL);
+        ASSERT_EQ(mCompressed.size(), fwrite(mCompressed.data(), 1, mCompressed.size(), mFile));
+        ASSERT_EQ(0, fflush(mFile));
+    }
+
+    virtual void TearDown() {
+        if (mFile != NULL) {
+            fclose(mFile);
+        }
+    }
+
+    void expectDataAt(StreamingZipInflater* inflater, off64_t offset) {
+        uint8_t buf[4096];
+        ASSERT_EQ(offset, inflater->seekAbsolute(offset));
+        const ssize_t count = inflater->read(buf, sizeof(buf));
+        ASSERT_LT(0, count);
+        EXPECT_EQ(0, memcmp(buf, mData.data() + offset, count)) << "at offset " << offset;
+    }
+
+    std::vector<uint8_t> mData;
+    std::vector<uint8_t> mCompressed;
+    FILE* mFile;
+};
+
+const off64_t kSeekOffsets[] = {
+    3 * 1024 * 1024 + 17, 100, 2 * 1024 * 1024, 1024 * 1024 + 1, 4 * 1024 * 1024 - 10, 0, 700000,
+};
+
+} // namespace
+
 TEST(AssetTest, FileAssetRegistersItself) {
     const int32_t count = Asset::getGlobalCount();
     Asset* asset = new _FileAsset();
@@ -35,3 +109,66 @@ TEST(AssetTest, CompressedAssetRegistersItself) {
     delete asset;
     EXPECT_EQ(count, Asset::getGlobalCount());
 }
+
+TEST_F(CompressedDataTest, InflaterSeeksBackwardsFromCheckpoints) {
+    StreamingZipInflater inflater(fileno(mFile), 0, mData.size(), mCompressed.size());
+
+    std::vector<uint8_t> out(mData.size());
+    ASSERT_EQ(ssize_t(out.size()), inflater.read(out.data(), out.size()));
+    EXPECT_TRUE(out == mData);
+
+    // The default budget has room for a few checkpoints over 4MB.
+    EXPECT_LT(0u, inflater.getCheckpointCount());
+    EXPECT_GE(StreamingZipInflater::DEFAULT_CHECKPOINT_BUDGET / (32 * 1024),
+            inflater.getCheckpointCount());
+
+    for (off64_t offset : kSeekOffsets) {
+        expectDataAt(&inflater, offset);
+    }
+}
+
+TEST_F(CompressedDataTest, InflaterSeeksBackwardsWithoutCheckpoints) {
+    StreamingZipInflater inflater(fileno(mFile), 0, mData.size(), mCompressed.size());
+    inflater.setCheckpointBudget(0);
+
+    ASSERT_EQ(ssize_t(mData.size()), inflater.read(NULL, mData.size()));
+    EXPECT_EQ(0u, inflater.getCheckpointCount());
+
+    for (off64_t offset : kSeekOffsets) {
+        expectDataAt(&inflater, offset);
+    }
+}
+
+TEST_F(CompressedDataTest, CompressedAssetSeeksBackwards) {
+    _CompressedAsset* asset = new _CompressedAsset();
+    ASSERT_EQ(NO_ERROR, asset->openChunk(dup(fileno(mFile)), 0, ZipFileRO::kCompressDeflated,
+            mData.size(), mCompressed.size()));
+
+    uint8_t buf[4096];
+    ASSERT_EQ(off64_t(mData.size() - sizeof(buf)),
+            asset->seek(mData.size() - sizeof(buf), SEEK_SET));
+    ASSERT_EQ(ssize_t(sizeof(buf)), asset->read(buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(buf, mData.data() + mData.size() - sizeof(buf), sizeof(buf)));
+
+    ASSERT_EQ(off64_t(1024 * 1024), asset->seek(1024 * 1024, SEEK_SET));
+    ASSERT_EQ(ssize_t(sizeof(buf)), asset->read(buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(buf, mData.data() + 1024 * 1024, sizeof(buf)));
+    delete asset;
+}
+
+TEST_F(CompressedDataTest, AssetsPrefetch) {
+    _CompressedAsset* compressed = new _CompressedAsset();
+    ASSERT_EQ(NO_ERROR, compressed->openChunk(dup(fileno(mFile)), 0,
+            ZipFileRO::kCompressDeflated, mData.size(), mCompressed.size()));
+    EXPECT_EQ(NO_ERROR, compressed->prefetch());
+    delete compressed;
+
+    // The compressed bytes are as good as any for an uncompressed asset.
+    _FileAsset* file = new _FileAsset();
+    ASSERT_EQ(NO_ERROR, file->openChunk(NULL, dup(fileno(mFile)), 0, mCompressed.size()));
+    EXPECT_EQ(NO_ERROR, file->prefetch());
+    uint8_t buf[4096];
+    ASSERT_EQ(ssize_t(sizeof(buf)), file->read(buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(buf, mCompressed.data(), sizeof(buf)));
+    delete file;
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/BackupHelpers.h>
+#include <utils/ByteOrder.h>
+#include <utils/String8.h>
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace android {
+
+// Enough files for the scan to be spread over several threads.
+static const int kFileCount = 200;
+
+class BackupHelpersTest : public testing::Test {
+protected:
+    String8 mDir;
+    std::vector<String8> mFiles;
+    std::vector<String8> mKeys;
+
+    virtual void SetUp() {
+        mDir.append(getenv("EXTERNAL_STORAGE"));
+        mDir.appendPath("backup_helpers_test");
+        ::mkdir(mDir.string(), S_IRWXU);
+
+        for (int i = 0; i < kFileCount; i++) {
+            String8 key = String8::format("file%03d", i);
+            String8 file(mDir);
+            file.appendPath(key);
+            mKeys.push_back(key);
+            mFiles.push_back(file);
+            writeFile(file, String8::format("contents of %s", key.string()));
+        }
+    }
+
+    virtual void TearDown() {
+        for (const String8& file : mFiles) {
+            ::unlink(file.string());
+        }
+        ::unlink(snapshotPath(0).string());
+        ::unlink(snapshotPath(1).string());
+        ::unlink(dataPath().string());
+        ::rmdir(mDir.string());
+    }
+
+    void writeFile(const String8& path, const String8& contents) {
+        writeFile(path, contents.string(), contents.length());
+    }
+
+    void writeFile(const String8& path, const char* data, size_t size) {
+        int fd = ::open(path.string(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        ASSERT_LE(0, fd) << "Couldn't create " << path.string();
+        ASSERT_EQ(ssize_t(size), ::write(fd, data, size));
+        ::close(fd);
+    }
+
+    // Sets the mtime of 'path' to 'mtime'.
+    void setModTime(const String8& path, time_t mtime) {
+        struct timeval times[2];
+        times[0].tv_sec = times[1].tv_sec = mtime;
+        times[0].tv_usec = times[1].tv_usec = 0;
+        ASSERT_EQ(0, ::utimes(path.string(), times));
+    }
+
+    time_t getModTime(const String8& path) {
+        struct stat st;
+        EXPECT_EQ(0, ::stat(path.string(), &st));
+        return st.st_mtime;
+    }
+
+    String8 snapshotPath(int which) {
+        String8 path(mDir);
+        path.appendPath(String8::format("snapshot%d", which));
+        return path;
+    }
+
+    String8 dataPath() {
+        String8 path(mDir);
+        path.appendPath("data");
+        return path;
+    }
+
+    // Backs up all files against the snapshot 'oldSnapshot' (or none if -1),
+    // writing snapshot 'newSnapshot', and returns the keys written out.
+    std::vector<String8> backUp(int oldSnapshot, int newSnapshot) {
+        std::vector<const char*> files;
+        std::vector<const char*> keys;
+        for (int i = 0; i < kFileCount; i++) {
+            files.push_back(mFiles[i].string());
+            keys.push_back(mKeys[i].string());
+        }
+
+        int oldFd = -1;
+        if (oldSnapshot >= 0) {
+            oldFd = ::open(snapshotPath(oldSnapshot).string(), O_RDONLY);
+        }
+        int newFd = ::open(snapshotPath(newSnapshot).string(),
+                O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        int dataFd = ::open(dataPath().string(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        BackupDataWriter* writer = new BackupDataWriter(dataFd);
+        EXPECT_EQ(0, back_up_files(oldFd, writer, newFd, files.data(), keys.data(),
+                kFileCount));
+        delete writer;
+        ::close(dataFd);
+        ::close(newFd);
+        if (oldFd >= 0) {
+            ::close(oldFd);
+        }
+
+        std::vector<String8> written;
+        dataFd = ::open(dataPath().string(), O_RDONLY);
+        BackupDataReader* reader = new BackupDataReader(dataFd);
+        bool done = false;
+        int type;
+        while (reader->ReadNextHeader(&done, &type) == NO_ERROR && !done) {
+            String8 key;
+            size_t dataSize;
+            EXPECT_EQ(NO_ERROR, reader->ReadEntityHeader(&key, &dataSize));
+            reader->SkipEntityData();
+            written.push_back(key);
+        }
+        delete reader;
+        ::close(dataFd);
+        return written;
+    }
+};
+
+TEST_F(BackupHelpersTest, BacksUpAllFilesInKeyOrder) {
+    std::vector<String8> written = backUp(-1, 0);
+    ASSERT_EQ(size_t(kFileCount), written.size());
+    for (int i = 0; i < kFileCount; i++) {
+        EXPECT_EQ(mKeys[i], written[i]);
+    }
+}
+
+TEST_F(BackupHelpersTest, BacksUpOnlyChangedFiles) {
+    // Files last modified well before the snapshots, so that their old
+    // checksums are reused rather than computed again.
+    const time_t past = time(NULL) - 60;
+    for (const String8& file : mFiles) {
+        setModTime(file, past);
+    }
+    ASSERT_EQ(size_t(kFileCount), backUp(-1, 0).size());
+    EXPECT_EQ(0u, backUp(0, 1).size());
+
+    String8 contents = String8::format("CONTENTS of %s", mKeys[42].string());
+    writeFile(mFiles[42], contents);
+    std::vector<String8> written = backUp(1, 0);
+    ASSERT_EQ(1u, written.size());
+    EXPECT_EQ(mKeys[42], written[0]);
+
+    // A file that keeps its old mtime, mode and size is trusted without being
+    // read, which shows the old checksum was reused.
+    contents = String8::format("CONTENTS OF %s", mKeys[7].string());
+    writeFile(mFiles[7], contents);
+    setModTime(mFiles[7], past);
+    EXPECT_EQ(0u, backUp(0, 1).size());
+}
+
+TEST_F(BackupHelpersTest, ChecksumsFilesModifiedDuringTheLastScan) {
+    ASSERT_EQ(size_t(kFileCount), backUp(-1, 0).size());
+
+    // Same size and the same mtime as in the snapshot, which a write right
+    // after the old scan read the file could leave behind.
+    const time_t mtime = getModTime(mFiles[42]);
+    String8 contents = String8::format("CONTENTS of %s", mKeys[42].string());
+    writeFile(mFiles[42], contents);
+    setModTime(mFiles[42], mtime);
+    std::vector<String8> written = backUp(0, 1);
+    ASSERT_EQ(1u, written.size());
+    EXPECT_EQ(mKeys[42], written[0]);
+}
+
+TEST_F(BackupHelpersTest, IgnoresLaterWritesToTheSnapshotFile) {
+    ASSERT_EQ(size_t(kFileCount), backUp(-1, 0).size());
+
+    // BackupHelperDispatcher and the helpers after this one keep writing to
+    // the same snapshot file, which moves its mtime past the last scan.
+    int fd = ::open(snapshotPath(0).string(), O_WRONLY | O_APPEND);
+    ASSERT_LE(0, fd);
+    const char trailing[16] = "next helper";
+    ASSERT_EQ(ssize_t(sizeof(trailing)), ::write(fd, trailing, sizeof(trailing)));
+    ::close(fd);
+    setModTime(snapshotPath(0), time(NULL) + 60);
+
+    const time_t mtime = getModTime(mFiles[42]);
+    String8 contents = String8::format("CONTENTS of %s", mKeys[42].string());
+    writeFile(mFiles[42], contents);
+    setModTime(mFiles[42], mtime);
+    std::vector<String8> written = backUp(0, 1);
+    ASSERT_EQ(1u, written.size());
+    EXPECT_EQ(mKeys[42], written[0]);
+}
+
+TEST_F(BackupHelpersTest, WritesTarfileChunks) {
+    // A few data chunks, the last one ending in a partial tar block.
+    std::vector<char> contents(2 * 1024 * 1024 + 1000);
+    for (size_t i = 0; i < contents.size(); i++) {
+        contents[i] = 'a' + i % 26;
+    }
+    writeFile(mFiles[0], contents.data(), contents.size());
+
+    int dataFd = ::open(dataPath().string(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    BackupDataWriter* writer = new BackupDataWriter(dataFd);
+    off_t size = 0;
+    EXPECT_EQ(0, write_tarfile(String8("com.example"), String8("f"), mDir, mFiles[0], &size,
+            writer));
+    delete writer;
+    ::close(dataFd);
+
+    // Strip the chunk framing to get at the tar stream.
+    std::vector<char> tar;
+    dataFd = ::open(dataPath().string(), O_RDONLY);
+    uint32_t chunkSize;
+    while (::read(dataFd, &chunkSize, sizeof(chunkSize)) == sizeof(chunkSize)) {
+        chunkSize = ntohl(chunkSize);
+        size_t start = tar.size();
+        tar.resize(start + chunkSize);
+        ASSERT_EQ(ssize_t(chunkSize), ::read(dataFd, tar.data() + start, chunkSize));
+    }
+    ::close(dataFd);
+
+    ASSERT_EQ(size_t(size), tar.size());
+    EXPECT_EQ(0, memcmp("ustar", tar.data() + 257, 5));
+    EXPECT_EQ(0, memcmp(contents.data(), tar.data() + 512, contents.size()));
+    for (size_t i = 512 + contents.size(); i < tar.size(); i++) {
+        EXPECT_EQ(0, tar[i]);
+    }
+}
+
+} // namespace android
@@ -20,6 +20,9 @@
 #include <utils/String8.h>
 
 #include <gtest/gtest.h>
+
+#include <vector>
+
 namespace android {
 
 TEST(ConfigLocaleTest, packAndUnpack2LetterLanguage) {
@@ -718,4 +721,50 @@ TEST(ConfigLocaleTest, isLocaleBetterThan_UsEnglishIsSpecial) {
     EXPECT_FALSE(config2.isLocaleBetterThan(config1, &request));
 }
 
+TEST(ConfigLocaleTest, LocaleRegionMatrixAgreesWithCompareRegions) {
+    const char* const regions[] = {
+        NULL, "US", "MX", "419", "AR", "ES", "GB", "AU", "IN", "CA", "001", "150", "PR",
+    };
+    const char* const requests[][2] = {
+        { "es", "US" }, { "es", "AR" }, { "es", "419" }, { "es", "ES" },
+        { "en", "US" }, { "en", "IN" }, { "en", "ZA" }, { "en", "PR" },
+    };
+
+    for (const auto& request : requests) {
+        ResTable_config requested;
+        fillIn(request[0], request[1], NULL, NULL, &requested);
+
+        std::vector<ResTable_config> configs;
+        std::vector<uint16_t> packedRegions;
+        for (const char* region : regions) {
+            ResTable_config config;
+            fillIn(request[0], region, NULL, NULL, &config);
+            configs.push_back(config);
+            packedRegions.push_back(static_cast<uint8_t>(config.country[0])
+                    | (static_cast<uint8_t>(config.country[1]) << 8));
+        }
+        // Leave one region out, which has to be compared directly.
+        packedRegions.pop_back();
+
+        LocaleRegionMatrix matrix;
+        matrix.build(requested.language, requested.localeScript, requested.country,
+                packedRegions);
+        EXPECT_EQ(packedRegions.size(), matrix.size());
+
+        for (const ResTable_config& left : configs) {
+            for (const ResTable_config& right : configs) {
+                const int expected = localeDataCompareRegions(left.country, right.country,
+                        requested.language, requested.localeScript, requested.country);
+                const int actual = matrix.compare(left.country, right.country);
+                EXPECT_EQ(expected > 0, actual > 0) << left.toString().string() << " vs "
+                        << right.toString().string() << " for " << request[0] << "-" << request[1];
+                EXPECT_EQ(expected < 0, actual < 0) << left.toString().string() << " vs "
+                        << right.toString().string() << " for " << request[0] << "-" << request[1];
+                EXPECT_EQ(left.isLocaleBetterThan(right, &requested),
+                        left.isLocaleBetterThan(right, &requested, &matrix));
+            }
+        }
+    }
+}
+
 }  // namespace android
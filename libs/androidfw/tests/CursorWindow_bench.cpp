@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <androidfw/CursorWindow.h>
+
+using namespace android;
+
+static const size_t kWindowSize = 4 * 1024 * 1024;
+
+static CursorWindow* createWindow(uint32_t numRows) {
+    CursorWindow* window = NULL;
+    status_t result = CursorWindow::create(String8("bench"), kWindowSize, &window);
+    LOG_ALWAYS_FATAL_IF(result != OK, "Failed to create window: %d", result);
+    window->setNumColumns(1);
+    for (uint32_t row = 0; row < numRows; row++) {
+        result = window->allocRow();
+        LOG_ALWAYS_FATAL_IF(result != OK, "Failed to fill window at row %u", row);
+        window->putLong(row, 0, row);
+    }
+    return window;
+}
+
+// Reads the rows the way a cursor moving through the window does.
+static void BM_CursorWindowGetFieldSlotSequential(benchmark::State& state) {
+    const uint32_t numRows = state.range_x();
+    CursorWindow* window = createWindow(numRows);
+
+    uint32_t row = 0;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(window->getFieldSlot(row, 0));
+        if (++row == numRows) {
+            row = 0;
+        }
+    }
+    delete window;
+}
+BENCHMARK(BM_CursorWindowGetFieldSlotSequential)->Arg(10000)->Arg(100000);
+
+// Reads the rows in a scattered order, as when a list jumps around.
+static void BM_CursorWindowGetFieldSlotRandom(benchmark::State& state) {
+    const uint32_t numRows = state.range_x();
+    CursorWindow* window = createWindow(numRows);
+
+    uint32_t row = 0;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(window->getFieldSlot(row, 0));
+        row = (row + 7919) % numRows;
+    }
+    delete window;
+}
+BENCHMARK(BM_CursorWindowGetFieldSlotRandom)->Arg(10000)->Arg(100000);
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/CursorWindow.h>
+#include <binder/Parcel.h>
+
+#include <string.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static void fillAndCheck(CursorWindow* window, uint32_t numRows) {
+    ASSERT_EQ(OK, window->setNumColumns(2));
+    for (uint32_t row = 0; row < numRows; row++) {
+        ASSERT_EQ(OK, window->allocRow());
+        ASSERT_EQ(OK, window->putLong(row, 0, row));
+    }
+    ASSERT_EQ(numRows, window->getNumRows());
+
+    // Read back out of order, so each lookup has to find its own chunk.
+    for (uint32_t i = 0; i < numRows; i++) {
+        const uint32_t row = (i * 7919) % numRows;
+        CursorWindow::FieldSlot* slot = window->getFieldSlot(row, 0);
+        ASSERT_TRUE(slot != NULL);
+        EXPECT_EQ(int32_t(CursorWindow::FIELD_TYPE_INTEGER), window->getFieldSlotType(slot));
+        EXPECT_EQ(int64_t(row), window->getFieldSlotValueLong(slot));
+
+        slot = window->getFieldSlot(row, 1);
+        ASSERT_TRUE(slot != NULL);
+        EXPECT_EQ(int32_t(CursorWindow::FIELD_TYPE_NULL), window->getFieldSlotType(slot));
+    }
+}
+
+TEST(CursorWindowTest, findsRowsAcrossManyChunks) {
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), 1024 * 1024, &window));
+    fillAndCheck(window, 5000);
+    delete window;
+}
+
+TEST(CursorWindowTest, findsRowsInFullWindow) {
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), 64 * 1024, &window));
+    ASSERT_EQ(OK, window->setNumColumns(1));
+    uint32_t numRows = 0;
+    while (window->allocRow() == OK) {
+        ASSERT_EQ(OK, window->putLong(numRows, 0, numRows));
+        numRows++;
+    }
+    ASSERT_LT(1000u, numRows);
+
+    for (uint32_t row = 0; row < numRows; row++) {
+        CursorWindow::FieldSlot* slot = window->getFieldSlot(row, 0);
+        ASSERT_TRUE(slot != NULL);
+        EXPECT_EQ(int64_t(row), window->getFieldSlotValueLong(slot));
+    }
+    delete window;
+}
+
+TEST(CursorWindowTest, reusesChunksAfterFreeingRows) {
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), 1024 * 1024, &window));
+    ASSERT_EQ(OK, window->setNumColumns(1));
+    for (uint32_t row = 0; row < 250; row++) {
+        ASSERT_EQ(OK, window->allocRow());
+    }
+    for (uint32_t row = 0; row < 120; row++) {
+        ASSERT_EQ(OK, window->freeLastRow());
+    }
+    for (uint32_t row = 130; row < 400; row++) {
+        ASSERT_EQ(OK, window->allocRow());
+        ASSERT_EQ(OK, window->putLong(row, 0, row));
+    }
+    for (uint32_t row = 130; row < 400; row++) {
+        CursorWindow::FieldSlot* slot = window->getFieldSlot(row, 0);
+        ASSERT_TRUE(slot != NULL);
+        EXPECT_EQ(int64_t(row), window->getFieldSlotValueLong(slot));
+    }
+    delete window;
+}
+
+TEST(CursorWindowTest, fillsRowThroughFieldDirectory) {
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), 64 * 1024, &window));
+    ASSERT_EQ(OK, window->setNumColumns(4));
+
+    CursorWindow::FieldSlot* fieldDir;
+    ASSERT_EQ(OK, window->allocRow(&fieldDir));
+    window->putLong(&fieldDir[0], 42);
+    window->putDouble(&fieldDir[1], 0.5);
+    ASSERT_EQ(OK, window->putString(&fieldDir[2], "text", 5));
+
+    EXPECT_EQ(&fieldDir[0], window->getFieldSlot(0, 0));
+    EXPECT_EQ(42, window->getFieldSlotValueLong(window->getFieldSlot(0, 0)));
+    EXPECT_EQ(0.5, window->getFieldSlotValueDouble(window->getFieldSlot(0, 1)));
+
+    size_t size;
+    const char* str = window->getFieldSlotValueString(window->getFieldSlot(0, 2), &size);
+    EXPECT_EQ(5u, size);
+    EXPECT_STREQ("text", str);
+    EXPECT_EQ(int32_t(CursorWindow::FIELD_TYPE_NULL),
+            window->getFieldSlotType(window->getFieldSlot(0, 3)));
+    delete window;
+}
+
+TEST(CursorWindowTest, growsBySegments) {
+    const size_t segmentSize = 16 * 1024;
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), segmentSize, 4 * segmentSize, &window));
+    ASSERT_EQ(OK, window->setNumColumns(2));
+
+    const char text[] = "a string that takes up some room in the window";
+    uint32_t numRows = 0;
+    while (window->allocRow() == OK) {
+        if (window->putLong(numRows, 0, numRows) != OK
+                || window->putString(numRows, 1, text, sizeof(text)) != OK) {
+            window->freeLastRow();
+            break;
+        }
+        numRows++;
+    }
+    EXPECT_EQ(4 * segmentSize, window->size());
+
+    for (uint32_t row = 0; row < numRows; row++) {
+        CursorWindow::FieldSlot* slot = window->getFieldSlot(row, 0);
+        ASSERT_TRUE(slot != NULL);
+        EXPECT_EQ(int64_t(row), window->getFieldSlotValueLong(slot));
+
+        size_t size;
+        slot = window->getFieldSlot(row, 1);
+        ASSERT_TRUE(slot != NULL);
+        EXPECT_STREQ(text, window->getFieldSlotValueString(slot, &size));
+    }
+    delete window;
+}
+
+TEST(CursorWindowTest, rejectsValuesLargerThanSegment) {
+    const size_t segmentSize = 16 * 1024;
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), segmentSize, 4 * segmentSize, &window));
+    ASSERT_EQ(OK, window->setNumColumns(1));
+    ASSERT_EQ(OK, window->allocRow());
+
+    std::vector<uint8_t> blob(segmentSize + 1);
+    EXPECT_EQ(NO_MEMORY, window->putBlob(0, 0, blob.data(), blob.size()));
+    EXPECT_EQ(segmentSize, window->size());
+    delete window;
+}
+
+TEST(CursorWindowTest, growsToAtMostMaxSegments) {
+    const size_t segmentSize = 16 * 1024;
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), segmentSize,
+            2 * CursorWindow::MAX_SEGMENTS * segmentSize, &window));
+    ASSERT_EQ(OK, window->setNumColumns(1));
+
+    std::vector<uint8_t> blob(segmentSize / 2);
+    for (uint32_t row = 0; window->allocRow() == OK; row++) {
+        if (window->putBlob(row, 0, blob.data(), blob.size()) != OK) {
+            break;
+        }
+    }
+    EXPECT_EQ(CursorWindow::MAX_SEGMENTS * segmentSize, window->size());
+    delete window;
+}
+
+TEST(CursorWindowTest, readsSegmentsFromParcel) {
+    const size_t segmentSize = 16 * 1024;
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), segmentSize, 4 * segmentSize, &window));
+    ASSERT_EQ(OK, window->setNumColumns(1));
+    // Enough to take up more than one segment.
+    std::vector<uint8_t> blob(segmentSize / 4, 'x');
+    for (uint32_t row = 0; row < 6; row++) {
+        ASSERT_EQ(OK, window->allocRow());
+        ASSERT_EQ(OK, window->putBlob(row, 0, blob.data(), blob.size()));
+    }
+
+    Parcel parcel;
+    ASSERT_EQ(OK, window->writeToParcel(&parcel));
+    delete window;
+    parcel.setDataPosition(0);
+    ASSERT_EQ(OK, CursorWindow::createFromParcel(&parcel, &window));
+
+    ASSERT_EQ(6u, window->getNumRows());
+    for (uint32_t row = 0; row < 6; row++) {
+        CursorWindow::FieldSlot* slot = window->getFieldSlot(row, 0);
+        ASSERT_TRUE(slot != NULL);
+        size_t size;
+        const void* value = window->getFieldSlotValueBlob(slot, &size);
+        ASSERT_EQ(blob.size(), size);
+        EXPECT_EQ(0, memcmp(blob.data(), value, size));
+    }
+    delete window;
+}
+
+TEST(CursorWindowTest, rejectsTooManySegmentsInParcel) {
+    Parcel parcel;
+    parcel.writeString8(String8("test"));
+    parcel.writeInt32(CursorWindow::MAX_SEGMENTS + 1);
+    parcel.setDataPosition(0);
+
+    CursorWindow* window = NULL;
+    EXPECT_EQ(BAD_VALUE, CursorWindow::createFromParcel(&parcel, &window));
+    EXPECT_TRUE(window == NULL);
+}
+
+TEST(CursorWindowTest, readsValuesOutsideTheWindowAsEmpty) {
+    const size_t segmentSize = 16 * 1024;
+    CursorWindow* window = NULL;
+    ASSERT_EQ(OK, CursorWindow::create(String8("test"), segmentSize, &window));
+    ASSERT_EQ(OK, window->setNumColumns(1));
+    ASSERT_EQ(OK, window->allocRow());
+    ASSERT_EQ(OK, window->putBlob(0, 0, "blob", 4));
+
+    // Stands in for a window written by another process. The value's offset
+    // and size follow the field type in the slot.
+    CursorWindow::FieldSlot* slot = window->getFieldSlot(0, 0);
+    uint32_t offsetAndSize[2] = { uint32_t(segmentSize - 2), 4 };
+    memcpy(reinterpret_cast<uint8_t*>(slot) + sizeof(int32_t), offsetAndSize,
+            sizeof(offsetAndSize));
+
+    size_t size;
+    EXPECT_TRUE(window->getFieldSlotValueBlob(slot, &size) == NULL);
+    EXPECT_EQ(0u, size);
+    delete window;
+}
+
+} // namespace android
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <androidfw/LocaleData.h>
+#include <androidfw/ResourceTypes.h>
+
+#include <string.h>
+#include <vector>
+
+using namespace android;
+
+namespace {
+
+// English as spoken in over a hundred regions, as an app with region-specific
+// strings for every market might ship it.
+const char* const kRegions[] = {
+    "001", "150", "419", "AE", "AG", "AI", "AL", "AR", "AS", "AT", "AU", "BB", "BD", "BE", "BG",
+    "BI", "BM", "BR", "BS", "BW", "BZ", "CA", "CC", "CH", "CK", "CL", "CM", "CN", "CO", "CX",
+    "CY", "CZ", "DE", "DG", "DK", "DM", "EE", "EG", "ER", "ES", "FI", "FJ", "FK", "FM", "FR",
+    "GB", "GD", "GG", "GH", "GI", "GM", "GR", "GU", "GY", "HK", "HU", "ID", "IE", "IL", "IM",
+    "IN", "IO", "IT", "JE", "JM", "JP", "KE", "KI", "KN", "KR", "KY", "LC", "LR", "LS", "LT",
+    "LV", "MG", "MH", "MO", "MP", "MS", "MT", "MU", "MW", "MX", "MY", "NA", "NF", "NG", "NL",
+    "NO", "NR", "NU", "NZ", "PG", "PH", "PK", "PL", "PN", "PR", "PT", "PW", "RO", "RU", "RW",
+    "SA", "SB", "SC", "SD", "SE", "SG", "SH", "SI", "SK", "SL", "SS", "SX", "SZ", "TC", "TH",
+    "TK", "TO", "TR", "TT", "TV", "TW", "TZ", "UA", "UG", "UM", "US", "VC", "VG", "VI", "VU",
+    "WS", "ZA", "ZM", "ZW",
+};
+
+ResTable_config makeConfig(const char* region) {
+    ResTable_config config;
+    memset(&config, 0, sizeof(config));
+    config.packLanguage("en");
+    if (region != NULL) {
+        config.packRegion(region);
+    }
+    config.computeScript();
+    config.localeScriptWasComputed = true;
+    return config;
+}
+
+std::vector<ResTable_config> makeConfigs() {
+    std::vector<ResTable_config> configs;
+    configs.push_back(makeConfig(NULL));
+    for (const char* region : kRegions) {
+        configs.push_back(makeConfig(region));
+    }
+    return configs;
+}
+
+// What getEntry() does to pick the best of the candidates for a request.
+const ResTable_config* pickBest(const std::vector<ResTable_config>& configs,
+        const ResTable_config& requested, const LocaleRegionMatrix* regions) {
+    const ResTable_config* best = &configs[0];
+    for (size_t i = 1; i < configs.size(); i++) {
+        if (configs[i].isBetterThan(*best, &requested, regions)) {
+            best = &configs[i];
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+static void BM_LocalePickBestDirect(benchmark::State& state) {
+    const std::vector<ResTable_config> configs = makeConfigs();
+    const ResTable_config requested = makeConfig("ZA");
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(pickBest(configs, requested, NULL));
+    }
+}
+BENCHMARK(BM_LocalePickBestDirect);
+
+static void BM_LocalePickBestMatrix(benchmark::State& state) {
+    const std::vector<ResTable_config> configs = makeConfigs();
+    const ResTable_config requested = makeConfig("ZA");
+    std::vector<uint16_t> packedRegions;
+    for (const ResTable_config& config : configs) {
+        packedRegions.push_back(static_cast<uint8_t>(config.country[0])
+                | (static_cast<uint8_t>(config.country[1]) << 8));
+    }
+    LocaleRegionMatrix matrix;
+    matrix.build(requested.language, requested.localeScript, requested.country, packedRegions);
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(pickBest(configs, requested, &matrix));
+    }
+}
+BENCHMARK(BM_LocalePickBestMatrix);
+
+// The cost setParameters() pays once for the matrix.
+static void BM_LocaleRegionMatrixBuild(benchmark::State& state) {
+    const std::vector<ResTable_config> configs = makeConfigs();
+    const ResTable_config requested = makeConfig("ZA");
+    std::vector<uint16_t> packedRegions;
+    for (const ResTable_config& config : configs) {
+        packedRegions.push_back(static_cast<uint8_t>(config.country[0])
+                | (static_cast<uint8_t>(config.country[1]) << 8));
+    }
+    while (state.KeepRunning()) {
+        LocaleRegionMatrix matrix;
+        matrix.build(requested.language, requested.localeScript, requested.country,
+                packedRegions);
+        benchmark::DoNotOptimize(matrix.size());
+    }
+}
+BENCHMARK(BM_LocaleRegionMatrixBuild);
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <androidfw/PackedConfigs.h>
+#include <androidfw/ResourceTypes.h>
+
+#include <string.h>
+#include <vector>
+
+using namespace android;
+
+namespace {
+
+// The locales a fully translated app typically ships strings for.
+const char* const kLocales[] = {
+    "af", "am", "ar", "as", "az", "be", "bg", "bn", "bs", "ca", "cs", "da",
+    "de", "el", "en-rAU", "en-rCA", "en-rGB", "en-rIN", "en-rXC", "es",
+    "es-rUS", "et", "eu", "fa", "fi", "fr", "fr-rCA", "gl", "gu", "hi", "hr",
+    "hu", "hy", "in", "is", "it", "iw", "ja", "ka", "kk", "km", "kn", "ko",
+    "ky", "lo", "lt", "lv", "mk", "ml", "mn", "mr", "ms", "my", "nb", "ne",
+    "nl", "or", "pa", "pl", "pt", "pt-rBR", "pt-rPT", "ro", "ru", "si", "sk",
+    "sl", "sq", "sr", "sr-rLatn", "sv", "sw", "ta", "te", "th", "tl", "tr",
+    "uk", "ur", "uz", "vi", "zh-rCN", "zh-rHK", "zh-rTW", "zu",
+};
+
+std::vector<ResTable_config> makeLocaleConfigs() {
+    std::vector<ResTable_config> configs;
+    for (const char* locale : kLocales) {
+        ResTable_config config;
+        memset(&config, 0, sizeof(config));
+        char language[4] = { 0, 0, 0, 0 };
+        memcpy(language, locale, 2);
+        config.packLanguage(language);
+        if (strlen(locale) > 4) {
+            if (strlen(locale) == 8) {
+                memcpy(config.localeScript, locale + 4, 4);
+            } else {
+                config.packRegion(locale + 4);
+            }
+        }
+        configs.push_back(config);
+    }
+    return configs;
+}
+
+ResTable_config makeSettings() {
+    ResTable_config settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.packLanguage("en");
+    settings.packRegion("US");
+    settings.computeScript();
+    settings.localeScriptWasComputed = true;
+    settings.sdkVersion = 24;
+    settings.screenWidthDp = 411;
+    settings.screenHeightDp = 731;
+    settings.smallestScreenWidthDp = 411;
+    return settings;
+}
+
+} // namespace
+
+// What getEntry() did for each candidate before configs were packed.
+static void BM_ConfigMatchScalar(benchmark::State& state) {
+    const std::vector<ResTable_config> configs = makeLocaleConfigs();
+    const ResTable_config settings = makeSettings();
+    while (state.KeepRunning()) {
+        size_t matches = 0;
+        for (const ResTable_config& config : configs) {
+            if (config.match(settings)) {
+                matches++;
+            }
+        }
+        benchmark::DoNotOptimize(matches);
+    }
+}
+BENCHMARK(BM_ConfigMatchScalar);
+
+static void BM_ConfigMatchPacked(benchmark::State& state) {
+    const std::vector<ResTable_config> configs = makeLocaleConfigs();
+    PackedConfigs packed;
+    for (const ResTable_config& config : configs) {
+        packed.add(config);
+    }
+    const ResTable_config settings = makeSettings();
+    std::vector<uint8_t> results(packed.size());
+    while (state.KeepRunning()) {
+        packed.match(settings, results.data());
+        benchmark::DoNotOptimize(results.data());
+    }
+}
+BENCHMARK(BM_ConfigMatchPacked);
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/PackedConfigs.h>
+#include <androidfw/ResourceTypes.h>
+
+#include <string.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace android;
+
+namespace {
+
+ResTable_config makeConfig(const char* lang, const char* country, const char* script) {
+    ResTable_config config;
+    memset(&config, 0, sizeof(config));
+    if (lang != NULL) {
+        config.packLanguage(lang);
+    }
+    if (country != NULL) {
+        config.packRegion(country);
+    }
+    if (script != NULL) {
+        memcpy(config.localeScript, script, sizeof(config.localeScript));
+    }
+    return config;
+}
+
+// Requested configurations have their script computed, as done by
+// AssetManager::setConfiguration().
+ResTable_config makeSettings(const char* lang, const char* country) {
+    ResTable_config settings = makeConfig(lang, country, NULL);
+    settings.computeScript();
+    settings.localeScriptWasComputed = true;
+    settings.mcc = 310;
+    settings.mnc = 4;
+    settings.orientation = ResTable_config::ORIENTATION_PORT;
+    settings.smallestScreenWidthDp = 360;
+    settings.screenWidthDp = 360;
+    settings.screenHeightDp = 640;
+    settings.sdkVersion = 23;
+    return settings;
+}
+
+std::vector<ResTable_config> makeConfigs() {
+    std::vector<ResTable_config> configs;
+    configs.push_back(makeConfig(NULL, NULL, NULL));
+    configs.push_back(makeConfig("en", NULL, NULL));
+    configs.push_back(makeConfig("en", "US", NULL));
+    configs.push_back(makeConfig("en", "GB", NULL));
+    configs.push_back(makeConfig("fr", NULL, NULL));
+    configs.push_back(makeConfig("sr", NULL, "Latn"));
+    configs.push_back(makeConfig("sr", NULL, "Cyrl"));
+    configs.push_back(makeConfig("zh", "TW", NULL));
+    configs.push_back(makeConfig("zh", "CN", NULL));
+    configs.push_back(makeConfig("zh", NULL, "Hant"));
+    // Private-use language, whose script can't be computed.
+    configs.push_back(makeConfig("qaa", NULL, NULL));
+    configs.push_back(makeConfig("qaa", "US", NULL));
+
+    ResTable_config config = makeConfig(NULL, NULL, NULL);
+    config.mcc = 310;
+    configs.push_back(config);
+    config.mnc = 5;
+    configs.push_back(config);
+
+    config = makeConfig(NULL, NULL, NULL);
+    config.sdkVersion = 21;
+    configs.push_back(config);
+    config.sdkVersion = 24;
+    configs.push_back(config);
+
+    config = makeConfig(NULL, NULL, NULL);
+    config.screenWidthDp = 320;
+    configs.push_back(config);
+    config.screenWidthDp = 600;
+    configs.push_back(config);
+    config = makeConfig(NULL, NULL, NULL);
+    config.smallestScreenWidthDp = 600;
+    configs.push_back(config);
+
+    config = makeConfig("en", NULL, NULL);
+    config.orientation = ResTable_config::ORIENTATION_PORT;
+    configs.push_back(config);
+    config.orientation = ResTable_config::ORIENTATION_LAND;
+    configs.push_back(config);
+
+    config = makeConfig(NULL, NULL, NULL);
+    config.density = ResTable_config::DENSITY_XHIGH;
+    configs.push_back(config);
+    return configs;
+}
+
+void expectAgreesWithMatch(const ResTable_config& settings) {
+    const std::vector<ResTable_config> configs = makeConfigs();
+    PackedConfigs packed;
+    for (const ResTable_config& config : configs) {
+        packed.add(config);
+    }
+    ASSERT_EQ(configs.size(), packed.size());
+
+    std::vector<uint8_t> results(packed.size());
+    packed.match(settings, results.data());
+    for (size_t i = 0; i < configs.size(); i++) {
+        const bool matches = configs[i].match(settings);
+        if (matches) {
+            EXPECT_NE(uint32_t(PackedConfigs::NO_MATCH), uint32_t(results[i]))
+                    << configs[i].toString().string() << " vs "
+                    << settings.toString().string();
+        } else {
+            EXPECT_NE(uint32_t(PackedConfigs::MATCH), uint32_t(results[i]))
+                    << configs[i].toString().string() << " vs "
+                    << settings.toString().string();
+        }
+    }
+}
+
+} // namespace
+
+TEST(PackedConfigsTest, agreesWithMatchForLocales) {
+    expectAgreesWithMatch(makeSettings("en", "US"));
+    expectAgreesWithMatch(makeSettings("en", "AU"));
+    expectAgreesWithMatch(makeSettings("sr", "RS"));
+    expectAgreesWithMatch(makeSettings("zh", "HK"));
+    expectAgreesWithMatch(makeSettings("zh", "CN"));
+    expectAgreesWithMatch(makeSettings("qaa", "US"));
+    expectAgreesWithMatch(makeSettings(NULL, NULL));
+}
+
+TEST(PackedConfigsTest, agreesWithMatchForOtherQualifiers) {
+    ResTable_config settings = makeSettings("en", "US");
+    settings.orientation = ResTable_config::ORIENTATION_LAND;
+    settings.sdkVersion = 24;
+    settings.smallestScreenWidthDp = 600;
+    settings.screenWidthDp = 1024;
+    settings.mnc = 5;
+    expectAgreesWithMatch(settings);
+}
+
+TEST(PackedConfigsTest, reportsWhichConfigsNeedFullMatch) {
+    PackedConfigs packed;
+    packed.add(makeConfig("fr", NULL, NULL));
+    packed.add(makeConfig("en", NULL, NULL));
+
+    ResTable_config config = makeConfig("en", NULL, NULL);
+    config.orientation = ResTable_config::ORIENTATION_LAND;
+    packed.add(config);
+
+    uint8_t results[3];
+    packed.match(makeSettings("en", "US"), results);
+    EXPECT_EQ(uint32_t(PackedConfigs::NO_MATCH), uint32_t(results[0]));
+    EXPECT_EQ(uint32_t(PackedConfigs::MATCH), uint32_t(results[1]));
+    EXPECT_EQ(uint32_t(PackedConfigs::MAYBE_MATCH), uint32_t(results[2]));
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+#include <string.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace android;
+
+namespace {
+
+/**
+ * Builds a UTF-8 string pool chunk holding 'count' distinct ASCII strings
+ * of 'length' characters each.
+ */
+std::vector<uint8_t> makeUtf8Pool(size_t count, size_t length) {
+    std::vector<uint8_t> strings;
+    std::vector<uint32_t> offsets;
+    for (size_t i = 0; i < count; i++) {
+        offsets.push_back(strings.size());
+        // Both the UTF-16 and UTF-8 lengths fit in a single byte here.
+        strings.push_back(length);
+        strings.push_back(length);
+        String8 str = String8::format("%0*zu", (int)length, i);
+        strings.insert(strings.end(), str.string(), str.string() + length);
+        strings.push_back(0);
+    }
+    while (strings.size() % 4 != 0) {
+        strings.push_back(0);
+    }
+
+    ResStringPool_header header;
+    memset(&header, 0, sizeof(header));
+    header.header.type = RES_STRING_POOL_TYPE;
+    header.header.headerSize = sizeof(header);
+    header.stringCount = count;
+    header.flags = ResStringPool_header::UTF8_FLAG;
+    header.stringsStart = sizeof(header) + offsets.size() * sizeof(uint32_t);
+    header.header.size = header.stringsStart + strings.size();
+
+    std::vector<uint8_t> data(header.header.size);
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + sizeof(header), offsets.data(), offsets.size() * sizeof(uint32_t));
+    memcpy(data.data() + header.stringsStart, strings.data(), strings.size());
+    return data;
+}
+
+String16 stringAt(const ResStringPool& pool, size_t idx) {
+    size_t len;
+    const char16_t* str = pool.stringAt(idx, &len);
+    return str != NULL ? String16(str, len) : String16();
+}
+
+} // namespace
+
+TEST(ResStringPoolTest, decodesUtf8StringsOnce) {
+    std::vector<uint8_t> data = makeUtf8Pool(10, 4);
+    ResStringPool pool(data.data(), data.size());
+    ASSERT_EQ(NO_ERROR, pool.getError());
+
+    EXPECT_EQ(String16("0003"), stringAt(pool, 3));
+    EXPECT_EQ(String16("0003"), stringAt(pool, 3));
+    EXPECT_EQ(String16("0007"), stringAt(pool, 7));
+
+    ResStringPool::DecodeCacheStats stats;
+    pool.getDecodeCacheStats(&stats);
+    EXPECT_EQ(2u, stats.strings);
+    EXPECT_EQ(2u, stats.misses);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(0u, stats.evictions);
+    EXPECT_LT(0u, stats.bytes);
+}
+
+TEST(ResStringPoolTest, predecodesRange) {
+    std::vector<uint8_t> data = makeUtf8Pool(10, 4);
+    ResStringPool pool(data.data(), data.size());
+    ASSERT_EQ(NO_ERROR, pool.getError());
+
+    // The range is clamped to the size of the pool.
+    pool.predecodeStrings(5, 100);
+
+    ResStringPool::DecodeCacheStats stats;
+    pool.getDecodeCacheStats(&stats);
+    EXPECT_EQ(5u, stats.strings);
+
+    EXPECT_EQ(String16("0009"), stringAt(pool, 9));
+    pool.getDecodeCacheStats(&stats);
+    EXPECT_EQ(1u, stats.hits);
+    EXPECT_EQ(5u, stats.misses);
+}
+
+TEST(ResStringPoolTest, evictsWhenOverLimit) {
+    // About 20K of decoded strings.
+    std::vector<uint8_t> data = makeUtf8Pool(100, 100);
+    ResStringPool pool(data.data(), data.size());
+    ASSERT_EQ(NO_ERROR, pool.getError());
+
+    const size_t limit = 16 * 1024;
+    pool.setDecodeCacheLimit(limit);
+    for (size_t i = 0; i < pool.size(); i++) {
+        EXPECT_EQ(String16(String8::format("%0100zu", i)), stringAt(pool, i));
+    }
+
+    ResStringPool::DecodeCacheStats stats;
+    pool.getDecodeCacheStats(&stats);
+    EXPECT_GE(limit, stats.bytes);
+    EXPECT_LT(0u, stats.evictions);
+    EXPECT_EQ(pool.size(), stats.strings + stats.evictions);
+
+    // Evicted strings are decoded again when asked for.
+    EXPECT_EQ(String16(String8::format("%0100zu", (size_t)0)), stringAt(pool, 0));
+}
+
+TEST(ResStringPoolTest, evictsStringsDecodedBeforeLimitWasSet) {
+    std::vector<uint8_t> data = makeUtf8Pool(100, 100);
+    ResStringPool pool(data.data(), data.size());
+    ASSERT_EQ(NO_ERROR, pool.getError());
+
+    for (size_t i = 0; i < pool.size(); i++) {
+        EXPECT_EQ(String16(String8::format("%0100zu", i)), stringAt(pool, i));
+    }
+
+    const size_t limit = 8 * 1024;
+    pool.setDecodeCacheLimit(limit);
+
+    ResStringPool::DecodeCacheStats stats;
+    pool.getDecodeCacheStats(&stats);
+    EXPECT_GE(limit, stats.bytes);
+    EXPECT_LT(0u, stats.evictions);
+    EXPECT_EQ(pool.size(), stats.strings + stats.evictions);
+
+    for (size_t i = 0; i < pool.size(); i++) {
+        EXPECT_EQ(String16(String8::format("%0100zu", i)), stringAt(pool, i));
+    }
+}
+
+TEST(ResStringPoolTest, globalStatsIncludeEveryPool) {
+    ResStringPool::DecodeCacheStats before;
+    ResStringPool::getGlobalDecodeCacheStats(&before);
+
+    std::vector<uint8_t> data = makeUtf8Pool(10, 4);
+    {
+        ResStringPool pool(data.data(), data.size());
+        ASSERT_EQ(NO_ERROR, pool.getError());
+        EXPECT_EQ(String16("0001"), stringAt(pool, 1));
+        EXPECT_EQ(String16("0001"), stringAt(pool, 1));
+
+        ResStringPool::DecodeCacheStats stats;
+        ResStringPool::getGlobalDecodeCacheStats(&stats);
+        EXPECT_EQ(before.strings + 1, stats.strings);
+        EXPECT_EQ(before.hits + 1, stats.hits);
+        EXPECT_EQ(before.misses + 1, stats.misses);
+    }
+
+    // Hits and misses of pools that are gone are still counted.
+    ResStringPool::DecodeCacheStats after;
+    ResStringPool::getGlobalDecodeCacheStats(&after);
+    EXPECT_EQ(before.strings, after.strings);
+    EXPECT_EQ(before.bytes, after.bytes);
+    EXPECT_EQ(before.hits + 1, after.hits);
+    EXPECT_EQ(before.misses + 1, after.misses);
+}
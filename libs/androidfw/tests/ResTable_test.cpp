@@ -16,9 +16,12 @@
 
 #include <androidfw/ResourceTypes.h>
 
+#include <atomic>
 #include <codecvt>
 #include <locale>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <utils/String8.h>
 #include <utils/String16.h>
@@ -78,6 +81,33 @@ TEST(ResTableTest, resourceNameIsResolved) {
     ASSERT_EQ(base::R::string::test1, resID);
 }
 
+TEST(ResTableTest, resourceNamesAreResolvedRepeatedly) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    String16 defPackage("com.android.test.basic");
+    String16 defType("integer");
+
+    // The second lookup into each type is answered from the name index.
+    for (int i = 0; i < 2; i++) {
+        String16 number2("number2");
+        EXPECT_EQ(base::R::integer::number2,
+                  table.identifierForName(number2.string(), number2.size(),
+                                          defType.string(), defType.size(),
+                                          defPackage.string(), defPackage.size()));
+
+        String16 test2("@string/test2");
+        EXPECT_EQ(base::R::string::test2,
+                  table.identifierForName(test2.string(), test2.size(), 0, 0,
+                                          defPackage.string(), defPackage.size()));
+
+        String16 missing("@string/doesNotExist");
+        EXPECT_EQ(uint32_t(0),
+                  table.identifierForName(missing.string(), missing.size(), 0, 0,
+                                          defPackage.string(), defPackage.size()));
+    }
+}
+
 TEST(ResTableTest, noParentThemeIsAppliedCorrectly) {
     ResTable table;
     ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
@@ -206,6 +236,112 @@ TEST(ResTableTest, resourceIsOverridenWithBetterConfig) {
     ASSERT_EQ(uint32_t(400), val.data);
 }
 
+TEST(ResTableTest, typeLoadedAfterParameterChangeUsesParameters) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    // No lookup has loaded the integer type's configurations yet.
+    ResTable_config param;
+    memset(&param, 0, sizeof(param));
+    param.language[0] = 's';
+    param.language[1] = 'v';
+    param.country[0] = 'S';
+    param.country[1] = 'E';
+    table.setParameters(&param);
+
+    Res_value val;
+    ssize_t block = table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG);
+    ASSERT_GE(block, 0);
+    ASSERT_EQ(Res_value::TYPE_INT_DEC, val.dataType);
+    ASSERT_EQ(uint32_t(400), val.data);
+
+    // Once loaded, the type is filtered like any other.
+    param.language[0] = 0;
+    param.language[1] = 0;
+    param.country[0] = 0;
+    param.country[1] = 0;
+    table.setParameters(&param);
+
+    block = table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG);
+    ASSERT_GE(block, 0);
+    ASSERT_EQ(uint32_t(200), val.data);
+}
+
+TEST(ResTableTest, resolvedEntryIsInvalidatedOnParameterChange) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    ResTable_config param;
+    memset(&param, 0, sizeof(param));
+    param.language[0] = 's';
+    param.language[1] = 'v';
+    param.country[0] = 'S';
+    param.country[1] = 'E';
+    table.setParameters(&param);
+
+    // Look up the same entry repeatedly so the second lookup hits the cache.
+    Res_value val;
+    for (int i = 0; i < 2; i++) {
+        ssize_t block = table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG);
+        ASSERT_GE(block, 0);
+        ASSERT_EQ(Res_value::TYPE_INT_DEC, val.dataType);
+        ASSERT_EQ(uint32_t(400), val.data);
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.language[0] = 'v';
+    param.language[1] = 's';
+    table.setParameters(&param);
+
+    ssize_t block = table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG);
+    ASSERT_GE(block, 0);
+    ASSERT_EQ(Res_value::TYPE_INT_DEC, val.dataType);
+    ASSERT_EQ(uint32_t(600), val.data);
+}
+
+TEST(ResTableTest, concurrentLookupsSurviveParameterChanges) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    ResTable_config paramSv;
+    memset(&paramSv, 0, sizeof(paramSv));
+    paramSv.language[0] = 's';
+    paramSv.language[1] = 'v';
+    paramSv.country[0] = 'S';
+    paramSv.country[1] = 'E';
+
+    ResTable_config paramVs;
+    memset(&paramVs, 0, sizeof(paramVs));
+    paramVs.language[0] = 'v';
+    paramVs.language[1] = 's';
+
+    std::atomic<bool> done(false);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&]() {
+            while (!done.load()) {
+                Res_value val;
+                ssize_t block = table.getResource(base::R::integer::number1, &val,
+                        MAY_NOT_BE_BAG);
+                if (block < 0 || (val.data != 400 && val.data != 600)) {
+                    failures++;
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        table.setParameters((i % 2) == 0 ? &paramSv : &paramVs);
+    }
+    done.store(true);
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(0, failures.load());
+}
+
 TEST(ResTableTest, emptyTableHasSensibleDefaults) {
     const int32_t assetCookie = 1;
 
@@ -341,6 +477,165 @@ TEST(ResTableTest, ShareButDontModifyResTable) {
     ASSERT_EQ(uint32_t(600), val.data);
 }
 
+TEST(ResTableTest, BagsAreSharedBetweenTablesWithTheSameSource) {
+    ResTable sharedTable;
+    ASSERT_EQ(NO_ERROR, sharedTable.add(basic_arsc, basic_arsc_len));
+
+    ResTable table1;
+    ASSERT_EQ(NO_ERROR, table1.add(&sharedTable, false));
+    ResTable table2;
+    ASSERT_EQ(NO_ERROR, table2.add(&sharedTable, false));
+    ResTable table3;
+    ASSERT_EQ(NO_ERROR, table3.add(&sharedTable, false));
+
+    const ResTable::bag_entry* bag1;
+    ssize_t count1 = table1.lockBag(base::R::style::Theme2, &bag1);
+    ASSERT_GT(count1, 0);
+
+    const ResTable::bag_entry* bag2;
+    ssize_t count2 = table2.lockBag(base::R::style::Theme2, &bag2);
+    ASSERT_EQ(count1, count2);
+
+    const ResTable::bag_entry* bag3;
+    ssize_t count3 = table3.lockBag(base::R::style::Theme2, &bag3);
+    ASSERT_EQ(count1, count3);
+
+    // Only the first table had to resolve the style; the others reuse its result.
+    EXPECT_EQ(bag2, bag3);
+    for (ssize_t i = 0; i < count1; i++) {
+        EXPECT_EQ(bag1[i].map.name.ident, bag2[i].map.name.ident);
+        EXPECT_EQ(bag1[i].map.value.dataType, bag2[i].map.value.dataType);
+        EXPECT_EQ(bag1[i].map.value.data, bag2[i].map.value.data);
+    }
+
+    table3.unlockBag(bag3);
+    table2.unlockBag(bag2);
+    table1.unlockBag(bag1);
+}
+
+TEST(ResTableTest, IndexedTableMatchesScannedTable) {
+    void* indexData = NULL;
+    size_t indexSize = 0;
+    ASSERT_EQ(NO_ERROR, ResTable::createIndex(basic_arsc, basic_arsc_len, 0x1234abcd,
+            &indexData, &indexSize));
+
+    uint32_t tableSize = 0;
+    uint32_t tableCrc = 0;
+    ASSERT_TRUE(ResTable::getIndexInfo(indexData, indexSize, NULL, &tableSize, &tableCrc));
+    EXPECT_EQ(uint32_t(basic_arsc_len), tableSize);
+    EXPECT_EQ(uint32_t(0x1234abcd), tableCrc);
+
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len, NULL, 0, indexData, indexSize,
+            -1, false));
+    free(indexData);
+
+    EXPECT_TRUE(IsStringEqual(table, base::R::string::test1, "test1"));
+
+    Res_value val;
+    ASSERT_GE(table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG), 0);
+    ASSERT_EQ(uint32_t(200), val.data);
+
+    ResTable_config param;
+    memset(&param, 0, sizeof(param));
+    param.language[0] = 's';
+    param.language[1] = 'v';
+    param.country[0] = 'S';
+    param.country[1] = 'E';
+    table.setParameters(&param);
+    ASSERT_GE(table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG), 0);
+    ASSERT_EQ(uint32_t(400), val.data);
+
+    const ResTable::bag_entry* bag;
+    ssize_t count = table.lockBag(base::R::style::Theme1, &bag);
+    EXPECT_GT(count, 0);
+    table.unlockBag(bag);
+}
+
+// Loads basic_arsc with 'indexData', which the table should reject and scan
+// around, and checks that the table is complete anyway.
+static void expectIndexRejected(const void* indexData, size_t indexSize) {
+    ResTable table;
+    bool indexRejected = false;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len, NULL, 0, indexData, indexSize,
+            -1, false, false, &indexRejected));
+    EXPECT_TRUE(indexRejected);
+
+    EXPECT_TRUE(IsStringEqual(table, base::R::string::test1, "test1"));
+    Res_value val;
+    ASSERT_GE(table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG), 0);
+    EXPECT_EQ(uint32_t(200), val.data);
+}
+
+TEST(ResTableTest, IndexForAnotherTableIsRejected) {
+    void* indexData = NULL;
+    size_t indexSize = 0;
+    ASSERT_EQ(NO_ERROR, ResTable::createIndex(lib_arsc, lib_arsc_len, 0, &indexData,
+            &indexSize));
+    expectIndexRejected(indexData, indexSize);
+    free(indexData);
+}
+
+TEST(ResTableTest, IndexWithWrongEntryCountIsRejected) {
+    void* indexData = NULL;
+    size_t indexSize = 0;
+    ASSERT_EQ(NO_ERROR, ResTable::createIndex(basic_arsc, basic_arsc_len, 0, &indexData,
+            &indexSize));
+
+    // Entries are 12 bytes each: chunk type, type ID, padding, offset and count.
+    // Make the count of every type spec and type larger than its chunk.
+    uint8_t* entry = (uint8_t*)indexData + ResTable::INDEX_HEADER_SIZE_BYTES;
+    const uint8_t* end = (const uint8_t*)indexData + indexSize;
+    for (; entry + 12 <= end; entry += 12) {
+        const uint16_t chunkType = dtohs(*(const uint16_t*)entry);
+        if (chunkType == RES_TABLE_TYPE_SPEC_TYPE || chunkType == RES_TABLE_TYPE_TYPE) {
+            *(uint32_t*)(entry + 8) = htodl(0x10000);
+        }
+    }
+
+    expectIndexRejected(indexData, indexSize);
+    free(indexData);
+}
+
+TEST(ResTableTest, IndexWithWrongChunkTypeIsRejected) {
+    void* indexData = NULL;
+    size_t indexSize = 0;
+    ASSERT_EQ(NO_ERROR, ResTable::createIndex(basic_arsc, basic_arsc_len, 0, &indexData,
+            &indexSize));
+
+    // Claim that the first type spec is a library chunk.
+    uint8_t* entry = (uint8_t*)indexData + ResTable::INDEX_HEADER_SIZE_BYTES;
+    const uint8_t* end = (const uint8_t*)indexData + indexSize;
+    for (; entry + 12 <= end; entry += 12) {
+        if (dtohs(*(const uint16_t*)entry) == RES_TABLE_TYPE_SPEC_TYPE) {
+            *(uint16_t*)entry = htods(RES_TABLE_LIBRARY_TYPE);
+            break;
+        }
+    }
+    ASSERT_LT(entry, end);
+
+    expectIndexRejected(indexData, indexSize);
+    free(indexData);
+}
+
+TEST(ResTableTest, CorruptIndexIsRejected) {
+    void* indexData = NULL;
+    size_t indexSize = 0;
+    ASSERT_EQ(NO_ERROR, ResTable::createIndex(basic_arsc, basic_arsc_len, 0, &indexData,
+            &indexSize));
+
+    // A truncated index, as an interrupted write could leave behind.
+    expectIndexRejected(indexData, indexSize / 2);
+
+    // Garbage after the header.
+    uint8_t* entries = (uint8_t*)indexData + ResTable::INDEX_HEADER_SIZE_BYTES;
+    for (size_t i = 0; i < indexSize - ResTable::INDEX_HEADER_SIZE_BYTES; i++) {
+        entries[i] = (uint8_t)(i * 37 + 11);
+    }
+    expectIndexRejected(indexData, indexSize);
+    free(indexData);
+}
+
 TEST(ResTableTest, GetConfigurationsReturnsUniqueList) {
     ResTable table;
     ASSERT_EQ(NO_ERROR, table.add(system_arsc, system_arsc_len));
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+
+#include <string.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace android;
+
+namespace {
+
+// Names 0-2 have resource IDs, given in an order that is not sorted.
+const char* const kStrings[] = { "second", "first", "third", "plain", "View" };
+const uint32_t kResIds[] = { 0x7f010002, 0x01010001, 0x7f010001 };
+const uint32_t kElementName = 4;
+
+template <typename T>
+void append(std::vector<uint8_t>* data, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    data->insert(data->end(), bytes, bytes + sizeof(value));
+}
+
+void appendStringPool(std::vector<uint8_t>* data) {
+    const size_t count = sizeof(kStrings) / sizeof(kStrings[0]);
+    std::vector<uint8_t> strings;
+    std::vector<uint32_t> offsets;
+    for (size_t i = 0; i < count; i++) {
+        const size_t length = strlen(kStrings[i]);
+        offsets.push_back(strings.size());
+        strings.push_back(length);
+        strings.push_back(length);
+        strings.insert(strings.end(), kStrings[i], kStrings[i] + length);
+        strings.push_back(0);
+    }
+    while (strings.size() % 4 != 0) {
+        strings.push_back(0);
+    }
+
+    ResStringPool_header header;
+    memset(&header, 0, sizeof(header));
+    header.header.type = RES_STRING_POOL_TYPE;
+    header.header.headerSize = sizeof(header);
+    header.stringCount = count;
+    header.flags = ResStringPool_header::UTF8_FLAG;
+    header.stringsStart = sizeof(header) + offsets.size() * sizeof(uint32_t);
+    header.header.size = header.stringsStart + strings.size();
+
+    append(data, header);
+    for (uint32_t offset : offsets) {
+        append(data, offset);
+    }
+    data->insert(data->end(), strings.begin(), strings.end());
+}
+
+void appendResourceMap(std::vector<uint8_t>* data) {
+    ResChunk_header header;
+    header.type = RES_XML_RESOURCE_MAP_TYPE;
+    header.headerSize = sizeof(header);
+    header.size = sizeof(header) + sizeof(kResIds);
+    append(data, header);
+    for (uint32_t resId : kResIds) {
+        append(data, resId);
+    }
+}
+
+void appendStartElement(std::vector<uint8_t>* data, const std::vector<uint32_t>& attrNames) {
+    ResXMLTree_node node;
+    memset(&node, 0, sizeof(node));
+    node.header.type = RES_XML_START_ELEMENT_TYPE;
+    node.header.headerSize = sizeof(node);
+    node.header.size = sizeof(node) + sizeof(ResXMLTree_attrExt)
+            + attrNames.size() * sizeof(ResXMLTree_attribute);
+    node.comment.index = -1;
+    append(data, node);
+
+    ResXMLTree_attrExt ext;
+    memset(&ext, 0, sizeof(ext));
+    ext.ns.index = -1;
+    ext.name.index = kElementName;
+    ext.attributeStart = sizeof(ext);
+    ext.attributeSize = sizeof(ResXMLTree_attribute);
+    ext.attributeCount = attrNames.size();
+    append(data, ext);
+
+    for (size_t i = 0; i < attrNames.size(); i++) {
+        ResXMLTree_attribute attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.ns.index = -1;
+        attr.name.index = attrNames[i];
+        attr.rawValue.index = -1;
+        attr.typedValue.size = sizeof(Res_value);
+        attr.typedValue.dataType = Res_value::TYPE_INT_DEC;
+        attr.typedValue.data = i;
+        append(data, attr);
+    }
+}
+
+void appendEndElement(std::vector<uint8_t>* data) {
+    ResXMLTree_node node;
+    memset(&node, 0, sizeof(node));
+    node.header.type = RES_XML_END_ELEMENT_TYPE;
+    node.header.headerSize = sizeof(node);
+    node.header.size = sizeof(node) + sizeof(ResXMLTree_endElementExt);
+    node.comment.index = -1;
+    append(data, node);
+
+    ResXMLTree_endElementExt ext;
+    ext.ns.index = -1;
+    ext.name.index = kElementName;
+    append(data, ext);
+}
+
+/**
+ * Builds <View second plain first third><View plain/></View>.
+ */
+std::vector<uint8_t> makeXml() {
+    std::vector<uint8_t> data;
+    ResXMLTree_header header;
+    header.header.type = RES_XML_TYPE;
+    header.header.headerSize = sizeof(header);
+    append(&data, header);
+
+    appendStringPool(&data);
+    appendResourceMap(&data);
+    appendStartElement(&data, std::vector<uint32_t>({ 0, 3, 1, 2 }));
+    appendStartElement(&data, std::vector<uint32_t>({ 3 }));
+    appendEndElement(&data);
+    appendEndElement(&data);
+
+    reinterpret_cast<ResXMLTree_header*>(data.data())->header.size = data.size();
+    return data;
+}
+
+} // namespace
+
+TEST(ResXMLParserTest, sortsAttributesByResourceId) {
+    std::vector<uint8_t> data = makeXml();
+    ResXMLTree tree;
+    ASSERT_EQ(NO_ERROR, tree.setTo(data.data(), data.size()));
+
+    ResXMLParser parser(tree);
+    parser.restart();
+    ASSERT_EQ(ResXMLParser::START_TAG, parser.next());
+
+    size_t count;
+    const ResXMLParser::AttributeIndexEntry* entries = parser.getSortedAttributes(&count);
+    ASSERT_EQ(3u, count);
+    EXPECT_EQ(0x01010001u, entries[0].resId);
+    EXPECT_EQ(2u, entries[0].index);
+    EXPECT_EQ(0x7f010001u, entries[1].resId);
+    EXPECT_EQ(3u, entries[1].index);
+    EXPECT_EQ(0x7f010002u, entries[2].resId);
+    EXPECT_EQ(0u, entries[2].index);
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ(entries[i].resId, parser.getAttributeNameResID(entries[i].index));
+    }
+
+    // The nested element only has an attribute without a resource ID.
+    ASSERT_EQ(ResXMLParser::START_TAG, parser.next());
+    parser.getSortedAttributes(&count);
+    EXPECT_EQ(0u, count);
+
+    ASSERT_EQ(ResXMLParser::END_TAG, parser.next());
+    parser.getSortedAttributes(&count);
+    EXPECT_EQ(0u, count);
+}
+
+TEST(ResXMLParserTest, findsAttributeByResourceId) {
+    std::vector<uint8_t> data = makeXml();
+    ResXMLTree tree;
+    ASSERT_EQ(NO_ERROR, tree.setTo(data.data(), data.size()));
+
+    ASSERT_EQ(ResXMLParser::START_TAG, tree.next());
+    EXPECT_EQ(2, tree.indexOfAttribute(0x01010001u));
+    EXPECT_EQ(3, tree.indexOfAttribute(0x7f010001u));
+    EXPECT_EQ(0, tree.indexOfAttribute(0x7f010002u));
+    EXPECT_EQ(NAME_NOT_FOUND, tree.indexOfAttribute(0x7f010003u));
+    EXPECT_EQ(NAME_NOT_FOUND, tree.indexOfAttribute(0u));
+
+    ASSERT_EQ(ResXMLParser::START_TAG, tree.next());
+    EXPECT_EQ(NAME_NOT_FOUND, tree.indexOfAttribute(0x7f010001u));
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+#include <androidfw/StyleResolver.h>
+
+#include "TestHelpers.h"
+#include "data/basic/R.h"
+
+#include <gtest/gtest.h>
+
+using namespace android;
+
+namespace {
+
+#include "data/basic/basic_arsc.h"
+
+static const uint32_t kAttrs[] = { base::R::attr::attr1, base::R::attr::attr2 };
+static const size_t kAttrCount = sizeof(kAttrs) / sizeof(kAttrs[0]);
+
+TEST(StyleResolverTest, resolvesAttributesFromDefaultStyle) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+    ResTable::Theme theme(table);
+
+    uint32_t values[kAttrCount * StyleResolver::STYLE_NUM_ENTRIES];
+    uint32_t indices[kAttrCount + 1];
+    StyleResolver(theme).resolveAttrs(0, base::R::style::Theme1, NULL, 0,
+            kAttrs, kAttrCount, values, indices);
+
+    const uint32_t* attr1 = values;
+    EXPECT_EQ(uint32_t(Res_value::TYPE_INT_DEC), attr1[StyleResolver::STYLE_TYPE]);
+    EXPECT_EQ(uint32_t(100), attr1[StyleResolver::STYLE_DATA]);
+
+    // References are followed to their final value.
+    const uint32_t* attr2 = values + StyleResolver::STYLE_NUM_ENTRIES;
+    EXPECT_EQ(uint32_t(Res_value::TYPE_INT_DEC), attr2[StyleResolver::STYLE_TYPE]);
+    EXPECT_EQ(uint32_t(200), attr2[StyleResolver::STYLE_DATA]);
+    EXPECT_EQ(uint32_t(base::R::integer::number1), attr2[StyleResolver::STYLE_RESOURCE_ID]);
+
+    EXPECT_EQ(uint32_t(2), indices[0]);
+    EXPECT_EQ(uint32_t(0), indices[1]);
+    EXPECT_EQ(uint32_t(1), indices[2]);
+}
+
+TEST(StyleResolverTest, fallsBackToTheme) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+    ResTable::Theme theme(table);
+    ASSERT_EQ(NO_ERROR, theme.applyStyle(base::R::style::Theme2));
+
+    uint32_t values[kAttrCount * StyleResolver::STYLE_NUM_ENTRIES];
+    StyleResolver(theme).applyStyle(NULL, 0, 0, kAttrs, kAttrCount, values, NULL);
+
+    const uint32_t* attr1 = values;
+    EXPECT_EQ(uint32_t(Res_value::TYPE_INT_DEC), attr1[StyleResolver::STYLE_TYPE]);
+    EXPECT_EQ(uint32_t(300), attr1[StyleResolver::STYLE_DATA]);
+
+    const uint32_t* attr2 = values + StyleResolver::STYLE_NUM_ENTRIES;
+    EXPECT_EQ(uint32_t(Res_value::TYPE_INT_DEC), attr2[StyleResolver::STYLE_TYPE]);
+    EXPECT_EQ(uint32_t(200), attr2[StyleResolver::STYLE_DATA]);
+    EXPECT_EQ(uint32_t(table.getTableCookie(0)), attr2[StyleResolver::STYLE_ASSET_COOKIE]);
+}
+
+TEST(StyleResolverTest, reportsMissingAttributes) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+    ResTable::Theme theme(table);
+
+    uint32_t values[kAttrCount * StyleResolver::STYLE_NUM_ENTRIES];
+    uint32_t indices[kAttrCount + 1];
+    StyleResolver(theme).resolveAttrs(0, 0, NULL, 0, kAttrs, kAttrCount, values, indices);
+
+    for (size_t i = 0; i < kAttrCount; i++) {
+        const uint32_t* attr = values + (i * StyleResolver::STYLE_NUM_ENTRIES);
+        EXPECT_EQ(uint32_t(Res_value::TYPE_NULL), attr[StyleResolver::STYLE_TYPE]);
+        EXPECT_EQ(uint32_t(-1), attr[StyleResolver::STYLE_ASSET_COOKIE]);
+    }
+    EXPECT_EQ(uint32_t(0), indices[0]);
+}
+
+} // namespace
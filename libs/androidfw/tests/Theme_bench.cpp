@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <androidfw/ResourceTypes.h>
+
+#include "data/system/R.h"
+#include "data/app/R.h"
+
+using namespace android;
+
+namespace {
+
+#include "data/system/system_arsc.h"
+#include "data/app/app_arsc.h"
+
+void loadTable(ResTable* table) {
+    table->add(system_arsc, system_arsc_len);
+    table->add(app_arsc, app_arsc_len);
+}
+
+} // namespace
+
+// What a ContextThemeWrapper does when it is created: a new theme copied from
+// an existing one.
+static void BM_ThemeCreateAndCopy(benchmark::State& state) {
+    ResTable table;
+    loadTable(&table);
+
+    ResTable::Theme theme(table);
+    theme.applyStyle(android::R::style::Theme_One);
+    theme.applyStyle(app::R::style::Theme_One);
+
+    while (state.KeepRunning()) {
+        ResTable::Theme copy(table);
+        copy.setTo(theme);
+        benchmark::DoNotOptimize(&copy);
+    }
+}
+BENCHMARK(BM_ThemeCreateAndCopy);
+
+static void BM_ThemeApplyStyle(benchmark::State& state) {
+    ResTable table;
+    loadTable(&table);
+
+    ResTable::Theme theme(table);
+    while (state.KeepRunning()) {
+        theme.clear();
+        theme.applyStyle(android::R::style::Theme_One);
+        theme.applyStyle(app::R::style::Theme_One);
+    }
+}
+BENCHMARK(BM_ThemeApplyStyle);
+
+static void BM_ThemeGetAttribute(benchmark::State& state) {
+    ResTable table;
+    loadTable(&table);
+
+    ResTable::Theme theme(table);
+    theme.applyStyle(android::R::style::Theme_One);
+    theme.applyStyle(app::R::style::Theme_One);
+
+    Res_value value;
+    while (state.KeepRunning()) {
+        theme.getAttribute(android::R::attr::background, &value);
+        theme.getAttribute(app::R::attr::number, &value);
+        benchmark::DoNotOptimize(&value);
+    }
+}
+BENCHMARK(BM_ThemeGetAttribute);
@@ -33,6 +33,32 @@ namespace {
 
 enum { MAY_NOT_BE_BAG = false };
 
+TEST(ThemeTest, copiedThemeIsNotAffectedByChangesToOriginal) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(system_arsc, system_arsc_len));
+    ASSERT_EQ(NO_ERROR, table.add(app_arsc, app_arsc_len));
+
+    ResTable::Theme theme1(table);
+    ASSERT_EQ(NO_ERROR, theme1.applyStyle(android::R::style::Theme_One));
+
+    ResTable::Theme theme2(table);
+    ASSERT_EQ(NO_ERROR, theme2.setTo(theme1));
+
+    // Modifying the copy must not change the original, and vice versa.
+    ASSERT_EQ(NO_ERROR, theme2.applyStyle(app::R::style::Theme_One));
+    ASSERT_EQ(NO_ERROR, theme1.clear());
+
+    Res_value val;
+    EXPECT_LT(theme1.getAttribute(android::R::attr::background, &val), 0);
+    EXPECT_LT(theme1.getAttribute(app::R::attr::number, &val), 0);
+
+    ASSERT_GE(theme2.getAttribute(android::R::attr::background, &val), 0);
+    EXPECT_EQ(Res_value::TYPE_INT_COLOR_RGB8, val.dataType);
+    ASSERT_GE(theme2.getAttribute(app::R::attr::number, &val), 0);
+    EXPECT_EQ(Res_value::TYPE_INT_DEC, val.dataType);
+    EXPECT_EQ(uint32_t(1), val.data);
+}
+
 /**
  * TODO(adamlesinski): Enable when fixed.
  */
@@ -39,6 +39,7 @@ sources := \
 	link/PrivateAttributeMover.cpp \
 	link/ReferenceLinker.cpp \
 	link/TableMerger.cpp \
+	link/XmlLinkCache.cpp \
 	link/XmlReferenceLinker.cpp \
 	process/SymbolTable.cpp \
 	proto/ProtoHelpers.cpp \
@@ -79,14 +80,17 @@ testSources := \
 	compile/Pseudolocalizer_test.cpp \
 	compile/XmlIdCollector_test.cpp \
 	filter/ConfigFilter_test.cpp \
+	flatten/Archive_test.cpp \
 	flatten/TableFlattener_test.cpp \
 	flatten/XmlFlattener_test.cpp \
+	io/ZipArchive_test.cpp \
 	link/AutoVersioner_test.cpp \
 	link/ManifestFixer_test.cpp \
 	link/PrivateAttributeMover_test.cpp \
 	link/ProductFilter_test.cpp \
 	link/ReferenceLinker_test.cpp \
 	link/TableMerger_test.cpp \
+	link/XmlLinkCache_test.cpp \
 	link/XmlReferenceLinker_test.cpp \
 	process/SymbolTable_test.cpp \
 	proto/TableProtoSerializer_test.cpp \
@@ -115,6 +119,7 @@ testSources := \
 
 toolSources := \
 	compile/Compile.cpp \
+	daemon/Daemon.cpp \
 	diff/Diff.cpp \
 	dump/Dump.cpp \
 	link/Link.cpp
@@ -25,6 +25,7 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 namespace aapt {
 
@@ -125,6 +126,37 @@ private:
     DISALLOW_COPY_AND_ASSIGN(StdErrDiagnostics);
 };
 
+/**
+ * Holds on to messages until they are flushed to another IDiagnostics. Work done on a
+ * background thread logs here, and the thread that owns the real diagnostics flushes
+ * the messages in a deterministic order.
+ */
+class BufferedDiagnostics : public IDiagnostics {
+public:
+    BufferedDiagnostics() = default;
+
+    void log(Level level, DiagMessageActual& actualMsg) override {
+        mMessages.push_back(Message{ level, actualMsg });
+    }
+
+    void flushTo(IDiagnostics* diag) {
+        for (Message& message : mMessages) {
+            diag->log(message.level, message.actual);
+        }
+        mMessages.clear();
+    }
+
+private:
+    struct Message {
+        Level level;
+        DiagMessageActual actual;
+    };
+
+    std::vector<Message> mMessages;
+
+    DISALLOW_COPY_AND_ASSIGN(BufferedDiagnostics);
+};
+
 class SourcePathDiagnostics : public IDiagnostics {
 public:
     SourcePathDiagnostics(const Source& src, IDiagnostics* diag) : mSource(src), mDiag(diag) {
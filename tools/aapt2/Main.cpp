@@ -25,6 +25,7 @@ extern int compile(const std::vector<StringPiece>& args);
 extern int link(const std::vector<StringPiece>& args);
 extern int dump(const std::vector<StringPiece>& args);
 extern int diff(const std::vector<StringPiece>& args);
+extern int daemon(const std::vector<StringPiece>& args);
 
 } // namespace aapt
 
@@ -47,12 +48,14 @@ int main(int argc, char** argv) {
             return aapt::dump(args);
         } else if (command == "diff") {
             return aapt::diff(args);
+        } else if (command == "daemon") {
+            return aapt::daemon(args);
         }
         std::cerr << "unknown command '" << command << "'\n";
     } else {
         std::cerr << "no command specified\n";
     }
 
-    std::cerr << "\nusage: aapt2 [compile|link|dump|diff] ..." << std::endl;
+    std::cerr << "\nusage: aapt2 [compile|link|dump|diff|daemon] ..." << std::endl;
     return 1;
 }
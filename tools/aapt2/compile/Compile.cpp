@@ -35,9 +35,13 @@
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <google/protobuf/io/coded_stream.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <dirent.h>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
 
 namespace aapt {
 
@@ -423,6 +427,9 @@ static bool compileFile(IAaptContext* context, const CompileOptions& options,
 
 class CompileContext : public IAaptContext {
 public:
+    CompileContext(IDiagnostics* diagnostics) : mDiagnostics(diagnostics) {
+    }
+
     void setVerbose(bool val) {
         mVerbose = val;
     }
@@ -432,7 +439,7 @@ public:
     }
 
     IDiagnostics* getDiagnostics() override {
-       return &mDiagnostics;
+       return mDiagnostics;
     }
 
     NameMangler* getNameMangler() override {
@@ -455,19 +462,148 @@ public:
     }
 
 private:
-    StdErrDiagnostics mDiagnostics;
+    IDiagnostics* mDiagnostics;
     bool mVerbose = false;
 
 };
 
+/**
+ * Compiles a single resource file, dispatching on its type.
+ */
+static bool compileResource(IAaptContext* context, const CompileOptions& options,
+                            ResourcePathData* pathData, IArchiveWriter* writer) {
+    if (options.verbose) {
+        context->getDiagnostics()->note(DiagMessage(pathData->source) << "processing");
+    }
+
+    if (pathData->resourceDir == u"values") {
+        // Overwrite the extension.
+        pathData->extension = "arsc";
+
+        const std::string outputFilename = buildIntermediateFilename(*pathData);
+        return compileTable(context, options, *pathData, writer, outputFilename);
+    }
+
+    const std::string outputFilename = buildIntermediateFilename(*pathData);
+    if (const ResourceType* type = parseResourceType(pathData->resourceDir)) {
+        if (*type != ResourceType::kRaw) {
+            if (pathData->extension == "xml") {
+                return compileXml(context, options, *pathData, writer, outputFilename);
+            } else if (pathData->extension == "png" || pathData->extension == "9.png") {
+                return compilePng(context, options, *pathData, writer, outputFilename);
+            }
+        }
+        return compileFile(context, options, *pathData, writer, outputFilename);
+    }
+
+    context->getDiagnostics()->error(
+            DiagMessage() << "invalid file path '" << pathData->source << "'");
+    return false;
+}
+
+/**
+ * Compiles the input files on 'jobs' threads. Each file is compiled into memory, and its
+ * entries and diagnostics are handed to archiveWriter and context in input order, so the
+ * output doesn't depend on which thread finished first.
+ */
+static bool compileResourcesInParallel(IAaptContext* context, const CompileOptions& options,
+                                       std::vector<ResourcePathData>* inputData,
+                                       IArchiveWriter* archiveWriter, size_t jobs) {
+    struct CompiledResource {
+        BufferedDiagnostics diagnostics;
+        BufferedArchiveWriter writer;
+        bool result = false;
+        bool done = false;
+    };
+
+    // Workers may only run this far ahead of the files written out, which keeps the
+    // compiled output held in memory bounded.
+    const size_t window = jobs * 4;
+    const size_t count = inputData->size();
+    std::vector<std::unique_ptr<CompiledResource>> results(count);
+    for (std::unique_ptr<CompiledResource>& result : results) {
+        result = util::make_unique<CompiledResource>();
+    }
+
+    std::mutex lock;
+    std::condition_variable resultReady;
+    std::condition_variable windowMoved;
+    size_t next = 0;
+    size_t written = 0;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                windowMoved.wait(guard, [&]() {
+                    return next >= count || next < written + window;
+                });
+                if (next >= count) {
+                    return;
+                }
+                i = next++;
+            }
+
+            CompiledResource* compiled = results[i].get();
+            CompileContext fileContext(&compiled->diagnostics);
+            fileContext.setVerbose(context->verbose());
+            compiled->result = compileResource(&fileContext, options, &(*inputData)[i],
+                                               &compiled->writer);
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                compiled->done = true;
+            }
+            resultReady.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::min(jobs, count); i++) {
+        threads.push_back(std::thread(worker));
+    }
+
+    bool error = false;
+    for (size_t i = 0; i < count; i++) {
+        CompiledResource* compiled = results[i].get();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            resultReady.wait(guard, [&]() { return compiled->done; });
+        }
+
+        compiled->diagnostics.flushTo(context->getDiagnostics());
+        if (!compiled->result) {
+            error = true;
+        }
+        if (!compiled->writer.writeTo(archiveWriter, context->getDiagnostics())) {
+            error = true;
+        }
+        results[i].reset();
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            written = i + 1;
+        }
+        windowMoved.notify_all();
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return !error;
+}
+
 /**
  * Entry point for compilation phase. Parses arguments and dispatches to the correct steps.
  */
 int compile(const std::vector<StringPiece>& args) {
-    CompileContext context;
+    StdErrDiagnostics diagnostics;
+    CompileContext context(&diagnostics);
     CompileOptions options;
 
     bool verbose = false;
+    Maybe<std::string> jobsStr;
     Flags flags = Flags()
             .requiredFlag("-o", "Output path", &options.outputPath)
             .optionalFlag("--dir", "Directory to scan for resources", &options.resDir)
@@ -475,6 +611,8 @@ int compile(const std::vector<StringPiece>& args) {
                             "(en-XA and ar-XB)", &options.pseudolocalize)
             .optionalSwitch("--legacy", "Treat errors that used to be valid in AAPT as warnings",
                             &options.legacyMode)
+            .optionalFlag("-j", "Number of files to compile in parallel (default 1)",
+                          &jobsStr)
             .optionalSwitch("-v", "Enables verbose logging", &verbose);
     if (!flags.parse("aapt2 compile", args, &std::cerr)) {
         return 1;
@@ -482,6 +620,18 @@ int compile(const std::vector<StringPiece>& args) {
 
     context.setVerbose(verbose);
 
+    size_t jobs = 1;
+    if (jobsStr) {
+        char* end = nullptr;
+        const long value = strtol(jobsStr.value().c_str(), &end, 10);
+        if (jobsStr.value().empty() || *end != '\0' || value < 1) {
+            context.getDiagnostics()->error(DiagMessage() << "invalid value '"
+                                            << jobsStr.value() << "' for -j option");
+            return 1;
+        }
+        jobs = static_cast<size_t>(value);
+    }
+
     std::unique_ptr<IArchiveWriter> archiveWriter;
 
     std::vector<ResourcePathData> inputData;
@@ -497,6 +647,13 @@ int compile(const std::vector<StringPiece>& args) {
             return 1;
         }
 
+        // Directory entries come back in no particular order. Sort them so the archive
+        // is the same from one build to the next.
+        std::sort(inputData.begin(), inputData.end(),
+                  [](const ResourcePathData& a, const ResourcePathData& b) -> bool {
+                      return a.source.path < b.source.path;
+                  });
+
         archiveWriter = createZipFileArchiveWriter(context.getDiagnostics(), options.outputPath);
 
     } else {
@@ -521,54 +678,21 @@ int compile(const std::vector<StringPiece>& args) {
     }
 
     bool error = false;
-    for (ResourcePathData& pathData : inputData) {
-        if (options.verbose) {
-            context.getDiagnostics()->note(DiagMessage(pathData.source) << "processing");
-        }
-
-        if (pathData.resourceDir == u"values") {
-            // Overwrite the extension.
-            pathData.extension = "arsc";
-
-            const std::string outputFilename = buildIntermediateFilename(pathData);
-            if (!compileTable(&context, options, pathData, archiveWriter.get(), outputFilename)) {
-                error = true;
-            }
-
-        } else {
-            const std::string outputFilename = buildIntermediateFilename(pathData);
-            if (const ResourceType* type = parseResourceType(pathData.resourceDir)) {
-                if (*type != ResourceType::kRaw) {
-                    if (pathData.extension == "xml") {
-                        if (!compileXml(&context, options, pathData, archiveWriter.get(),
-                                        outputFilename)) {
-                            error = true;
-                        }
-                    } else if (pathData.extension == "png" || pathData.extension == "9.png") {
-                        if (!compilePng(&context, options, pathData, archiveWriter.get(),
-                                        outputFilename)) {
-                            error = true;
-                        }
-                    } else {
-                        if (!compileFile(&context, options, pathData, archiveWriter.get(),
-                                         outputFilename)) {
-                            error = true;
-                        }
-                    }
-                } else {
-                    if (!compileFile(&context, options, pathData, archiveWriter.get(),
-                                     outputFilename)) {
-                        error = true;
-                    }
-                }
-            } else {
-                context.getDiagnostics()->error(
-                        DiagMessage() << "invalid file path '" << pathData.source << "'");
+    if (jobs > 1) {
+        error = !compileResourcesInParallel(&context, options, &inputData, archiveWriter.get(),
+                                            jobs);
+    } else {
+        for (ResourcePathData& pathData : inputData) {
+            if (!compileResource(&context, options, &pathData, archiveWriter.get())) {
                 error = true;
             }
         }
     }
 
+    if (!archiveWriter->finish()) {
+        error = true;
+    }
+
     if (error) {
         return 1;
     }
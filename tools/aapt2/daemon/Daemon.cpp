@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Flags.h"
+#include "process/SymbolTable.h"
+#include "util/StringPiece.h"
+#include "util/Util.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace aapt {
+
+extern int compile(const std::vector<StringPiece>& args);
+extern int link(const std::vector<StringPiece>& args, AssetManagerSymbolSourceCache* includeCache);
+
+/**
+ * State that is kept between the requests handled by one daemon.
+ */
+struct DaemonState {
+    AssetManagerSymbolSourceCache includeCache;
+};
+
+/**
+ * Runs one command line. Arguments are separated by spaces, like in argument files.
+ */
+static int runCommandLine(const std::string& line, DaemonState* state) {
+    std::vector<std::string> argList;
+    for (StringPiece arg : util::tokenize<char>(line, ' ')) {
+        arg = util::trimWhitespace(arg);
+        if (!arg.empty()) {
+            argList.push_back(arg.toString());
+        }
+    }
+
+    if (argList.empty()) {
+        std::cerr << "no command specified\n";
+        return 1;
+    }
+
+    std::vector<StringPiece> args;
+    for (size_t i = 1; i < argList.size(); i++) {
+        args.push_back(argList[i]);
+    }
+
+    const StringPiece command = argList[0];
+    if (command == "compile" || command == "c") {
+        return compile(args);
+    } else if (command == "link" || command == "l") {
+        return link(args, &state->includeCache);
+    }
+    std::cerr << "unknown command '" << command << "'\n";
+    return 1;
+}
+
+int daemon(const std::vector<StringPiece>& args) {
+    Flags flags;
+    if (!flags.parse("aapt2 daemon", args, &std::cerr)) {
+        return 1;
+    }
+
+    if (!flags.getArgs().empty()) {
+        std::cerr << "daemon takes no arguments.\n\n";
+        flags.usage("aapt2 daemon", &std::cerr);
+        return 1;
+    }
+
+    // Each line on stdin is a compile or link command line. Everything the command
+    // writes to stdout or stderr is collected and written to stdout, followed by a
+    // line that reads "Done" if the command succeeded or "Error" if it failed.
+    DaemonState state;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (util::trimWhitespace(line).empty()) {
+            continue;
+        }
+
+        std::stringstream output;
+        std::streambuf* coutBuf = std::cout.rdbuf(output.rdbuf());
+        std::streambuf* cerrBuf = std::cerr.rdbuf(output.rdbuf());
+        const int result = runCommandLine(line, &state);
+        std::cout.rdbuf(coutBuf);
+        std::cerr.rdbuf(cerrBuf);
+
+        std::cout << output.str() << (result == 0 ? "Done" : "Error") << std::endl;
+    }
+    return 0;
+}
+
+} // namespace aapt
@@ -18,11 +18,17 @@
 #include "util/Files.h"
 #include "util/StringPiece.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
-#include <ziparchive/zip_writer.h>
+#include <zlib.h>
 
 namespace aapt {
 
@@ -92,76 +98,725 @@ struct DirectoryWriter : public IArchiveWriter {
     }
 };
 
-struct ZipFileWriter : public IArchiveWriter {
-    std::unique_ptr<FILE, decltype(fclose)*> mFile = { nullptr, fclose };
-    std::unique_ptr<ZipWriter> mWriter;
+constexpr uint32_t kLocalFileHeaderSignature = 0x04034b50;
+constexpr uint32_t kCentralDirectorySignature = 0x02014b50;
+constexpr uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+constexpr uint32_t kDataDescriptorSignature = 0x08074b50;
+constexpr size_t kLocalFileHeaderSize = 30;
+constexpr uint16_t kZipVersion = 20;
+constexpr uint16_t kMethodStored = 0;
+constexpr uint16_t kMethodDeflated = 8;
+
+// Set in an entry's flags when its CRC and sizes follow the data in a data descriptor.
+constexpr uint16_t kDataDescriptorFlag = 1 << 3;
+
+// All entries get the earliest time a ZIP file can hold (1980-01-01 00:00), so that
+// archives are reproducible.
+constexpr uint16_t kDosTime = 0;
+constexpr uint16_t kDosDate = (1 << 5) | 1;
+
+// At most this many threads compress entries.
+constexpr size_t kMaxCompressionThreads = 8;
+
+// Once entries waiting to be written add up to this many bytes, finishEntry() waits
+// for the oldest one instead of letting more pile up.
+constexpr size_t kMaxPendingBytes = 64 * 1024 * 1024;
+
+// Entries larger than this aren't held in memory. Once the earlier entries are written,
+// they are compressed and written as they come in, on the calling thread.
+constexpr size_t kMaxBufferedEntrySize = 1024 * 1024;
+
+// How much deflated data is produced at a time for a streamed entry.
+constexpr size_t kStreamChunkSize = 64 * 1024;
+
+static void putU16(std::vector<uint8_t>* out, uint16_t value) {
+    out->push_back(value & 0xff);
+    out->push_back(value >> 8);
+}
+
+static void putU32(std::vector<uint8_t>* out, uint32_t value) {
+    putU16(out, value & 0xffff);
+    putU16(out, value >> 16);
+}
+
+static bool initDeflate(z_stream* stream) {
+    // Same settings ZipWriter uses.
+    memset(stream, 0, sizeof(*stream));
+    return deflateInit2(stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                        Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+/**
+ * Writes a ZIP archive. Entries are checksummed and compressed on a pool of threads
+ * while the caller moves on to the next one, and are written to the file in the order
+ * they were started, so the archive doesn't depend on how the work was scheduled.
+ * Entries too large to keep in memory are streamed to the file instead.
+ */
+class ZipFileWriter : public IArchiveWriter {
+public:
+    ZipFileWriter() = default;
+
+    ~ZipFileWriter() override {
+        finish();
+    }
 
     bool open(IDiagnostics* diag, const StringPiece& path) {
+        mDiag = diag;
         mFile = { fopen(path.data(), "w+b"), fclose };
         if (!mFile) {
             diag->error(DiagMessage() << "failed to open " << path << ": " << strerror(errno));
             return false;
         }
-        mWriter = util::make_unique<ZipWriter>(mFile.get());
         return true;
     }
 
     bool startEntry(const StringPiece& path, uint32_t flags) override {
-        if (!mWriter) {
+        if (!mFile || mCurrentEntry || mFinished) {
+            return false;
+        }
+
+        mCurrentEntry = util::make_unique<Entry>();
+        mCurrentEntry->path = path.toString();
+        mCurrentEntry->flags = flags;
+        return true;
+    }
+
+    bool writeEntry(const void* data, size_t len) override {
+        if (!mCurrentEntry) {
+            return false;
+        }
+
+        if (mStream) {
+            return streamBytes(data, len);
+        }
+
+        if (len > 0) {
+            uint8_t* dst = mCurrentEntry->input.nextBlock<uint8_t>(len);
+            memcpy(dst, data, len);
+        }
+
+        if (mCurrentEntry->input.size() > kMaxBufferedEntrySize) {
+            return startStream();
+        }
+        return true;
+    }
+
+    bool writeEntry(const BigBuffer& buffer) override {
+        for (const BigBuffer::Block& b : buffer) {
+            if (!writeEntry(b.buffer.get(), b.size)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool finishEntry() override {
+        if (!mCurrentEntry) {
+            return false;
+        }
+
+        if (mStream) {
+            return finishStream();
+        }
+
+        if (mThreads.empty()) {
+            const size_t threadCount = std::min<size_t>(
+                    std::max(1u, std::thread::hardware_concurrency()), kMaxCompressionThreads);
+            for (size_t i = 0; i < threadCount; i++) {
+                mThreads.push_back(std::thread(&ZipFileWriter::compressEntries, this));
+            }
+        }
+
+        mCurrentEntry->uncompressedSize = mCurrentEntry->input.size();
+        mCurrentEntry->bufferedSize = mCurrentEntry->input.size();
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            mPendingBytes += mCurrentEntry->bufferedSize;
+            mWork.push_back(mCurrentEntry.get());
+            mPending.push_back(std::move(mCurrentEntry));
+        }
+        mWorkAvailable.notify_one();
+        return writeReadyEntries(false);
+    }
+
+    bool writeDeflatedEntry(const StringPiece& path, uint32_t flags,
+                            const void* data, size_t len,
+                            uint32_t crc32, size_t uncompressedSize) override {
+        // The data can only be used as is if it was going to be deflated anyway, and
+        // doesn't need to be aligned (which only makes sense for stored entries).
+        if (!mFile || mCurrentEntry || mFinished
+                || (flags & (ArchiveEntry::kCompress | ArchiveEntry::kAlign))
+                        != ArchiveEntry::kCompress) {
+            return false;
+        }
+
+        if (len > kMaxBufferedEntrySize) {
+            // Write it straight from the caller's buffer rather than copying it.
+            if (!writeReadyEntries(true)
+                    || !writeLocalFileHeader(path.toString(), flags, 0, kMethodDeflated, crc32,
+                                             len, uncompressedSize)
+                    || !writeBytes(data, len)) {
+                mError = true;
+            }
+            return !mError;
+        }
+
+        std::unique_ptr<Entry> entry = util::make_unique<Entry>();
+        entry->path = path.toString();
+        entry->flags = flags;
+        entry->method = kMethodDeflated;
+        entry->crc = crc32;
+        entry->uncompressedSize = uncompressedSize;
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        entry->compressed.assign(bytes, bytes + len);
+        entry->bufferedSize = len;
+        entry->compressOk = true;
+        entry->ready = true;
+
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            mPendingBytes += entry->bufferedSize;
+            mPending.push_back(std::move(entry));
+        }
+        return writeReadyEntries(false);
+    }
+
+    bool finish() override {
+        if (!mFile || mFinished) {
+            return !mError;
+        }
+        mFinished = true;
+
+        // An entry that was started but never finished is left out. If it was being
+        // streamed it's already partly written, and the archive is broken.
+        if (mStream) {
+            mError = true;
+            mStream.reset();
+        }
+        mCurrentEntry.reset();
+
+        writeReadyEntries(true);
+
+        {
+            std::lock_guard<std::mutex> guard(mLock);
+            mStopping = true;
+        }
+        mWorkAvailable.notify_all();
+        for (std::thread& thread : mThreads) {
+            thread.join();
+        }
+        mThreads.clear();
+
+        if (!mError) {
+            writeCentralDirectory();
+        }
+
+        if (fflush(mFile.get()) != 0) {
+            mDiag->error(DiagMessage() << "failed to write archive: " << strerror(errno));
+            mError = true;
+        }
+        return !mError;
+    }
+
+private:
+    struct Entry {
+        std::string path;
+        uint32_t flags = 0;
+        BigBuffer input = BigBuffer(4096);
+        size_t uncompressedSize = 0;
+
+        // How much of the data waiting to be written this entry accounts for.
+        size_t bufferedSize = 0;
+
+        // Filled in by compressEntry().
+        uint16_t method = kMethodStored;
+        uint32_t crc = 0;
+        std::vector<uint8_t> compressed;
+        bool compressOk = false;
+        bool ready = false;
+    };
+
+    /**
+     * The state of an entry that is being written as it comes in.
+     */
+    struct Stream {
+        z_stream zstream;
+        bool deflating = false;
+        uLong crc = crc32(0L, Z_NULL, 0);
+        size_t uncompressedSize = 0;
+        size_t dataOffset = 0;
+        std::vector<uint8_t> out;
+
+        ~Stream() {
+            if (deflating) {
+                deflateEnd(&zstream);
+            }
+        }
+    };
+
+    struct CentralDirectoryRecord {
+        std::string path;
+        uint16_t flags;
+        uint16_t method;
+        uint32_t crc;
+        uint32_t compressedSize;
+        uint32_t uncompressedSize;
+        uint32_t offset;
+    };
+
+    void compressEntries() {
+        while (true) {
+            Entry* entry;
+            {
+                std::unique_lock<std::mutex> guard(mLock);
+                mWorkAvailable.wait(guard, [&]() { return mStopping || !mWork.empty(); });
+                if (mWork.empty()) {
+                    return;
+                }
+                entry = mWork.front();
+                mWork.pop_front();
+            }
+
+            const bool result = compressEntry(entry);
+
+            {
+                std::lock_guard<std::mutex> guard(mLock);
+                entry->compressOk = result;
+                entry->ready = true;
+            }
+            mEntryReady.notify_all();
+        }
+    }
+
+    static bool compressEntry(Entry* entry) {
+        uLong crc = crc32(0L, Z_NULL, 0);
+        for (const BigBuffer::Block& b : entry->input) {
+            crc = crc32(crc, b.buffer.get(), b.size);
+        }
+        entry->crc = static_cast<uint32_t>(crc);
+
+        if (!(entry->flags & ArchiveEntry::kCompress)) {
+            entry->method = kMethodStored;
+            return true;
+        }
+
+        z_stream stream;
+        if (!initDeflate(&stream)) {
+            return false;
+        }
+
+        // With room for the worst case, deflate() never runs out of output space.
+        entry->compressed.resize(deflateBound(&stream, entry->input.size()));
+        stream.next_out = entry->compressed.data();
+        stream.avail_out = entry->compressed.size();
+
+        int result = Z_OK;
+        for (const BigBuffer::Block& b : entry->input) {
+            stream.next_in = b.buffer.get();
+            stream.avail_in = b.size;
+            while (stream.avail_in > 0 && result == Z_OK) {
+                result = deflate(&stream, Z_NO_FLUSH);
+            }
+        }
+        if (result == Z_OK) {
+            result = deflate(&stream, Z_FINISH);
+        }
+        entry->compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        entry->method = kMethodDeflated;
+        return result == Z_STREAM_END;
+    }
+
+    /**
+     * Writes out the entries at the front of the queue that are done. If wait is true,
+     * or too much data is waiting, waits for entries that aren't.
+     */
+    bool writeReadyEntries(bool wait) {
+        while (true) {
+            std::unique_ptr<Entry> entry;
+            {
+                std::unique_lock<std::mutex> guard(mLock);
+                if (mPending.empty()) {
+                    break;
+                }
+
+                if (!mPending.front()->ready) {
+                    if (!wait && mPendingBytes <= kMaxPendingBytes) {
+                        break;
+                    }
+                    mEntryReady.wait(guard, [&]() { return mPending.front()->ready; });
+                }
+                entry = std::move(mPending.front());
+                mPending.pop_front();
+                mPendingBytes -= entry->bufferedSize;
+            }
+
+            if (!mError && !writeEntryToFile(entry.get())) {
+                mError = true;
+            }
+        }
+        return !mError;
+    }
+
+    bool writeEntryToFile(Entry* entry) {
+        if (!entry->compressOk) {
+            mDiag->error(DiagMessage(entry->path) << "failed to compress");
+            return false;
+        }
+
+        const size_t compressedSize = entry->method == kMethodDeflated
+                ? entry->compressed.size() : entry->uncompressedSize;
+        if (!writeLocalFileHeader(entry->path, entry->flags, 0, entry->method, entry->crc,
+                                  compressedSize, entry->uncompressedSize)) {
             return false;
         }
 
-        size_t zipFlags = 0;
-        if (flags & ArchiveEntry::kCompress) {
-            zipFlags |= ZipWriter::kCompress;
+        if (entry->method == kMethodDeflated) {
+            return writeBytes(entry->compressed.data(), entry->compressed.size());
         }
 
+        for (const BigBuffer::Block& b : entry->input) {
+            if (!writeBytes(b.buffer.get(), b.size)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Writes a local file header at the current offset, and records the entry for the
+     * central directory. With kDataDescriptorFlag in zipFlags, the CRC and sizes are
+     * left out of the header and have to be given to writeDataDescriptor() later.
+     */
+    bool writeLocalFileHeader(const std::string& path, uint32_t flags, uint16_t zipFlags,
+                              uint16_t method, uint32_t crc, size_t compressedSize,
+                              size_t uncompressedSize) {
+        if (mOffset > UINT32_MAX || compressedSize > UINT32_MAX
+                || uncompressedSize > UINT32_MAX) {
+            mDiag->error(DiagMessage(path) << "archive is too large");
+            return false;
+        }
+
+        // Pad the extra field so that the data starts on a 4 byte boundary.
+        size_t padding = 0;
         if (flags & ArchiveEntry::kAlign) {
-            zipFlags |= ZipWriter::kAlign32;
+            const size_t dataOffset = mOffset + kLocalFileHeaderSize + path.size();
+            padding = (4 - (dataOffset % 4)) % 4;
         }
 
-        int32_t result = mWriter->StartEntry(path.data(), zipFlags);
-        if (result != 0) {
+        mRecords.push_back(CentralDirectoryRecord{
+                path,
+                zipFlags,
+                method,
+                crc,
+                static_cast<uint32_t>(compressedSize),
+                static_cast<uint32_t>(uncompressedSize),
+                static_cast<uint32_t>(mOffset) });
+
+        const bool deferred = (zipFlags & kDataDescriptorFlag) != 0;
+        std::vector<uint8_t> header;
+        putU32(&header, kLocalFileHeaderSignature);
+        putU16(&header, kZipVersion);
+        putU16(&header, zipFlags);
+        putU16(&header, method);
+        putU16(&header, kDosTime);
+        putU16(&header, kDosDate);
+        putU32(&header, deferred ? 0 : crc);
+        putU32(&header, deferred ? 0 : compressedSize);
+        putU32(&header, deferred ? 0 : uncompressedSize);
+        putU16(&header, path.size());
+        putU16(&header, padding);
+        header.insert(header.end(), path.begin(), path.end());
+        header.resize(header.size() + padding, 0);
+        return writeBytes(header.data(), header.size());
+    }
+
+    /**
+     * Writes the data descriptor that follows the data of the last entry, and fills in
+     * its central directory record.
+     */
+    bool writeDataDescriptor(uint32_t crc, size_t compressedSize, size_t uncompressedSize) {
+        CentralDirectoryRecord& record = mRecords.back();
+        if (compressedSize > UINT32_MAX || uncompressedSize > UINT32_MAX) {
+            mDiag->error(DiagMessage(record.path) << "archive is too large");
+            return false;
+        }
+
+        record.crc = crc;
+        record.compressedSize = static_cast<uint32_t>(compressedSize);
+        record.uncompressedSize = static_cast<uint32_t>(uncompressedSize);
+
+        std::vector<uint8_t> descriptor;
+        putU32(&descriptor, kDataDescriptorSignature);
+        putU32(&descriptor, crc);
+        putU32(&descriptor, compressedSize);
+        putU32(&descriptor, uncompressedSize);
+        return writeBytes(descriptor.data(), descriptor.size());
+    }
+
+    /**
+     * Switches the current entry to being written as it comes in, once it has grown too
+     * large to hold in memory. Entries started before it are written out first.
+     */
+    bool startStream() {
+        if (!writeReadyEntries(true)) {
             return false;
         }
+
+        Entry* entry = mCurrentEntry.get();
+        mStream = util::make_unique<Stream>();
+        entry->method = kMethodStored;
+        if (entry->flags & ArchiveEntry::kCompress) {
+            if (!initDeflate(&mStream->zstream)) {
+                mDiag->error(DiagMessage(entry->path) << "failed to compress");
+                mError = true;
+                return false;
+            }
+            mStream->deflating = true;
+            mStream->out.resize(kStreamChunkSize);
+            entry->method = kMethodDeflated;
+        }
+
+        if (!writeLocalFileHeader(entry->path, entry->flags, kDataDescriptorFlag,
+                                  entry->method, 0, 0, 0)) {
+            mError = true;
+            return false;
+        }
+        mStream->dataOffset = mOffset;
+
+        // Take the data buffered so far out of the entry, so it's freed once written.
+        BigBuffer input(4096);
+        input.appendBuffer(std::move(entry->input));
+        for (const BigBuffer::Block& b : input) {
+            if (!streamBytes(b.buffer.get(), b.size)) {
+                return false;
+            }
+        }
         return true;
     }
 
-    bool writeEntry(const void* data, size_t len) override {
-        int32_t result = mWriter->WriteBytes(data, len);
-        if (result != 0) {
+    bool streamBytes(const void* data, size_t len) {
+        if (mError) {
             return false;
         }
+
+        // zlib takes lengths as unsigned ints.
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        while (len > 0) {
+            const uInt chunk = static_cast<uInt>(std::min<size_t>(len, UINT32_MAX));
+            mStream->crc = crc32(mStream->crc, bytes, chunk);
+            mStream->uncompressedSize += chunk;
+            if (mStream->deflating) {
+                mStream->zstream.next_in = const_cast<Bytef*>(bytes);
+                mStream->zstream.avail_in = chunk;
+                if (!deflateStream(Z_NO_FLUSH)) {
+                    return false;
+                }
+            } else if (!writeBytes(bytes, chunk)) {
+                mError = true;
+                return false;
+            }
+            bytes += chunk;
+            len -= chunk;
+        }
         return true;
     }
 
-    bool writeEntry(const BigBuffer& buffer) override {
-        for (const BigBuffer::Block& b : buffer) {
-            int32_t result = mWriter->WriteBytes(b.buffer.get(), b.size);
-            if (result != 0) {
+    /**
+     * Runs deflate() over the stream's pending input, writing out what it produces.
+     */
+    bool deflateStream(int flush) {
+        z_stream* zstream = &mStream->zstream;
+        int result;
+        do {
+            zstream->next_out = mStream->out.data();
+            zstream->avail_out = mStream->out.size();
+            result = deflate(zstream, flush);
+            if (result == Z_STREAM_ERROR
+                    || !writeBytes(mStream->out.data(),
+                                   mStream->out.size() - zstream->avail_out)) {
+                mError = true;
                 return false;
             }
+        } while (zstream->avail_out == 0);
+
+        if (flush == Z_FINISH && result != Z_STREAM_END) {
+            mDiag->error(DiagMessage(mCurrentEntry->path) << "failed to compress");
+            mError = true;
+            return false;
         }
         return true;
     }
 
-    bool finishEntry() override {
-        int32_t result = mWriter->FinishEntry();
-        if (result != 0) {
+    bool finishStream() {
+        bool result = !mError;
+        if (result && mStream->deflating) {
+            mStream->zstream.avail_in = 0;
+            result = deflateStream(Z_FINISH);
+        }
+        if (result && !writeDataDescriptor(static_cast<uint32_t>(mStream->crc),
+                                           mOffset - mStream->dataOffset,
+                                           mStream->uncompressedSize)) {
+            mError = true;
+            result = false;
+        }
+        mStream.reset();
+        mCurrentEntry.reset();
+        return result;
+    }
+
+    bool writeCentralDirectory() {
+        if (mRecords.size() > UINT16_MAX) {
+            mDiag->error(DiagMessage() << "too many entries in archive");
+            mError = true;
+            return false;
+        }
+
+        const size_t start = mOffset;
+        std::vector<uint8_t> data;
+        for (const CentralDirectoryRecord& record : mRecords) {
+            putU32(&data, kCentralDirectorySignature);
+            putU16(&data, kZipVersion);
+            putU16(&data, kZipVersion);
+            putU16(&data, record.flags);
+            putU16(&data, record.method);
+            putU16(&data, kDosTime);
+            putU16(&data, kDosDate);
+            putU32(&data, record.crc);
+            putU32(&data, record.compressedSize);
+            putU32(&data, record.uncompressedSize);
+            putU16(&data, record.path.size());
+            putU16(&data, 0);
+            putU16(&data, 0);
+            putU16(&data, 0);
+            putU16(&data, 0);
+            putU32(&data, 0);
+            putU32(&data, record.offset);
+            data.insert(data.end(), record.path.begin(), record.path.end());
+        }
+
+        if (start + data.size() > UINT32_MAX) {
+            mDiag->error(DiagMessage() << "archive is too large");
+            mError = true;
+            return false;
+        }
+
+        const size_t size = data.size();
+        putU32(&data, kEndOfCentralDirectorySignature);
+        putU16(&data, 0);
+        putU16(&data, 0);
+        putU16(&data, mRecords.size());
+        putU16(&data, mRecords.size());
+        putU32(&data, size);
+        putU32(&data, start);
+        putU16(&data, 0);
+        if (!writeBytes(data.data(), data.size())) {
+            mError = true;
             return false;
         }
         return true;
     }
 
-    virtual ~ZipFileWriter() {
-        if (mWriter) {
-            mWriter->Finish();
+    bool writeBytes(const void* data, size_t len) {
+        if (fwrite(data, 1, len, mFile.get()) != len) {
+            mDiag->error(DiagMessage() << "failed to write archive: " << strerror(errno));
+            return false;
         }
+        mOffset += len;
+        return true;
     }
+
+    IDiagnostics* mDiag = nullptr;
+    std::unique_ptr<FILE, decltype(fclose)*> mFile = { nullptr, fclose };
+    size_t mOffset = 0;
+    bool mError = false;
+    bool mFinished = false;
+    std::unique_ptr<Entry> mCurrentEntry;
+    std::unique_ptr<Stream> mStream;
+    std::vector<CentralDirectoryRecord> mRecords;
+
+    // Guards everything below, and the results compressEntry() leaves in queued entries.
+    std::mutex mLock;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mEntryReady;
+    std::deque<Entry*> mWork;
+    std::deque<std::unique_ptr<Entry>> mPending;
+    size_t mPendingBytes = 0;
+    bool mStopping = false;
+    std::vector<std::thread> mThreads;
+
+    DISALLOW_COPY_AND_ASSIGN(ZipFileWriter);
 };
 
 } // namespace
 
+bool BufferedArchiveWriter::startEntry(const StringPiece& path, uint32_t flags) {
+    if (mInEntry) {
+        return false;
+    }
+    mEntries.push_back(Entry{ path.toString(), flags, BigBuffer(4096) });
+    mInEntry = true;
+    return true;
+}
+
+bool BufferedArchiveWriter::writeEntry(const BigBuffer& buffer) {
+    for (const BigBuffer::Block& b : buffer) {
+        if (!writeEntry(b.buffer.get(), b.size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BufferedArchiveWriter::writeEntry(const void* data, size_t len) {
+    if (!mInEntry) {
+        return false;
+    }
+
+    if (len > 0) {
+        uint8_t* dst = mEntries.back().data.nextBlock<uint8_t>(len);
+        memcpy(dst, data, len);
+    }
+    return true;
+}
+
+bool BufferedArchiveWriter::finishEntry() {
+    if (!mInEntry) {
+        return false;
+    }
+    mInEntry = false;
+    return true;
+}
+
+bool BufferedArchiveWriter::writeTo(IArchiveWriter* writer, IDiagnostics* diag) {
+    if (mInEntry) {
+        // Drop the unfinished entry, it was abandoned after an error.
+        mEntries.pop_back();
+        mInEntry = false;
+    }
+
+    std::vector<Entry> entries = std::move(mEntries);
+    mEntries.clear();
+    for (const Entry& entry : entries) {
+        if (!writer->startEntry(entry.path, entry.flags)) {
+            diag->error(DiagMessage(entry.path) << "failed to open");
+            return false;
+        }
+
+        if (!writer->writeEntry(entry.data)) {
+            diag->error(DiagMessage(entry.path) << "failed to write");
+            return false;
+        }
+
+        if (!writer->finishEntry()) {
+            diag->error(DiagMessage(entry.path) << "failed to finish entry");
+            return false;
+        }
+    }
+    return true;
+}
+
 std::unique_ptr<IArchiveWriter> createDirectoryArchiveWriter(IDiagnostics* diag,
                                                              const StringPiece& path) {
 
@@ -49,12 +49,63 @@ struct IArchiveWriter : public google::protobuf::io::CopyingOutputStream {
     virtual bool writeEntry(const void* data, size_t len) = 0;
     virtual bool finishEntry() = 0;
 
+    /**
+     * Writes a whole entry whose data is already deflated, given the CRC32 and size of the
+     * inflated data. Writers that can't store it as is for the given flags return false
+     * without writing anything, and the caller should write the inflated data instead.
+     */
+    virtual bool writeDeflatedEntry(const StringPiece& path, uint32_t flags,
+                                    const void* data, size_t len,
+                                    uint32_t crc32, size_t uncompressedSize) {
+        return false;
+    }
+
+    /**
+     * Writes out anything still held back, once all entries have been written. Returns
+     * false if any entry failed to make it to the output.
+     */
+    virtual bool finish() {
+        return true;
+    }
+
     // CopyingOutputStream implementations.
     bool Write(const void* buffer, int size) override {
         return writeEntry(buffer, size);
     }
 };
 
+/**
+ * Holds entries in memory until they are written to another IArchiveWriter. This lets
+ * entries be produced on several threads and still be written out in a deterministic order.
+ */
+class BufferedArchiveWriter : public IArchiveWriter {
+public:
+    BufferedArchiveWriter() = default;
+
+    bool startEntry(const StringPiece& path, uint32_t flags) override;
+    bool writeEntry(const BigBuffer& buffer) override;
+    bool writeEntry(const void* data, size_t len) override;
+    bool finishEntry() override;
+
+    /**
+     * Writes all finished entries to writer, in the order they were started, and
+     * forgets them.
+     */
+    bool writeTo(IArchiveWriter* writer, IDiagnostics* diag);
+
+private:
+    struct Entry {
+        std::string path;
+        uint32_t flags;
+        BigBuffer data;
+    };
+
+    std::vector<Entry> mEntries;
+    bool mInEntry = false;
+
+    DISALLOW_COPY_AND_ASSIGN(BufferedArchiveWriter);
+};
+
 std::unique_ptr<IArchiveWriter> createDirectoryArchiveWriter(IDiagnostics* diag,
                                                              const StringPiece& path);
 
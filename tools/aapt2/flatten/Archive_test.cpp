@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flatten/Archive.h"
+#include "test/Common.h"
+#include "util/Files.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <ziparchive/zip_archive.h>
+#include <zlib.h>
+
+namespace aapt {
+
+namespace {
+
+struct RecordingArchiveWriter : public IArchiveWriter {
+    struct Entry {
+        std::string path;
+        uint32_t flags;
+        std::string data;
+    };
+
+    std::vector<Entry> entries;
+
+    bool startEntry(const StringPiece& path, uint32_t flags) override {
+        entries.push_back(Entry{ path.toString(), flags, {} });
+        return true;
+    }
+
+    bool writeEntry(const BigBuffer& buffer) override {
+        for (const BigBuffer::Block& b : buffer) {
+            writeEntry(b.buffer.get(), b.size);
+        }
+        return true;
+    }
+
+    bool writeEntry(const void* data, size_t len) override {
+        entries.back().data.append(reinterpret_cast<const char*>(data), len);
+        return true;
+    }
+
+    bool finishEntry() override {
+        return true;
+    }
+};
+
+struct TestEntry {
+    std::string path;
+    uint32_t flags;
+    std::string data;
+};
+
+/**
+ * Returns size bytes of data that compresses, but not to nothing.
+ */
+std::string makeData(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = 'a' + (i * 7 + i / 13) % 26;
+    }
+    return data;
+}
+
+bool writeEntry(IArchiveWriter* writer, const TestEntry& entry) {
+    if (!writer->startEntry(entry.path, entry.flags)) {
+        return false;
+    }
+
+    // Hand the data over in pieces, like the protobuf output stream does.
+    const size_t kPieceSize = 64 * 1024;
+    for (size_t i = 0; i < entry.data.size(); i += kPieceSize) {
+        const size_t len = std::min(kPieceSize, entry.data.size() - i);
+        if (!writer->writeEntry(entry.data.data() + i, len)) {
+            return false;
+        }
+    }
+    return writer->finishEntry();
+}
+
+class ZipFileArchiveWriterTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        const char* tmp = getenv("TMPDIR");
+        mPath = tmp ? tmp : "/tmp";
+        file::appendPath(&mPath, "aapt2_archive_test.zip");
+    }
+
+    void TearDown() override {
+        std::remove(mPath.c_str());
+    }
+
+    /**
+     * Opens the archive written to mPath and checks that it holds exactly the given
+     * entries, in order.
+     */
+    void verifyArchive(const std::vector<TestEntry>& expected) {
+        ZipArchiveHandle handle;
+        ASSERT_EQ(0, OpenArchive(mPath.data(), &handle));
+
+        off64_t lastOffset = -1;
+        for (const TestEntry& expectedEntry : expected) {
+            SCOPED_TRACE(expectedEntry.path);
+
+            ZipEntry entry;
+            ASSERT_EQ(0, FindEntry(handle, ZipString(expectedEntry.path.data()), &entry));
+
+            const bool compressed = (expectedEntry.flags & ArchiveEntry::kCompress) != 0;
+            EXPECT_EQ(compressed ? kCompressDeflated : kCompressStored, entry.method);
+            if (expectedEntry.flags & ArchiveEntry::kAlign) {
+                EXPECT_EQ(0, entry.offset % 4);
+            }
+            EXPECT_GT(entry.offset, lastOffset);
+            lastOffset = entry.offset;
+
+            const uLong crc = crc32(crc32(0L, Z_NULL, 0),
+                                    reinterpret_cast<const Bytef*>(expectedEntry.data.data()),
+                                    expectedEntry.data.size());
+            EXPECT_EQ(static_cast<uint32_t>(crc), entry.crc32);
+
+            ASSERT_EQ(expectedEntry.data.size(), entry.uncompressed_length);
+            std::string data(entry.uncompressed_length, '\0');
+            ASSERT_EQ(0, ExtractToMemory(handle, &entry, reinterpret_cast<uint8_t*>(&data[0]),
+                                         data.size()));
+            EXPECT_EQ(expectedEntry.data, data);
+        }
+
+        void* cookie;
+        ASSERT_EQ(0, StartIteration(handle, &cookie, nullptr, nullptr));
+        size_t count = 0;
+        ZipEntry entry;
+        ZipString name;
+        while (Next(cookie, &entry, &name) == 0) {
+            count++;
+        }
+        EndIteration(cookie);
+        EXPECT_EQ(expected.size(), count);
+
+        CloseArchive(handle);
+    }
+
+protected:
+    std::string mPath;
+};
+
+} // namespace
+
+TEST_F(ZipFileArchiveWriterTest, WritesEntriesThatCanBeRead) {
+    const std::vector<TestEntry> entries = {
+            { "res/raw/stored.txt", 0, "stored data" },
+            { "res/raw/compressed.txt", ArchiveEntry::kCompress, makeData(10000) },
+            { "empty", ArchiveEntry::kCompress, "" },
+            { "empty_stored", 0, "" },
+
+            // Paths of each length modulo 4, so that every amount of padding is needed.
+            { "a", ArchiveEntry::kAlign, "aligned data" },
+            { "ab", ArchiveEntry::kAlign, "aligned data" },
+            { "abc", ArchiveEntry::kAlign, "aligned data" },
+            { "abcd", ArchiveEntry::kAlign, "aligned data" },
+    };
+
+    std::unique_ptr<IArchiveWriter> writer = createZipFileArchiveWriter(test::getDiagnostics(),
+                                                                        mPath);
+    ASSERT_NE(nullptr, writer);
+    for (const TestEntry& entry : entries) {
+        ASSERT_TRUE(writeEntry(writer.get(), entry));
+    }
+    ASSERT_TRUE(writer->finish());
+    writer.reset();
+
+    verifyArchive(entries);
+}
+
+TEST_F(ZipFileArchiveWriterTest, StreamsLargeEntriesInOrder) {
+    // Large entries are written out as they come in rather than held in memory, after
+    // the entries before them.
+    const std::vector<TestEntry> entries = {
+            { "small.txt", ArchiveEntry::kCompress, makeData(1000) },
+            { "large_compressed.bin", ArchiveEntry::kCompress, makeData(3 * 1024 * 1024) },
+            { "small_aligned.bin", ArchiveEntry::kAlign, "aligned data" },
+            { "large_aligned.bin", ArchiveEntry::kAlign, makeData(2 * 1024 * 1024 + 1) },
+            { "large_stored.bin", 0, makeData(2 * 1024 * 1024 + 3) },
+            { "last.txt", ArchiveEntry::kCompress, makeData(1000) },
+    };
+
+    std::unique_ptr<IArchiveWriter> writer = createZipFileArchiveWriter(test::getDiagnostics(),
+                                                                        mPath);
+    ASSERT_NE(nullptr, writer);
+    for (const TestEntry& entry : entries) {
+        ASSERT_TRUE(writeEntry(writer.get(), entry));
+    }
+    ASSERT_TRUE(writer->finish());
+    writer.reset();
+
+    verifyArchive(entries);
+}
+
+TEST(BufferedArchiveWriterTest, WritesEntriesInOrder) {
+    BufferedArchiveWriter buffered;
+    ASSERT_TRUE(buffered.startEntry("b.flat", 0));
+    ASSERT_TRUE(buffered.writeEntry("hello ", 6));
+    ASSERT_TRUE(buffered.writeEntry("world", 5));
+    ASSERT_TRUE(buffered.finishEntry());
+    ASSERT_TRUE(buffered.startEntry("a.flat", ArchiveEntry::kCompress));
+    ASSERT_TRUE(buffered.finishEntry());
+
+    RecordingArchiveWriter writer;
+    ASSERT_TRUE(buffered.writeTo(&writer, test::getDiagnostics()));
+    ASSERT_EQ(2u, writer.entries.size());
+    EXPECT_EQ(std::string("b.flat"), writer.entries[0].path);
+    EXPECT_EQ(0u, writer.entries[0].flags);
+    EXPECT_EQ(std::string("hello world"), writer.entries[0].data);
+    EXPECT_EQ(std::string("a.flat"), writer.entries[1].path);
+    EXPECT_EQ(uint32_t(ArchiveEntry::kCompress), writer.entries[1].flags);
+    EXPECT_EQ(std::string(), writer.entries[1].data);
+
+    // Entries are only written once.
+    RecordingArchiveWriter writer2;
+    ASSERT_TRUE(buffered.writeTo(&writer2, test::getDiagnostics()));
+    EXPECT_EQ(0u, writer2.entries.size());
+}
+
+TEST(BufferedArchiveWriterTest, DropsUnfinishedEntry) {
+    BufferedArchiveWriter buffered;
+    ASSERT_TRUE(buffered.startEntry("a.flat", 0));
+    ASSERT_TRUE(buffered.finishEntry());
+    ASSERT_TRUE(buffered.startEntry("b.flat", 0));
+    ASSERT_TRUE(buffered.writeEntry("partial", 7));
+    EXPECT_FALSE(buffered.startEntry("c.flat", 0));
+
+    RecordingArchiveWriter writer;
+    ASSERT_TRUE(buffered.writeTo(&writer, test::getDiagnostics()));
+    ASSERT_EQ(1u, writer.entries.size());
+    EXPECT_EQ(std::string("a.flat"), writer.entries[0].path);
+}
+
+} // namespace aapt
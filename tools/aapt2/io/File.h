@@ -44,6 +44,20 @@ public:
      */
     virtual std::unique_ptr<IData> openAsData() = 0;
 
+    /**
+     * If the file is stored deflated, as in a ZIP archive, returns the raw deflated stream
+     * and sets outCrc32 and outUncompressedSize. This lets the file be copied into another
+     * archive without deflating it again. Implementations must check the stream against
+     * outCrc32 and outUncompressedSize, as openAsData() would have.
+     *
+     * Returns nullptr if the file isn't deflated, the stream can't be opened or doesn't
+     * match its CRC32; use openAsData() instead, which reports the error.
+     */
+    virtual std::unique_ptr<IData> openAsDeflatedData(uint32_t* outCrc32,
+                                                      size_t* outUncompressedSize) {
+        return {};
+    }
+
     /**
      * Returns the source of this file. This is for presentation to the user and may not be a
      * valid file system path (for example, it may contain a '@' sign to separate the files within
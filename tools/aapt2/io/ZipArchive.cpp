@@ -18,12 +18,43 @@
 #include "io/ZipArchive.h"
 #include "util/Util.h"
 
+#include <cstring>
 #include <utils/FileMap.h>
 #include <ziparchive/zip_archive.h>
+#include <zlib.h>
 
 namespace aapt {
 namespace io {
 
+/**
+ * Inflates the deflated data without keeping the result, and checks that it comes out
+ * to the given size and CRC32. This is what ExtractToMemory() would have checked.
+ */
+static bool verifyDeflatedData(const void* data, size_t len, uint32_t crc32,
+                               size_t uncompressedSize) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return false;
+    }
+
+    uint8_t buffer[32 * 1024];
+    uLong crc = ::crc32(0L, Z_NULL, 0);
+    stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data));
+    stream.avail_in = static_cast<uInt>(len);
+    int result;
+    do {
+        stream.next_out = buffer;
+        stream.avail_out = sizeof(buffer);
+        result = inflate(&stream, Z_NO_FLUSH);
+        crc = ::crc32(crc, buffer, sizeof(buffer) - stream.avail_out);
+    } while (result == Z_OK);
+    inflateEnd(&stream);
+
+    return result == Z_STREAM_END && stream.total_out == uncompressedSize
+            && static_cast<uint32_t>(crc) == crc32;
+}
+
 ZipFile::ZipFile(ZipArchiveHandle handle, const ZipEntry& entry, const Source& source) :
         mZipHandle(handle), mZipEntry(entry), mSource(source) {
 }
@@ -52,6 +83,33 @@ std::unique_ptr<IData> ZipFile::openAsData() {
     }
 }
 
+std::unique_ptr<IData> ZipFile::openAsDeflatedData(uint32_t* outCrc32,
+                                                   size_t* outUncompressedSize) {
+    if (mZipEntry.method != kCompressDeflated) {
+        return {};
+    }
+
+    int fd = GetFileDescriptor(mZipHandle);
+
+    android::FileMap fileMap;
+    bool result = fileMap.create(nullptr, fd, mZipEntry.offset,
+                                 mZipEntry.compressed_length, true);
+    if (!result) {
+        return {};
+    }
+
+    // The data is copied without being extracted, so check it here the way extracting
+    // it would have. Inflating is much cheaper than deflating it again.
+    if (!verifyDeflatedData(fileMap.getDataPtr(), fileMap.getDataLength(), mZipEntry.crc32,
+                            mZipEntry.uncompressed_length)) {
+        return {};
+    }
+
+    *outCrc32 = mZipEntry.crc32;
+    *outUncompressedSize = mZipEntry.uncompressed_length;
+    return util::make_unique<MmappedData>(std::move(fileMap));
+}
+
 const Source& ZipFile::getSource() const {
     return mSource;
 }
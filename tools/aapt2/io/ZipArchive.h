@@ -35,6 +35,8 @@ public:
     ZipFile(ZipArchiveHandle handle, const ZipEntry& entry, const Source& source);
 
     std::unique_ptr<IData> openAsData() override;
+    std::unique_ptr<IData> openAsDeflatedData(uint32_t* outCrc32,
+                                              size_t* outUncompressedSize) override;
     const Source& getSource() const override;
 
 private:
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flatten/Archive.h"
+#include "io/ZipArchive.h"
+#include "test/Common.h"
+#include "util/Files.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <string>
+#include <zlib.h>
+
+namespace aapt {
+namespace io {
+
+static constexpr const char* kDeflatedPath = "res/raw/data.bin";
+
+static std::string makeData(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = 'a' + (i * 7 + i / 13) % 26;
+    }
+    return data;
+}
+
+static uint32_t crc32Of(const std::string& data) {
+    return static_cast<uint32_t>(crc32(crc32(0L, Z_NULL, 0),
+                                       reinterpret_cast<const Bytef*>(data.data()),
+                                       data.size()));
+}
+
+class ZipArchiveTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        const char* tmp = getenv("TMPDIR");
+        const std::string dir = tmp ? tmp : "/tmp";
+        mInputPath = dir;
+        file::appendPath(&mInputPath, "aapt2_zip_archive_test_in.zip");
+        mOutputPath = dir;
+        file::appendPath(&mOutputPath, "aapt2_zip_archive_test_out.zip");
+    }
+
+    void TearDown() override {
+        std::remove(mInputPath.c_str());
+        std::remove(mOutputPath.c_str());
+    }
+
+    void writeInput() {
+        std::unique_ptr<IArchiveWriter> writer = createZipFileArchiveWriter(
+                test::getDiagnostics(), mInputPath);
+        ASSERT_NE(nullptr, writer);
+        ASSERT_TRUE(writer->startEntry(kDeflatedPath, ArchiveEntry::kCompress));
+        ASSERT_TRUE(writer->writeEntry(mData.data(), mData.size()));
+        ASSERT_TRUE(writer->finishEntry());
+        ASSERT_TRUE(writer->startEntry("stored.txt", 0));
+        ASSERT_TRUE(writer->writeEntry(mData.data(), mData.size()));
+        ASSERT_TRUE(writer->finishEntry());
+        ASSERT_TRUE(writer->finish());
+    }
+
+protected:
+    const std::string mData = makeData(10000);
+    std::string mInputPath;
+    std::string mOutputPath;
+};
+
+TEST_F(ZipArchiveTest, CopiesDeflatedEntryToAnotherArchive) {
+    writeInput();
+
+    std::string error;
+    std::unique_ptr<ZipFileCollection> input = ZipFileCollection::create(mInputPath, &error);
+    ASSERT_NE(nullptr, input) << error;
+
+    IFile* storedFile = input->findFile("stored.txt");
+    ASSERT_NE(nullptr, storedFile);
+    uint32_t crc = 0;
+    size_t uncompressedSize = 0;
+    EXPECT_EQ(nullptr, storedFile->openAsDeflatedData(&crc, &uncompressedSize));
+
+    IFile* file = input->findFile(kDeflatedPath);
+    ASSERT_NE(nullptr, file);
+    std::unique_ptr<IData> deflated = file->openAsDeflatedData(&crc, &uncompressedSize);
+    ASSERT_NE(nullptr, deflated);
+    EXPECT_EQ(crc32Of(mData), crc);
+    EXPECT_EQ(mData.size(), uncompressedSize);
+    EXPECT_LT(deflated->size(), mData.size());
+
+    {
+        std::unique_ptr<IArchiveWriter> writer = createZipFileArchiveWriter(
+                test::getDiagnostics(), mOutputPath);
+        ASSERT_NE(nullptr, writer);
+
+        // Deflated data can't be aligned.
+        EXPECT_FALSE(writer->writeDeflatedEntry(
+                "aligned.bin", ArchiveEntry::kCompress | ArchiveEntry::kAlign,
+                deflated->data(), deflated->size(), crc, uncompressedSize));
+
+        ASSERT_TRUE(writer->writeDeflatedEntry("copy.bin", ArchiveEntry::kCompress,
+                                               deflated->data(), deflated->size(),
+                                               crc, uncompressedSize));
+        ASSERT_TRUE(writer->finish());
+    }
+
+    std::unique_ptr<ZipFileCollection> output = ZipFileCollection::create(mOutputPath, &error);
+    ASSERT_NE(nullptr, output) << error;
+    EXPECT_EQ(nullptr, output->findFile("aligned.bin"));
+
+    IFile* copy = output->findFile("copy.bin");
+    ASSERT_NE(nullptr, copy);
+    std::unique_ptr<IData> data = copy->openAsData();
+    ASSERT_NE(nullptr, data);
+    EXPECT_EQ(mData, std::string(reinterpret_cast<const char*>(data->data()), data->size()));
+}
+
+TEST_F(ZipArchiveTest, DoesNotCopyCorruptDeflatedEntry) {
+    writeInput();
+
+    // Flip a byte of the deflated data, which starts right after the first local file
+    // header and its path.
+    std::string contents;
+    {
+        std::ifstream fin(mInputPath, std::ifstream::binary);
+        contents.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+    }
+    const size_t dataOffset = 30 + strlen(kDeflatedPath);
+    ASSERT_LT(dataOffset + 16, contents.size());
+    contents[dataOffset + 16] ^= 0x55;
+    {
+        std::ofstream fout(mInputPath, std::ofstream::binary);
+        fout.write(contents.data(), contents.size());
+    }
+
+    std::string error;
+    std::unique_ptr<ZipFileCollection> input = ZipFileCollection::create(mInputPath, &error);
+    ASSERT_NE(nullptr, input) << error;
+
+    IFile* file = input->findFile(kDeflatedPath);
+    ASSERT_NE(nullptr, file);
+    uint32_t crc = 0;
+    size_t uncompressedSize = 0;
+    EXPECT_EQ(nullptr, file->openAsDeflatedData(&crc, &uncompressedSize));
+
+    // Extracting it fails too, so the caller reports the error.
+    EXPECT_EQ(nullptr, file->openAsData());
+}
+
+} // namespace io
+} // namespace aapt
@@ -39,6 +39,14 @@ public:
         mKeepMethodSet[methodName].insert(source);
     }
 
+    inline const std::map<std::u16string, std::set<Source>>& getClasses() const {
+        return mKeepSet;
+    }
+
+    inline const std::map<std::u16string, std::set<Source>>& getMethods() const {
+        return mKeepMethodSet;
+    }
+
 private:
     friend bool writeKeepSet(std::ostream* out, const KeepSet& keepSet);
 
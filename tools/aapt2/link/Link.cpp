@@ -35,6 +35,7 @@
 #include "link/ReferenceLinker.h"
 #include "link/ManifestFixer.h"
 #include "link/TableMerger.h"
+#include "link/XmlLinkCache.h"
 #include "process/IResourceTableConsumer.h"
 #include "process/SymbolTable.h"
 #include "proto/ProtoSerialize.h"
@@ -44,11 +45,14 @@
 #include "util/StringPiece.h"
 #include "xml/XmlDom.h"
 
+#include <androidfw/AssetManager.h>
 #include <google/protobuf/io/coded_stream.h>
 
 #include <fstream>
+#include <sstream>
 #include <sys/stat.h>
 #include <vector>
+#include <zlib.h>
 
 namespace aapt {
 
@@ -75,6 +79,10 @@ struct LinkOptions {
     ManifestFixerOptions manifestFixerOptions;
     std::unordered_set<std::string> products;
     TableSplitterOptions tableSplitterOptions;
+    Maybe<std::string> incrementalCacheDir;
+
+    // When set, the symbols of the include paths are taken from and kept in this cache.
+    AssetManagerSymbolSourceCache* includeCache = nullptr;
 };
 
 class LinkContext : public IAaptContext {
@@ -134,6 +142,25 @@ private:
 static bool copyFileToArchive(io::IFile* file, const std::string& outPath,
                               uint32_t compressionFlags,
                               IArchiveWriter* writer, IAaptContext* context) {
+    // A file that is already deflated in a ZIP archive (a static library, for instance)
+    // is copied over as is instead of being inflated and deflated again. Compiled files
+    // can't be, since their header is stripped off below.
+    if (!util::stringEndsWith<char>(file->getSource().path, ".flat")) {
+        uint32_t crc32 = 0;
+        size_t uncompressedSize = 0;
+        std::unique_ptr<io::IData> deflated = file->openAsDeflatedData(&crc32,
+                                                                       &uncompressedSize);
+        if (deflated && writer->writeDeflatedEntry(outPath, compressionFlags,
+                                                   deflated->data(), deflated->size(),
+                                                   crc32, uncompressedSize)) {
+            if (context->verbose()) {
+                context->getDiagnostics()->note(DiagMessage() << "copying " << outPath
+                                                << " to archive");
+            }
+            return true;
+        }
+    }
+
     std::unique_ptr<io::IData> data = file->openAsData();
     if (!data) {
         context->getDiagnostics()->error(DiagMessage(file->getSource())
@@ -172,13 +199,17 @@ static bool copyFileToArchive(io::IFile* file, const std::string& outPath,
     return false;
 }
 
+/**
+ * Flattens the XML into `buffer` and writes it to the archive. The flattened XML
+ * is left in `buffer`.
+ */
 static bool flattenXml(xml::XmlResource* xmlRes, const StringPiece& path, Maybe<size_t> maxSdkLevel,
-                       bool keepRawValues, IArchiveWriter* writer, IAaptContext* context) {
-    BigBuffer buffer(1024);
+                       bool keepRawValues, BigBuffer* buffer, IArchiveWriter* writer,
+                       IAaptContext* context) {
     XmlFlattenerOptions options = {};
     options.keepRawValues = keepRawValues;
     options.maxSdkLevel = maxSdkLevel;
-    XmlFlattener flattener(&buffer, options);
+    XmlFlattener flattener(buffer, options);
     if (!flattener.consume(context, xmlRes)) {
         return false;
     }
@@ -193,7 +224,28 @@ static bool flattenXml(xml::XmlResource* xmlRes, const StringPiece& path, Maybe<
     }
 
     if (writer->startEntry(path, ArchiveEntry::kCompress)) {
-        if (writer->writeEntry(buffer)) {
+        if (writer->writeEntry(*buffer)) {
+            if (writer->finishEntry()) {
+                return true;
+            }
+        }
+    }
+    context->getDiagnostics()->error(DiagMessage() << "failed to write " << path << " to archive");
+    return false;
+}
+
+/**
+ * Writes XML that was flattened on a previous run, taken from the XmlLinkCache.
+ */
+static bool writeCachedXml(const std::string& flattenedXml, const StringPiece& path,
+                           IArchiveWriter* writer, IAaptContext* context) {
+    if (context->verbose()) {
+        context->getDiagnostics()->note(DiagMessage() << "writing cached " << path
+                                        << " to archive");
+    }
+
+    if (writer->startEntry(path, ArchiveEntry::kCompress)) {
+        if (writer->writeEntry(flattenedXml.data(), flattenedXml.size())) {
             if (writer->finishEntry()) {
                 return true;
             }
@@ -283,6 +335,7 @@ struct ResourceFileFlattenerOptions {
     bool keepRawValues = false;
     bool doNotCompressAnything = false;
     std::vector<std::string> extensionsToNotCompress;
+    XmlLinkCache* xmlLinkCache = nullptr;
 };
 
 class ResourceFileFlattener {
@@ -300,13 +353,23 @@ private:
         std::unique_ptr<xml::XmlResource> xmlToFlatten;
         std::string dstPath;
         bool skipVersion = false;
+
+        // Only set when there is an XmlLinkCache. If xmlToFlatten is null, the entry was
+        // found in the cache. Otherwise it is stored once the XML is flattened.
+        std::string cacheKey;
+        std::unique_ptr<XmlLinkCache::Entry> cacheEntry;
     };
 
     uint32_t getCompressionFlags(const StringPiece& str);
 
+    std::string getCacheOptions(const ResourceFile& fileDesc);
+
     bool linkAndVersionXmlFile(const ResourceEntry* entry, const ResourceFile& fileDesc,
                                io::IFile* file, ResourceTable* table, FileOperation* outFileOp);
 
+    bool versionXmlFile(const ResourceEntry* entry, const ResourceFile& fileDesc,
+                        const std::set<int>& sdkLevels, io::IFile* file, ResourceTable* table);
+
     ResourceFileFlattenerOptions mOptions;
     IAaptContext* mContext;
     proguard::KeepSet* mKeepSet;
@@ -325,15 +388,35 @@ uint32_t ResourceFileFlattener::getCompressionFlags(const StringPiece& str) {
     return ArchiveEntry::kCompress;
 }
 
+std::string ResourceFileFlattener::getCacheOptions(const ResourceFile& fileDesc) {
+    std::stringstream options;
+    options << fileDesc.name << "\n"
+            << fileDesc.config << "\n"
+            << fileDesc.source.path << "\n"
+            << mOptions.keepRawValues << mOptions.noAutoVersion << mOptions.noVersionVectors;
+    return options.str();
+}
+
+static void addKeepRules(const proguard::KeepSet& rules, proguard::KeepSet* keepSet) {
+    for (const auto& rule : rules.getClasses()) {
+        for (const Source& source : rule.second) {
+            keepSet->addClass(source, rule.first);
+        }
+    }
+
+    for (const auto& rule : rules.getMethods()) {
+        for (const Source& source : rule.second) {
+            keepSet->addMethod(source, rule.first);
+        }
+    }
+}
+
 bool ResourceFileFlattener::linkAndVersionXmlFile(const ResourceEntry* entry,
                                                   const ResourceFile& fileDesc,
                                                   io::IFile* file,
                                                   ResourceTable* table,
                                                   FileOperation* outFileOp) {
     const StringPiece srcPath = file->getSource().path;
-    if (mContext->verbose()) {
-        mContext->getDiagnostics()->note(DiagMessage() << "linking " << srcPath);
-    }
 
     std::unique_ptr<io::IData> data = file->openAsData();
     if (!data) {
@@ -341,6 +424,30 @@ bool ResourceFileFlattener::linkAndVersionXmlFile(const ResourceEntry* entry,
         return false;
     }
 
+    XmlLinkCache* cache = mOptions.xmlLinkCache;
+    if (cache) {
+        outFileOp->cacheKey = cache->makeKey(data->data(), data->size(),
+                                             getCacheOptions(fileDesc));
+        outFileOp->cacheEntry = util::make_unique<XmlLinkCache::Entry>();
+        if (cache->find(outFileOp->cacheKey, mContext->getExternalSymbols(),
+                        outFileOp->cacheEntry.get())) {
+            if (mContext->verbose()) {
+                mContext->getDiagnostics()->note(DiagMessage() << "using cached " << srcPath);
+            }
+
+            addKeepRules(outFileOp->cacheEntry->keepSet, mKeepSet);
+            outFileOp->skipVersion = outFileOp->cacheEntry->skipVersion;
+            if (mOptions.noAutoVersion || outFileOp->skipVersion) {
+                return true;
+            }
+            return versionXmlFile(entry, fileDesc, outFileOp->cacheEntry->sdkLevels, file, table);
+        }
+    }
+
+    if (mContext->verbose()) {
+        mContext->getDiagnostics()->note(DiagMessage() << "linking " << srcPath);
+    }
+
     if (util::stringEndsWith<char>(srcPath, ".flat")) {
         outFileOp->xmlToFlatten = loadBinaryXmlSkipFileExport(file->getSource(),
                                                               data->data(), data->size(),
@@ -359,15 +466,31 @@ bool ResourceFileFlattener::linkAndVersionXmlFile(const ResourceEntry* entry,
     outFileOp->xmlToFlatten->file = fileDesc;
 
     XmlReferenceLinker xmlLinker;
-    if (!xmlLinker.consume(mContext, outFileOp->xmlToFlatten.get())) {
+    proguard::KeepSet* keepSet = mKeepSet;
+    if (cache) {
+        // Record the symbols this file depends on, so that the cache can tell
+        // when they change.
+        SymbolRecordingContext recordingContext(mContext);
+        if (!xmlLinker.consume(&recordingContext, outFileOp->xmlToFlatten.get())) {
+            return false;
+        }
+        outFileOp->cacheEntry->symbolNames = recordingContext.getNamesLookedUp();
+        outFileOp->cacheEntry->symbolIds = recordingContext.getIdsLookedUp();
+        outFileOp->cacheEntry->sdkLevels = xmlLinker.getSdkLevels();
+        keepSet = &outFileOp->cacheEntry->keepSet;
+    } else if (!xmlLinker.consume(mContext, outFileOp->xmlToFlatten.get())) {
         return false;
     }
 
     if (!proguard::collectProguardRules(outFileOp->xmlToFlatten->file.source,
-                                        outFileOp->xmlToFlatten.get(), mKeepSet)) {
+                                        outFileOp->xmlToFlatten.get(), keepSet)) {
         return false;
     }
 
+    if (keepSet != mKeepSet) {
+        addKeepRules(*keepSet, mKeepSet);
+    }
+
     if (!mOptions.noAutoVersion) {
         if (mOptions.noVersionVectors) {
             // Skip this if it is a vector or animated-vector.
@@ -376,46 +499,56 @@ bool ResourceFileFlattener::linkAndVersionXmlFile(const ResourceEntry* entry,
                 if (el->name == u"vector" || el->name == u"animated-vector") {
                     // We are NOT going to version this file.
                     outFileOp->skipVersion = true;
+                    if (outFileOp->cacheEntry) {
+                        outFileOp->cacheEntry->skipVersion = true;
+                    }
                     return true;
                 }
             }
         }
+        return versionXmlFile(entry, fileDesc, xmlLinker.getSdkLevels(), file, table);
+    }
+    return true;
+}
 
-        // Find the first SDK level used that is higher than this defined config and
-        // not superseded by a lower or equal SDK level resource.
-        for (int sdkLevel : xmlLinker.getSdkLevels()) {
-            if (sdkLevel > outFileOp->xmlToFlatten->file.config.sdkVersion) {
-                if (!shouldGenerateVersionedResource(entry, outFileOp->xmlToFlatten->file.config,
-                                                     sdkLevel)) {
-                    // If we shouldn't generate a versioned resource, stop checking.
-                    break;
-                }
+bool ResourceFileFlattener::versionXmlFile(const ResourceEntry* entry,
+                                           const ResourceFile& fileDesc,
+                                           const std::set<int>& sdkLevels,
+                                           io::IFile* file,
+                                           ResourceTable* table) {
+    // Find the first SDK level used that is higher than this defined config and
+    // not superseded by a lower or equal SDK level resource.
+    for (int sdkLevel : sdkLevels) {
+        if (sdkLevel > fileDesc.config.sdkVersion) {
+            if (!shouldGenerateVersionedResource(entry, fileDesc.config, sdkLevel)) {
+                // If we shouldn't generate a versioned resource, stop checking.
+                break;
+            }
 
-                ResourceFile versionedFileDesc = outFileOp->xmlToFlatten->file;
-                versionedFileDesc.config.sdkVersion = (uint16_t) sdkLevel;
+            ResourceFile versionedFileDesc = fileDesc;
+            versionedFileDesc.config.sdkVersion = (uint16_t) sdkLevel;
 
-                if (mContext->verbose()) {
-                    mContext->getDiagnostics()->note(DiagMessage(versionedFileDesc.source)
-                                                     << "auto-versioning resource from config '"
-                                                     << outFileOp->xmlToFlatten->file.config
-                                                     << "' -> '"
-                                                     << versionedFileDesc.config << "'");
-                }
+            if (mContext->verbose()) {
+                mContext->getDiagnostics()->note(DiagMessage(versionedFileDesc.source)
+                                                 << "auto-versioning resource from config '"
+                                                 << fileDesc.config
+                                                 << "' -> '"
+                                                 << versionedFileDesc.config << "'");
+            }
 
-                std::u16string genPath = util::utf8ToUtf16(ResourceUtils::buildResourceFileName(
-                        versionedFileDesc, mContext->getNameMangler()));
+            std::u16string genPath = util::utf8ToUtf16(ResourceUtils::buildResourceFileName(
+                    versionedFileDesc, mContext->getNameMangler()));
 
-                bool added = table->addFileReferenceAllowMangled(versionedFileDesc.name,
-                                                                 versionedFileDesc.config,
-                                                                 versionedFileDesc.source,
-                                                                 genPath,
-                                                                 file,
-                                                                 mContext->getDiagnostics());
-                if (!added) {
-                    return false;
-                }
-                break;
+            bool added = table->addFileReferenceAllowMangled(versionedFileDesc.name,
+                                                             versionedFileDesc.config,
+                                                             versionedFileDesc.source,
+                                                             genPath,
+                                                             file,
+                                                             mContext->getDiagnostics());
+            if (!added) {
+                return false;
             }
+            break;
         }
     }
     return true;
@@ -496,11 +629,25 @@ bool ResourceFileFlattener::flatten(ResourceTable* table, IArchiveWriter* archiv
                         maxSdkLevel = std::max<size_t>(config.sdkVersion, 1u);
                     }
 
+                    BigBuffer buffer(1024);
                     bool result = flattenXml(fileOp.xmlToFlatten.get(), fileOp.dstPath, maxSdkLevel,
-                                             mOptions.keepRawValues,
+                                             mOptions.keepRawValues, &buffer,
                                              archiveWriter, mContext);
                     if (!result) {
                         error = true;
+                    } else if (fileOp.cacheEntry) {
+                        for (const BigBuffer::Block& block : buffer) {
+                            fileOp.cacheEntry->flattenedXml.append(
+                                    reinterpret_cast<const char*>(block.buffer.get()), block.size);
+                        }
+                        mOptions.xmlLinkCache->store(fileOp.cacheKey, *fileOp.cacheEntry,
+                                                     mContext->getExternalSymbols(),
+                                                     mContext->getDiagnostics());
+                    }
+                } else if (fileOp.cacheEntry) {
+                    if (!writeCachedXml(fileOp.cacheEntry->flattenedXml, fileOp.dstPath,
+                                        archiveWriter, mContext)) {
+                        error = true;
                     }
                 } else {
                     bool result = copyFileToArchive(fileOp.fileToCopy, fileOp.dstPath,
@@ -528,8 +675,16 @@ public:
      * results for faster lookup.
      */
     bool loadSymbolsFromIncludePaths() {
-        std::unique_ptr<AssetManagerSymbolSource> assetSource =
-                util::make_unique<AssetManagerSymbolSource>();
+        std::shared_ptr<AssetManagerSymbolSource> assetSource;
+        if (mOptions.includeCache) {
+            assetSource = mOptions.includeCache->find(mOptions.includePaths);
+        }
+
+        const bool loadAssets = !assetSource;
+        if (loadAssets) {
+            assetSource = std::make_shared<AssetManagerSymbolSource>();
+        }
+
         for (const std::string& path : mOptions.includePaths) {
             if (mContext->verbose()) {
                 mContext->getDiagnostics()->note(DiagMessage(path) << "loading include path");
@@ -565,14 +720,19 @@ public:
                 return false;
             }
 
-            if (!assetSource->addAssetPath(path)) {
+            if (loadAssets && !assetSource->addAssetPath(path)) {
                 mContext->getDiagnostics()->error(
                         DiagMessage(path) << "failed to load include path");
                 return false;
             }
         }
 
-        mContext->getExternalSymbols()->appendSource(std::move(assetSource));
+        if (loadAssets && mOptions.includeCache) {
+            mOptions.includeCache->insert(mOptions.includePaths, assetSource);
+        }
+
+        mContext->getExternalSymbols()->appendSource(
+                util::make_unique<SharedSymbolSource>(assetSource));
         return true;
     }
 
@@ -685,7 +845,7 @@ public:
         if (writer->startEntry("resources.arsc", ArchiveEntry::kAlign)) {
             if (writer->writeEntry(buffer)) {
                 if (writer->finishEntry()) {
-                    return true;
+                    return writeTableIndex(buffer, writer);
                 }
             }
         }
@@ -695,6 +855,38 @@ public:
         return false;
     }
 
+    /**
+     * Writes an index of the chunks of the flattened table, which lets the framework load
+     * the table without scanning it. The index is only an optimization, so failing to
+     * create one is not an error.
+     */
+    bool writeTableIndex(const BigBuffer& table, IArchiveWriter* writer) {
+        std::unique_ptr<uint8_t[]> data = util::copy(table);
+        const uint32_t crc = static_cast<uint32_t>(
+                crc32(crc32(0L, Z_NULL, 0), data.get(), table.size()));
+
+        void* indexData = nullptr;
+        size_t indexSize = 0;
+        if (android::ResTable::createIndex(data.get(), table.size(), crc, &indexData,
+                                           &indexSize) != android::NO_ERROR) {
+            mContext->getDiagnostics()->warn(
+                    DiagMessage() << "failed to create index of resources.arsc");
+            return true;
+        }
+
+        // The framework reads the index in place, so it must be stored and aligned.
+        const bool result = writer->startEntry(android::AssetManager::RESOURCES_INDEX_FILENAME,
+                                               ArchiveEntry::kAlign)
+                && writer->writeEntry(indexData, indexSize)
+                && writer->finishEntry();
+        free(indexData);
+        if (!result) {
+            mContext->getDiagnostics()->error(
+                    DiagMessage() << "failed to write resources.idx to archive");
+        }
+        return result;
+    }
+
     bool flattenTableToPb(ResourceTable* table, IArchiveWriter* writer) {
         // Create the file/zip entry.
         if (!writer->startEntry("resources.arsc.flat", 0)) {
@@ -1247,8 +1439,9 @@ public:
                 }
 
                 const bool keepRawValues = mOptions.staticLib;
+                BigBuffer buffer(1024);
                 bool result = flattenXml(manifestXml.get(), "AndroidManifest.xml", {},
-                                         keepRawValues, archiveWriter.get(), mContext);
+                                         keepRawValues, &buffer, archiveWriter.get(), mContext);
                 if (!result) {
                     error = true;
                 }
@@ -1268,6 +1461,25 @@ public:
         fileFlattenerOptions.extensionsToNotCompress = mOptions.extensionsToNotCompress;
         fileFlattenerOptions.noAutoVersion = mOptions.noAutoVersion;
         fileFlattenerOptions.noVersionVectors = mOptions.noVersionVectors;
+
+        std::unique_ptr<XmlLinkCache> xmlLinkCache;
+        if (mOptions.incrementalCacheDir) {
+            const std::string& cacheDir = mOptions.incrementalCacheDir.value();
+            if (!file::mkdirs(cacheDir)) {
+                mContext->getDiagnostics()->error(
+                        DiagMessage() << "failed to create directory '" << cacheDir << "'");
+                return 1;
+            }
+
+            // Everything that changes how names are mangled goes into every key.
+            std::u16string salt = mContext->getCompilationPackage();
+            for (const std::u16string& package : mTableMerger->getMergedPackages()) {
+                salt += u"\n" + package;
+            }
+            xmlLinkCache = util::make_unique<XmlLinkCache>(cacheDir, util::utf16ToUtf8(salt));
+            fileFlattenerOptions.xmlLinkCache = xmlLinkCache.get();
+        }
+
         ResourceFileFlattener fileFlattener(fileFlattenerOptions, mContext, &proguardKeepSet);
 
         if (!fileFlattener.flatten(&mFinalTable, archiveWriter.get())) {
@@ -1297,6 +1509,11 @@ public:
             }
         }
 
+        if (!archiveWriter->finish()) {
+            mContext->getDiagnostics()->error(DiagMessage() << "failed to write archive");
+            return 1;
+        }
+
         if (mOptions.generateJavaClassPath) {
             JavaClassGeneratorOptions options;
             options.types = JavaClassGeneratorOptions::SymbolTypes::kAll;
@@ -1370,9 +1587,10 @@ private:
     std::vector<std::unique_ptr<ResourceTable>> mStaticTableIncludes;
 };
 
-int link(const std::vector<StringPiece>& args) {
+int link(const std::vector<StringPiece>& args, AssetManagerSymbolSourceCache* includeCache) {
     LinkContext context;
     LinkOptions options;
+    options.includeCache = includeCache;
     Maybe<std::string> privateSymbolsPackage;
     Maybe<std::string> minSdkVersion, targetSdkVersion;
     Maybe<std::string> renameManifestPackage, renameInstrumentationTargetPackage;
@@ -1453,6 +1671,9 @@ int link(const std::vector<StringPiece>& args) {
                           &renameInstrumentationTargetPackage)
             .optionalFlagList("-0", "File extensions not to compress",
                               &options.extensionsToNotCompress)
+            .optionalFlag("--incremental-cache", "Directory in which to keep linked XML files "
+                          "between runs,\nso that only the ones that changed are linked again",
+                          &options.incrementalCacheDir)
             .optionalSwitch("-v", "Enables verbose logging", &verbose);
 
     if (!flags.parse("aapt2 link", args, &std::cerr)) {
@@ -1586,4 +1807,8 @@ int link(const std::vector<StringPiece>& args) {
     return cmd.run(argList);
 }
 
+int link(const std::vector<StringPiece>& args) {
+    return link(args, nullptr);
+}
+
 } // namespace aapt
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ResourceUtils.h"
+#include "link/XmlLinkCache.h"
+#include "proto/ProtoSerialize.h"
+#include "util/Files.h"
+#include "util/Util.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#endif
+
+namespace aapt {
+
+namespace {
+
+/**
+ * Bump this when the format of an entry, or what goes into a key, changes.
+ */
+constexpr uint32_t kCacheVersion = 2;
+
+/**
+ * Tells apart entries written by different builds of aapt2, whose linked output may
+ * differ even when kCacheVersion wasn't bumped. That is the size and modification time
+ * of the running executable, which keeps builds reproducible where a compile timestamp
+ * would not. Where the executable can't be found, only kCacheVersion tells them apart.
+ */
+std::string getToolId() {
+    std::string id;
+
+    std::string exePath;
+#if defined(__linux__)
+    exePath = "/proc/self/exe";
+#elif defined(__APPLE__)
+    char buf[1024];
+    uint32_t bufSize = sizeof(buf);
+    if (_NSGetExecutablePath(buf, &bufSize) == 0) {
+        exePath = buf;
+    }
+#endif
+
+    struct stat st;
+    if (!exePath.empty() && stat(exePath.c_str(), &st) == 0) {
+        id += std::to_string(static_cast<long long>(st.st_size));
+        id += " " + std::to_string(static_cast<long long>(st.st_mtime));
+    }
+    return id;
+}
+
+class RecordingSymbolSource : public ISymbolSource {
+public:
+    RecordingSymbolSource(SymbolTable* symbols, std::set<ResourceName>* names,
+                          std::set<ResourceId>* ids) :
+            mSymbols(symbols), mNames(names), mIds(ids) {
+    }
+
+    std::unique_ptr<SymbolTable::Symbol> findByName(const ResourceName& name) override {
+        mNames->insert(name);
+        if (const SymbolTable::Symbol* symbol = mSymbols->findByName(name)) {
+            return util::make_unique<SymbolTable::Symbol>(*symbol);
+        }
+        return {};
+    }
+
+    std::unique_ptr<SymbolTable::Symbol> findById(ResourceId id) override {
+        mIds->insert(id);
+        if (const SymbolTable::Symbol* symbol = mSymbols->findById(id)) {
+            return util::make_unique<SymbolTable::Symbol>(*symbol);
+        }
+        return {};
+    }
+
+private:
+    SymbolTable* mSymbols;
+    std::set<ResourceName>* mNames;
+    std::set<ResourceId>* mIds;
+
+    DISALLOW_COPY_AND_ASSIGN(RecordingSymbolSource);
+};
+
+/**
+ * 64-bit FNV-1a. Values are fed in byte by byte, so the result doesn't depend on the host.
+ */
+class Digest {
+public:
+    void update(const void* data, size_t len) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < len; i++) {
+            mValue = (mValue ^ bytes[i]) * 0x100000001b3ull;
+        }
+    }
+
+    void update(uint64_t value) {
+        uint8_t bytes[8];
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+        update(bytes, sizeof(bytes));
+    }
+
+    void update(const StringPiece& str) {
+        update(static_cast<uint64_t>(str.size()));
+        update(str.data(), str.size());
+    }
+
+    void update(const ResourceName& name) {
+        update(util::utf16ToUtf8(name.toString()));
+    }
+
+    uint64_t value() const {
+        return mValue;
+    }
+
+private:
+    uint64_t mValue = 0xcbf29ce484222325ull;
+};
+
+void digestSymbol(const SymbolTable::Symbol* symbol, Digest* digest) {
+    if (!symbol) {
+        digest->update(uint64_t(0));
+        return;
+    }
+
+    digest->update(uint64_t(1));
+    digest->update(uint64_t(symbol->id ? symbol->id.value().id : 0));
+    digest->update(uint64_t(symbol->isPublic));
+
+    const Attribute* attr = symbol->attribute.get();
+    if (!attr) {
+        digest->update(uint64_t(0));
+        return;
+    }
+
+    digest->update(uint64_t(1));
+    digest->update(uint64_t(attr->typeMask));
+    digest->update(uint64_t(static_cast<uint32_t>(attr->minInt)));
+    digest->update(uint64_t(static_cast<uint32_t>(attr->maxInt)));
+    digest->update(uint64_t(attr->symbols.size()));
+    for (const Attribute::Symbol& s : attr->symbols) {
+        if (s.symbol.name) {
+            digest->update(s.symbol.name.value());
+        } else {
+            digest->update(StringPiece());
+        }
+        digest->update(uint64_t(s.symbol.id ? s.symbol.id.value().id : 0));
+        digest->update(uint64_t(s.value));
+    }
+}
+
+/**
+ * Digests how every symbol recorded in `entry` resolves in `symbols`.
+ */
+uint64_t digestSymbols(const XmlLinkCache::Entry& entry, SymbolTable* symbols) {
+    Digest digest;
+    for (const ResourceName& name : entry.symbolNames) {
+        digest.update(name);
+        digestSymbol(symbols->findByName(name), &digest);
+    }
+    for (const ResourceId& id : entry.symbolIds) {
+        digest.update(uint64_t(id.id));
+        digestSymbol(symbols->findById(id), &digest);
+    }
+    return digest.value();
+}
+
+void serializeKeepRules(const std::map<std::u16string, std::set<Source>>& rules,
+                        ::google::protobuf::RepeatedPtrField<pb::XmlLinkCacheEntry_KeepRule>*
+                                outRules) {
+    for (const auto& rule : rules) {
+        const std::string name = util::utf16ToUtf8(rule.first);
+        for (const Source& source : rule.second) {
+            pb::XmlLinkCacheEntry_KeepRule* pbRule = outRules->Add();
+            pbRule->set_name(name);
+            pbRule->set_source_path(source.path);
+            if (source.line) {
+                pbRule->set_line_no(static_cast<uint32_t>(source.line.value()));
+            }
+        }
+    }
+}
+
+Source deserializeKeepRuleSource(const pb::XmlLinkCacheEntry_KeepRule& pbRule) {
+    Source source(pbRule.source_path());
+    if (pbRule.has_line_no()) {
+        source.line = static_cast<size_t>(pbRule.line_no());
+    }
+    return source;
+}
+
+} // namespace
+
+SymbolRecordingContext::SymbolRecordingContext(IAaptContext* context) : mContext(context) {
+    mSymbols.appendSource(util::make_unique<RecordingSymbolSource>(
+            context->getExternalSymbols(), &mNames, &mIds));
+}
+
+XmlLinkCache::XmlLinkCache(const StringPiece& dir, const StringPiece& salt) :
+        mDir(dir.toString()), mSalt(salt.toString()) {
+}
+
+std::string XmlLinkCache::makeKey(const void* data, size_t len,
+                                  const StringPiece& options) const {
+    static const std::string sToolId = getToolId();
+
+    Digest digest;
+    digest.update(uint64_t(kCacheVersion));
+    digest.update(sToolId);
+    digest.update(mSalt);
+    digest.update(options);
+    digest.update(StringPiece(reinterpret_cast<const char*>(data), len));
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(digest.value()));
+    return key;
+}
+
+std::string XmlLinkCache::getEntryPath(const std::string& key) const {
+    std::string path = mDir;
+    file::appendPath(&path, key + ".xml.cache");
+    return path;
+}
+
+bool XmlLinkCache::find(const std::string& key, SymbolTable* symbols, Entry* outEntry) {
+    std::string error;
+    Maybe<android::FileMap> f = file::mmapPath(getEntryPath(key), &error);
+    if (!f) {
+        return false;
+    }
+
+    pb::XmlLinkCacheEntry pbEntry;
+    if (!pbEntry.ParseFromArray(f.value().getDataPtr(), f.value().getDataLength())) {
+        return false;
+    }
+
+    Entry entry;
+    for (const std::string& pbName : pbEntry.symbol_names()) {
+        // Need to create an lvalue here so that nameRef can point to something real.
+        const std::u16string utf16Name = util::utf8ToUtf16(pbName);
+        ResourceNameRef nameRef;
+        if (!ResourceUtils::parseResourceName(utf16Name, &nameRef)) {
+            return false;
+        }
+        entry.symbolNames.insert(nameRef.toResourceName());
+    }
+
+    for (uint32_t id : pbEntry.symbol_ids()) {
+        entry.symbolIds.insert(ResourceId(id));
+    }
+
+    if (digestSymbols(entry, symbols) != pbEntry.symbol_digest()) {
+        return false;
+    }
+
+    for (uint32_t sdkLevel : pbEntry.sdk_levels()) {
+        entry.sdkLevels.insert(static_cast<int>(sdkLevel));
+    }
+    entry.skipVersion = pbEntry.skip_version();
+
+    for (const pb::XmlLinkCacheEntry_KeepRule& pbRule : pbEntry.keep_classes()) {
+        entry.keepSet.addClass(deserializeKeepRuleSource(pbRule),
+                               util::utf8ToUtf16(pbRule.name()));
+    }
+    for (const pb::XmlLinkCacheEntry_KeepRule& pbRule : pbEntry.keep_methods()) {
+        entry.keepSet.addMethod(deserializeKeepRuleSource(pbRule),
+                                util::utf8ToUtf16(pbRule.name()));
+    }
+
+    entry.flattenedXml = pbEntry.flattened_xml();
+    *outEntry = std::move(entry);
+    return true;
+}
+
+bool XmlLinkCache::store(const std::string& key, const Entry& entry, SymbolTable* symbols,
+                         IDiagnostics* diag) {
+    pb::XmlLinkCacheEntry pbEntry;
+    for (const ResourceName& name : entry.symbolNames) {
+        pbEntry.add_symbol_names(util::utf16ToUtf8(name.toString()));
+    }
+    for (const ResourceId& id : entry.symbolIds) {
+        pbEntry.add_symbol_ids(id.id);
+    }
+    pbEntry.set_symbol_digest(digestSymbols(entry, symbols));
+
+    for (int sdkLevel : entry.sdkLevels) {
+        pbEntry.add_sdk_levels(static_cast<uint32_t>(sdkLevel));
+    }
+    pbEntry.set_skip_version(entry.skipVersion);
+    serializeKeepRules(entry.keepSet.getClasses(), pbEntry.mutable_keep_classes());
+    serializeKeepRules(entry.keepSet.getMethods(), pbEntry.mutable_keep_methods());
+    pbEntry.set_flattened_xml(entry.flattenedXml);
+
+    // Write to a temporary file and move it into place, so that an interrupted run
+    // never leaves a truncated entry behind. The temporary name is unique to this
+    // store, so that processes or threads writing the same entry don't clash.
+    std::string data;
+    if (!pbEntry.SerializeToString(&data)) {
+        diag->warn(DiagMessage() << "failed to serialize incremental cache entry");
+        return false;
+    }
+
+    const std::string path = getEntryPath(key);
+    static std::atomic<uint32_t> sTmpCounter(0);
+    const std::string tmpPath = path + ".tmp." + std::to_string(getpid()) + "."
+            + std::to_string(sTmpCounter++);
+    {
+        std::ofstream fout(tmpPath, std::ofstream::binary);
+        if (!fout || !fout.write(data.data(), data.size()) || !fout.flush()) {
+            diag->warn(DiagMessage(tmpPath) << "failed to write incremental cache entry");
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        // Windows won't rename over an existing file.
+        std::remove(path.c_str());
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            diag->warn(DiagMessage(path) << "failed to write incremental cache entry");
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace aapt
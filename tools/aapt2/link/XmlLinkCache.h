@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AAPT_LINK_XMLLINKCACHE_H
+#define AAPT_LINK_XMLLINKCACHE_H
+
+#include "Diagnostics.h"
+#include "Resource.h"
+#include "java/ProguardRules.h"
+#include "process/IResourceTableConsumer.h"
+#include "process/SymbolTable.h"
+#include "util/StringPiece.h"
+
+#include <android-base/macros.h>
+#include <set>
+#include <string>
+
+namespace aapt {
+
+/**
+ * Forwards to another IAaptContext, but records the name or ID of every symbol
+ * looked up through getExternalSymbols().
+ */
+class SymbolRecordingContext : public IAaptContext {
+public:
+    explicit SymbolRecordingContext(IAaptContext* context);
+
+    SymbolTable* getExternalSymbols() override {
+        return &mSymbols;
+    }
+
+    IDiagnostics* getDiagnostics() override {
+        return mContext->getDiagnostics();
+    }
+
+    const std::u16string& getCompilationPackage() override {
+        return mContext->getCompilationPackage();
+    }
+
+    uint8_t getPackageId() override {
+        return mContext->getPackageId();
+    }
+
+    NameMangler* getNameMangler() override {
+        return mContext->getNameMangler();
+    }
+
+    bool verbose() override {
+        return mContext->verbose();
+    }
+
+    const std::set<ResourceName>& getNamesLookedUp() const {
+        return mNames;
+    }
+
+    const std::set<ResourceId>& getIdsLookedUp() const {
+        return mIds;
+    }
+
+private:
+    IAaptContext* mContext;
+    std::set<ResourceName> mNames;
+    std::set<ResourceId> mIds;
+    SymbolTable mSymbols;
+
+    DISALLOW_COPY_AND_ASSIGN(SymbolRecordingContext);
+};
+
+/**
+ * Keeps linked and flattened XML files in a directory between runs of `aapt2 link`.
+ *
+ * An entry is stored under a key built from the compiled XML file and the options that
+ * change how it is linked. It is only used if every symbol looked up while linking it
+ * still resolves to the same ID, visibility and attribute definition.
+ */
+class XmlLinkCache {
+public:
+    struct Entry {
+        /**
+         * The symbols that were looked up while linking the XML.
+         */
+        std::set<ResourceName> symbolNames;
+        std::set<ResourceId> symbolIds;
+
+        /**
+         * The SDK levels of the attributes used, from XmlReferenceLinker::getSdkLevels().
+         */
+        std::set<int> sdkLevels;
+
+        bool skipVersion = false;
+        proguard::KeepSet keepSet;
+        std::string flattenedXml;
+    };
+
+    /**
+     * `salt` is mixed into every key. It describes whatever affects linking for
+     * the whole run, such as the package being compiled.
+     */
+    XmlLinkCache(const StringPiece& dir, const StringPiece& salt);
+
+    /**
+     * Returns the key for the compiled XML in `data`. `options` describes everything else
+     * that changes the linked output of this one file.
+     */
+    std::string makeKey(const void* data, size_t len, const StringPiece& options) const;
+
+    /**
+     * Returns true and fills in `outEntry` if there is an entry for `key` whose symbols
+     * resolve in `symbols` the same way they did when it was stored.
+     */
+    bool find(const std::string& key, SymbolTable* symbols, Entry* outEntry);
+
+    /**
+     * Stores `entry` under `key`, recording how its symbols resolve in `symbols`.
+     */
+    bool store(const std::string& key, const Entry& entry, SymbolTable* symbols,
+               IDiagnostics* diag);
+
+private:
+    std::string getEntryPath(const std::string& key) const;
+
+    std::string mDir;
+    std::string mSalt;
+
+    DISALLOW_COPY_AND_ASSIGN(XmlLinkCache);
+};
+
+} // namespace aapt
+
+#endif /* AAPT_LINK_XMLLINKCACHE_H */
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "link/Linkers.h"
+#include "link/XmlLinkCache.h"
+#include "test/Test.h"
+#include "util/Files.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace aapt {
+
+static std::unique_ptr<IAaptContext> buildContext(ResourceId greenId) {
+    return test::ContextBuilder()
+            .setCompilationPackage(u"com.app.test")
+            .setNameManglerPolicy(NameManglerPolicy{ u"com.app.test" })
+            .addSymbolSource(test::StaticSymbolSourceBuilder()
+                    .addPublicSymbol(u"@android:attr/background", ResourceId(0x01010001),
+                                     test::AttributeBuilder()
+                                             .setTypeMask(android::ResTable_map::TYPE_COLOR)
+                                             .build())
+                    .addSymbol(u"@com.app.test:color/green", greenId)
+                    .build())
+            .build();
+}
+
+class XmlLinkCacheTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        const char* tmp = getenv("TMPDIR");
+        mDir = tmp ? tmp : "/tmp";
+        file::appendPath(&mDir, "aapt2_xml_link_cache_test");
+        ASSERT_TRUE(file::mkdirs(mDir));
+    }
+
+    void TearDown() override {
+        for (const std::string& name : file::listFiles(mDir)) {
+            std::string path = mDir;
+            file::appendPath(&path, name);
+            std::remove(path.c_str());
+        }
+    }
+
+protected:
+    std::string mDir;
+};
+
+TEST_F(XmlLinkCacheTest, RecordsSymbolsLookedUp) {
+    std::unique_ptr<IAaptContext> context = buildContext(ResourceId(0x7f020000));
+    std::unique_ptr<xml::XmlResource> doc = test::buildXmlDomForPackageName(context.get(), R"EOF(
+        <View xmlns:android="http://schemas.android.com/apk/res/android"
+              android:background="@color/green" />)EOF");
+
+    SymbolRecordingContext recordingContext(context.get());
+    XmlReferenceLinker linker;
+    ASSERT_TRUE(linker.consume(&recordingContext, doc.get()));
+
+    const std::set<ResourceName>& names = recordingContext.getNamesLookedUp();
+    EXPECT_EQ(2u, names.size());
+    EXPECT_EQ(1u, names.count(test::parseNameOrDie(u"@android:attr/background")));
+    EXPECT_EQ(1u, names.count(test::parseNameOrDie(u"@com.app.test:color/green")));
+}
+
+TEST_F(XmlLinkCacheTest, KeyDependsOnDataAndOptions) {
+    XmlLinkCache cache(mDir, "salt");
+    EXPECT_EQ(cache.makeKey("abc", 3, "v1"), cache.makeKey("abc", 3, "v1"));
+    EXPECT_NE(cache.makeKey("abc", 3, "v1"), cache.makeKey("abd", 3, "v1"));
+    EXPECT_NE(cache.makeKey("abc", 3, "v1"), cache.makeKey("abc", 3, "v2"));
+
+    XmlLinkCache otherCache(mDir, "other salt");
+    EXPECT_NE(cache.makeKey("abc", 3, "v1"), otherCache.makeKey("abc", 3, "v1"));
+}
+
+TEST_F(XmlLinkCacheTest, FindsEntryUntilSymbolsChange) {
+    std::unique_ptr<IAaptContext> context = buildContext(ResourceId(0x7f020000));
+    XmlLinkCache cache(mDir, "salt");
+    const std::string key = cache.makeKey("abc", 3, "");
+
+    XmlLinkCache::Entry entry;
+    entry.symbolNames.insert(test::parseNameOrDie(u"@android:attr/background"));
+    entry.symbolNames.insert(test::parseNameOrDie(u"@com.app.test:color/green"));
+    entry.symbolNames.insert(test::parseNameOrDie(u"@com.app.test:color/missing"));
+    entry.sdkLevels.insert(21);
+    entry.skipVersion = true;
+    entry.keepSet.addClass(Source("res/layout/main.xml", 3), u"com.app.test.MyView");
+    entry.flattenedXml = std::string("\x03\x00\x08\x00", 4);
+
+    XmlLinkCache::Entry found;
+    EXPECT_FALSE(cache.find(key, context->getExternalSymbols(), &found));
+
+    ASSERT_TRUE(cache.store(key, entry, context->getExternalSymbols(),
+                            context->getDiagnostics()));
+    ASSERT_TRUE(cache.find(key, context->getExternalSymbols(), &found));
+    EXPECT_EQ(entry.symbolNames, found.symbolNames);
+    EXPECT_EQ(entry.sdkLevels, found.sdkLevels);
+    EXPECT_TRUE(found.skipVersion);
+    EXPECT_EQ(entry.keepSet.getClasses(), found.keepSet.getClasses());
+    EXPECT_EQ(entry.flattenedXml, found.flattenedXml);
+
+    // The same resource with a new ID.
+    std::unique_ptr<IAaptContext> changedContext = buildContext(ResourceId(0x7f020001));
+    EXPECT_FALSE(cache.find(key, changedContext->getExternalSymbols(), &found));
+}
+
+TEST_F(XmlLinkCacheTest, StoreReplacesEntryWithoutLeavingFilesBehind) {
+    std::unique_ptr<IAaptContext> context = buildContext(ResourceId(0x7f020000));
+    XmlLinkCache cache(mDir, "salt");
+    const std::string key = cache.makeKey("abc", 3, "");
+
+    XmlLinkCache::Entry entry;
+    entry.flattenedXml = "first";
+    ASSERT_TRUE(cache.store(key, entry, context->getExternalSymbols(),
+                            context->getDiagnostics()));
+    entry.flattenedXml = "second";
+    ASSERT_TRUE(cache.store(key, entry, context->getExternalSymbols(),
+                            context->getDiagnostics()));
+
+    XmlLinkCache::Entry found;
+    ASSERT_TRUE(cache.find(key, context->getExternalSymbols(), &found));
+    EXPECT_EQ(std::string("second"), found.flattenedXml);
+    EXPECT_EQ(1u, file::listFiles(mDir).size());
+}
+
+} // namespace aapt
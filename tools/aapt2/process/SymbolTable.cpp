@@ -22,6 +22,7 @@
 
 #include <androidfw/AssetManager.h>
 #include <androidfw/ResourceTypes.h>
+#include <sys/stat.h>
 
 namespace aapt {
 
@@ -307,4 +308,50 @@ std::unique_ptr<SymbolTable::Symbol> AssetManagerSymbolSource::findByReference(
     return {};
 }
 
+bool AssetManagerSymbolSourceCache::stampFiles(const std::vector<std::string>& paths,
+                                               std::vector<FileStamp>* outStamps) {
+    for (const std::string& path : paths) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) != 0) {
+            return false;
+        }
+        outStamps->push_back(FileStamp{ static_cast<int64_t>(sb.st_size),
+                                        static_cast<int64_t>(sb.st_mtime) });
+    }
+    return true;
+}
+
+std::shared_ptr<AssetManagerSymbolSource> AssetManagerSymbolSourceCache::find(
+        const std::vector<std::string>& paths) {
+    auto iter = mEntries.find(paths);
+    if (iter == mEntries.end()) {
+        return {};
+    }
+
+    std::vector<FileStamp> stamps;
+    if (stampFiles(paths, &stamps)) {
+        const std::vector<FileStamp>& cachedStamps = iter->second.stamps;
+        if (std::equal(stamps.begin(), stamps.end(), cachedStamps.begin(),
+                       [](const FileStamp& a, const FileStamp& b) -> bool {
+                           return a.size == b.size && a.mtime == b.mtime;
+                       })) {
+            return iter->second.source;
+        }
+    }
+
+    mEntries.erase(iter);
+    return {};
+}
+
+void AssetManagerSymbolSourceCache::insert(
+        const std::vector<std::string>& paths,
+        const std::shared_ptr<AssetManagerSymbolSource>& source) {
+    Entry entry;
+    if (!stampFiles(paths, &entry.stamps)) {
+        return;
+    }
+    entry.source = source;
+    mEntries[paths] = std::move(entry);
+}
+
 } // namespace aapt
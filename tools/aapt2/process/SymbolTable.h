@@ -28,7 +28,9 @@
 #include <android-base/macros.h>
 #include <androidfw/AssetManager.h>
 #include <algorithm>
+#include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace aapt {
@@ -167,6 +169,68 @@ private:
     DISALLOW_COPY_AND_ASSIGN(AssetManagerSymbolSource);
 };
 
+/**
+ * Forwards lookups to a symbol source that other SymbolTables may share.
+ */
+class SharedSymbolSource : public ISymbolSource {
+public:
+    explicit SharedSymbolSource(const std::shared_ptr<ISymbolSource>& source) : mSource(source) {
+    }
+
+    std::unique_ptr<SymbolTable::Symbol> findByName(const ResourceName& name) override {
+        return mSource->findByName(name);
+    }
+
+    std::unique_ptr<SymbolTable::Symbol> findById(ResourceId id) override {
+        return mSource->findById(id);
+    }
+
+    std::unique_ptr<SymbolTable::Symbol> findByReference(const Reference& ref) override {
+        return mSource->findByReference(ref);
+    }
+
+private:
+    std::shared_ptr<ISymbolSource> mSource;
+
+    DISALLOW_COPY_AND_ASSIGN(SharedSymbolSource);
+};
+
+/**
+ * Keeps AssetManagerSymbolSources loaded between links run by the same process, keyed
+ * on the APK paths they were loaded from. A source is dropped once any of its APKs
+ * changes size or modification time.
+ */
+class AssetManagerSymbolSourceCache {
+public:
+    AssetManagerSymbolSourceCache() = default;
+
+    /**
+     * Returns the source loaded from `paths`, or nullptr if there is none or it is stale.
+     */
+    std::shared_ptr<AssetManagerSymbolSource> find(const std::vector<std::string>& paths);
+
+    void insert(const std::vector<std::string>& paths,
+                const std::shared_ptr<AssetManagerSymbolSource>& source);
+
+private:
+    struct FileStamp {
+        int64_t size;
+        int64_t mtime;
+    };
+
+    struct Entry {
+        std::vector<FileStamp> stamps;
+        std::shared_ptr<AssetManagerSymbolSource> source;
+    };
+
+    static bool stampFiles(const std::vector<std::string>& paths,
+                           std::vector<FileStamp>* outStamps);
+
+    std::map<std::vector<std::string>, Entry> mEntries;
+
+    DISALLOW_COPY_AND_ASSIGN(AssetManagerSymbolSourceCache);
+};
+
 } // namespace aapt
 
 #endif /* AAPT_PROCESS_SYMBOLTABLE_H */
@@ -16,6 +16,11 @@
 
 #include "process/SymbolTable.h"
 #include "test/Test.h"
+#include "util/Files.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 
 namespace aapt {
 
@@ -50,4 +55,25 @@ TEST(ResourceTableSymbolSourceTest, FindPrivateAttrSymbol) {
     EXPECT_NE(nullptr, s->attribute);
 }
 
+TEST(AssetManagerSymbolSourceCacheTest, DropsSourceWhenFileChanges) {
+    const char* tmp = getenv("TMPDIR");
+    std::string path = tmp ? tmp : "/tmp";
+    file::appendPath(&path, "aapt2_symbol_source_cache_test.apk");
+    std::ofstream(path, std::ofstream::binary) << "contents";
+
+    const std::vector<std::string> paths = { path };
+    AssetManagerSymbolSourceCache cache;
+    EXPECT_EQ(nullptr, cache.find(paths));
+
+    std::shared_ptr<AssetManagerSymbolSource> source = std::make_shared<AssetManagerSymbolSource>();
+    cache.insert(paths, source);
+    EXPECT_EQ(source, cache.find(paths));
+    EXPECT_EQ(nullptr, cache.find(std::vector<std::string>()));
+
+    std::ofstream(path, std::ofstream::binary) << "new contents";
+    EXPECT_EQ(nullptr, cache.find(paths));
+
+    std::remove(path.c_str());
+}
+
 } // namespace aapt